@@ -0,0 +1,381 @@
+#ifndef ADVERTISING_POLICY_H_
+#define ADVERTISING_POLICY_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "events/EventQueue.h"
+#include "platform/Callback.h"
+#include "platform/NonCopyable.h"
+#include "rtos/Kernel.h"
+
+#include "ble/BLE.h"
+#include "ble/Gap.h"
+
+#include "BinaryLog.h"
+#include "EventQueueMonitor.h"
+
+#ifndef MBED_CONF_APP_ADV_FAST_INTERVAL_MS
+#define MBED_CONF_APP_ADV_FAST_INTERVAL_MS 30
+#endif
+
+#ifndef MBED_CONF_APP_ADV_FAST_DURATION_MS
+#define MBED_CONF_APP_ADV_FAST_DURATION_MS 30000
+#endif
+
+#ifndef MBED_CONF_APP_ADV_MEDIUM_INTERVAL_MS
+#define MBED_CONF_APP_ADV_MEDIUM_INTERVAL_MS 152
+#endif
+
+#ifndef MBED_CONF_APP_ADV_MEDIUM_DURATION_MS
+#define MBED_CONF_APP_ADV_MEDIUM_DURATION_MS 120000
+#endif
+
+#ifndef MBED_CONF_APP_ADV_SLOW_INTERVAL_MS
+#define MBED_CONF_APP_ADV_SLOW_INTERVAL_MS 1022
+#endif
+
+#ifndef MBED_CONF_APP_ADV_EVENT_CHARGE_UC
+#define MBED_CONF_APP_ADV_EVENT_CHARGE_UC 15
+#endif
+
+#ifndef MBED_CONF_APP_ADV_RETRY_MS
+#define MBED_CONF_APP_ADV_RETRY_MS 1000
+#endif
+
+/**
+ * Select the advertising interval from the time spent advertising.
+ *
+ * Advertising starts fast after boot, after a disconnection and on
+ * boost(), for MBED_CONF_APP_ADV_FAST_DURATION_MS; centrals scanning for
+ * the device find it quickly. It then steps down to a medium interval for
+ * MBED_CONF_APP_ADV_MEDIUM_DURATION_MS and finally to a slow interval
+ * that keeps the device discoverable at a low idle current. When a
+ * connection leaves room for more centrals advertising resumes at the slow
+ * interval.
+ *
+ * If the stack refuses to start a window, the phase is retried after
+ * MBED_CONF_APP_ADV_RETRY_MS so the device never stays silent.
+ *
+ * The policy counts the time spent in each phase, estimates the number of
+ * advertising events and their charge from
+ * MBED_CONF_APP_ADV_EVENT_CHARGE_UC, and measures the time from the start
+ * of an advertising window to the connection.
+ */
+class AdvertisingPolicy : private mbed::NonCopyable<AdvertisingPolicy> {
+    typedef AdvertisingPolicy Self;
+
+public:
+    enum phase_t {
+        PHASE_FAST,
+        PHASE_MEDIUM,
+        PHASE_SLOW,
+        PHASE_COUNT,
+        PHASE_STOPPED = PHASE_COUNT
+    };
+
+    struct stats_t {
+        uint32_t windows[PHASE_COUNT];
+        uint32_t connections[PHASE_COUNT];
+        uint64_t time_ms[PHASE_COUNT];
+        uint32_t boosts;
+        uint32_t connect_count;
+        uint64_t connect_total_ms;
+        uint32_t connect_min_ms;
+        uint32_t connect_max_ms;
+    };
+
+    AdvertisingPolicy(events::EventQueue &event_queue, BLE &ble_interface) :
+        _event_queue(event_queue),
+        _ble_interface(ble_interface),
+        _phase(PHASE_STOPPED),
+        _phase_start_ms(0),
+        _window_start_ms(0),
+        _step_id(0),
+        _retry_phase(PHASE_STOPPED)
+    {
+        memset(&_stats, 0, sizeof(_stats));
+        _stats.connect_min_ms = UINT32_MAX;
+    }
+
+    /**
+     * Open an advertising window at the fast interval.
+     *
+     * Used at boot and after a disconnection.
+     */
+    bool start()
+    {
+        _window_start_ms = rtos::Kernel::get_ms_count();
+        return enter(PHASE_FAST);
+    }
+
+    /**
+     * Keep advertising at the slow interval once a connection has been
+     * accepted and room is left for more centrals.
+     */
+    bool resume()
+    {
+        _window_start_ms = rtos::Kernel::get_ms_count();
+        return enter(PHASE_SLOW);
+    }
+
+    /**
+     * Return to the fast interval; ignored while not advertising.
+     *
+     * Must be called from the ble lane; see request_boost().
+     */
+    void boost()
+    {
+        if (_phase == PHASE_STOPPED && _retry_phase == PHASE_STOPPED) {
+            return;
+        }
+        ++_stats.boosts;
+        start();
+    }
+
+    /**
+     * Post a boost() on the ble lane; may be called from any thread or
+     * interrupt handler, for example a button.
+     */
+    void request_boost()
+    {
+        _event_queue.call(this, &Self::boost);
+    }
+
+    /**
+     * Account the window that led to a connection; the controller stops
+     * advertising once connected.
+     *
+     * @return The time from the start of the window to the connection, 0
+     * if the device was not advertising.
+     */
+    uint32_t when_connection()
+    {
+        if (_phase == PHASE_STOPPED) {
+            cancel_step();
+            return 0;
+        }
+
+        uint32_t elapsed_ms = rtos::Kernel::get_ms_count() - _window_start_ms;
+        ++_stats.connections[_phase];
+        ++_stats.connect_count;
+        _stats.connect_total_ms += elapsed_ms;
+        if (elapsed_ms < _stats.connect_min_ms) {
+            _stats.connect_min_ms = elapsed_ms;
+        }
+        if (elapsed_ms > _stats.connect_max_ms) {
+            _stats.connect_max_ms = elapsed_ms;
+        }
+
+        account();
+        cancel_step();
+        _phase = PHASE_STOPPED;
+        return elapsed_ms;
+    }
+
+    phase_t phase() const
+    {
+        return _phase;
+    }
+
+    const stats_t &stats() const
+    {
+        return _stats;
+    }
+
+    /**
+     * Print the time spent in each phase, the estimated advertising charge
+     * and the time to connect.
+     */
+    void print_stats() const
+    {
+        static const char *const names[PHASE_COUNT] = { "fast", "medium", "slow" };
+        uint64_t charge_uc = 0;
+
+        for (size_t i = 0; i < PHASE_COUNT; ++i) {
+            uint64_t time_ms = _stats.time_ms[i];
+            if (_phase == (phase_t) i) {
+                time_ms += rtos::Kernel::get_ms_count() - _phase_start_ms;
+            }
+            uint32_t events = estimated_events((phase_t) i, time_ms);
+            charge_uc += (uint64_t) events * MBED_CONF_APP_ADV_EVENT_CHARGE_UC;
+            printf(
+                "advertising %s: %lu windows, %lu ms, ~%lu events, %lu connections\r\n",
+                names[i],
+                (unsigned long) _stats.windows[i],
+                (unsigned long) time_ms,
+                (unsigned long) events,
+                (unsigned long) _stats.connections[i]
+            );
+        }
+
+        printf(
+            "\t~%lu uC spent advertising, %lu boosts\r\n",
+            (unsigned long) charge_uc, (unsigned long) _stats.boosts
+        );
+        if (_stats.connect_count) {
+            printf(
+                "\ttime to connect %lu/%lu/%lu ms (min/avg/max)\r\n",
+                (unsigned long) _stats.connect_min_ms,
+                (unsigned long)(_stats.connect_total_ms / _stats.connect_count),
+                (unsigned long) _stats.connect_max_ms
+            );
+        }
+    }
+
+private:
+    /**
+     * Restart advertising with the interval of a phase and program the step
+     * down to the next phase.
+     */
+    bool enter(phase_t phase)
+    {
+        Gap &gap = _ble_interface.gap();
+
+        account();
+        cancel_step();
+        _phase = PHASE_STOPPED;
+
+        // the interval of a running advertising set cannot be changed
+        if (gap.isAdvertisingActive(ble::LEGACY_ADVERTISING_HANDLE)) {
+            gap.stopAdvertising(ble::LEGACY_ADVERTISING_HANDLE);
+        }
+
+        ble::adv_interval_t interval(ble::millisecond_t(interval_ms(phase)));
+        ble_error_t error = gap.setAdvertisingParameters(
+            ble::LEGACY_ADVERTISING_HANDLE,
+            ble::AdvertisingParameters(
+                ble::advertising_type_t::CONNECTABLE_UNDIRECTED,
+                interval,
+                interval
+            )
+        );
+        if (error) {
+            LOG_ERROR(LOG_MODULE_BLE, "Gap::setAdvertisingParameters() failed with error %d\r\n", error);
+            schedule_retry(phase);
+            return false;
+        }
+
+        error = gap.startAdvertising(ble::LEGACY_ADVERTISING_HANDLE);
+        if (error) {
+            LOG_ERROR(LOG_MODULE_BLE, "Error %u during gap.startAdvertising.\r\n", error);
+            schedule_retry(phase);
+            return false;
+        }
+
+        _phase = phase;
+        _phase_start_ms = rtos::Kernel::get_ms_count();
+        ++_stats.windows[phase];
+        LOG_INFO(LOG_MODULE_BLE, "Advertising every %u ms.\r\n", (unsigned) interval_ms(phase));
+
+        uint32_t duration_ms = duration_ms_of(phase);
+        if (duration_ms) {
+            _step_id = EventQueueMonitor::call_in(
+                _event_queue,
+                EventQueueMonitor::EVENT_ADVERTISING,
+                duration_ms,
+                mbed::callback(this, &Self::step_down)
+            );
+        }
+        return true;
+    }
+
+    void step_down()
+    {
+        _step_id = 0;
+        if (_phase == PHASE_FAST) {
+            enter(PHASE_MEDIUM);
+        } else if (_phase == PHASE_MEDIUM) {
+            enter(PHASE_SLOW);
+        }
+    }
+
+    /**
+     * Enter a phase again once the stack failed to start it.
+     */
+    void schedule_retry(phase_t phase)
+    {
+        _retry_phase = phase;
+        _step_id = EventQueueMonitor::call_in(
+            _event_queue,
+            EventQueueMonitor::EVENT_ADVERTISING,
+            MBED_CONF_APP_ADV_RETRY_MS,
+            mbed::callback(this, &Self::retry)
+        );
+    }
+
+    void retry()
+    {
+        phase_t phase = _retry_phase;
+        _step_id = 0;
+        _retry_phase = PHASE_STOPPED;
+        enter(phase);
+    }
+
+    void cancel_step()
+    {
+        if (_step_id) {
+            EventQueueMonitor::cancel(_event_queue, _step_id);
+            _step_id = 0;
+        }
+        _retry_phase = PHASE_STOPPED;
+    }
+
+    /**
+     * Add the time spent in the current phase to its counter.
+     */
+    void account()
+    {
+        if (_phase == PHASE_STOPPED) {
+            return;
+        }
+        uint64_t now = rtos::Kernel::get_ms_count();
+        _stats.time_ms[_phase] += now - _phase_start_ms;
+        _phase_start_ms = now;
+    }
+
+    static uint32_t interval_ms(phase_t phase)
+    {
+        switch (phase) {
+            case PHASE_FAST:
+                return MBED_CONF_APP_ADV_FAST_INTERVAL_MS;
+            case PHASE_MEDIUM:
+                return MBED_CONF_APP_ADV_MEDIUM_INTERVAL_MS;
+            default:
+                return MBED_CONF_APP_ADV_SLOW_INTERVAL_MS;
+        }
+    }
+
+    static uint32_t duration_ms_of(phase_t phase)
+    {
+        switch (phase) {
+            case PHASE_FAST:
+                return MBED_CONF_APP_ADV_FAST_DURATION_MS;
+            case PHASE_MEDIUM:
+                return MBED_CONF_APP_ADV_MEDIUM_DURATION_MS;
+            default:
+                return 0;
+        }
+    }
+
+    /**
+     * Number of advertising events in a duration; the controller adds a
+     * random delay of 0 to 10 ms to every interval.
+     */
+    static uint32_t estimated_events(phase_t phase, uint64_t time_ms)
+    {
+        return time_ms / (interval_ms(phase) + 5);
+    }
+
+    events::EventQueue &_event_queue;
+    BLE &_ble_interface;
+    phase_t _phase;
+    uint64_t _phase_start_ms;
+    uint64_t _window_start_ms;
+    int _step_id;
+    phase_t _retry_phase;
+    stats_t _stats;
+};
+
+#endif /* ADVERTISING_POLICY_H_ */
@@ -0,0 +1,219 @@
+#ifndef BLE_GATEWAY_H_
+#define BLE_GATEWAY_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "events/EventQueue.h"
+#include "platform/NonCopyable.h"
+#include "rtos/Kernel.h"
+
+#include "ble/BLE.h"
+#include "ble/Gap.h"
+
+#include "BinaryLog.h"
+#include "EventQueueMonitor.h"
+#include "ScanAggregator.h"
+#include "Uplink.h"
+#include "UplinkFrame.h"
+
+#ifndef MBED_CONF_APP_GATEWAY_TABLE_SIZE
+#define MBED_CONF_APP_GATEWAY_TABLE_SIZE 64
+#endif
+
+#ifndef MBED_CONF_APP_GATEWAY_REPORT_PERIOD_MS
+#define MBED_CONF_APP_GATEWAY_REPORT_PERIOD_MS 5000
+#endif
+
+#ifndef MBED_CONF_APP_GATEWAY_SCAN_INTERVAL_MS
+#define MBED_CONF_APP_GATEWAY_SCAN_INTERVAL_MS 100
+#endif
+
+#ifndef MBED_CONF_APP_GATEWAY_SCAN_WINDOW_MS
+#define MBED_CONF_APP_GATEWAY_SCAN_WINDOW_MS 50
+#endif
+
+/**
+ * Observer that aggregates the advertisements of nearby devices and uploads
+ * them in batches on the TCP uplink.
+ *
+ * Advertisements are folded into a ScanAggregator; every
+ * MBED_CONF_APP_GATEWAY_REPORT_PERIOD_MS the peers seen are sent as a single
+ * binary report instead of one TCP message per advertisement.
+ *
+ * Reports are encoded on the BLE lane and framed by the uplink on the wifi
+ * lane, which stores them while the link is down. A window with more peers
+ * than a report holds is split: once a report is handed over, the next one
+ * is encoded until the window is drained. While a report is being handed
+ * over the next period is skipped; the aggregator keeps the peers pending.
+ */
+class BLEGateway : private mbed::NonCopyable<BLEGateway> {
+public:
+    /**
+     * Largest report sent at once; the largest record of an uplink frame.
+     */
+    static const size_t MAX_REPORT_SIZE = Uplink::MAX_RECORD_SIZE;
+
+    /**
+     * Construct a gateway uploading its reports as uplink records.
+     *
+     * @param[in] uplink Uplink to the collector.
+     */
+    BLEGateway(Uplink &uplink) :
+        _uplink(uplink),
+        _event_queue(NULL),
+        _sending(false),
+        _more(false),
+        _report_length(0),
+        _reports_sent(0),
+        _bytes_sent(0),
+        _send_errors(0)
+    {
+    }
+
+    /**
+     * Configure and start scanning.
+     *
+     * This function is meant to be passed to BLEProcess::on_init.
+     */
+    void start(BLE &ble_interface, events::EventQueue &event_queue)
+    {
+        if (_event_queue) {
+            return;
+        }
+        _event_queue = &event_queue;
+
+        Gap &gap = ble_interface.gap();
+
+        ble_error_t error = gap.setScanParameters(
+            ble::ScanParameters(
+                ble::phy_t::LE_1M,
+                ble::scan_interval_t(MBED_CONF_APP_GATEWAY_SCAN_INTERVAL_MS * 8 / 5),
+                ble::scan_window_t(MBED_CONF_APP_GATEWAY_SCAN_WINDOW_MS * 8 / 5),
+                /* active scanning */ false
+            )
+        );
+
+        if (error) {
+            LOG_ERROR(LOG_MODULE_GATEWAY, "Gap::setScanParameters() failed with error %d\r\n", error);
+            return;
+        }
+
+        /* duplicates are kept so RSSI statistics cover every advertisement */
+        error = gap.startScan();
+        if (error) {
+            LOG_ERROR(LOG_MODULE_GATEWAY, "Gap::startScan() failed with error %d\r\n", error);
+            return;
+        }
+
+        LOG_INFO(LOG_MODULE_GATEWAY, "Gateway scanning started.\r\n");
+
+        EventQueueMonitor::call_every(
+            *_event_queue,
+            EventQueueMonitor::EVENT_GATEWAY,
+            MBED_CONF_APP_GATEWAY_REPORT_PERIOD_MS,
+            mbed::callback(this, &BLEGateway::send_report)
+        );
+    }
+
+    /**
+     * Account an advertisement received by the scanner.
+     *
+     * This function is meant to be passed to
+     * BLEProcess::on_advertising_report.
+     */
+    void when_advertising_report(const ble::AdvertisingReportEvent &event)
+    {
+        mbed::Span<const uint8_t> payload = event.getPayload();
+
+        _aggregator.observe(
+            event.getPeerAddress().data(),
+            event.getPeerAddressType().value(),
+            event.getRssi(),
+            payload.data(),
+            payload.size(),
+            (uint32_t) rtos::Kernel::get_ms_count()
+        );
+    }
+
+    void print_stats() const
+    {
+        printf(
+            "gateway: %lu advertisements, %lu dropped with an evicted peer, %lu peers pending\r\n",
+            (unsigned long) _aggregator.advertisements(),
+            (unsigned long) _aggregator.dropped(),
+            (unsigned long) _aggregator.pending_records()
+        );
+        printf(
+            "\t%lu reports, %lu bytes handed to the uplink, %lu hand-overs failed\r\n",
+            (unsigned long) _reports_sent,
+            (unsigned long) _bytes_sent,
+            (unsigned long) _send_errors
+        );
+    }
+
+private:
+    /**
+     * Close the current window and hand its report over to the uplink.
+     */
+    void send_report()
+    {
+        if (_sending) {
+            return;
+        }
+
+        size_t length = _aggregator.report(
+            _report, sizeof(_report), (uint32_t) rtos::Kernel::get_ms_count()
+        );
+
+        if (!length) {
+            return;
+        }
+
+        // the rest of the window follows once this report is handed over
+        _more = _aggregator.pending_records() != 0;
+
+        _sending = true;
+        _report_length = length;
+        if (!EventQueueMonitor::call(
+                _uplink.queue(),
+                EventQueueMonitor::EVENT_GATEWAY,
+                mbed::callback(this, &BLEGateway::upload)
+            )) {
+            _sending = false;
+            ++_send_errors;
+        }
+    }
+
+    /**
+     * Hand the encoded report over to the uplink; runs on the wifi lane.
+     */
+    void upload()
+    {
+        _uplink.append(UplinkFrame::RECORD_SCAN_REPORT, _report, _report_length);
+        ++_reports_sent;
+        _bytes_sent += _report_length;
+
+        _sending = false;
+        if (_more) {
+            EventQueueMonitor::call(
+                *_event_queue,
+                EventQueueMonitor::EVENT_GATEWAY,
+                mbed::callback(this, &BLEGateway::send_report)
+            );
+        }
+    }
+
+    Uplink &_uplink;
+    events::EventQueue *_event_queue;
+    volatile bool _sending;
+    bool _more;
+    size_t _report_length;
+    ScanAggregator<MBED_CONF_APP_GATEWAY_TABLE_SIZE> _aggregator;
+    uint8_t _report[MAX_REPORT_SIZE];
+    uint32_t _reports_sent;
+    uint32_t _bytes_sent;
+    uint32_t _send_errors;
+};
+
+#endif /* BLE_GATEWAY_H_ */
@@ -0,0 +1,390 @@
+#ifndef BINARY_LOG_H_
+#define BINARY_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <type_traits>
+
+#include "hal/us_ticker_api.h"
+#include "platform/Callback.h"
+#include "platform/mbed_critical.h"
+#include "platform/NonCopyable.h"
+#include "rtos/Thread.h"
+#include "rtos/ThisThread.h"
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+/* records above this level are compiled out */
+#ifndef MBED_CONF_APP_LOG_LEVEL
+#define MBED_CONF_APP_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#ifndef MBED_CONF_APP_LOG_RING_SIZE
+#define MBED_CONF_APP_LOG_RING_SIZE 64
+#endif
+
+#ifndef MBED_CONF_APP_LOG_FLUSH_PERIOD_MS
+#define MBED_CONF_APP_LOG_FLUSH_PERIOD_MS 50
+#endif
+
+#ifndef MBED_CONF_APP_LOG_THREAD_PRIORITY
+#define MBED_CONF_APP_LOG_THREAD_PRIORITY osPriorityLow
+#endif
+
+#ifndef MBED_CONF_APP_LOG_THREAD_STACK_SIZE
+#define MBED_CONF_APP_LOG_THREAD_STACK_SIZE 1024
+#endif
+
+enum log_module_t {
+    LOG_MODULE_MAIN,
+    LOG_MODULE_BLE,
+    LOG_MODULE_CLOCK,
+    LOG_MODULE_BULK,
+    LOG_MODULE_POLICY,
+    LOG_MODULE_GATEWAY,
+    LOG_MODULE_POLLER,
+    LOG_MODULE_WIFI,
+    LOG_MODULE_SECURITY,
+    LOG_MODULE_DIAGNOSTICS,
+    LOG_MODULE_COUNT
+};
+
+/**
+ * Deferred formatting logger.
+ *
+ * A log call stores the address of its format string, its arguments as raw
+ * machine words and a timestamp in a lock-free ring; it costs a few dozen
+ * cycles and never blocks, so it can be used in BLE callbacks and in
+ * interrupt handlers. A low priority thread formats the records and prints
+ * them on the console.
+ *
+ * Because formatting is deferred, arguments are limited to integers and
+ * pointers to strings with static storage duration (%s of a literal); 64 bit
+ * and floating point arguments are not supported.
+ *
+ * When the ring is full new records are dropped and counted; the number of
+ * records lost is printed with the next record formatted.
+ *
+ * Formatted records can also be handed to a sink, such as the bulk data
+ * service, to be pulled from the node over BLE.
+ */
+class BinaryLog : private mbed::NonCopyable<BinaryLog> {
+public:
+    static const size_t MAX_ARGS = 6;
+
+    /**
+     * Largest formatted record, terminator included; longer records are
+     * truncated.
+     */
+    static const size_t MAX_LINE_SIZE = 128;
+
+    /**
+     * Destination of the formatted records: text and length; returns the
+     * number of bytes accepted.
+     */
+    typedef mbed::Callback<size_t(const uint8_t *, size_t)> sink_t;
+    static const size_t RING_SIZE = MBED_CONF_APP_LOG_RING_SIZE;
+
+    struct stats_t {
+        uint32_t written;
+        uint32_t dropped;
+        uint32_t filtered;
+    };
+
+    /**
+     * Access the logger of the application.
+     */
+    static BinaryLog &instance()
+    {
+        static BinaryLog log;
+        return log;
+    }
+
+    /**
+     * Start the thread formatting the records.
+     */
+    void start()
+    {
+        if (_started) {
+            return;
+        }
+        _started = true;
+        _thread.start(mbed::callback(this, &BinaryLog::run));
+    }
+
+    /**
+     * Runtime filter: records of a module above level are discarded.
+     */
+    void set_level(log_module_t module, uint8_t level)
+    {
+        _module_level[module] = level;
+    }
+
+    /**
+     * Set the sink receiving each record once formatted, on the logger
+     * thread.
+     */
+    void set_sink(sink_t sink)
+    {
+        _sink = sink;
+    }
+
+    bool enabled(log_module_t module, uint8_t level) const
+    {
+        return level <= _module_level[module];
+    }
+
+    /**
+     * Record a log entry.
+     *
+     * @param[in] level Level of the entry.
+     * @param[in] module Module emitting the entry.
+     * @param[in] format printf format of the entry; must outlive the record.
+     * @param[in] args Integral or pointer arguments of the format.
+     */
+    template<typename... Args>
+    void write(uint8_t level, log_module_t module, const char *format, Args... args)
+    {
+        static_assert(sizeof...(Args) <= MAX_ARGS, "too many log arguments");
+
+        if (!enabled(module, level)) {
+            core_util_atomic_incr_u32(&_stats.filtered, 1);
+            return;
+        }
+
+        const uintptr_t words[] = { 0, to_word(args)... };
+        record_t *record = reserve();
+        if (!record) {
+            core_util_atomic_incr_u32(&_stats.dropped, 1);
+            return;
+        }
+
+        record->timestamp_us = us_ticker_read();
+        record->format = format;
+        record->module = module;
+        record->level = level;
+        for (size_t i = 0; i < sizeof...(Args); ++i) {
+            record->args[i] = words[i + 1];
+        }
+        publish(record);
+    }
+
+    /**
+     * Format and print every pending record.
+     *
+     * Called periodically by the logger thread; may be called directly, for
+     * example before a reset, to empty the ring.
+     */
+    void flush()
+    {
+        while (true) {
+            record_t &record = _ring[_tail % RING_SIZE];
+            if (core_util_atomic_load_u32(&record.sequence) != _tail + 1) {
+                return;
+            }
+
+            uint32_t dropped = core_util_atomic_load_u32(&_stats.dropped);
+            if (dropped != _dropped_reported) {
+                printf("[log] %lu records dropped\r\n", (unsigned long)(dropped - _dropped_reported));
+                _dropped_reported = dropped;
+            }
+
+            char line[MAX_LINE_SIZE];
+            int length = snprintf(
+                line, sizeof(line),
+                "[%10lu][%s][%c] ",
+                (unsigned long) record.timestamp_us,
+                module_name(record.module),
+                "-EWID"[record.level < 5 ? record.level : 0]
+            );
+            if (length >= 0 && (size_t) length < sizeof(line)) {
+                int body = snprintf(
+                    line + length, sizeof(line) - length,
+                    record.format,
+                    record.args[0], record.args[1], record.args[2],
+                    record.args[3], record.args[4], record.args[5]
+                );
+                length = body < 0 ? length : length + body;
+            }
+            if (length < 0) {
+                length = 0;
+                line[0] = '\0';
+            } else if ((size_t) length >= sizeof(line)) {
+                length = sizeof(line) - 1;
+            }
+
+            fputs(line, stdout);
+            if (_sink) {
+                _sink((const uint8_t *) line, length);
+            }
+
+            core_util_atomic_store_u32(&record.sequence, _tail + RING_SIZE);
+            ++_tail;
+        }
+    }
+
+    stats_t stats() const
+    {
+        stats_t stats = {
+            core_util_atomic_load_u32(&_stats.written),
+            core_util_atomic_load_u32(&_stats.dropped),
+            core_util_atomic_load_u32(&_stats.filtered)
+        };
+        return stats;
+    }
+
+private:
+    static_assert((RING_SIZE & (RING_SIZE - 1)) == 0, "log ring size must be a power of two");
+
+    /**
+     * A slot of the ring. The sequence number tells producers and the
+     * consumer who owns the slot: it equals the position of the next write
+     * when free and that position plus one once published.
+     */
+    struct record_t {
+        volatile uint32_t sequence;
+        uint32_t timestamp_us;
+        const char *format;
+        uint8_t module;
+        uint8_t level;
+        uintptr_t args[MAX_ARGS];
+    };
+
+    BinaryLog() :
+        _head(0),
+        _tail(0),
+        _dropped_reported(0),
+        _started(false),
+        _thread(
+            MBED_CONF_APP_LOG_THREAD_PRIORITY,
+            MBED_CONF_APP_LOG_THREAD_STACK_SIZE,
+            NULL,
+            "log"
+        )
+    {
+        for (uint32_t i = 0; i < RING_SIZE; ++i) {
+            _ring[i].sequence = i;
+        }
+        for (size_t i = 0; i < LOG_MODULE_COUNT; ++i) {
+            _module_level[i] = MBED_CONF_APP_LOG_LEVEL;
+        }
+        _stats.written = 0;
+        _stats.dropped = 0;
+        _stats.filtered = 0;
+    }
+
+    /**
+     * Claim the slot at the head of the ring; safe against concurrent
+     * producers, including interrupt handlers.
+     */
+    record_t *reserve()
+    {
+        uint32_t position = core_util_atomic_load_u32(&_head);
+        while (true) {
+            record_t &record = _ring[position % RING_SIZE];
+            int32_t delta = (int32_t)(core_util_atomic_load_u32(&record.sequence) - position);
+
+            if (delta == 0) {
+                if (core_util_atomic_cas_u32(&_head, &position, position + 1)) {
+                    return &record;
+                }
+            } else if (delta < 0) {
+                return NULL;
+            } else {
+                position = core_util_atomic_load_u32(&_head);
+            }
+        }
+    }
+
+    void publish(record_t *record)
+    {
+        uint32_t position = record->sequence;
+        core_util_atomic_store_u32(&record->sequence, position + 1);
+        core_util_atomic_incr_u32(&_stats.written, 1);
+    }
+
+    void run()
+    {
+        while (true) {
+            flush();
+            rtos::ThisThread::sleep_for(MBED_CONF_APP_LOG_FLUSH_PERIOD_MS);
+        }
+    }
+
+    template<typename T>
+    static typename std::enable_if<std::is_pointer<T>::value, uintptr_t>::type
+    to_word(T value)
+    {
+        return (uintptr_t) value;
+    }
+
+    template<typename T>
+    static typename std::enable_if<!std::is_pointer<T>::value, uintptr_t>::type
+    to_word(T value)
+    {
+        static_assert(
+            std::is_integral<T>::value || std::is_enum<T>::value,
+            "only integral and pointer log arguments are supported"
+        );
+        static_assert(sizeof(T) <= sizeof(uint32_t), "64 bit log arguments are not supported");
+        return (uintptr_t) value;
+    }
+
+    static const char *module_name(uint8_t module)
+    {
+        static const char *const names[LOG_MODULE_COUNT] = {
+            "main", "ble", "clock", "bulk", "policy", "gateway", "poller", "wifi", "security",
+            "diagnostics"
+        };
+        return module < LOG_MODULE_COUNT ? names[module] : "?";
+    }
+
+    record_t _ring[RING_SIZE];
+    volatile uint32_t _head;
+    uint32_t _tail;
+    uint32_t _dropped_reported;
+    bool _started;
+    uint8_t _module_level[LOG_MODULE_COUNT];
+    struct {
+        volatile uint32_t written;
+        volatile uint32_t dropped;
+        volatile uint32_t filtered;
+    } _stats;
+    rtos::Thread _thread;
+    sink_t _sink;
+};
+
+#define LOG_RECORD(level, module, ...) \
+    BinaryLog::instance().write(level, module, __VA_ARGS__)
+
+#if MBED_CONF_APP_LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(module, ...) LOG_RECORD(LOG_LEVEL_ERROR, module, __VA_ARGS__)
+#else
+#define LOG_ERROR(module, ...) do { } while (0)
+#endif
+
+#if MBED_CONF_APP_LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(module, ...) LOG_RECORD(LOG_LEVEL_WARN, module, __VA_ARGS__)
+#else
+#define LOG_WARN(module, ...) do { } while (0)
+#endif
+
+#if MBED_CONF_APP_LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(module, ...) LOG_RECORD(LOG_LEVEL_INFO, module, __VA_ARGS__)
+#else
+#define LOG_INFO(module, ...) do { } while (0)
+#endif
+
+#if MBED_CONF_APP_LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(module, ...) LOG_RECORD(LOG_LEVEL_DEBUG, module, __VA_ARGS__)
+#else
+#define LOG_DEBUG(module, ...) do { } while (0)
+#endif
+
+#endif /* BINARY_LOG_H_ */
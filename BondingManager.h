@@ -0,0 +1,365 @@
+#ifndef BONDING_MANAGER_H_
+#define BONDING_MANAGER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "events/EventQueue.h"
+#include "platform/NonCopyable.h"
+#include "hal/us_ticker_api.h"
+
+#include "ble/BLE.h"
+#include "ble/Gap.h"
+#include "ble/SecurityManager.h"
+
+#if COMPONENT_FLASHIAP
+#include "FlashIAPBlockDevice.h"
+#include "LittleFileSystem.h"
+#endif
+
+#include "BinaryLog.h"
+
+#ifndef MBED_CONF_APP_BLE_MAX_CONNECTIONS
+#define MBED_CONF_APP_BLE_MAX_CONNECTIONS 3
+#endif
+
+#ifndef MBED_CONF_APP_SECURITY_PRIVACY
+#define MBED_CONF_APP_SECURITY_PRIVACY true
+#endif
+
+/* mount point of the partition holding the bond database */
+#define BONDING_FILE_SYSTEM_NAME "bonds"
+
+/**
+ * Bonding with the centrals and resumption of encryption on reconnection.
+ *
+ * The keys exchanged during pairing are stored by the Security Manager in
+ * a database file kept on a LittleFS partition of the internal flash
+ * (FlashIAP component); bonds survive resets. Without the FlashIAP
+ * component the database lives in RAM and bonds are lost at reset.
+ *
+ * On every connection in the peripheral role the link encryption is
+ * requested: a bonded central resumes encryption with its stored keys while
+ * an unknown central goes through pairing (Just Works, no MITM protection
+ * since the board has no display or keyboard). With privacy enabled the
+ * resolvable private addresses of bonded centrals are resolved to their
+ * identity; centrals whose address does not resolve are paired.
+ *
+ * The time from connection to encrypted link is measured separately for
+ * resumed and newly paired links.
+ */
+class BondingManager : private mbed::NonCopyable<BondingManager>,
+                       public SecurityManager::EventHandler {
+    typedef BondingManager Self;
+
+public:
+    /**
+     * Duration statistics of a link setup, in microseconds.
+     */
+    struct timing_t {
+        uint32_t count;
+        uint32_t failures;
+        uint64_t total_us;
+        uint32_t min_us;
+        uint32_t max_us;
+    };
+
+    BondingManager() :
+#if COMPONENT_FLASHIAP
+        _file_system(BONDING_FILE_SYSTEM_NAME),
+#endif
+        _ble(NULL),
+        _persistent(false)
+    {
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            _links[i].in_use = false;
+        }
+        reset(_resumed);
+        reset(_paired);
+    }
+
+    /**
+     * Initialize the Security Manager and the privacy of the device.
+     *
+     * Subscribed to the ble initialization; registered before the services
+     * so the device is secured before it becomes connectable.
+     */
+    void start(BLE &ble_interface, events::EventQueue &event_queue)
+    {
+        if (_ble) {
+            return;
+        }
+        _ble = &ble_interface;
+
+        const char *db_path = mount_database();
+        SecurityManager &sm = _ble->securityManager();
+        ble_error_t error = sm.init(
+            /* enableBonding */ true,
+            /* requireMITM */ false,
+            SecurityManager::IO_CAPS_NONE,
+            /* passkey */ NULL,
+            /* signing */ false,
+            db_path
+        );
+        if (error) {
+            LOG_ERROR(LOG_MODULE_SECURITY, "Error %u during SecurityManager::init.\r\n", error);
+            return;
+        }
+
+        sm.setEventHandler(this);
+        sm.preserveBondingStateOnReset(_persistent);
+        // pairing requests are accepted explicitly to tell pairings apart
+        // from encryption resumed with stored keys
+        sm.setPairingRequestAuthorisation(true);
+
+        Gap &gap = _ble->gap();
+        gap.onConnection(this, &Self::when_connection);
+        gap.onDisconnection(this, &Self::when_disconnection);
+
+#if MBED_CONF_APP_SECURITY_PRIVACY
+        ble::peripheral_privacy_configuration_t peripheral_privacy = {
+            /* use_non_resolvable_random_address */ false,
+            ble::peripheral_privacy_configuration_t::PERFORM_PAIRING_PROCEDURE
+        };
+        gap.setPeripheralPrivacyConfiguration(&peripheral_privacy);
+
+        ble::central_privay_configuration_t central_privacy = {
+            /* use_non_resolvable_random_address */ false,
+            ble::central_privay_configuration_t::RESOLVE_AND_FORWARD
+        };
+        gap.setCentralPrivacyConfiguration(&central_privacy);
+
+        error = gap.enablePrivacy(true);
+        if (error) {
+            LOG_ERROR(LOG_MODULE_SECURITY, "Error %u while enabling privacy.\r\n", error);
+        }
+#endif
+
+        LOG_INFO(
+            LOG_MODULE_SECURITY, "Security initialized, %s bond database.\r\n",
+            _persistent ? "persistent" : "volatile"
+        );
+    }
+
+    /**
+     * Erase every bond, in RAM and in flash.
+     */
+    void purge()
+    {
+        if (_ble) {
+            _ble->securityManager().purgeAllBondingState();
+        }
+    }
+
+    const timing_t &resumed_timing() const
+    {
+        return _resumed;
+    }
+
+    const timing_t &paired_timing() const
+    {
+        return _paired;
+    }
+
+    /**
+     * Print the time to an encrypted link of resumed and paired links.
+     */
+    void print_stats() const
+    {
+        print_timing("resumed", _resumed);
+        print_timing("paired", _paired);
+    }
+
+private:
+    /**
+     * Security state of a link in the peripheral role.
+     */
+    struct link_t {
+        bool in_use;
+        bool pairing;
+        bool encrypted;
+        ble::connection_handle_t handle;
+        uint32_t connected_us;
+    };
+
+    /**
+     * Mount the file system holding the bond database.
+     *
+     * @return Path of the database or NULL to keep it in RAM.
+     */
+    const char *mount_database()
+    {
+#if COMPONENT_FLASHIAP
+        int error = _file_system.mount(&_block_device);
+        if (error) {
+            LOG_WARN(LOG_MODULE_SECURITY, "Formatting the bond partition (%d).\r\n", error);
+            error = _file_system.reformat(&_block_device);
+        }
+        if (error) {
+            LOG_ERROR(LOG_MODULE_SECURITY, "Error %d while mounting the bond partition.\r\n", error);
+            return NULL;
+        }
+        _persistent = true;
+        return "/" BONDING_FILE_SYSTEM_NAME "/ble_security_db";
+#else
+        return NULL;
+#endif
+    }
+
+    void when_connection(const Gap::ConnectionCallbackParams_t *event)
+    {
+        if (event->role != Gap::PERIPHERAL) {
+            return;
+        }
+
+        link_t *link = allocate(event->handle);
+        if (!link) {
+            return;
+        }
+        link->pairing = false;
+        link->encrypted = false;
+        link->connected_us = us_ticker_read();
+
+        // a bonded central resumes encryption with its keys; other centrals
+        // receive a security request and start pairing
+        ble_error_t error = _ble->securityManager().setLinkEncryption(
+            event->handle, ble::link_encryption_t::ENCRYPTED
+        );
+        if (error) {
+            LOG_ERROR(LOG_MODULE_SECURITY, "Error %u while requesting encryption.\r\n", error);
+        }
+    }
+
+    void when_disconnection(const Gap::DisconnectionCallbackParams_t *event)
+    {
+        link_t *link = find(event->handle);
+        if (!link) {
+            return;
+        }
+        if (!link->encrypted) {
+            ++(link->pairing ? _paired : _resumed).failures;
+        }
+        link->in_use = false;
+    }
+
+    virtual void pairingRequest(ble::connection_handle_t connectionHandle)
+    {
+        link_t *link = find(connectionHandle);
+        if (link) {
+            link->pairing = true;
+        }
+        _ble->securityManager().acceptPairingRequest(connectionHandle);
+    }
+
+    virtual void pairingResult(
+        ble::connection_handle_t connectionHandle,
+        SecurityManager::SecurityCompletionStatus_t result
+    ) {
+        if (result == SecurityManager::SEC_STATUS_SUCCESS) {
+            LOG_INFO(LOG_MODULE_SECURITY, "Paired on connection %u.\r\n", connectionHandle);
+        } else {
+            LOG_WARN(
+                LOG_MODULE_SECURITY, "Pairing failed (%u) on connection %u.\r\n",
+                result, connectionHandle
+            );
+        }
+    }
+
+    virtual void linkEncryptionResult(
+        ble::connection_handle_t connectionHandle,
+        ble::link_encryption_t result
+    ) {
+        link_t *link = find(connectionHandle);
+        if (!link || link->encrypted) {
+            return;
+        }
+
+        if (result == ble::link_encryption_t::ENCRYPTED ||
+            result == ble::link_encryption_t::ENCRYPTED_WITH_MITM ||
+            result == ble::link_encryption_t::ENCRYPTED_WITH_SC_AND_MITM) {
+            link->encrypted = true;
+            uint32_t elapsed_us = us_ticker_read() - link->connected_us;
+            record(link->pairing ? _paired : _resumed, elapsed_us);
+            LOG_INFO(
+                LOG_MODULE_SECURITY, "Link %u encrypted in %u us (%s).\r\n",
+                connectionHandle, (unsigned) elapsed_us,
+                link->pairing ? "paired" : "resumed"
+            );
+        }
+    }
+
+    link_t *find(ble::connection_handle_t handle)
+    {
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            if (_links[i].in_use && _links[i].handle == handle) {
+                return &_links[i];
+            }
+        }
+        return NULL;
+    }
+
+    link_t *allocate(ble::connection_handle_t handle)
+    {
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            if (!_links[i].in_use) {
+                _links[i].in_use = true;
+                _links[i].handle = handle;
+                return &_links[i];
+            }
+        }
+        LOG_ERROR(LOG_MODULE_SECURITY, "Error: security link table full.\r\n");
+        return NULL;
+    }
+
+    static void reset(timing_t &timing)
+    {
+        timing.count = 0;
+        timing.failures = 0;
+        timing.total_us = 0;
+        timing.min_us = UINT32_MAX;
+        timing.max_us = 0;
+    }
+
+    static void record(timing_t &timing, uint32_t elapsed_us)
+    {
+        ++timing.count;
+        timing.total_us += elapsed_us;
+        if (elapsed_us < timing.min_us) {
+            timing.min_us = elapsed_us;
+        }
+        if (elapsed_us > timing.max_us) {
+            timing.max_us = elapsed_us;
+        }
+    }
+
+    static void print_timing(const char *name, const timing_t &timing)
+    {
+        if (!timing.count) {
+            printf(
+                "security: 0 %s links encrypted, %lu failed\r\n",
+                name, (unsigned long) timing.failures
+            );
+            return;
+        }
+        printf(
+            "security: %lu %s links encrypted in %lu/%lu/%lu us (min/avg/max), %lu failed\r\n",
+            (unsigned long) timing.count, name,
+            (unsigned long) timing.min_us,
+            (unsigned long)(timing.total_us / timing.count),
+            (unsigned long) timing.max_us,
+            (unsigned long) timing.failures
+        );
+    }
+
+#if COMPONENT_FLASHIAP
+    FlashIAPBlockDevice _block_device;
+    LittleFileSystem _file_system;
+#endif
+    BLE *_ble;
+    bool _persistent;
+    link_t _links[MBED_CONF_APP_BLE_MAX_CONNECTIONS];
+    timing_t _resumed;
+    timing_t _paired;
+};
+
+#endif /* BONDING_MANAGER_H_ */
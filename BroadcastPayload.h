@@ -0,0 +1,111 @@
+#ifndef BROADCAST_PAYLOAD_H_
+#define BROADCAST_PAYLOAD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Telemetry broadcast in the manufacturer specific data of the advertising
+ * payload.
+ *
+ * Layout (little endian):
+ *   company id (2), version (1), sequence (1), hour, minute, second,
+ *   connections (1), uptime in seconds (4), counters (4 each).
+ *
+ * Observers read the node state without connecting; the sequence number
+ * lets them discard duplicate reports of the same refresh.
+ */
+struct broadcast_data_t {
+    enum counter_t {
+        COUNTER_CONNECTIONS_TOTAL,
+        COUNTER_BULK_BUFFERED,
+        COUNTER_BULK_DROPPED,
+        COUNTER_COUNT
+    };
+
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    uint8_t connections;
+    uint32_t uptime_s;
+    uint32_t counters[COUNTER_COUNT];
+};
+
+/* Bluetooth SIG company identifier reserved for tests */
+#define BROADCAST_COMPANY_ID 0xFFFF
+#define BROADCAST_VERSION 1
+#define BROADCAST_PAYLOAD_SIZE (12 + 4 * broadcast_data_t::COUNTER_COUNT)
+
+/**
+ * Encode telemetry into a manufacturer specific data field.
+ *
+ * @param[in] data Telemetry to encode.
+ * @param[in] sequence Sequence number of the refresh.
+ * @param[out] buffer Destination buffer.
+ * @param[in] size Size of the destination buffer.
+ *
+ * @return The number of bytes written or 0 if the buffer is too small.
+ */
+inline size_t broadcast_encode(
+    const broadcast_data_t &data, uint8_t sequence, uint8_t *buffer, size_t size
+) {
+    if (size < BROADCAST_PAYLOAD_SIZE) {
+        return 0;
+    }
+
+    uint8_t *p = buffer;
+    *p++ = BROADCAST_COMPANY_ID & 0xFF;
+    *p++ = BROADCAST_COMPANY_ID >> 8;
+    *p++ = BROADCAST_VERSION;
+    *p++ = sequence;
+    *p++ = data.hour;
+    *p++ = data.minute;
+    *p++ = data.second;
+    *p++ = data.connections;
+    for (size_t i = 0; i < 4; ++i) {
+        *p++ = data.uptime_s >> (8 * i);
+    }
+    for (size_t c = 0; c < broadcast_data_t::COUNTER_COUNT; ++c) {
+        for (size_t i = 0; i < 4; ++i) {
+            *p++ = data.counters[c] >> (8 * i);
+        }
+    }
+
+    return p - buffer;
+}
+
+/**
+ * Decode a manufacturer specific data field produced by broadcast_encode.
+ *
+ * @return true if the field holds a broadcast of a supported version.
+ */
+inline bool broadcast_decode(
+    const uint8_t *buffer, size_t size, broadcast_data_t &data, uint8_t &sequence
+) {
+    if (size < BROADCAST_PAYLOAD_SIZE ||
+        (buffer[0] | (buffer[1] << 8)) != BROADCAST_COMPANY_ID ||
+        buffer[2] != BROADCAST_VERSION) {
+        return false;
+    }
+
+    const uint8_t *p = buffer + 3;
+    sequence = *p++;
+    data.hour = *p++;
+    data.minute = *p++;
+    data.second = *p++;
+    data.connections = *p++;
+    data.uptime_s = 0;
+    for (size_t i = 0; i < 4; ++i) {
+        data.uptime_s |= (uint32_t) *p++ << (8 * i);
+    }
+    for (size_t c = 0; c < broadcast_data_t::COUNTER_COUNT; ++c) {
+        data.counters[c] = 0;
+        for (size_t i = 0; i < 4; ++i) {
+            data.counters[c] |= (uint32_t) *p++ << (8 * i);
+        }
+    }
+
+    return true;
+}
+
+#endif /* BROADCAST_PAYLOAD_H_ */
@@ -0,0 +1,479 @@
+#ifndef BULK_DATA_SERVICE_H_
+#define BULK_DATA_SERVICE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "events/EventQueue.h"
+#include "platform/Callback.h"
+#include "platform/CircularBuffer.h"
+#include "platform/NonCopyable.h"
+#include "rtos/Kernel.h"
+
+#include "ble/BLE.h"
+#include "ble/GattServer.h"
+
+#include "BinaryLog.h"
+#include "BroadcastPayload.h"
+#include "EventQueueMonitor.h"
+
+#ifndef MBED_CONF_APP_BULK_BUFFER_SIZE
+#define MBED_CONF_APP_BULK_BUFFER_SIZE 4096
+#endif
+
+#ifndef MBED_CONF_APP_BULK_MAX_IN_FLIGHT
+#define MBED_CONF_APP_BULK_MAX_IN_FLIGHT 4
+#endif
+
+#ifndef MBED_CONF_APP_BULK_RETRY_MS
+#define MBED_CONF_APP_BULK_RETRY_MS 10
+#endif
+
+/**
+ * Stream the content of a ring buffer to a client as back to back
+ * notifications sized to the negotiated ATT MTU.
+ *
+ * The service holds three characteristics:
+ *   - data: variable length, read and notify; carries the chunks.
+ *   - control: write only; 0x01 starts a transfer, 0x00 aborts it.
+ *   - stats: read and notify; bytes sent, duration in ms and throughput in
+ *     bytes per second of the last transfer (uint32 little endian each).
+ *
+ * A client subscribes to data, then writes 0x01 to control; a start from a
+ * client not subscribed is ignored. Chunks are sent until the buffer is
+ * drained; at most MBED_CONF_APP_BULK_MAX_IN_FLIGHT notifications are
+ * queued in the stack at once, onDataSent schedules the refill of the pipe
+ * from the event queue. A chunk the stack rejects with nothing in flight is
+ * retried after MBED_CONF_APP_BULK_RETRY_MS.
+ *
+ * The buffer is filled with push() from a single producer thread; the
+ * application feeds it the formatted log records (BinaryLog::set_sink).
+ */
+class BulkDataService : private mbed::NonCopyable<BulkDataService> {
+    typedef BulkDataService Self;
+
+public:
+    /**
+     * Largest ATT MTU the stack can negotiate.
+     */
+    static const uint16_t MAX_ATT_MTU = MBED_CONF_CORDIO_DESIRED_ATT_MTU;
+
+    /**
+     * Largest payload of a notification: MTU minus opcode and handle.
+     */
+    static const uint16_t MAX_CHUNK_SIZE = MAX_ATT_MTU - 3;
+
+    static const uint16_t DEFAULT_ATT_MTU = 23;
+
+    static const uint8_t CONTROL_STOP = 0x00;
+    static const uint8_t CONTROL_START = 0x01;
+
+    BulkDataService() :
+        _data_char(
+            "e2d9df2d-aa93-4d85-b94c-0219d6338076",
+            _chunk, 0, sizeof(_chunk),
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ |
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY,
+            NULL, 0, true
+        ),
+        _control_char(
+            "e282133a-1efa-49da-9aa8-4916e7ab28d2",
+            &_control, sizeof(_control), sizeof(_control),
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE,
+            NULL, 0, false
+        ),
+        _stats_char(
+            "d10e38f5-3669-47d6-be0d-896142c652a2",
+            _stats, sizeof(_stats), sizeof(_stats),
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ |
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY,
+            NULL, 0, false
+        ),
+        _bulk_service(
+            /* uuid */ "1771a717-a2d9-4a27-8bb2-3af1f9347e1a",
+            /* characteristics */ _bulk_characteristics,
+            /* numCharacteristics */ sizeof(_bulk_characteristics) /
+                                     sizeof(_bulk_characteristics[0])
+        ),
+        _server(NULL),
+        _event_queue(NULL),
+        _connection(0),
+        _att_mtu(DEFAULT_ATT_MTU),
+        _streaming(false),
+        _pump_scheduled(false),
+        _in_flight(0),
+        _pending_len(0),
+        _bytes_sent(0),
+        _start_ms(0),
+        _overflow(0),
+        _control(CONTROL_STOP),
+        _transfer_cb(),
+        _att_mtu_source()
+    {
+        memset(_chunk, 0, sizeof(_chunk));
+        memset(_stats, 0, sizeof(_stats));
+
+        _bulk_characteristics[0] = &_data_char;
+        _bulk_characteristics[1] = &_control_char;
+        _bulk_characteristics[2] = &_stats_char;
+
+        _control_char.setWriteAuthorizationCallback(this, &Self::authorize_control_write);
+    }
+
+    /**
+     * Register the service in the GattServer.
+     *
+     * This function is meant to be passed to BLEProcess::on_init.
+     */
+    void start(BLE &ble_interface, events::EventQueue &event_queue)
+    {
+        if (_event_queue) {
+            return;
+        }
+
+        _server = &ble_interface.gattServer();
+        _event_queue = &event_queue;
+
+        ble_error_t err = _server->addService(_bulk_service);
+        if (err) {
+            LOG_ERROR(LOG_MODULE_BULK, "Error %u during bulk service registration.\r\n", err);
+            return;
+        }
+
+        _server->onDataSent(as_cb(&Self::when_data_sent));
+        _server->onDataWritten(as_cb(&Self::when_data_written));
+        ble_interface.gap().onDisconnection(this, &Self::when_disconnection);
+
+        LOG_INFO(LOG_MODULE_BULK, "bulk service registered\r\n");
+        LOG_INFO(LOG_MODULE_BULK, "service handle: %u\r\n", _bulk_service.getHandle());
+        LOG_INFO(LOG_MODULE_BULK, "\tdata characteristic value handle %u\r\n", _data_char.getValueHandle());
+        LOG_INFO(LOG_MODULE_BULK, "\tcontrol characteristic value handle %u\r\n", _control_char.getValueHandle());
+        LOG_INFO(LOG_MODULE_BULK, "\tstats characteristic value handle %u\r\n", _stats_char.getValueHandle());
+    }
+
+    /**
+     * Append data to the transfer buffer.
+     *
+     * @param[in] data Bytes to queue.
+     * @param[in] len Number of bytes to queue.
+     *
+     * @return The number of bytes accepted; bytes that do not fit are dropped
+     * and accounted in overflow().
+     */
+    size_t push(const uint8_t *data, size_t len)
+    {
+        size_t accepted = 0;
+        while (accepted < len && !_buffer.full()) {
+            _buffer.push(data[accepted]);
+            ++accepted;
+        }
+        _overflow += len - accepted;
+        return accepted;
+    }
+
+    /**
+     * Subscription to the start and end of transfers.
+     *
+     * @param[in] cb Callback invoked with the connection of the transfer and
+     * true when it starts, false when it ends.
+     */
+    void on_transfer(mbed::Callback<void(ble::connection_handle_t, bool)> cb)
+    {
+        _transfer_cb = cb;
+    }
+
+    /**
+     * Set the function queried for the ATT MTU of the streaming connection.
+     *
+     * Without it chunks are sized for the default MTU.
+     */
+    void set_att_mtu_source(mbed::Callback<uint16_t(ble::connection_handle_t)> cb)
+    {
+        _att_mtu_source = cb;
+    }
+
+    /**
+     * Number of bytes dropped because the transfer buffer was full.
+     */
+    uint32_t overflow() const
+    {
+        return _overflow;
+    }
+
+    /**
+     * Fill the bulk transfer counters of the broadcast telemetry.
+     */
+    void fill_broadcast(broadcast_data_t &data)
+    {
+        data.counters[broadcast_data_t::COUNTER_BULK_BUFFERED] = _buffer.size();
+        data.counters[broadcast_data_t::COUNTER_BULK_DROPPED] = _overflow;
+    }
+
+    /**
+     * ATT MTU negotiated on the streaming connection.
+     */
+    uint16_t att_mtu() const
+    {
+        return _att_mtu;
+    }
+
+private:
+    /**
+     * Abort the transfer if its connection is lost.
+     */
+    void when_disconnection(const Gap::DisconnectionCallbackParams_t *event)
+    {
+        if (_streaming && event->handle == _connection) {
+            stop_transfer();
+        }
+    }
+
+    /**
+     * Handler called when a write request on the control characteristic is
+     * received.
+     */
+    void authorize_control_write(GattWriteAuthCallbackParams *e)
+    {
+        if (e->offset != 0) {
+            e->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_INVALID_OFFSET;
+            return;
+        }
+
+        if (e->len != 1) {
+            e->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_INVALID_ATT_VAL_LENGTH;
+            return;
+        }
+
+        if (e->data[0] != CONTROL_START && e->data[0] != CONTROL_STOP) {
+            e->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_WRITE_NOT_PERMITTED;
+            return;
+        }
+
+        e->authorizationReply = AUTH_CALLBACK_REPLY_SUCCESS;
+    }
+
+    /**
+     * Start or abort a transfer when the control characteristic is written.
+     */
+    void when_data_written(const GattWriteCallbackParams *e)
+    {
+        if (e->handle != _control_char.getValueHandle() || e->len != 1) {
+            return;
+        }
+
+        if (e->data[0] == CONTROL_START) {
+            start_transfer(e->connHandle);
+        } else {
+            stop_transfer();
+        }
+    }
+
+    /**
+     * Handler called when notifications have been sent; refill the pipe.
+     *
+     * The stack may call it from within GattServer::write, the refill is
+     * therefore deferred to the event queue.
+     *
+     * The count covers the notifications of every service on every
+     * connection and the stack does not tell which ones were sent; a count
+     * received with no chunk in flight is not ours and is ignored. Credits
+     * released for the notifications of another service only let the stack
+     * reject a chunk, which is then retried.
+     */
+    void when_data_sent(unsigned count)
+    {
+        if (!_streaming || !_in_flight) {
+            return;
+        }
+
+        _in_flight = (count >= _in_flight) ? 0 : _in_flight - count;
+        schedule_pump(0);
+    }
+
+    void schedule_pump(uint32_t delay_ms)
+    {
+        if (_pump_scheduled) {
+            return;
+        }
+        _pump_scheduled = true;
+        EventQueueMonitor::call_in(
+            *_event_queue,
+            EventQueueMonitor::EVENT_BULK_PUMP,
+            delay_ms,
+            mbed::callback(this, &Self::scheduled_pump)
+        );
+    }
+
+    void scheduled_pump()
+    {
+        _pump_scheduled = false;
+        if (_streaming) {
+            pump();
+        }
+    }
+
+    void start_transfer(ble::connection_handle_t connection)
+    {
+        if (_streaming) {
+            return;
+        }
+
+        bool enabled = false;
+        if (_server->areUpdatesEnabled(connection, _data_char, &enabled) || !enabled) {
+            LOG_WARN(LOG_MODULE_BULK, "bulk transfer not started: data notifications disabled\r\n");
+            return;
+        }
+
+        LOG_INFO(LOG_MODULE_BULK, "bulk transfer started, %u bytes buffered\r\n", (unsigned) _buffer.size());
+        _connection = connection;
+        _streaming = true;
+        _in_flight = 0;
+        _pending_len = 0;
+        _bytes_sent = 0;
+        _start_ms = rtos::Kernel::get_ms_count();
+        if (_transfer_cb) {
+            _transfer_cb(_connection, true);
+        }
+        pump();
+    }
+
+    void stop_transfer()
+    {
+        if (!_streaming) {
+            return;
+        }
+
+        _streaming = false;
+        // a chunk left pending was sized for the MTU of this connection
+        _pending_len = 0;
+        report_throughput();
+        if (_transfer_cb) {
+            _transfer_cb(_connection, false);
+        }
+    }
+
+    /**
+     * Send chunks until the stack has MBED_CONF_APP_BULK_MAX_IN_FLIGHT
+     * notifications queued or the buffer is empty.
+     */
+    void pump()
+    {
+        _att_mtu = DEFAULT_ATT_MTU;
+        if (_att_mtu_source) {
+            _att_mtu = _att_mtu_source(_connection);
+        }
+        if (_att_mtu > MAX_ATT_MTU) {
+            _att_mtu = MAX_ATT_MTU;
+        }
+        const uint16_t chunk_size = _att_mtu - 3;
+
+        for (unsigned sent = 0;
+             sent < MBED_CONF_APP_BULK_MAX_IN_FLIGHT &&
+             _in_flight < MBED_CONF_APP_BULK_MAX_IN_FLIGHT;
+             ++sent) {
+            // a chunk rejected by the stack is retried before popping new data
+            if (!_pending_len) {
+                while (_pending_len < chunk_size && _buffer.pop(_chunk[_pending_len])) {
+                    ++_pending_len;
+                }
+            }
+
+            if (!_pending_len) {
+                if (!_in_flight) {
+                    stop_transfer();
+                }
+                return;
+            }
+
+            ++_in_flight;
+            ble_error_t err = _server->write(
+                _connection, _data_char.getValueHandle(), _chunk, _pending_len
+            );
+            if (err) {
+                // out of buffers; onDataSent resumes the transfer, or the
+                // retry if no chunk is in flight to trigger it
+                --_in_flight;
+                if (!_in_flight) {
+                    schedule_pump(MBED_CONF_APP_BULK_RETRY_MS);
+                }
+                return;
+            }
+
+            _bytes_sent += _pending_len;
+            _pending_len = 0;
+        }
+    }
+
+    /**
+     * Publish the statistics of the last transfer in the stats
+     * characteristic.
+     */
+    void report_throughput()
+    {
+        uint32_t duration_ms = (uint32_t)(rtos::Kernel::get_ms_count() - _start_ms);
+        uint32_t throughput = duration_ms ?
+            (uint32_t)(((uint64_t) _bytes_sent * 1000) / duration_ms) : 0;
+
+        LOG_INFO(
+            LOG_MODULE_BULK, "bulk transfer done: %u bytes in %u ms (%u B/s, MTU %u)\r\n",
+            (unsigned) _bytes_sent, (unsigned) duration_ms,
+            (unsigned) throughput, (unsigned) _att_mtu
+        );
+
+        write_le32(&_stats[0], _bytes_sent);
+        write_le32(&_stats[4], duration_ms);
+        write_le32(&_stats[8], throughput);
+        _server->write(_stats_char.getValueHandle(), _stats, sizeof(_stats));
+    }
+
+    static void write_le32(uint8_t *dst, uint32_t value)
+    {
+        dst[0] = value;
+        dst[1] = value >> 8;
+        dst[2] = value >> 16;
+        dst[3] = value >> 24;
+    }
+
+    /**
+     * Helper that construct an event handler from a member function of this
+     * instance.
+     */
+    template<typename Arg>
+    FunctionPointerWithContext<Arg> as_cb(void (Self::*member)(Arg))
+    {
+        return makeFunctionPointer(this, member);
+    }
+
+    uint8_t _chunk[MAX_CHUNK_SIZE];
+    uint8_t _stats[12];
+
+    GattCharacteristic _data_char;
+    GattCharacteristic _control_char;
+    GattCharacteristic _stats_char;
+
+    // list of the characteristics of the bulk service
+    GattCharacteristic* _bulk_characteristics[3];
+
+    GattService _bulk_service;
+
+    GattServer* _server;
+    events::EventQueue *_event_queue;
+
+    mbed::CircularBuffer<uint8_t, MBED_CONF_APP_BULK_BUFFER_SIZE> _buffer;
+
+    ble::connection_handle_t _connection;
+    uint16_t _att_mtu;
+    bool _streaming;
+    bool _pump_scheduled;
+    unsigned _in_flight;
+    uint16_t _pending_len;
+    uint32_t _bytes_sent;
+    uint64_t _start_ms;
+    uint32_t _overflow;
+    uint8_t _control;
+    mbed::Callback<void(ble::connection_handle_t, bool)> _transfer_cb;
+    mbed::Callback<uint16_t(ble::connection_handle_t)> _att_mtu_source;
+};
+
+#endif /* BULK_DATA_SERVICE_H_ */
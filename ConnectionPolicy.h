@@ -0,0 +1,345 @@
+#ifndef CONNECTION_POLICY_H_
+#define CONNECTION_POLICY_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "events/EventQueue.h"
+#include "platform/Callback.h"
+#include "platform/NonCopyable.h"
+#include "rtos/Kernel.h"
+
+#include "ble/BLE.h"
+#include "ble/Gap.h"
+#include "ble/GattServer.h"
+
+#include "BinaryLog.h"
+#include "EventQueueMonitor.h"
+
+#ifndef MBED_CONF_APP_BLE_MAX_CONNECTIONS
+#define MBED_CONF_APP_BLE_MAX_CONNECTIONS 3
+#endif
+
+#ifndef MBED_CONF_APP_CONN_BURST_INTERVAL_MS
+#define MBED_CONF_APP_CONN_BURST_INTERVAL_MS 15
+#endif
+
+#ifndef MBED_CONF_APP_CONN_IDLE_INTERVAL_MS
+#define MBED_CONF_APP_CONN_IDLE_INTERVAL_MS 500
+#endif
+
+#ifndef MBED_CONF_APP_CONN_IDLE_LATENCY
+#define MBED_CONF_APP_CONN_IDLE_LATENCY 4
+#endif
+
+#ifndef MBED_CONF_APP_CONN_SUPERVISION_TIMEOUT_MS
+#define MBED_CONF_APP_CONN_SUPERVISION_TIMEOUT_MS 6000
+#endif
+
+#ifndef MBED_CONF_APP_CONN_IDLE_TIMEOUT_MS
+#define MBED_CONF_APP_CONN_IDLE_TIMEOUT_MS 2000
+#endif
+
+#ifndef MBED_CONF_APP_CONN_BURST_WRITE_THRESHOLD
+#define MBED_CONF_APP_CONN_BURST_WRITE_THRESHOLD 4
+#endif
+
+/**
+ * Select the connection parameters of each link from its activity.
+ *
+ * A link that transfers data (bulk transfer in progress or more than
+ * MBED_CONF_APP_CONN_BURST_WRITE_THRESHOLD writes within an idle timeout) is
+ * switched to a short interval without slave latency. A link without
+ * activity for MBED_CONF_APP_CONN_IDLE_TIMEOUT_MS is switched to a long
+ * interval with slave latency.
+ *
+ * The parameters requested and the parameters actually in use on the link
+ * are tracked per connection.
+ */
+class ConnectionPolicy : private mbed::NonCopyable<ConnectionPolicy> {
+    typedef ConnectionPolicy Self;
+
+public:
+    enum mode_t {
+        MODE_CENTRAL_DEFAULT,
+        MODE_BURST,
+        MODE_IDLE
+    };
+
+    /**
+     * State of a connection seen by the policy.
+     *
+     * Intervals are expressed in 1.25 ms units and supervision timeout in
+     * 10 ms units as on air.
+     */
+    struct connection_t {
+        bool in_use;
+        ble::connection_handle_t handle;
+        mode_t mode;
+        mode_t previous_mode;
+        bool transfer_active;
+        uint16_t interval;
+        uint16_t latency;
+        uint16_t supervision_timeout;
+        uint16_t writes;
+        uint64_t writes_window_start_ms;
+        uint64_t last_activity_ms;
+        uint32_t updates_requested;
+        uint32_t updates_completed;
+        uint32_t updates_failed;
+    };
+
+    ConnectionPolicy(events::EventQueue &event_queue, BLE &ble_interface) :
+        _event_queue(event_queue),
+        _ble_interface(ble_interface),
+        _idle_check_id(0)
+    {
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            _connections[i].in_use = false;
+        }
+    }
+
+    /**
+     * Start tracking a connection with the parameters chosen by the central.
+     */
+    void when_connection(const Gap::ConnectionCallbackParams_t *event)
+    {
+        connection_t *connection = allocate(event->handle);
+        if (!connection) {
+            LOG_ERROR(LOG_MODULE_POLICY, "Error: connection policy table full.\r\n");
+            return;
+        }
+
+        connection->mode = MODE_CENTRAL_DEFAULT;
+        connection->previous_mode = MODE_CENTRAL_DEFAULT;
+        connection->transfer_active = false;
+        connection->interval = event->connectionParams->maxConnectionInterval;
+        connection->latency = event->connectionParams->slaveLatency;
+        connection->supervision_timeout = event->connectionParams->connectionSupervisionTimeout;
+        connection->writes = 0;
+        connection->last_activity_ms = rtos::Kernel::get_ms_count();
+        connection->writes_window_start_ms = connection->last_activity_ms;
+        connection->updates_requested = 0;
+        connection->updates_completed = 0;
+        connection->updates_failed = 0;
+
+        if (!_idle_check_id) {
+            _idle_check_id = EventQueueMonitor::call_every(
+                _event_queue,
+                EventQueueMonitor::EVENT_CONNECTION_POLICY,
+                MBED_CONF_APP_CONN_IDLE_TIMEOUT_MS / 2,
+                mbed::callback(this, &Self::check_idle)
+            );
+        }
+    }
+
+    /**
+     * Stop tracking a connection.
+     */
+    void when_disconnection(const Gap::DisconnectionCallbackParams_t *event)
+    {
+        connection_t *connection = find(event->handle);
+        if (!connection) {
+            return;
+        }
+
+        print_connection(*connection);
+        connection->in_use = false;
+
+        if (!active_connections() && _idle_check_id) {
+            EventQueueMonitor::cancel(_event_queue, _idle_check_id);
+            _idle_check_id = 0;
+        }
+    }
+
+    /**
+     * Record the parameters the controller settled on after an update.
+     */
+    void when_parameters_updated(const ble::ConnectionParametersUpdateCompleteEvent &event)
+    {
+        connection_t *connection = find(event.getConnectionHandle());
+        if (!connection) {
+            return;
+        }
+
+        if (event.getStatus() != BLE_ERROR_NONE) {
+            // the link kept its parameters; the next trigger asks again
+            ++connection->updates_failed;
+            connection->mode = connection->previous_mode;
+            return;
+        }
+
+        ++connection->updates_completed;
+        connection->interval = event.getConnectionInterval().value();
+        connection->latency = event.getSlaveLatency().value();
+        connection->supervision_timeout = event.getSupervisionTimeout().value();
+    }
+
+    /**
+     * Register a write from the peer; a run of writes within an idle timeout
+     * switches the link to burst mode.
+     */
+    void when_data_written(const GattWriteCallbackParams *e)
+    {
+        connection_t *connection = find(e->connHandle);
+        if (!connection) {
+            return;
+        }
+
+        uint64_t now = rtos::Kernel::get_ms_count();
+        connection->last_activity_ms = now;
+        if ((now - connection->writes_window_start_ms) >= MBED_CONF_APP_CONN_IDLE_TIMEOUT_MS) {
+            connection->writes = 0;
+            connection->writes_window_start_ms = now;
+        }
+        if (++connection->writes >= MBED_CONF_APP_CONN_BURST_WRITE_THRESHOLD) {
+            request(*connection, MODE_BURST);
+        }
+    }
+
+    /**
+     * Signal the start or the end of a bulk transfer on a connection.
+     *
+     * The link stays in burst mode while a transfer is active.
+     */
+    void set_transfer_active(ble::connection_handle_t handle, bool active)
+    {
+        connection_t *connection = find(handle);
+        if (!connection) {
+            return;
+        }
+
+        connection->transfer_active = active;
+        connection->last_activity_ms = rtos::Kernel::get_ms_count();
+        if (active) {
+            request(*connection, MODE_BURST);
+        }
+    }
+
+    /**
+     * Access the state of a tracked connection.
+     *
+     * @return NULL if the connection is not tracked.
+     */
+    const connection_t *get_connection(ble::connection_handle_t handle) const
+    {
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            if (_connections[i].in_use && _connections[i].handle == handle) {
+                return &_connections[i];
+            }
+        }
+        return NULL;
+    }
+
+private:
+    connection_t *find(ble::connection_handle_t handle)
+    {
+        return const_cast<connection_t *>(get_connection(handle));
+    }
+
+    connection_t *allocate(ble::connection_handle_t handle)
+    {
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            if (!_connections[i].in_use) {
+                _connections[i].in_use = true;
+                _connections[i].handle = handle;
+                return &_connections[i];
+            }
+        }
+        return NULL;
+    }
+
+    size_t active_connections() const
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            count += _connections[i].in_use;
+        }
+        return count;
+    }
+
+    /**
+     * Demote connections without activity to idle parameters.
+     */
+    void check_idle()
+    {
+        uint64_t now = rtos::Kernel::get_ms_count();
+
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            connection_t &connection = _connections[i];
+            if (!connection.in_use || connection.transfer_active) {
+                continue;
+            }
+
+            if ((now - connection.last_activity_ms) >= MBED_CONF_APP_CONN_IDLE_TIMEOUT_MS) {
+                request(connection, MODE_IDLE);
+            }
+        }
+    }
+
+    /**
+     * Ask the central to switch the connection to the parameters of a mode.
+     */
+    void request(connection_t &connection, mode_t mode)
+    {
+        if (connection.mode == mode) {
+            return;
+        }
+
+        uint16_t interval = (mode == MODE_BURST) ?
+            ms_to_interval(MBED_CONF_APP_CONN_BURST_INTERVAL_MS) :
+            ms_to_interval(MBED_CONF_APP_CONN_IDLE_INTERVAL_MS);
+        uint16_t latency = (mode == MODE_BURST) ? 0 : MBED_CONF_APP_CONN_IDLE_LATENCY;
+
+        ble_error_t error = _ble_interface.gap().updateConnectionParameters(
+            connection.handle,
+            ble::conn_interval_t(interval),
+            ble::conn_interval_t(interval),
+            ble::slave_latency_t(latency),
+            ble::supervision_timeout_t(MBED_CONF_APP_CONN_SUPERVISION_TIMEOUT_MS / 10)
+        );
+
+        if (error) {
+            LOG_ERROR(LOG_MODULE_POLICY, "Error %u during connection parameters update.\r\n", error);
+            ++connection.updates_failed;
+            return;
+        }
+
+        connection.previous_mode = connection.mode;
+        connection.mode = mode;
+        ++connection.updates_requested;
+    }
+
+    /**
+     * Convert milliseconds to 1.25 ms connection interval units.
+     */
+    static uint16_t ms_to_interval(uint32_t ms)
+    {
+        return (ms * 4) / 5;
+    }
+
+    static void print_connection(const connection_t &connection)
+    {
+        // runs on the ble lane: the records are formatted by the low priority "log" thread
+        LOG_INFO(
+            LOG_MODULE_POLICY, "connection %u: interval %u, latency %u, timeout %u\r\n",
+            (unsigned) connection.handle,
+            (unsigned) connection.interval,
+            (unsigned) connection.latency,
+            (unsigned) connection.supervision_timeout
+        );
+        LOG_INFO(
+            LOG_MODULE_POLICY, "\tupdates %u requested, %u completed, %u failed\r\n",
+            (unsigned) connection.updates_requested,
+            (unsigned) connection.updates_completed,
+            (unsigned) connection.updates_failed
+        );
+    }
+
+    events::EventQueue &_event_queue;
+    BLE &_ble_interface;
+    connection_t _connections[MBED_CONF_APP_BLE_MAX_CONNECTIONS];
+    int _idle_check_id;
+};
+
+#endif /* CONNECTION_POLICY_H_ */
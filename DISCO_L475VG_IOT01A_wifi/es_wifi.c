@@ -859,6 +859,8 @@ uint8_t ES_WIFI_IsConnected(ES_WIFIObject_t *Obj)
   */
 ES_WIFI_Status_t ES_WIFI_Disconnect(ES_WIFIObject_t *Obj)
 {
+  /* whatever the answer, the join is over */
+  Obj->NetSettings.IsConnected = 0;
   sprintf((char*)Obj->CmdData,"CD\r"); 
   return  AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData); 
 }
@@ -50,6 +50,9 @@
 /* Includes ------------------------------------------------------------------*/
 #include "es_wifi_io.h"
 #include <string.h>
+#include "hal/us_ticker_api.h"
+#include "platform/mbed_power_mgmt.h"
+#include "platform/mbed_thread.h"
 
 /* Private define ------------------------------------------------------------*/
 #define MIN(a, b)  ((a) < (b) ? (a) : (b))
@@ -58,7 +61,15 @@
 /* Private variables ---------------------------------------------------------*/
 SPI_HandleTypeDef hspi;
 
+/* deep sleep stops the SPI clock: it is locked only while NSS is asserted */
+static uint8_t  SpiSelected = 0;
+static uint32_t SpiSelectTime = 0;
+static uint32_t SpiBusyTime = 0;
+
 /* Private function prototypes -----------------------------------------------*/
+static void SPI_WIFI_Select(void);
+static void SPI_WIFI_Deselect(void);
+static void SPI_WIFI_Wait(void);
 
 /* Private functions ---------------------------------------------------------*/
 /*******************************************************************************
@@ -169,7 +180,7 @@ int8_t SPI_WIFI_Init(void)
   
   WIFI_RESET_MODULE();
   
-  WIFI_ENABLE_NSS(); 
+  SPI_WIFI_Select(); 
   
   while (WIFI_IS_CMDDATA_READY())
   {
@@ -177,7 +188,7 @@ int8_t SPI_WIFI_Init(void)
     count += 2;
     if(((HAL_GetTick() - tickstart ) > 0xFFFF) || (Status != HAL_OK))
     {
-      WIFI_DISABLE_NSS(); 
+      SPI_WIFI_Deselect(); 
       return -1;
     }    
   }
@@ -185,11 +196,11 @@ int8_t SPI_WIFI_Init(void)
   if((Prompt[0] != 0x15) ||(Prompt[1] != 0x15) ||(Prompt[2] != '\r')||
        (Prompt[3] != '\n') ||(Prompt[4] != '>') ||(Prompt[5] != ' '))
   {
-    WIFI_DISABLE_NSS(); 
+    SPI_WIFI_Deselect(); 
     return -1;
   }    
    
-  WIFI_DISABLE_NSS(); 
+  SPI_WIFI_Deselect(); 
   return 0;
 }
 
@@ -219,7 +230,7 @@ int16_t SPI_WIFI_ReceiveData(uint8_t *pData, uint16_t len, uint32_t timeout)
   
   HAL_SPIEx_FlushRxFifo(&hspi);
   
-  WIFI_DISABLE_NSS(); 
+  SPI_WIFI_Deselect(); 
   
   while (!WIFI_IS_CMDDATA_READY())
   {
@@ -227,9 +238,10 @@ int16_t SPI_WIFI_ReceiveData(uint8_t *pData, uint16_t len, uint32_t timeout)
     {
       return -1;
     }
+    SPI_WIFI_Wait();
   }
   
-  WIFI_ENABLE_NSS(); 
+  SPI_WIFI_Select(); 
   
   while (WIFI_IS_CMDDATA_READY())
   {
@@ -259,7 +271,7 @@ int16_t SPI_WIFI_ReceiveData(uint8_t *pData, uint16_t len, uint32_t timeout)
       
       if((HAL_GetTick() - tickstart ) > timeout)
       {
-        WIFI_DISABLE_NSS(); 
+        SPI_WIFI_Deselect(); 
         return -1;
       }
     }
@@ -269,7 +281,7 @@ int16_t SPI_WIFI_ReceiveData(uint8_t *pData, uint16_t len, uint32_t timeout)
     }
   }
   
-  WIFI_DISABLE_NSS(); 
+  SPI_WIFI_Deselect(); 
   return length;
 }
 /**
@@ -288,17 +300,18 @@ int16_t SPI_WIFI_SendData( uint8_t *pdata,  uint16_t len, uint32_t timeout)
   {
     if((HAL_GetTick() - tickstart ) > timeout)
     {
-      WIFI_DISABLE_NSS();       
+      SPI_WIFI_Deselect();       
       return -1;
     }
+    SPI_WIFI_Wait();
   }
   
-  WIFI_ENABLE_NSS(); 
+  SPI_WIFI_Select(); 
   if (len > 1)
   {
    if( HAL_SPI_Transmit(&hspi, (uint8_t *)pdata , len/2, timeout) != HAL_OK)
    {
-     WIFI_DISABLE_NSS(); 
+     SPI_WIFI_Deselect(); 
      return -1;
    }
   }
@@ -310,7 +323,7 @@ int16_t SPI_WIFI_SendData( uint8_t *pdata,  uint16_t len, uint32_t timeout)
     
     if( HAL_SPI_Transmit(&hspi, Padding, 1, timeout) != HAL_OK)
     {
-      WIFI_DISABLE_NSS();       
+      SPI_WIFI_Deselect();       
       return -1;
     }
   }
@@ -325,7 +338,66 @@ int16_t SPI_WIFI_SendData( uint8_t *pdata,  uint16_t len, uint32_t timeout)
   */
 void SPI_WIFI_Delay(uint32_t Delay)
 {
-  HAL_Delay(Delay);
+  /* sleep instead of spinning so other threads run and the MCU may sleep */
+  thread_sleep_for(Delay);
+}
+
+/**
+  * @brief  Time spent with the SPI bus selected
+  * @param  None
+  * @retval Time in us, wraps around
+  */
+uint32_t SPI_WIFI_GetBusyTime(void)
+{
+  uint32_t busy = SpiBusyTime;
+  
+  if (SpiSelected)
+  {
+    busy += us_ticker_read() - SpiSelectTime;
+  }
+  return busy;
+}
+
+/**
+  * @brief  Assert NSS and prevent deep sleep until it is released
+  * @param  None
+  * @retval None
+  */
+static void SPI_WIFI_Select(void)
+{
+  if (!SpiSelected)
+  {
+    SpiSelected = 1;
+    sleep_manager_lock_deep_sleep();
+    SpiSelectTime = us_ticker_read();
+  }
+  WIFI_ENABLE_NSS();
+}
+
+/**
+  * @brief  Release NSS and allow deep sleep
+  * @param  None
+  * @retval None
+  */
+static void SPI_WIFI_Deselect(void)
+{
+  WIFI_DISABLE_NSS();
+  if (SpiSelected)
+  {
+    SpiSelected = 0;
+    SpiBusyTime += us_ticker_read() - SpiSelectTime;
+    sleep_manager_unlock_deep_sleep();
+  }
+}
+
+/**
+  * @brief  Wait for the module to raise CMDDATA_READY
+  * @param  None
+  * @retval None
+  */
+static void SPI_WIFI_Wait(void)
+{
+  thread_sleep_for(1);
 }
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -76,6 +76,7 @@ int8_t  SPI_WIFI_Init(void);
 int16_t SPI_WIFI_ReceiveData(uint8_t *pData, uint16_t len, uint32_t timeout);
 int16_t SPI_WIFI_SendData( uint8_t *pData, uint16_t len, uint32_t timeout);
 void    SPI_WIFI_Delay(uint32_t Delay);
+uint32_t SPI_WIFI_GetBusyTime(void);
     
 #ifdef __cplusplus
 }
@@ -46,12 +46,31 @@
   */
 /* Includes ------------------------------------------------------------------*/
 #include "wifi.h"
+#include "hal/us_ticker_api.h"
 
 /* Private define ------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
 ES_WIFIObject_t    EsWifiObj;
+static WIFI_CommandHook_t CommandHook = NULL;
 
 /* Private functions ---------------------------------------------------------*/
+/**
+  * @brief  Report a command to the hook, if any
+  * @param  command : Command completed
+  * @param  status : Status of the command
+  * @param  bytes : Payload bytes transferred
+  * @param  start : us_ticker_read() at the start of the command
+  * @retval Status of the command
+  */
+static WIFI_Status_t WIFI_Report(WIFI_Command_t command, WIFI_Status_t status, uint32_t bytes, uint32_t start)
+{
+  if(CommandHook)
+  {
+    CommandHook(command, status, bytes, us_ticker_read() - start);
+  }
+  return status;
+}
+
 /**
   * @brief  Initialiaze the WIFI core
   * @param  None
@@ -60,6 +79,7 @@ ES_WIFIObject_t    EsWifiObj;
 WIFI_Status_t WIFI_Init(void)
 {
   WIFI_Status_t ret = WIFI_STATUS_ERROR;
+  uint32_t start = us_ticker_read();
   
   if(ES_WIFI_RegisterBusIO(&EsWifiObj, 
                            SPI_WIFI_Init, 
@@ -74,7 +94,17 @@ WIFI_Status_t WIFI_Init(void)
       ret = WIFI_STATUS_OK;
     }
   }
-  return ret;
+  return WIFI_Report(WIFI_COMMAND_INIT, ret, 0, start);
+}
+
+/**
+  * @brief  Register the function called after each command of the module
+  * @param  hook : Function called, NULL for none
+  * @retval None
+  */
+void WIFI_SetCommandHook(WIFI_CommandHook_t hook)
+{
+  CommandHook = hook;
 }
 
 /**
@@ -124,6 +154,7 @@ WIFI_Status_t WIFI_Connect(
                              WIFI_Ecn_t ecn)
 {
   WIFI_Status_t ret = WIFI_STATUS_ERROR;  
+  uint32_t start = us_ticker_read();
  
   if(ES_WIFI_Connect(&EsWifiObj, SSID, Password, (ES_WIFI_SecurityType_t) ecn) == ES_WIFI_STATUS_OK)
   {
@@ -133,7 +164,7 @@ WIFI_Status_t WIFI_Connect(
     }
     
   }
-  return ret;
+  return WIFI_Report(WIFI_COMMAND_JOIN, ret, 0, start);
 }
 
 /**
@@ -167,6 +198,36 @@ WIFI_Status_t WIFI_GetIP_Address (uint8_t  *ipaddr)
   return ret;
 }
 
+/**
+  * @brief  Query the module for its network settings and check that it
+  *         still holds an address; WIFI_GetIP_Address only returns the
+  *         state cached at the last join or query.
+  * @param  ipaddr : array of the IP address, updated if connected
+  * @retval Operation Status.
+  */
+WIFI_Status_t WIFI_CheckConnection(uint8_t  *ipaddr)
+{
+  WIFI_Status_t ret = WIFI_STATUS_ERROR;
+  uint32_t start = us_ticker_read();
+  
+  if(ES_WIFI_GetNetworkSettings(&EsWifiObj) != ES_WIFI_STATUS_OK)
+  {
+    return WIFI_Report(WIFI_COMMAND_STATUS, WIFI_STATUS_ERROR, 0, start);
+  }
+  
+  /* the module reports 0.0.0.0 once it lost the access point */
+  EsWifiObj.NetSettings.IsConnected =
+    (EsWifiObj.NetSettings.IP_Addr[0] | EsWifiObj.NetSettings.IP_Addr[1] |
+     EsWifiObj.NetSettings.IP_Addr[2] | EsWifiObj.NetSettings.IP_Addr[3]) != 0;
+  if(EsWifiObj.NetSettings.IsConnected)
+  {
+    memcpy(ipaddr, EsWifiObj.NetSettings.IP_Addr, 4);
+    ret = WIFI_STATUS_OK;
+  }
+  WIFI_Report(WIFI_COMMAND_STATUS, WIFI_STATUS_OK, 0, start);
+  return ret;
+}
+
 /**
   * @brief  Disconnect from a network
   * @param  None
@@ -175,12 +236,13 @@ WIFI_Status_t WIFI_GetIP_Address (uint8_t  *ipaddr)
 WIFI_Status_t WIFI_Disconnect(void)
 {
   WIFI_Status_t ret = WIFI_STATUS_ERROR;    
+  uint32_t start = us_ticker_read();
   if( ES_WIFI_Disconnect(&EsWifiObj)== ES_WIFI_STATUS_OK)
   {
       ret = WIFI_STATUS_OK; 
   }
   
-  return ret;
+  return WIFI_Report(WIFI_COMMAND_DISCONNECT, ret, 0, start);
 }
 
 /**
@@ -294,6 +356,7 @@ WIFI_Status_t WIFI_OpenClientConnection(uint32_t socket, WIFI_Protocol_t type, c
 {
   WIFI_Status_t ret = WIFI_STATUS_ERROR;
   ES_WIFI_Conn_t conn;
+  uint32_t start = us_ticker_read();
   
   conn.Number = socket;
   conn.RemotePort = port;
@@ -307,7 +370,7 @@ WIFI_Status_t WIFI_OpenClientConnection(uint32_t socket, WIFI_Protocol_t type, c
   {
     ret = WIFI_STATUS_OK;
   }
-  return ret;
+  return WIFI_Report(WIFI_COMMAND_OPEN, ret, 0, start);
 }
 
 /**
@@ -323,13 +386,14 @@ WIFI_Status_t WIFI_CloseClientConnection(uint32_t socket)
 {
   WIFI_Status_t ret = WIFI_STATUS_ERROR;  
   ES_WIFI_Conn_t conn;
+  uint32_t start = us_ticker_read();
   conn.Number = socket;
   
   if(ES_WIFI_StopClientConnection(&EsWifiObj, &conn)== ES_WIFI_STATUS_OK)
   {
     ret = WIFI_STATUS_OK;
   }
-  return ret; 
+  return WIFI_Report(WIFI_COMMAND_CLOSE, ret, 0, start); 
 }
 
 /**
@@ -373,16 +437,17 @@ WIFI_Status_t WIFI_StopServer(uint32_t socket)
   * @param  len : length of data to be sent
   * @retval Operation status
   */
-WIFI_StatuData(uint8_t socket, uint8_t *pdata, uint16_t Reqlen, uint16_t *SentDatalen, uint32_t Timeout)
+WIFI_Status_t WIFI_SendData(uint8_t socket, uint8_t *pdata, uint16_t Reqlen, uint16_t *SentDatalen, uint32_t Timeout)
 {
   WIFI_Status_t ret = WIFI_STATUS_ERROR;
+  uint32_t start = us_ticker_read();
 
     if(ES_WIFI_SendData(&EsWifiObj, socket, pdata, Reqlen, SentDatalen, Timeout) == ES_WIFI_STATUS_OK)
     {
       ret = WIFI_STATUS_OK;
     }
 
-  return ret;
+  return WIFI_Report(WIFI_COMMAND_SEND, ret, ret == WIFI_STATUS_OK ? *SentDatalen : 0, start);
 }
 
 /**
@@ -394,12 +459,13 @@ WIFI_StatuData(uint8_t socket, uint8_t *pdata, uint16_t Reqlen, uint16_t *SentDa
 WIFI_Status_t WIFI_ReceiveData(uint8_t socket, uint8_t *pdata, uint16_t Reqlen, uint16_t *RcvDatalen, uint32_t Timeout)
 {
   WIFI_Status_t ret = WIFI_STATUS_ERROR; 
+  uint32_t start = us_ticker_read();
 
   if(ES_WIFI_ReceiveData(&EsWifiObj, socket, pdata, Reqlen, RcvDatalen, Timeout) == ES_WIFI_STATUS_OK)
   {
     ret = WIFI_STATUS_OK; 
   }
-  return ret;
+  return WIFI_Report(WIFI_COMMAND_RECEIVE, ret, ret == WIFI_STATUS_OK ? *RcvDatalen : 0, start);
 }
 
 /**
@@ -93,6 +93,21 @@ typedef enum {
   WIFI_STATUS_ASSIGNED       = 4,  
 }WIFI_Status_t;
 
+typedef enum {
+  WIFI_COMMAND_INIT          = 0,
+  WIFI_COMMAND_JOIN          = 1,
+  WIFI_COMMAND_DISCONNECT    = 2,
+  WIFI_COMMAND_OPEN          = 3,
+  WIFI_COMMAND_CLOSE         = 4,
+  WIFI_COMMAND_SEND          = 5,
+  WIFI_COMMAND_RECEIVE       = 6,
+  WIFI_COMMAND_STATUS        = 7,
+}WIFI_Command_t;
+
+/* called after each module command: command, status, payload bytes
+   transferred and duration of the command in us */
+typedef void (*WIFI_CommandHook_t)(WIFI_Command_t command, WIFI_Status_t status, uint32_t bytes, uint32_t duration_us);
+
 typedef struct {
   WIFI_Ecn_t Ecn;                                           /*!< Security of Wi-Fi spot. This parameter has a value of \ref WIFI_Ecn_t enumeration */
   char SSID[WIFI_MAX_SSID_NAME + 1];                        /*!< Service Set Identifier value. Wi-Fi spot name */
@@ -146,12 +161,14 @@ typedef struct {
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions ------------------------------------------------------- */
 WIFI_Status_t       WIFI_Init(void);
+void                WIFI_SetCommandHook(WIFI_CommandHook_t hook);
 WIFI_Status_t       WIFI_ListAccessPoints(WIFI_APs_t *APs, uint8_t AP_MaxNbr);
 WIFI_Status_t       WIFI_Connect(
                              const char* SSID, 
                              const char* Password,
                              WIFI_Ecn_t ecn);
 WIFI_Status_t       WIFI_GetIP_Address(uint8_t  *ipaddr);
+WIFI_Status_t       WIFI_CheckConnection(uint8_t  *ipaddr);
 WIFI_Status_t       WIFI_GetMAC_Address(uint8_t  *mac);                             
                              
 WIFI_Status_t       WIFI_Disconnect(void);
@@ -0,0 +1,600 @@
+#ifndef DIAGNOSTICS_SERVICE_H_
+#define DIAGNOSTICS_SERVICE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "events/EventQueue.h"
+#include "platform/Callback.h"
+#include "platform/mbed_stats.h"
+#include "platform/NonCopyable.h"
+#include "rtos/Kernel.h"
+
+#include "ble/BLE.h"
+#include "ble/GattServer.h"
+
+#include "BinaryLog.h"
+#include "EventLane.h"
+#include "EventQueueMonitor.h"
+#include "Metrics.h"
+
+#ifndef MBED_CONF_APP_BLE_MAX_CONNECTIONS
+#define MBED_CONF_APP_BLE_MAX_CONNECTIONS 3
+#endif
+
+#ifndef MBED_CONF_APP_DIAGNOSTICS_PERIOD_MS
+#define MBED_CONF_APP_DIAGNOSTICS_PERIOD_MS 5000
+#endif
+
+/**
+ * GATT service exposing the health of the node, readable from a phone
+ * without the wifi link.
+ *
+ * The snapshot characteristic (read, notify) holds a version (1) and the
+ * sequence number of the snapshot (1), followed by sections: type (1),
+ * length (1), payload. Integers are little endian; sections whose
+ * statistics are compiled out are omitted.
+ *   - SECTION_SYSTEM: uptime in s (4), CPU load since the previous snapshot
+ *     in permille (2), 0xFFFF without platform.cpu-stats-enabled;
+ *   - SECTION_HEAP: current, largest and reserved heap size in bytes (4
+ *     each), allocations failed (4); with platform.heap-stats-enabled;
+ *   - SECTION_LANE, per lane: index (1), stack size (2), stack high-water
+ *     mark (2), 0xFFFF without platform.stack-stats-enabled, high-water mark
+ *     of the event queue depth (1), event latency p50 and p99 (1 each),
+ *     largest event latency in us (4);
+ *   - SECTION_WIFI: module commands failed (4), p50, p90 and p99 of the
+ *     duration of the send, receive and other module commands (1 each);
+ *   - SECTION_UPLINK: bytes sent (4), sends failed (4), records dropped
+ *     (4).
+ * Percentiles are the log2 of the upper bound of their histogram bucket in
+ * us: 32 above the last bucket, 0xFF without sample.
+ *
+ * A read returns the whole snapshot. Notifications are sized to the ATT
+ * MTU of each subscribed connection: they carry the header and the whole
+ * sections that fit, starting after the last section sent on that
+ * connection, so a client at the default MTU receives a snapshot over
+ * successive notifications. Every section fits the default MTU.
+ *
+ * Snapshots are built on the application lane, one section per event, so
+ * gathering the statistics (scanning the stacks for their watermark in
+ * particular) never holds the BLE lane; a snapshot done is handed to the
+ * BLE lane which publishes it. A snapshot is built every
+ * MBED_CONF_APP_DIAGNOSTICS_PERIOD_MS while a client is subscribed, and
+ * after each read so the next one is fresh; with a period of 0 snapshots
+ * are only built after reads.
+ */
+class DiagnosticsService : private mbed::NonCopyable<DiagnosticsService> {
+    typedef DiagnosticsService Self;
+
+public:
+    static const uint8_t VERSION = 1;
+
+    enum section_t {
+        SECTION_SYSTEM = 1,
+        SECTION_HEAP = 2,
+        SECTION_LANE = 3,
+        SECTION_WIFI = 4,
+        SECTION_UPLINK = 5
+    };
+
+    /**
+     * Largest number of lanes reported.
+     */
+    static const size_t MAX_LANES = 4;
+
+    static const size_t HEADER_SIZE = 2;
+    static const size_t SECTION_HEADER_SIZE = 2;
+
+    static const size_t SYSTEM_SIZE = 6;
+    static const size_t HEAP_SIZE = 16;
+    static const size_t LANE_SIZE = 12;
+    static const size_t WIFI_SIZE = 13;
+    static const size_t UPLINK_SIZE = 12;
+
+    static const size_t MAX_SECTIONS = 4 + MAX_LANES;
+
+    static const size_t MAX_SNAPSHOT_SIZE = HEADER_SIZE +
+        MAX_SECTIONS * SECTION_HEADER_SIZE +
+        SYSTEM_SIZE + HEAP_SIZE + MAX_LANES * LANE_SIZE + WIFI_SIZE + UPLINK_SIZE;
+
+    static const uint16_t DEFAULT_ATT_MTU = 23;
+
+    /**
+     * @param[in] app_queue Queue of the lane building the snapshots.
+     */
+    DiagnosticsService(events::EventQueue &app_queue) :
+        _snapshot_char(
+            "a55efe7a-8bb4-45db-88f8-0763b93b849e",
+            _value, 0, sizeof(_value),
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ |
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY,
+            NULL, 0, true
+        ),
+        _diagnostics_service(
+            /* uuid */ "fcc6cc14-a01e-4e21-b0f8-05c30d9a486c",
+            /* characteristics */ _diagnostics_characteristics,
+            /* numCharacteristics */ sizeof(_diagnostics_characteristics) /
+                                     sizeof(_diagnostics_characteristics[0])
+        ),
+        _app_queue(app_queue),
+        _ble_queue(NULL),
+        _server(NULL),
+        _lane_count(0),
+        _building(false),
+        _subscribed(false),
+        _step(0),
+        _sequence(0),
+        _staging_length(0),
+        _length(0),
+        _section_count(0),
+        _cpu_uptime_us(0),
+        _cpu_sleep_us(0),
+        _snapshots(0),
+        _reads(0),
+        _notifications(0),
+        _att_mtu_source()
+    {
+        memset(_value, 0, sizeof(_value));
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            _connections[i].in_use = false;
+        }
+
+        _diagnostics_characteristics[0] = &_snapshot_char;
+    }
+
+    /**
+     * Report the stack and the event queue of a lane; call before start().
+     */
+    void add_lane(EventLane &lane, const EventQueueMonitor &monitor)
+    {
+        if (_lane_count == MAX_LANES) {
+            return;
+        }
+        _lanes[_lane_count].lane = &lane;
+        _lanes[_lane_count].monitor = &monitor;
+        ++_lane_count;
+    }
+
+    /**
+     * Set the function queried for the ATT MTU of a connection.
+     *
+     * Without it notifications are sized for the default MTU.
+     */
+    void set_att_mtu_source(mbed::Callback<uint16_t(ble::connection_handle_t)> cb)
+    {
+        _att_mtu_source = cb;
+    }
+
+    /**
+     * Register the service in the GattServer.
+     *
+     * This function is meant to be passed to BLEProcess::on_init.
+     */
+    void start(BLE &ble_interface, events::EventQueue &event_queue)
+    {
+        if (_ble_queue) {
+            return;
+        }
+
+        GattServer &server = ble_interface.gattServer();
+        ble_error_t err = server.addService(_diagnostics_service);
+        if (err) {
+            LOG_ERROR(LOG_MODULE_DIAGNOSTICS, "Error %u during diagnostics service registration.\r\n", err);
+            return;
+        }
+
+        server.onDataRead(as_cb(&Self::when_data_read));
+        server.onUpdatesEnabled(as_cb(&Self::when_update_enabled));
+        ble_interface.gap().onConnection(this, &Self::when_connection);
+        ble_interface.gap().onDisconnection(this, &Self::when_disconnection);
+
+        LOG_INFO(LOG_MODULE_DIAGNOSTICS, "diagnostics service registered\r\n");
+        LOG_INFO(LOG_MODULE_DIAGNOSTICS, "service handle: %u\r\n", _diagnostics_service.getHandle());
+        LOG_INFO(LOG_MODULE_DIAGNOSTICS, "\tsnapshot characteristic value handle %u\r\n", _snapshot_char.getValueHandle());
+
+        _server = &server;
+        _ble_queue = &event_queue;
+
+        // the first snapshot is there for the first read
+        request_snapshot();
+        if (MBED_CONF_APP_DIAGNOSTICS_PERIOD_MS) {
+            EventQueueMonitor::call_every(
+                _app_queue,
+                EventQueueMonitor::EVENT_DIAGNOSTICS,
+                MBED_CONF_APP_DIAGNOSTICS_PERIOD_MS,
+                mbed::callback(this, &Self::when_period)
+            );
+        }
+    }
+
+    void print_stats() const
+    {
+        printf(
+            "diagnostics: %lu snapshots of %u bytes, %lu reads, %lu notifications\r\n",
+            (unsigned long) _snapshots,
+            (unsigned) _length,
+            (unsigned long) _reads,
+            (unsigned long) _notifications
+        );
+    }
+
+private:
+    struct lane_t {
+        EventLane *lane;
+        const EventQueueMonitor *monitor;
+    };
+
+    struct connection_t {
+        bool in_use;
+        ble::connection_handle_t handle;
+        size_t next_section;
+    };
+
+    /*
+     * BLE lane
+     */
+
+    void when_connection(const Gap::ConnectionCallbackParams_t *event)
+    {
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            if (!_connections[i].in_use) {
+                _connections[i].in_use = true;
+                _connections[i].handle = event->handle;
+                _connections[i].next_section = 0;
+                return;
+            }
+        }
+    }
+
+    void when_disconnection(const Gap::DisconnectionCallbackParams_t *event)
+    {
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            if (_connections[i].in_use && _connections[i].handle == event->handle) {
+                _connections[i].in_use = false;
+            }
+        }
+    }
+
+    /**
+     * Refresh the snapshot after it has been read.
+     */
+    void when_data_read(const GattReadCallbackParams *e)
+    {
+        if (e->handle != _snapshot_char.getValueHandle()) {
+            return;
+        }
+        ++_reads;
+        request_snapshot();
+    }
+
+    void when_update_enabled(GattAttribute::Handle_t handle)
+    {
+        if (handle != _snapshot_char.getValueHandle()) {
+            return;
+        }
+        _subscribed = true;
+        request_snapshot();
+    }
+
+    void request_snapshot()
+    {
+        EventQueueMonitor::call(
+            _app_queue,
+            EventQueueMonitor::EVENT_DIAGNOSTICS,
+            mbed::callback(this, &Self::begin_snapshot)
+        );
+    }
+
+    /**
+     * Publish the snapshot built and notify the subscribed connections.
+     */
+    void publish()
+    {
+        memcpy(_value, _staging, _staging_length);
+        _length = _staging_length;
+        _building = false;
+        ++_snapshots;
+
+        _section_count = 0;
+        for (size_t offset = HEADER_SIZE;
+             offset + SECTION_HEADER_SIZE <= _length && _section_count < MAX_SECTIONS;
+             offset += SECTION_HEADER_SIZE + _value[offset + 1]) {
+            _section_offsets[_section_count++] = offset;
+        }
+
+        bool subscribed = false;
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            connection_t &connection = _connections[i];
+            bool enabled = false;
+            if (!connection.in_use ||
+                _server->areUpdatesEnabled(connection.handle, _snapshot_char, &enabled) ||
+                !enabled) {
+                continue;
+            }
+            subscribed = true;
+            notify(connection);
+        }
+        _subscribed = subscribed;
+
+        // notifications rewrite the value; reads get the whole snapshot
+        _server->write(_snapshot_char.getValueHandle(), _value, _length, true);
+    }
+
+    /**
+     * Notify a connection with the sections that fit its ATT MTU.
+     */
+    void notify(connection_t &connection)
+    {
+        if (!_section_count) {
+            return;
+        }
+
+        uint16_t att_mtu = DEFAULT_ATT_MTU;
+        if (_att_mtu_source) {
+            att_mtu = _att_mtu_source(connection.handle);
+        }
+        const size_t capacity = att_mtu - 3;
+
+        memcpy(_notification, _value, HEADER_SIZE);
+        size_t length = HEADER_SIZE;
+        size_t section = connection.next_section % _section_count;
+        for (size_t sent = 0; sent < _section_count; ++sent) {
+            size_t size = section_size(section);
+            if (length + size > capacity) {
+                break;
+            }
+            memcpy(_notification + length, _value + _section_offsets[section], size);
+            length += size;
+            section = (section + 1) % _section_count;
+        }
+        connection.next_section = section;
+
+        ble_error_t err = _server->write(
+            connection.handle, _snapshot_char.getValueHandle(), _notification, length
+        );
+        if (!err) {
+            ++_notifications;
+        }
+    }
+
+    size_t section_size(size_t section) const
+    {
+        return SECTION_HEADER_SIZE + _value[_section_offsets[section] + 1];
+    }
+
+    /*
+     * Application lane
+     */
+
+    void when_period()
+    {
+        if (_subscribed) {
+            begin_snapshot();
+        }
+    }
+
+    void begin_snapshot()
+    {
+        // the previous snapshot is still being built or handed over
+        if (_building) {
+            return;
+        }
+        _building = true;
+        _staging[0] = VERSION;
+        _staging[1] = _sequence++;
+        _staging_length = HEADER_SIZE;
+        _step = 0;
+        build_step();
+    }
+
+    /**
+     * Append the next section, then yield to the other events of the lane.
+     */
+    void build_step()
+    {
+        const size_t lane_steps_end = 2 + _lane_count;
+        if (_step == 0) {
+            write_system();
+        } else if (_step == 1) {
+            write_heap();
+        } else if (_step < lane_steps_end) {
+            write_lane(_step - 2);
+        } else if (_step == lane_steps_end) {
+            write_wifi();
+        } else {
+            write_uplink();
+        }
+        ++_step;
+
+        int id;
+        if (_step <= lane_steps_end + 1) {
+            id = EventQueueMonitor::call(
+                _app_queue,
+                EventQueueMonitor::EVENT_DIAGNOSTICS,
+                mbed::callback(this, &Self::build_step)
+            );
+        } else {
+            id = EventQueueMonitor::call(
+                *_ble_queue,
+                EventQueueMonitor::EVENT_DIAGNOSTICS,
+                mbed::callback(this, &Self::publish)
+            );
+        }
+        if (!id) {
+            _building = false;
+        }
+    }
+
+    void write_system()
+    {
+        uint16_t load = UINT16_MAX;
+#if defined(MBED_CPU_STATS_ENABLED)
+        mbed_stats_cpu_t cpu;
+        mbed_stats_cpu_get(&cpu);
+        uint64_t uptime_us = cpu.uptime - _cpu_uptime_us;
+        uint64_t sleep_us = cpu.sleep_time - _cpu_sleep_us;
+        _cpu_uptime_us = cpu.uptime;
+        _cpu_sleep_us = cpu.sleep_time;
+        load = uptime_us ? (uint16_t)((uptime_us - sleep_us) * 1000 / uptime_us) : 0;
+#endif
+
+        uint8_t *p = begin_section(SECTION_SYSTEM, SYSTEM_SIZE);
+        p = write_le32(p, (uint32_t)(rtos::Kernel::get_ms_count() / 1000));
+        write_le16(p, load);
+    }
+
+    void write_heap()
+    {
+#if defined(MBED_HEAP_STATS_ENABLED)
+        mbed_stats_heap_t heap;
+        mbed_stats_heap_get(&heap);
+
+        uint8_t *p = begin_section(SECTION_HEAP, HEAP_SIZE);
+        p = write_le32(p, heap.current_size);
+        p = write_le32(p, heap.max_size);
+        p = write_le32(p, heap.reserved_size);
+        write_le32(p, heap.alloc_fail_cnt);
+#endif
+    }
+
+    void write_lane(size_t index)
+    {
+        const lane_t &lane = _lanes[index];
+        uint32_t max_stack = UINT16_MAX;
+#if defined(MBED_STACK_STATS_ENABLED)
+        max_stack = lane.lane->max_stack();
+#endif
+        uint32_t depth = lane.monitor->depth_high_water_mark();
+
+        uint8_t *p = begin_section(SECTION_LANE, LANE_SIZE);
+        *p++ = index;
+        p = write_le16(p, lane.lane->stack_size());
+        p = write_le16(p, max_stack);
+        *p++ = depth > UINT8_MAX ? UINT8_MAX : depth;
+        *p++ = encode_bound(lane.monitor->latency_percentile(50));
+        *p++ = encode_bound(lane.monitor->latency_percentile(99));
+        write_le32(p, lane.monitor->latency_max());
+    }
+
+    void write_wifi()
+    {
+        static const Metrics::histogram_t histograms[] = {
+            Metrics::HISTOGRAM_WIFI_SEND_US,
+            Metrics::HISTOGRAM_WIFI_RECEIVE_US,
+            Metrics::HISTOGRAM_WIFI_CONTROL_US
+        };
+
+        uint8_t *p = begin_section(SECTION_WIFI, WIFI_SIZE);
+        p = write_le32(p, Metrics::counter(Metrics::COUNTER_WIFI_ERRORS));
+        for (size_t i = 0; i < sizeof(histograms) / sizeof(histograms[0]); ++i) {
+            *p++ = encode_bound(Metrics::percentile(histograms[i], 50));
+            *p++ = encode_bound(Metrics::percentile(histograms[i], 90));
+            *p++ = encode_bound(Metrics::percentile(histograms[i], 99));
+        }
+    }
+
+    void write_uplink()
+    {
+        uint8_t *p = begin_section(SECTION_UPLINK, UPLINK_SIZE);
+        p = write_le32(p, Metrics::counter(Metrics::COUNTER_UPLINK_BYTES_SENT));
+        p = write_le32(p, Metrics::counter(Metrics::COUNTER_UPLINK_SEND_ERRORS));
+        write_le32(p, Metrics::counter(Metrics::COUNTER_UPLINK_RECORDS_DROPPED));
+    }
+
+    /**
+     * Append the header of a section to the snapshot and return where its
+     * payload goes.
+     */
+    uint8_t *begin_section(uint8_t type, size_t length)
+    {
+        uint8_t *p = _staging + _staging_length;
+        p[0] = type;
+        p[1] = length;
+        _staging_length += SECTION_HEADER_SIZE + length;
+        return p + SECTION_HEADER_SIZE;
+    }
+
+    /**
+     * Encode the upper bound of a histogram bucket, a power of two, as its
+     * log2.
+     */
+    static uint8_t encode_bound(uint32_t bound)
+    {
+        if (!bound) {
+            return UINT8_MAX;
+        }
+        if (bound == UINT32_MAX) {
+            return 32;
+        }
+        return __builtin_ctz(bound);
+    }
+
+    static uint8_t *write_le16(uint8_t *dst, uint16_t value)
+    {
+        dst[0] = value;
+        dst[1] = value >> 8;
+        return dst + 2;
+    }
+
+    static uint8_t *write_le32(uint8_t *dst, uint32_t value)
+    {
+        dst[0] = value;
+        dst[1] = value >> 8;
+        dst[2] = value >> 16;
+        dst[3] = value >> 24;
+        return dst + 4;
+    }
+
+    /**
+     * Helper that construct an event handler from a member function of this
+     * instance.
+     */
+    template<typename Arg>
+    FunctionPointerWithContext<Arg> as_cb(void (Self::*member)(Arg))
+    {
+        return makeFunctionPointer(this, member);
+    }
+
+    uint8_t _value[MAX_SNAPSHOT_SIZE];
+
+    GattCharacteristic _snapshot_char;
+
+    // list of the characteristics of the diagnostics service
+    GattCharacteristic* _diagnostics_characteristics[1];
+
+    GattService _diagnostics_service;
+
+    events::EventQueue &_app_queue;
+    events::EventQueue *_ble_queue;
+    GattServer* _server;
+
+    lane_t _lanes[MAX_LANES];
+    size_t _lane_count;
+
+    // snapshot being built on the application lane
+    volatile bool _building;
+    volatile bool _subscribed;
+    size_t _step;
+    uint8_t _sequence;
+    uint8_t _staging[MAX_SNAPSHOT_SIZE];
+    size_t _staging_length;
+
+    // snapshot published, on the BLE lane
+    uint16_t _length;
+    size_t _section_offsets[MAX_SECTIONS];
+    size_t _section_count;
+    uint8_t _notification[MAX_SNAPSHOT_SIZE];
+    connection_t _connections[MBED_CONF_APP_BLE_MAX_CONNECTIONS];
+
+    uint64_t _cpu_uptime_us;
+    uint64_t _cpu_sleep_us;
+
+    uint32_t _snapshots;
+    uint32_t _reads;
+    uint32_t _notifications;
+    mbed::Callback<uint16_t(ble::connection_handle_t)> _att_mtu_source;
+};
+
+#endif /* DIAGNOSTICS_SERVICE_H_ */
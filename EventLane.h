@@ -0,0 +1,117 @@
+#ifndef EVENT_LANE_H_
+#define EVENT_LANE_H_
+
+#include <stdint.h>
+
+#include "events/EventQueue.h"
+#include "platform/Callback.h"
+#include "platform/NonCopyable.h"
+#include "rtos/Thread.h"
+
+#include "BinaryLog.h"
+
+#ifndef MBED_CONF_APP_BLE_LANE_PRIORITY
+#define MBED_CONF_APP_BLE_LANE_PRIORITY osPriorityHigh
+#endif
+
+#ifndef MBED_CONF_APP_BLE_LANE_STACK_SIZE
+#define MBED_CONF_APP_BLE_LANE_STACK_SIZE 4096
+#endif
+
+#ifndef MBED_CONF_APP_APP_LANE_PRIORITY
+#define MBED_CONF_APP_APP_LANE_PRIORITY osPriorityNormal
+#endif
+
+#ifndef MBED_CONF_APP_APP_LANE_STACK_SIZE
+#define MBED_CONF_APP_APP_LANE_STACK_SIZE 2048
+#endif
+
+#ifndef MBED_CONF_APP_WIFI_LANE_PRIORITY
+#define MBED_CONF_APP_WIFI_LANE_PRIORITY osPriorityBelowNormal
+#endif
+
+#ifndef MBED_CONF_APP_WIFI_LANE_STACK_SIZE
+#define MBED_CONF_APP_WIFI_LANE_STACK_SIZE 2048
+#endif
+
+/**
+ * Event queue dispatched forever by its own RTOS thread.
+ *
+ * The application runs three lanes:
+ *   - ble: the BLE stack and every module calling the BLE API; the API is
+ *     not thread safe so BLE calls never leave this lane;
+ *   - app: application work that does not touch the BLE API, such as
+ *     statistics reports;
+ *   - wifi: blocking operations on the wifi module.
+ * Work crosses lanes only by posting an event on the queue of the target
+ * lane; data handed over must stay valid until the event runs.
+ */
+class EventLane : private mbed::NonCopyable<EventLane> {
+public:
+    /**
+     * Construct a lane; its thread is started by start().
+     *
+     * @param[in] name Name of the thread.
+     * @param[in] priority Priority of the thread.
+     * @param[in] stack_size Stack size of the thread.
+     */
+    EventLane(const char *name, osPriority priority, uint32_t stack_size) :
+        _name(name),
+        _thread(priority, stack_size, NULL, name)
+    {
+    }
+
+    events::EventQueue &queue()
+    {
+        return _queue;
+    }
+
+    /**
+     * Stack size of the lane thread, in bytes.
+     */
+    uint32_t stack_size() const
+    {
+        return _thread.stack_size();
+    }
+
+    /**
+     * Largest stack usage of the lane thread so far, in bytes; only
+     * meaningful with the stack statistics (platform.stack-stats-enabled),
+     * which fill the stacks with a watermark.
+     */
+    uint32_t max_stack() const
+    {
+        return _thread.max_stack();
+    }
+
+    /**
+     * Start dispatching the queue.
+     */
+    bool start()
+    {
+        osStatus status = _thread.start(
+            mbed::callback(&_queue, &events::EventQueue::dispatch_forever)
+        );
+
+        if (status != osOK) {
+            LOG_ERROR(LOG_MODULE_MAIN, "Error %d while starting the %s lane.\r\n", status, _name);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Wait for the lane thread; lanes run forever.
+     */
+    void join()
+    {
+        _thread.join();
+    }
+
+private:
+    const char *_name;
+    events::EventQueue _queue;
+    rtos::Thread _thread;
+};
+
+#endif /* EVENT_LANE_H_ */
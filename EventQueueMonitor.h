@@ -0,0 +1,505 @@
+#ifndef EVENT_QUEUE_MONITOR_H_
+#define EVENT_QUEUE_MONITOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "events/EventQueue.h"
+#include "hal/us_ticker_api.h"
+#include "platform/Callback.h"
+#include "platform/mbed_critical.h"
+#include "platform/NonCopyable.h"
+
+#ifndef MBED_CONF_APP_QUEUE_MONITOR_MAX_PERIODIC
+#define MBED_CONF_APP_QUEUE_MONITOR_MAX_PERIODIC 8
+#endif
+
+/**
+ * Instrumentation of an event queue.
+ *
+ * Events posted through the monitor are wrapped in a trampoline that
+ * measures, per category of event:
+ *   - the latency between the time the event was due (posted, or scheduled
+ *     for delayed and periodic events) and the start of its dispatch;
+ *   - its run time.
+ * Both are accumulated in histograms with power of two buckets in
+ * microseconds. The monitor also tracks the number of one-shot events
+ * pending in the queue, its high-water mark and the posts that failed
+ * because the queue memory was exhausted.
+ *
+ * Modules post through the static helpers with the queue they were given;
+ * if no monitor is attached to that queue the event is posted as is.
+ */
+class EventQueueMonitor : private mbed::NonCopyable<EventQueueMonitor> {
+    typedef EventQueueMonitor Self;
+
+public:
+    enum category_t {
+        EVENT_BLE_STACK,
+        EVENT_CLOCK_TICK,
+        EVENT_BROADCAST,
+        EVENT_BULK_PUMP,
+        EVENT_CONNECTION_POLICY,
+        EVENT_GATEWAY,
+        EVENT_POLLER,
+        EVENT_SCHEDULER,
+        EVENT_ADVERTISING,
+        EVENT_UPLINK,
+        EVENT_LINK,
+        EVENT_DIAGNOSTICS,
+        EVENT_OTHER,
+        EVENT_CATEGORY_COUNT
+    };
+
+    /**
+     * Bucket i counts durations in [2^(i-1), 2^i) us; bucket 0 counts
+     * durations under 1 us and the last bucket everything above.
+     */
+    static const size_t HISTOGRAM_BUCKETS = 20;
+
+    struct category_stats_t {
+        uint32_t dispatched;
+        uint32_t latency_max_us;
+        uint32_t run_time_max_us;
+        uint64_t latency_total_us;
+        uint64_t run_time_total_us;
+        uint32_t latency[HISTOGRAM_BUCKETS];
+        uint32_t run_time[HISTOGRAM_BUCKETS];
+    };
+
+    EventQueueMonitor(events::EventQueue &event_queue) :
+        _event_queue(event_queue),
+        _depth(0),
+        _depth_high_water_mark(0),
+        _post_failures(0)
+    {
+        memset(_stats, 0, sizeof(_stats));
+        for (size_t i = 0; i < MBED_CONF_APP_QUEUE_MONITOR_MAX_PERIODIC; ++i) {
+            _periodic[i].id = 0;
+        }
+        attach(this);
+    }
+
+    ~EventQueueMonitor()
+    {
+        detach(this);
+    }
+
+    /**
+     * Post a one-shot event on a queue.
+     *
+     * @return The id of the event or 0 if the queue memory is exhausted.
+     */
+    static int call(
+        events::EventQueue &event_queue, category_t category, mbed::Callback<void()> cb
+    ) {
+        return call_in(event_queue, category, 0, cb);
+    }
+
+    /**
+     * Post a one-shot event dispatched after a delay.
+     */
+    static int call_in(
+        events::EventQueue &event_queue, category_t category, int ms, mbed::Callback<void()> cb
+    ) {
+        Self *monitor = find(event_queue);
+        if (!monitor) {
+            return event_queue.call_in(ms, cb);
+        }
+        return monitor->post(category, ms, cb);
+    }
+
+    /**
+     * Post a periodic event on a queue.
+     *
+     * Periodic events posted through the monitor must be cancelled with
+     * EventQueueMonitor::cancel.
+     */
+    static int call_every(
+        events::EventQueue &event_queue, category_t category, int ms, mbed::Callback<void()> cb
+    ) {
+        Self *monitor = find(event_queue);
+        if (!monitor) {
+            return event_queue.call_every(ms, cb);
+        }
+        return monitor->post_periodic(category, ms, cb);
+    }
+
+    /**
+     * Cancel an event posted through the monitor.
+     *
+     * One-shot events must only be cancelled while they are pending, from
+     * the thread dispatching the queue.
+     */
+    static void cancel(events::EventQueue &event_queue, int id)
+    {
+        event_queue.cancel(id);
+
+        Self *monitor = find(event_queue);
+        if (!monitor) {
+            return;
+        }
+
+        for (size_t i = 0; i < MBED_CONF_APP_QUEUE_MONITOR_MAX_PERIODIC; ++i) {
+            if (monitor->_periodic[i].id == id) {
+                monitor->_periodic[i].id = 0;
+                return;
+            }
+        }
+
+        core_util_atomic_decr_u32(&monitor->_depth, 1);
+    }
+
+    /**
+     * Run a job multiplexed on an event of the queue, such as the periodic
+     * jobs of a PowerManager, and account it in its own category.
+     *
+     * @param[in] due_us Due date of the job on the us ticker.
+     */
+    static void run_job(
+        events::EventQueue &event_queue, category_t category, uint32_t due_us,
+        const mbed::Callback<void()> &cb
+    ) {
+        Self *monitor = find(event_queue);
+        if (!monitor) {
+            cb();
+            return;
+        }
+        monitor->run(category, due_us, cb);
+    }
+
+    const category_stats_t &stats(category_t category) const
+    {
+        return _stats[category];
+    }
+
+    /**
+     * Number of one-shot events posted and neither dispatched nor
+     * cancelled yet.
+     */
+    uint32_t depth() const
+    {
+        return core_util_atomic_load_u32(&_depth);
+    }
+
+    uint32_t depth_high_water_mark() const
+    {
+        return core_util_atomic_load_u32(&_depth_high_water_mark);
+    }
+
+    uint32_t post_failures() const
+    {
+        return core_util_atomic_load_u32(&_post_failures);
+    }
+
+    /**
+     * Upper bound of the histogram bucket holding the given percentile of
+     * the latencies of every category, in us; 0 if nothing was dispatched.
+     */
+    uint32_t latency_percentile(uint32_t percent) const
+    {
+        uint32_t latency[HISTOGRAM_BUCKETS] = { 0 };
+        uint64_t count = 0;
+        for (size_t c = 0; c < EVENT_CATEGORY_COUNT; ++c) {
+            for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+                latency[i] += _stats[c].latency[i];
+                count += _stats[c].latency[i];
+            }
+        }
+        if (!count) {
+            return 0;
+        }
+
+        uint64_t rank = (count * percent + 99) / 100;
+        uint64_t seen = 0;
+        size_t i = 0;
+        while (i < HISTOGRAM_BUCKETS - 1) {
+            seen += latency[i];
+            if (seen >= rank) {
+                break;
+            }
+            ++i;
+        }
+        return i < HISTOGRAM_BUCKETS - 1 ? (uint32_t) 1 << i : UINT32_MAX;
+    }
+
+    /**
+     * Largest latency of every category, in us.
+     */
+    uint32_t latency_max() const
+    {
+        uint32_t max_us = 0;
+        for (size_t c = 0; c < EVENT_CATEGORY_COUNT; ++c) {
+            if (_stats[c].latency_max_us > max_us) {
+                max_us = _stats[c].latency_max_us;
+            }
+        }
+        return max_us;
+    }
+
+    void reset()
+    {
+        core_util_critical_section_enter();
+        memset(_stats, 0, sizeof(_stats));
+        _depth_high_water_mark = _depth;
+        _post_failures = 0;
+        core_util_critical_section_exit();
+    }
+
+    /**
+     * Print the statistics of every category dispatched.
+     */
+    void print_stats() const
+    {
+        printf(
+            "event queue: depth %lu, high-water mark %lu, %lu posts failed\r\n",
+            (unsigned long) depth(),
+            (unsigned long) depth_high_water_mark(),
+            (unsigned long) post_failures()
+        );
+
+        for (size_t c = 0; c < EVENT_CATEGORY_COUNT; ++c) {
+            const category_stats_t &s = _stats[c];
+            if (!s.dispatched) {
+                continue;
+            }
+
+            printf(
+                "\t%s: %lu events, latency mean %lu max %lu us, run time mean %lu max %lu us\r\n",
+                category_name(c),
+                (unsigned long) s.dispatched,
+                (unsigned long)(s.latency_total_us / s.dispatched),
+                (unsigned long) s.latency_max_us,
+                (unsigned long)(s.run_time_total_us / s.dispatched),
+                (unsigned long) s.run_time_max_us
+            );
+            print_histogram("\t\tlatency", s.latency);
+            print_histogram("\t\trun time", s.run_time);
+        }
+    }
+
+    /**
+     * Export the statistics in a binary form.
+     *
+     * Layout (little endian): depth (4), high-water mark (4), post failures
+     * (4), then per category: dispatched (4), latency max (4), run time max
+     * (4), latency histogram (4 per bucket), run time histogram (4 per
+     * bucket).
+     *
+     * @return The number of bytes written or 0 if the buffer is too small.
+     */
+    size_t encode(uint8_t *buffer, size_t size) const
+    {
+        if (size < ENCODED_SIZE) {
+            return 0;
+        }
+
+        uint8_t *p = buffer;
+        p = write_le32(p, depth());
+        p = write_le32(p, depth_high_water_mark());
+        p = write_le32(p, post_failures());
+        for (size_t c = 0; c < EVENT_CATEGORY_COUNT; ++c) {
+            const category_stats_t &s = _stats[c];
+            p = write_le32(p, s.dispatched);
+            p = write_le32(p, s.latency_max_us);
+            p = write_le32(p, s.run_time_max_us);
+            for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+                p = write_le32(p, s.latency[i]);
+            }
+            for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+                p = write_le32(p, s.run_time[i]);
+            }
+        }
+        return p - buffer;
+    }
+
+    static const size_t ENCODED_SIZE =
+        12 + EVENT_CATEGORY_COUNT * (12 + 8 * HISTOGRAM_BUCKETS);
+
+private:
+    struct periodic_t {
+        int id;
+        uint8_t category;
+        uint32_t period_us;
+        uint32_t due_us;
+        mbed::Callback<void()> cb;
+    };
+
+    static const size_t MAX_QUEUES = 4;
+
+    static Self **registry()
+    {
+        static Self *monitors[MAX_QUEUES] = { NULL };
+        return monitors;
+    }
+
+    static void attach(Self *monitor)
+    {
+        Self **monitors = registry();
+        for (size_t i = 0; i < MAX_QUEUES; ++i) {
+            if (!monitors[i]) {
+                monitors[i] = monitor;
+                return;
+            }
+        }
+    }
+
+    static void detach(Self *monitor)
+    {
+        Self **monitors = registry();
+        for (size_t i = 0; i < MAX_QUEUES; ++i) {
+            if (monitors[i] == monitor) {
+                monitors[i] = NULL;
+            }
+        }
+    }
+
+    static Self *find(events::EventQueue &event_queue)
+    {
+        Self **monitors = registry();
+        for (size_t i = 0; i < MAX_QUEUES; ++i) {
+            if (monitors[i] && &monitors[i]->_event_queue == &event_queue) {
+                return monitors[i];
+            }
+        }
+        return NULL;
+    }
+
+    /**
+     * Post a one-shot event; may be called from interrupt context.
+     */
+    int post(category_t category, int ms, mbed::Callback<void()> cb)
+    {
+        uint32_t depth = core_util_atomic_incr_u32(&_depth, 1);
+        uint32_t high_water_mark = core_util_atomic_load_u32(&_depth_high_water_mark);
+        while (depth > high_water_mark &&
+               !core_util_atomic_cas_u32(&_depth_high_water_mark, &high_water_mark, depth)) {
+        }
+
+        uint32_t due_us = us_ticker_read() + ms * 1000;
+        int id = _event_queue.call_in(
+            ms, this, &Self::dispatch, (uint8_t) category, due_us, cb
+        );
+
+        if (!id) {
+            core_util_atomic_decr_u32(&_depth, 1);
+            core_util_atomic_incr_u32(&_post_failures, 1);
+        }
+        return id;
+    }
+
+    int post_periodic(category_t category, int ms, mbed::Callback<void()> cb)
+    {
+        for (size_t i = 0; i < MBED_CONF_APP_QUEUE_MONITOR_MAX_PERIODIC; ++i) {
+            periodic_t &periodic = _periodic[i];
+            if (periodic.id) {
+                continue;
+            }
+
+            periodic.category = category;
+            periodic.period_us = ms * 1000;
+            periodic.due_us = us_ticker_read() + periodic.period_us;
+            periodic.cb = cb;
+            periodic.id = _event_queue.call_every(ms, this, &Self::dispatch_periodic, i);
+            if (!periodic.id) {
+                core_util_atomic_incr_u32(&_post_failures, 1);
+            }
+            return periodic.id;
+        }
+
+        // no slot left: post without instrumentation
+        return _event_queue.call_every(ms, cb);
+    }
+
+    void dispatch(uint8_t category, uint32_t due_us, mbed::Callback<void()> cb)
+    {
+        core_util_atomic_decr_u32(&_depth, 1);
+        run(category, due_us, cb);
+    }
+
+    void dispatch_periodic(size_t index)
+    {
+        periodic_t &periodic = _periodic[index];
+        uint32_t due_us = periodic.due_us;
+        periodic.due_us += periodic.period_us;
+        run(periodic.category, due_us, periodic.cb);
+    }
+
+    void run(uint8_t category, uint32_t due_us, const mbed::Callback<void()> &cb)
+    {
+        uint32_t start_us = us_ticker_read();
+        cb();
+        uint32_t end_us = us_ticker_read();
+
+        // events dispatched early by the tick granularity have no latency
+        int32_t latency_us = (int32_t)(start_us - due_us);
+        if (latency_us < 0) {
+            latency_us = 0;
+        }
+        uint32_t run_time_us = end_us - start_us;
+
+        category_stats_t &s = _stats[category];
+        ++s.dispatched;
+        s.latency_total_us += latency_us;
+        s.run_time_total_us += run_time_us;
+        if ((uint32_t) latency_us > s.latency_max_us) {
+            s.latency_max_us = latency_us;
+        }
+        if (run_time_us > s.run_time_max_us) {
+            s.run_time_max_us = run_time_us;
+        }
+        ++s.latency[bucket(latency_us)];
+        ++s.run_time[bucket(run_time_us)];
+    }
+
+    static size_t bucket(uint32_t us)
+    {
+        size_t i = 0;
+        while (us && i < HISTOGRAM_BUCKETS - 1) {
+            us >>= 1;
+            ++i;
+        }
+        return i;
+    }
+
+    static void print_histogram(const char *name, const uint32_t (&histogram)[HISTOGRAM_BUCKETS])
+    {
+        printf("%s:", name);
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+            if (histogram[i]) {
+                printf(" <%luus:%lu", (unsigned long)(1UL << i), (unsigned long) histogram[i]);
+            }
+        }
+        printf("\r\n");
+    }
+
+    static uint8_t *write_le32(uint8_t *dst, uint32_t value)
+    {
+        dst[0] = value;
+        dst[1] = value >> 8;
+        dst[2] = value >> 16;
+        dst[3] = value >> 24;
+        return dst + 4;
+    }
+
+    static const char *category_name(size_t category)
+    {
+        static const char *const names[EVENT_CATEGORY_COUNT] = {
+            "ble stack", "clock tick", "broadcast", "bulk pump",
+            "connection policy", "gateway", "poller", "scheduler", "advertising", "uplink",
+            "link", "diagnostics", "other"
+        };
+        return names[category];
+    }
+
+    events::EventQueue &_event_queue;
+    volatile uint32_t _depth;
+    volatile uint32_t _depth_high_water_mark;
+    volatile uint32_t _post_failures;
+    category_stats_t _stats[EVENT_CATEGORY_COUNT];
+    periodic_t _periodic[MBED_CONF_APP_QUEUE_MONITOR_MAX_PERIODIC];
+};
+
+#endif /* EVENT_QUEUE_MONITOR_H_ */
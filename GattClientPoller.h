@@ -0,0 +1,682 @@
+#ifndef GATT_CLIENT_POLLER_H_
+#define GATT_CLIENT_POLLER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "events/EventQueue.h"
+#include "platform/Callback.h"
+#include "platform/NonCopyable.h"
+#include "rtos/Kernel.h"
+
+#include "ble/BLE.h"
+#include "ble/Gap.h"
+#include "ble/GattClient.h"
+#include "ble/DiscoveredCharacteristic.h"
+#include "ble/DiscoveredCharacteristicDescriptor.h"
+
+#include "BinaryLog.h"
+#include "EventQueueMonitor.h"
+#include "Uplink.h"
+#include "UplinkFrame.h"
+
+#ifndef MBED_CONF_APP_POLLER_MAX_PEERS
+#define MBED_CONF_APP_POLLER_MAX_PEERS 4
+#endif
+
+#ifndef MBED_CONF_APP_POLLER_MAX_CONNECTIONS
+#define MBED_CONF_APP_POLLER_MAX_CONNECTIONS 2
+#endif
+
+#ifndef MBED_CONF_APP_BLE_CONNECTION_BUDGET
+#define MBED_CONF_APP_BLE_CONNECTION_BUDGET 3
+#endif
+
+#ifndef MBED_CONF_APP_POLLER_READ_PERIOD_MS
+#define MBED_CONF_APP_POLLER_READ_PERIOD_MS 10000
+#endif
+
+#ifndef MBED_CONF_APP_POLLER_KEEP_CONNECTED_MS
+#define MBED_CONF_APP_POLLER_KEEP_CONNECTED_MS 2000
+#endif
+
+#ifndef MBED_CONF_APP_POLLER_CONNECT_TIMEOUT_MS
+#define MBED_CONF_APP_POLLER_CONNECT_TIMEOUT_MS 3000
+#endif
+
+/**
+ * Central role engine pulling a characteristic from a list of known
+ * peripherals.
+ *
+ * For each peer the engine connects, discovers the service and the
+ * characteristic once, caches their handles and then either reads the
+ * value or subscribes to its notifications. Later connections reuse the
+ * cached handles and skip discovery, the dominant cost of a short session.
+ *
+ * Peers are served earliest deadline first, one connection attempt at a
+ * time. Peers read more often than MBED_CONF_APP_POLLER_KEEP_CONNECTED_MS
+ * and subscribed peers stay connected; the others are disconnected after
+ * each read to free a connection slot.
+ *
+ * The stack holds MBED_CONF_APP_BLE_CONNECTION_BUDGET links in both roles;
+ * a new link is only opened while the links reported by the source set
+ * with set_link_count_source() leave room for it.
+ *
+ * Samples are forwarded to the uplink as RECORD_POLL_SAMPLE records.
+ */
+class GattClientPoller : private mbed::NonCopyable<GattClientPoller> {
+    typedef GattClientPoller Self;
+
+public:
+    enum peer_state_t {
+        PEER_IDLE,
+        PEER_CONNECTING,
+        PEER_DISCOVERING,
+        PEER_READING,
+        PEER_CONNECTED,
+        PEER_DISCONNECTING
+    };
+
+    struct peer_t {
+        ble::peer_address_type_t address_type;
+        BLEProtocol::AddressBytes_t address;
+        bool subscribe;
+        uint32_t period_ms;
+        peer_state_t state;
+        ble::connection_handle_t connection;
+        uint64_t next_due_ms;
+        /* handles cached across connections */
+        bool cached;
+        GattAttribute::Handle_t value_handle;
+        GattAttribute::Handle_t cccd_handle;
+        DiscoveredCharacteristic characteristic;
+        uint32_t samples;
+        uint32_t connections;
+        uint32_t discoveries;
+        uint32_t failures;
+    };
+
+    /**
+     * @param[in] uplink Uplink to the collector.
+     * @param[in] service_uuid UUID of the service holding the value.
+     * @param[in] characteristic_uuid UUID of the polled characteristic.
+     */
+    GattClientPoller(Uplink &uplink, const UUID &service_uuid, const UUID &characteristic_uuid) :
+        _uplink(uplink),
+        _service_uuid(service_uuid),
+        _characteristic_uuid(characteristic_uuid),
+        _ble(NULL),
+        _event_queue(NULL),
+        _peer_count(0),
+        _connecting(NULL),
+        _discovering(NULL),
+        _connect_timeout_id(0),
+        _start_ms(0),
+        _samples(0),
+        _cache_hits(0),
+        _unexpected_connections(0)
+    {
+    }
+
+    /**
+     * Add a peripheral to poll.
+     *
+     * @param[in] address_type Type of the address of the peer.
+     * @param[in] address Address of the peer, least significant byte first.
+     * @param[in] subscribe Subscribe to notifications instead of reading.
+     * @param[in] period_ms Read period; ignored for subscriptions.
+     *
+     * @return false if the peer table is full.
+     */
+    bool add_peer(
+        ble::peer_address_type_t address_type,
+        const BLEProtocol::AddressBytes_t address,
+        bool subscribe,
+        uint32_t period_ms = MBED_CONF_APP_POLLER_READ_PERIOD_MS
+    ) {
+        if (_peer_count == MBED_CONF_APP_POLLER_MAX_PEERS) {
+            return false;
+        }
+
+        peer_t &peer = _peers[_peer_count++];
+        peer.address_type = address_type;
+        memcpy(peer.address, address, sizeof(peer.address));
+        peer.subscribe = subscribe;
+        peer.period_ms = period_ms;
+        peer.state = PEER_IDLE;
+        peer.connection = 0;
+        peer.next_due_ms = 0;
+        peer.cached = false;
+        peer.value_handle = 0;
+        peer.cccd_handle = 0;
+        peer.samples = 0;
+        peer.connections = 0;
+        peer.discoveries = 0;
+        peer.failures = 0;
+        return true;
+    }
+
+    /**
+     * Add the peers listed in a string of comma separated addresses written
+     * most significant byte first ("C0:11:22:33:44:55,D0:...").
+     *
+     * @return The number of peers added.
+     */
+    size_t add_peers(
+        const char *addresses, ble::peer_address_type_t address_type, bool subscribe
+    ) {
+        size_t added = 0;
+        const char *p = addresses;
+
+        while (*p) {
+            BLEProtocol::AddressBytes_t address;
+            size_t i = 0;
+            for (; i < sizeof(address); ++i) {
+                char *end = NULL;
+                unsigned long byte = strtoul(p, &end, 16);
+                if (end == p || byte > 0xFF) {
+                    break;
+                }
+                address[sizeof(address) - 1 - i] = byte;
+                p = end;
+                if (*p == ':') {
+                    ++p;
+                }
+            }
+
+            if (i == sizeof(address) && add_peer(address_type, address, subscribe)) {
+                ++added;
+            }
+
+            while (*p && *p != ',') {
+                ++p;
+            }
+            if (*p == ',') {
+                ++p;
+            }
+        }
+
+        return added;
+    }
+
+    /**
+     * Subscription to the values pulled from the peers.
+     *
+     * @param[in] cb Callback invoked with the index of the peer and the value.
+     */
+    void on_sample(mbed::Callback<void(size_t, const uint8_t*, uint16_t)> cb)
+    {
+        _sample_cb = cb;
+    }
+
+    /**
+     * Set the source of the number of links held or reserved outside of
+     * the poller, by the peripheral role.
+     */
+    void set_link_count_source(mbed::Callback<size_t()> cb)
+    {
+        _link_count_source = cb;
+    }
+
+    /**
+     * Number of links opened or being opened by the poller.
+     */
+    size_t link_count() const
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < _peer_count; ++i) {
+            if (_peers[i].state != PEER_IDLE) {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * Register the GattClient handlers and start polling.
+     *
+     * This function is meant to be passed to BLEProcess::on_init.
+     */
+    void start(BLE &ble_interface, events::EventQueue &event_queue)
+    {
+        if (_event_queue || !_peer_count) {
+            return;
+        }
+
+        _ble = &ble_interface;
+        _event_queue = &event_queue;
+        _start_ms = rtos::Kernel::get_ms_count();
+
+        Gap &gap = _ble->gap();
+        gap.onConnection(this, &Self::when_connection);
+        gap.onDisconnection(this, &Self::when_disconnection);
+
+        GattClient &client = _ble->gattClient();
+        client.onDataRead(as_cb(&Self::when_data_read));
+        client.onHVX(as_cb(&Self::when_hvx));
+        client.onServiceDiscoveryTermination(
+            makeFunctionPointer(this, &Self::when_discovery_terminated)
+        );
+
+        LOG_INFO(LOG_MODULE_POLLER, "Polling %u peripheral(s).\r\n", (unsigned) _peer_count);
+        EventQueueMonitor::call_every(
+            *_event_queue,
+            EventQueueMonitor::EVENT_POLLER,
+            100,
+            mbed::callback(this, &Self::schedule)
+        );
+    }
+
+    /**
+     * Print the samples rate and per peer counters.
+     */
+    void print_stats() const
+    {
+        uint64_t elapsed_ms = rtos::Kernel::get_ms_count() - _start_ms;
+        printf(
+            "poller: %lu samples in %lu ms, %lu cache hits, %lu unexpected connections closed\r\n",
+            (unsigned long) _samples, (unsigned long) elapsed_ms,
+            (unsigned long) _cache_hits, (unsigned long) _unexpected_connections
+        );
+        for (size_t i = 0; i < _peer_count; ++i) {
+            const peer_t &peer = _peers[i];
+            printf(
+                "\tpeer %u: %lu samples, %lu connections, %lu discoveries, %lu failures\r\n",
+                (unsigned) i, (unsigned long) peer.samples,
+                (unsigned long) peer.connections, (unsigned long) peer.discoveries,
+                (unsigned long) peer.failures
+            );
+        }
+    }
+
+private:
+    /**
+     * Serve due peers: start a connection to the most overdue idle peer and
+     * re-read the peers kept connected.
+     */
+    void schedule()
+    {
+        uint64_t now = rtos::Kernel::get_ms_count();
+        peer_t *candidate = NULL;
+        size_t connected = 0;
+
+        for (size_t i = 0; i < _peer_count; ++i) {
+            peer_t &peer = _peers[i];
+
+            if (peer.state != PEER_IDLE) {
+                ++connected;
+            }
+
+            if (peer.state == PEER_CONNECTED && !peer.subscribe && now >= peer.next_due_ms) {
+                read(peer);
+            }
+
+            if (peer.state == PEER_IDLE && now >= peer.next_due_ms &&
+                (!candidate || peer.next_due_ms < candidate->next_due_ms)) {
+                candidate = &peer;
+            }
+        }
+
+        if (!candidate || _connecting || _discovering ||
+            connected >= MBED_CONF_APP_POLLER_MAX_CONNECTIONS) {
+            return;
+        }
+
+        // the links of the peripheral role count against the same budget
+        size_t others = _link_count_source ? _link_count_source() : 0;
+        if (connected + others >= MBED_CONF_APP_BLE_CONNECTION_BUDGET) {
+            return;
+        }
+
+        ble_error_t error = _ble->gap().connect(
+            candidate->address_type,
+            ble::address_t(candidate->address),
+            ble::ConnectionParameters()
+        );
+
+        if (error) {
+            ++candidate->failures;
+            candidate->next_due_ms = now + candidate->period_ms;
+            return;
+        }
+
+        candidate->state = PEER_CONNECTING;
+        _connecting = candidate;
+        _connect_timeout_id = EventQueueMonitor::call_in(
+            *_event_queue,
+            EventQueueMonitor::EVENT_POLLER,
+            MBED_CONF_APP_POLLER_CONNECT_TIMEOUT_MS,
+            mbed::callback(this, &Self::when_connect_timeout)
+        );
+    }
+
+    void when_connect_timeout()
+    {
+        _connect_timeout_id = 0;
+        if (!_connecting) {
+            return;
+        }
+
+        _ble->gap().cancelConnect();
+        ++_connecting->failures;
+        _connecting->state = PEER_IDLE;
+        _connecting->next_due_ms = rtos::Kernel::get_ms_count() + _connecting->period_ms;
+        _connecting = NULL;
+    }
+
+    void when_connection(const Gap::ConnectionCallbackParams_t *event)
+    {
+        if (event->role != Gap::CENTRAL) {
+            return;
+        }
+
+        if (!_connecting ||
+            memcmp(event->peerAddr, _connecting->address, sizeof(_connecting->address))) {
+            // the poller is the only central; this connection completed
+            // after its timeout and is outside the connection budget
+            LOG_WARN(LOG_MODULE_POLLER, "closing unexpected connection %u\r\n", (unsigned) event->handle);
+            ++_unexpected_connections;
+            _ble->gap().disconnect(event->handle, ble::local_disconnection_reason_t::USER_TERMINATION);
+            return;
+        }
+
+        peer_t &peer = *_connecting;
+        _connecting = NULL;
+        if (_connect_timeout_id) {
+            EventQueueMonitor::cancel(*_event_queue, _connect_timeout_id);
+            _connect_timeout_id = 0;
+        }
+
+        peer.connection = event->handle;
+        ++peer.connections;
+
+        if (peer.cached) {
+            ++_cache_hits;
+            serve(peer);
+            return;
+        }
+
+        discover(peer);
+    }
+
+    void when_disconnection(const Gap::DisconnectionCallbackParams_t *event)
+    {
+        peer_t *peer = find(event->handle);
+        if (!peer) {
+            return;
+        }
+
+        if (peer == _discovering) {
+            _discovering = NULL;
+        }
+
+        if (peer->state != PEER_DISCONNECTING) {
+            ++peer->failures;
+        }
+
+        peer->state = PEER_IDLE;
+        if (peer->subscribe) {
+            peer->next_due_ms = rtos::Kernel::get_ms_count();
+        }
+    }
+
+    /**
+     * Discover the characteristic and its CCCD; only one discovery runs at
+     * a time.
+     */
+    void discover(peer_t &peer)
+    {
+        peer.state = PEER_DISCOVERING;
+        _discovering = &peer;
+        ++peer.discoveries;
+
+        ble_error_t error = _ble->gattClient().launchServiceDiscovery(
+            peer.connection,
+            NULL,
+            makeFunctionPointer(this, &Self::when_characteristic_discovered),
+            _service_uuid,
+            _characteristic_uuid
+        );
+
+        if (error) {
+            _discovering = NULL;
+            fail(peer);
+        }
+    }
+
+    void when_characteristic_discovered(const DiscoveredCharacteristic *characteristic)
+    {
+        if (!_discovering) {
+            return;
+        }
+
+        _discovering->characteristic = *characteristic;
+        _discovering->value_handle = characteristic->getValueHandle();
+        _discovering->cccd_handle = 0;
+    }
+
+    void when_discovery_terminated(ble::connection_handle_t connection)
+    {
+        peer_t *peer = _discovering;
+        if (!peer || peer->connection != connection) {
+            return;
+        }
+
+        if (!peer->value_handle) {
+            _discovering = NULL;
+            fail(*peer);
+            return;
+        }
+
+        if (!peer->subscribe) {
+            _discovering = NULL;
+            peer->cached = true;
+            serve(*peer);
+            return;
+        }
+
+        ble_error_t error = peer->characteristic.discoverDescriptors(
+            makeFunctionPointer(this, &Self::when_descriptor_discovered),
+            makeFunctionPointer(this, &Self::when_descriptor_discovery_terminated)
+        );
+
+        if (error) {
+            _discovering = NULL;
+            fail(*peer);
+        }
+    }
+
+    void when_descriptor_discovered(
+        const CharacteristicDescriptorDiscovery::DiscoveryCallbackParams_t *params
+    ) {
+        if (_discovering &&
+            params->descriptor.getUUID() == BLE_UUID_DESCRIPTOR_CLIENT_CHAR_CONFIG) {
+            _discovering->cccd_handle = params->descriptor.getAttributeHandle();
+            _discovering->characteristic.getGattClient()->terminateCharacteristicDescriptorDiscovery(
+                _discovering->characteristic
+            );
+        }
+    }
+
+    void when_descriptor_discovery_terminated(
+        const CharacteristicDescriptorDiscovery::TerminationCallbackParams_t *params
+    ) {
+        peer_t *peer = _discovering;
+        _discovering = NULL;
+        if (!peer) {
+            return;
+        }
+
+        if (!peer->cccd_handle) {
+            fail(*peer);
+            return;
+        }
+
+        peer->cached = true;
+        serve(*peer);
+    }
+
+    /**
+     * Read or subscribe with the cached handles.
+     */
+    void serve(peer_t &peer)
+    {
+        if (!peer.subscribe) {
+            read(peer);
+            return;
+        }
+
+        uint16_t notify = BLE_HVX_NOTIFICATION;
+        ble_error_t error = _ble->gattClient().write(
+            GattClient::GATT_OP_WRITE_REQ,
+            peer.connection,
+            peer.cccd_handle,
+            sizeof(notify),
+            reinterpret_cast<const uint8_t *>(&notify)
+        );
+
+        if (error) {
+            fail(peer);
+            return;
+        }
+
+        peer.state = PEER_CONNECTED;
+    }
+
+    void read(peer_t &peer)
+    {
+        ble_error_t error = _ble->gattClient().read(peer.connection, peer.value_handle, 0);
+        if (error) {
+            fail(peer);
+            return;
+        }
+        peer.state = PEER_READING;
+    }
+
+    void when_data_read(const GattReadCallbackParams *params)
+    {
+        peer_t *peer = find(params->connHandle);
+        if (!peer || peer->state != PEER_READING || params->handle != peer->value_handle) {
+            return;
+        }
+
+        if (params->status != BLE_ERROR_NONE) {
+            // the peer may have changed its database; discover it again
+            peer->cached = false;
+            fail(*peer);
+            return;
+        }
+
+        sample(*peer, params->data, params->len);
+        peer->next_due_ms = rtos::Kernel::get_ms_count() + peer->period_ms;
+
+        if (peer->period_ms <= MBED_CONF_APP_POLLER_KEEP_CONNECTED_MS) {
+            peer->state = PEER_CONNECTED;
+        } else {
+            disconnect(*peer);
+        }
+    }
+
+    void when_hvx(const GattHVXCallbackParams *params)
+    {
+        peer_t *peer = find(params->connHandle);
+        if (!peer || params->handle != peer->value_handle) {
+            return;
+        }
+
+        sample(*peer, params->data, params->len);
+    }
+
+    void sample(peer_t &peer, const uint8_t *data, uint16_t length)
+    {
+        ++peer.samples;
+        ++_samples;
+
+        uint8_t record[Uplink::SMALL_RECORD_SIZE];
+        size_t value_length = length;
+        if (value_length > sizeof(record) - 7) {
+            value_length = sizeof(record) - 7;
+        }
+        record[0] = peer.address_type.value();
+        memcpy(record + 1, peer.address, 6);
+        memcpy(record + 7, data, value_length);
+        if (!_uplink.send(UplinkFrame::RECORD_POLL_SAMPLE, record, 7 + value_length)) {
+            LOG_WARN(LOG_MODULE_POLLER, "sample of peer %u dropped\r\n", (unsigned)(&peer - _peers));
+        }
+
+        if (_sample_cb) {
+            _sample_cb(&peer - _peers, data, length);
+        }
+    }
+
+    void fail(peer_t &peer)
+    {
+        ++peer.failures;
+        peer.next_due_ms = rtos::Kernel::get_ms_count() + peer.period_ms;
+        disconnect(peer);
+    }
+
+    /**
+     * Close the connection of a peer; if the stack refuses, the peer is
+     * idle again and polled at its next due time.
+     */
+    void disconnect(peer_t &peer)
+    {
+        peer.state = PEER_DISCONNECTING;
+        ble_error_t error = _ble->gap().disconnect(
+            peer.connection, ble::local_disconnection_reason_t::USER_TERMINATION
+        );
+        if (error) {
+            LOG_WARN(LOG_MODULE_POLLER, "disconnection of peer %u failed with error %u\r\n",
+                (unsigned)(&peer - _peers), error);
+            ++peer.failures;
+            if (&peer == _discovering) {
+                _discovering = NULL;
+            }
+            peer.state = PEER_IDLE;
+        }
+    }
+
+    peer_t *find(ble::connection_handle_t connection)
+    {
+        for (size_t i = 0; i < _peer_count; ++i) {
+            if (_peers[i].state != PEER_IDLE &&
+                _peers[i].state != PEER_CONNECTING &&
+                _peers[i].connection == connection) {
+                return &_peers[i];
+            }
+        }
+        return NULL;
+    }
+
+    /**
+     * Helper that construct an event handler from a member function of this
+     * instance.
+     */
+    template<typename Arg>
+    FunctionPointerWithContext<Arg> as_cb(void (Self::*member)(Arg))
+    {
+        return makeFunctionPointer(this, member);
+    }
+
+    Uplink &_uplink;
+    UUID _service_uuid;
+    UUID _characteristic_uuid;
+    BLE *_ble;
+    events::EventQueue *_event_queue;
+    peer_t _peers[MBED_CONF_APP_POLLER_MAX_PEERS];
+    size_t _peer_count;
+    peer_t *_connecting;
+    peer_t *_discovering;
+    int _connect_timeout_id;
+    uint64_t _start_ms;
+    uint32_t _samples;
+    uint32_t _cache_hits;
+    uint32_t _unexpected_connections;
+    mbed::Callback<void(size_t, const uint8_t*, uint16_t)> _sample_cb;
+    mbed::Callback<size_t()> _link_count_source;
+};
+
+#endif /* GATT_CLIENT_POLLER_H_ */
@@ -0,0 +1,394 @@
+#ifndef LINK_SUPERVISOR_H_
+#define LINK_SUPERVISOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wifi.h"
+
+#include "events/EventQueue.h"
+#include "platform/Callback.h"
+#include "platform/NonCopyable.h"
+#include "rtos/Kernel.h"
+
+#include "BinaryLog.h"
+#include "EventQueueMonitor.h"
+
+#ifndef MBED_CONF_APP_LINK_BACKOFF_MIN_MS
+#define MBED_CONF_APP_LINK_BACKOFF_MIN_MS 1000
+#endif
+
+#ifndef MBED_CONF_APP_LINK_BACKOFF_MAX_MS
+#define MBED_CONF_APP_LINK_BACKOFF_MAX_MS 120000
+#endif
+
+#ifndef MBED_CONF_APP_LINK_PROBE_PERIOD_MS
+#define MBED_CONF_APP_LINK_PROBE_PERIOD_MS 10000
+#endif
+
+#ifndef MBED_CONF_APP_LINK_MAX_SEND_ERRORS
+#define MBED_CONF_APP_LINK_MAX_SEND_ERRORS 3
+#endif
+
+/**
+ * Owner of the wifi link to the collector.
+ *
+ * The supervisor joins the access point, waits for its address from DHCP
+ * and opens the TCP connection to the collector, one module command per
+ * event on the lane performing the wifi I/O. A failed step is retried
+ * after an exponential backoff between MBED_CONF_APP_LINK_BACKOFF_MIN_MS
+ * and MBED_CONF_APP_LINK_BACKOFF_MAX_MS; half of each delay is random
+ * (equal jitter) and the generator is seeded per node, so a fleet that
+ * lost its access point does not reconnect in lockstep. The first attempt
+ * after boot or after a loss is delayed by a random fraction of the
+ * minimum backoff for the same reason.
+ *
+ * Once up, the link is probed every MBED_CONF_APP_LINK_PROBE_PERIOD_MS for
+ * its address, and the uplink reports the result of each send: losing the
+ * address rejoins the access point, MBED_CONF_APP_LINK_MAX_SEND_ERRORS
+ * failed sends in a row reopen the connection.
+ *
+ * The socket is published to the subscriber of on_socket_change, -1 while
+ * the link is down; the state and the socket can be read from any thread.
+ */
+class LinkSupervisor : private mbed::NonCopyable<LinkSupervisor> {
+    typedef LinkSupervisor Self;
+
+public:
+    enum state_t {
+        /** Not started. */
+        LINK_IDLE,
+        /** Joining the access point. */
+        LINK_JOINING,
+        /** Waiting for an address from DHCP. */
+        LINK_ADDRESSING,
+        /** Opening the connection to the collector. */
+        LINK_CONNECTING,
+        /** Connected to the collector. */
+        LINK_UP
+    };
+
+    /**
+     * Module socket of the connection to the collector.
+     */
+    static const int32_t SOCKET = 0;
+
+    /**
+     * Largest shift of the minimum backoff; keeps it within 32 bits.
+     */
+    static const uint32_t MAX_ATTEMPT_SHIFT = 16;
+
+    /**
+     * @param[in] wifi_queue Queue of the lane performing the wifi I/O.
+     * @param[in] server_ip Address of the collector.
+     * @param[in] server_port Port of the collector.
+     * @param[in] seed Seed of the jitter; distinct per node.
+     */
+    LinkSupervisor(
+        events::EventQueue &wifi_queue,
+        const uint8_t server_ip[4],
+        uint16_t server_port,
+        uint32_t seed
+    ) :
+        _queue(wifi_queue),
+        _server_port(server_port),
+        _random(seed ? seed : 1),
+        _state(LINK_IDLE),
+        _socket(-1),
+        _probe_event(0),
+        _attempt(0),
+        _send_errors(0),
+        _reinit(false),
+        _up_since_ms(0),
+        _up_total_ms(0),
+        _joins(0),
+        _join_failures(0),
+        _address_failures(0),
+        _connects(0),
+        _connect_failures(0),
+        _lost_by_probe(0),
+        _lost_by_send(0)
+    {
+        memcpy(_server_ip, server_ip, sizeof(_server_ip));
+        memset(_ip, 0, sizeof(_ip));
+    }
+
+    /**
+     * Subscription to the changes of the socket; called on the wifi lane
+     * with the new socket, -1 when the link goes down.
+     */
+    void on_socket_change(mbed::Callback<void(int32_t)> cb)
+    {
+        _socket_cb = cb;
+    }
+
+    /**
+     * Bring the link up; callable from any thread.
+     */
+    void start()
+    {
+        if (_state != LINK_IDLE) {
+            return;
+        }
+        _state = LINK_JOINING;
+        schedule_step(jitter(MBED_CONF_APP_LINK_BACKOFF_MIN_MS));
+    }
+
+    state_t state() const
+    {
+        return (state_t) _state;
+    }
+
+    /**
+     * Socket connected to the collector, -1 if the link is down.
+     */
+    int32_t socket() const
+    {
+        return _socket;
+    }
+
+    /**
+     * Account the result of a send on the socket.
+     *
+     * This function is meant to be passed to Uplink::on_send.
+     */
+    void when_send(bool ok)
+    {
+        if (_state != LINK_UP) {
+            return;
+        }
+        if (ok) {
+            _send_errors = 0;
+            return;
+        }
+        if (++_send_errors >= MBED_CONF_APP_LINK_MAX_SEND_ERRORS) {
+            LOG_WARN(LOG_MODULE_WIFI, "Link: %u sends failed, reconnecting.\r\n", (unsigned) _send_errors);
+            ++_lost_by_send;
+            lose(LINK_CONNECTING);
+        }
+    }
+
+    void print_stats() const
+    {
+        static const char *const names[] = { "idle", "joining", "addressing", "connecting", "up" };
+        uint32_t up_ms = _up_total_ms;
+        if (_state == LINK_UP) {
+            up_ms += (uint32_t) rtos::Kernel::get_ms_count() - _up_since_ms;
+        }
+        printf(
+            "link: %s, up %lu s, %lu joins (%lu failed, %lu without address), %lu connections (%lu failed)\r\n",
+            names[_state],
+            (unsigned long)(up_ms / 1000),
+            (unsigned long) _joins,
+            (unsigned long) _join_failures,
+            (unsigned long) _address_failures,
+            (unsigned long) _connects,
+            (unsigned long) _connect_failures
+        );
+        printf(
+            "\tlost %lu times by probe, %lu by send errors, next backoff %lu ms\r\n",
+            (unsigned long) _lost_by_probe,
+            (unsigned long) _lost_by_send,
+            (unsigned long) backoff_ms()
+        );
+    }
+
+private:
+    /**
+     * Run the step of the current state.
+     */
+    void step()
+    {
+        switch (_state) {
+            case LINK_JOINING:
+                join();
+                break;
+            case LINK_ADDRESSING:
+                address();
+                break;
+            case LINK_CONNECTING:
+                connect();
+                break;
+            default:
+                break;
+        }
+    }
+
+    void join()
+    {
+        // a module that failed to join may be wedged: reset it first
+        if (_reinit && WIFI_Init() != WIFI_STATUS_OK) {
+            ++_join_failures;
+            retry();
+            return;
+        }
+        if (WIFI_Connect(MBED_CONF_APP_WIFI_SSID, MBED_CONF_APP_WIFI_PASSWORD, WIFI_ECN_WPA2_PSK) != WIFI_STATUS_OK) {
+            LOG_WARN(LOG_MODULE_WIFI, "Link: cannot join the access point.\r\n");
+            ++_join_failures;
+            _reinit = true;
+            retry();
+            return;
+        }
+        ++_joins;
+        _reinit = false;
+        _state = LINK_ADDRESSING;
+        schedule_step(0);
+    }
+
+    void address()
+    {
+        if (WIFI_CheckConnection(_ip) != WIFI_STATUS_OK) {
+            ++_address_failures;
+            WIFI_Disconnect();
+            _state = LINK_JOINING;
+            retry();
+            return;
+        }
+        LOG_INFO(
+            LOG_MODULE_WIFI, "Link: address %u.%u.%u.%u\r\n",
+            (unsigned) _ip[0], (unsigned) _ip[1], (unsigned) _ip[2], (unsigned) _ip[3]
+        );
+        _state = LINK_CONNECTING;
+        schedule_step(0);
+    }
+
+    void connect()
+    {
+        if (WIFI_OpenClientConnection(
+                SOCKET, WIFI_TCP_PROTOCOL, "TCP_CLIENT", _server_ip, _server_port, 0
+            ) != WIFI_STATUS_OK) {
+            ++_connect_failures;
+            // the collector may be down, or the access point gone
+            if (WIFI_CheckConnection(_ip) != WIFI_STATUS_OK) {
+                WIFI_Disconnect();
+                _state = LINK_JOINING;
+            }
+            retry();
+            return;
+        }
+
+        LOG_INFO(
+            LOG_MODULE_WIFI, "Link: connected to %u.%u.%u.%u:%u\r\n",
+            (unsigned) _server_ip[0], (unsigned) _server_ip[1],
+            (unsigned) _server_ip[2], (unsigned) _server_ip[3], (unsigned) _server_port
+        );
+        ++_connects;
+        _attempt = 0;
+        _send_errors = 0;
+        _state = LINK_UP;
+        _up_since_ms = (uint32_t) rtos::Kernel::get_ms_count();
+        publish(SOCKET);
+        _probe_event = EventQueueMonitor::call_every(
+            _queue,
+            EventQueueMonitor::EVENT_LINK,
+            MBED_CONF_APP_LINK_PROBE_PERIOD_MS,
+            mbed::callback(this, &Self::probe)
+        );
+    }
+
+    /**
+     * Check that the module still holds its address; the module is queried,
+     * the address cached by the driver outlives the join.
+     */
+    void probe()
+    {
+        if (_state != LINK_UP || WIFI_CheckConnection(_ip) == WIFI_STATUS_OK) {
+            return;
+        }
+        LOG_WARN(LOG_MODULE_WIFI, "Link: address lost, rejoining.\r\n");
+        ++_lost_by_probe;
+        WIFI_Disconnect();
+        lose(LINK_JOINING);
+    }
+
+    /**
+     * Take the link down and restart it from the given state.
+     */
+    void lose(state_t restart)
+    {
+        if (_probe_event) {
+            EventQueueMonitor::cancel(_queue, _probe_event);
+            _probe_event = 0;
+        }
+        WIFI_CloseClientConnection(SOCKET);
+        _up_total_ms += (uint32_t) rtos::Kernel::get_ms_count() - _up_since_ms;
+        _state = restart;
+        publish(-1);
+        schedule_step(jitter(MBED_CONF_APP_LINK_BACKOFF_MIN_MS));
+    }
+
+    void publish(int32_t socket)
+    {
+        _socket = socket;
+        if (_socket_cb) {
+            _socket_cb(socket);
+        }
+    }
+
+    /**
+     * Run the step again after the backoff of the next attempt.
+     */
+    void retry()
+    {
+        uint32_t delay_ms = backoff_ms();
+        if (_attempt < MAX_ATTEMPT_SHIFT) {
+            ++_attempt;
+        }
+        schedule_step(delay_ms / 2 + jitter(delay_ms / 2 + 1));
+    }
+
+    uint32_t backoff_ms() const
+    {
+        uint32_t delay_ms = (uint32_t) MBED_CONF_APP_LINK_BACKOFF_MIN_MS << _attempt;
+        return delay_ms > MBED_CONF_APP_LINK_BACKOFF_MAX_MS ? MBED_CONF_APP_LINK_BACKOFF_MAX_MS : delay_ms;
+    }
+
+    /**
+     * Random delay in [0, range_ms).
+     */
+    uint32_t jitter(uint32_t range_ms)
+    {
+        // xorshift32
+        _random ^= _random << 13;
+        _random ^= _random >> 17;
+        _random ^= _random << 5;
+        return range_ms ? _random % range_ms : 0;
+    }
+
+    void schedule_step(uint32_t delay_ms)
+    {
+        EventQueueMonitor::call_in(
+            _queue,
+            EventQueueMonitor::EVENT_LINK,
+            delay_ms,
+            mbed::callback(this, &Self::step)
+        );
+    }
+
+    events::EventQueue &_queue;
+    uint8_t _server_ip[4];
+    uint16_t _server_port;
+    uint8_t _ip[4];
+    uint32_t _random;
+    volatile uint8_t _state;
+    volatile int32_t _socket;
+    mbed::Callback<void(int32_t)> _socket_cb;
+    int _probe_event;
+    uint32_t _attempt;
+    uint32_t _send_errors;
+    bool _reinit;
+    uint32_t _up_since_ms;
+    uint32_t _up_total_ms;
+
+    uint32_t _joins;
+    uint32_t _join_failures;
+    uint32_t _address_failures;
+    uint32_t _connects;
+    uint32_t _connect_failures;
+    uint32_t _lost_by_probe;
+    uint32_t _lost_by_send;
+};
+
+#endif /* LINK_SUPERVISOR_H_ */
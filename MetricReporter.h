@@ -0,0 +1,209 @@
+#ifndef METRIC_REPORTER_H_
+#define METRIC_REPORTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "events/EventQueue.h"
+#include "platform/Callback.h"
+#include "platform/NonCopyable.h"
+#include "platform/mbed_critical.h"
+#include "rtos/Kernel.h"
+
+#include "BinaryLog.h"
+#include "EventQueueMonitor.h"
+#include "UplinkFrame.h"
+#include "WindowAggregator.h"
+
+#ifndef MBED_CONF_APP_METRICS_POLL_MS
+#define MBED_CONF_APP_METRICS_POLL_MS 1000
+#endif
+
+#ifndef MBED_CONF_APP_METRICS_UPLINK_SEND_WINDOW_MS
+#define MBED_CONF_APP_METRICS_UPLINK_SEND_WINDOW_MS 60000
+#endif
+
+#ifndef MBED_CONF_APP_METRICS_UPLINK_SEND_HOP_MS
+#define MBED_CONF_APP_METRICS_UPLINK_SEND_HOP_MS 60000
+#endif
+
+#ifndef MBED_CONF_APP_METRICS_UPLINK_ACK_WINDOW_MS
+#define MBED_CONF_APP_METRICS_UPLINK_ACK_WINDOW_MS 60000
+#endif
+
+#ifndef MBED_CONF_APP_METRICS_UPLINK_ACK_HOP_MS
+#define MBED_CONF_APP_METRICS_UPLINK_ACK_HOP_MS 60000
+#endif
+
+#ifndef MBED_CONF_APP_METRICS_BLE_CONNECT_WINDOW_MS
+#define MBED_CONF_APP_METRICS_BLE_CONNECT_WINDOW_MS 60000
+#endif
+
+#ifndef MBED_CONF_APP_METRICS_BLE_CONNECT_HOP_MS
+#define MBED_CONF_APP_METRICS_BLE_CONNECT_HOP_MS 60000
+#endif
+
+#ifndef MBED_CONF_APP_METRICS_BLE_CONNECTION_WINDOW_MS
+#define MBED_CONF_APP_METRICS_BLE_CONNECTION_WINDOW_MS 300000
+#endif
+
+#ifndef MBED_CONF_APP_METRICS_BLE_CONNECTION_HOP_MS
+#define MBED_CONF_APP_METRICS_BLE_CONNECTION_HOP_MS 60000
+#endif
+
+/**
+ * Windowed statistics of the node metrics, uploaded as summary records.
+ *
+ * Instead of a record per event, the samples of each metric are folded into
+ * a WindowAggregator and a RECORD_METRIC_SUMMARY record is sent per window
+ * with samples. Each metric has its own window and hop, set by the
+ * MBED_CONF_APP_METRICS_<METRIC>_WINDOW_MS and _HOP_MS options: a hop equal
+ * to the window gives tumbling windows, a shorter hop sliding windows
+ * summarized every hop. A window of 0 disables the metric.
+ *
+ * Samples may be observed from any thread or interrupt. Windows are closed
+ * every MBED_CONF_APP_METRICS_POLL_MS on the lane performing the wifi I/O,
+ * where the summaries are handed to the sink.
+ */
+class MetricReporter : private mbed::NonCopyable<MetricReporter> {
+    typedef MetricReporter Self;
+
+public:
+    enum metric_t {
+        /** Duration of a frame send by the wifi module, in us. */
+        METRIC_UPLINK_SEND_US,
+        /** Time between the send of a frame and its ack, in ms. */
+        METRIC_UPLINK_ACK_MS,
+        /** Duration of a connection with a central, in ms; at its end. */
+        METRIC_BLE_CONNECTION_MS,
+        /**
+         * Time from the start of the advertising window to a connection, in
+         * ms; the count of a summary is the number of connections.
+         */
+        METRIC_BLE_CONNECT_MS,
+        METRIC_COUNT
+    };
+
+    /**
+     * Largest number of hops in a sliding window.
+     */
+    static const size_t MAX_PANES = 8;
+
+    typedef WindowAggregator<METRIC_COUNT, MAX_PANES> Aggregator;
+
+    /**
+     * Destination of the summary records: type, payload and length.
+     */
+    typedef mbed::Callback<void(uint8_t, const uint8_t *, size_t)> sink_t;
+
+    /**
+     * @param[in] wifi_queue Queue of the lane performing the wifi I/O.
+     */
+    MetricReporter(events::EventQueue &wifi_queue) :
+        _queue(wifi_queue),
+        _started(false),
+        _samples(0),
+        _summaries_sent(0)
+    {
+    }
+
+    /**
+     * Open the windows of the metrics and start closing them.
+     *
+     * @param[in] sink Called on the wifi lane with each summary record,
+     * typically Uplink::append.
+     */
+    void start(sink_t sink)
+    {
+        if (_started) {
+            return;
+        }
+        _sink = sink;
+
+        static const struct {
+            uint32_t window_ms;
+            uint32_t hop_ms;
+        } windows[METRIC_COUNT] = {
+            { MBED_CONF_APP_METRICS_UPLINK_SEND_WINDOW_MS, MBED_CONF_APP_METRICS_UPLINK_SEND_HOP_MS },
+            { MBED_CONF_APP_METRICS_UPLINK_ACK_WINDOW_MS, MBED_CONF_APP_METRICS_UPLINK_ACK_HOP_MS },
+            { MBED_CONF_APP_METRICS_BLE_CONNECTION_WINDOW_MS, MBED_CONF_APP_METRICS_BLE_CONNECTION_HOP_MS },
+            { MBED_CONF_APP_METRICS_BLE_CONNECT_WINDOW_MS, MBED_CONF_APP_METRICS_BLE_CONNECT_HOP_MS }
+        };
+
+        uint32_t now_ms = (uint32_t) rtos::Kernel::get_ms_count();
+        core_util_critical_section_enter();
+        for (size_t i = 0; i < METRIC_COUNT; ++i) {
+            if (windows[i].window_ms &&
+                !_aggregator.configure(i, windows[i].window_ms, windows[i].hop_ms, now_ms)) {
+                LOG_ERROR(
+                    LOG_MODULE_WIFI, "Metric %u: window of %u ms not made of up to %u hops.\r\n",
+                    (unsigned) i, (unsigned) windows[i].window_ms, (unsigned) MAX_PANES
+                );
+            }
+        }
+        core_util_critical_section_exit();
+
+        _started = true;
+        EventQueueMonitor::call_every(
+            _queue,
+            EventQueueMonitor::EVENT_UPLINK,
+            MBED_CONF_APP_METRICS_POLL_MS,
+            mbed::callback(this, &Self::poll)
+        );
+    }
+
+    /**
+     * Account a sample of a metric; callable from any context.
+     */
+    void observe(metric_t metric, int32_t value)
+    {
+        core_util_critical_section_enter();
+        _aggregator.observe(metric, value);
+        ++_samples;
+        core_util_critical_section_exit();
+    }
+
+    void print_stats() const
+    {
+        printf(
+            "metrics: %lu samples, %lu summaries sent\r\n",
+            (unsigned long) _samples,
+            (unsigned long) _summaries_sent
+        );
+    }
+
+private:
+    /**
+     * Send the summaries of the windows ended.
+     */
+    void poll()
+    {
+        uint32_t now_ms = (uint32_t) rtos::Kernel::get_ms_count();
+        Aggregator::summary_t summaries[METRIC_COUNT];
+        size_t count;
+        do {
+            // the copy is short; the sink may block on the module
+            core_util_critical_section_enter();
+            count = _aggregator.poll(now_ms, summaries, METRIC_COUNT);
+            core_util_critical_section_exit();
+
+            for (size_t i = 0; i < count; ++i) {
+                uint8_t record[Aggregator::SUMMARY_SIZE];
+                size_t length = Aggregator::encode(summaries[i], record);
+                _sink(UplinkFrame::RECORD_METRIC_SUMMARY, record, length);
+                ++_summaries_sent;
+            }
+        } while (count == METRIC_COUNT);
+    }
+
+    events::EventQueue &_queue;
+    sink_t _sink;
+    Aggregator _aggregator;
+    bool _started;
+
+    uint32_t _samples;
+    uint32_t _summaries_sent;
+};
+
+#endif /* METRIC_REPORTER_H_ */
@@ -0,0 +1,285 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "wifi.h"
+
+#include "platform/mbed_critical.h"
+
+/**
+ * Static registry of the node counters, gauges and histograms.
+ *
+ * Metrics are declared below at compile time, with their names; their
+ * storage is a zero initialized static block, so the registry allocates
+ * nothing and needs no construction before the first update. Updates are
+ * a single atomic operation and may come from any thread or interrupt;
+ * histograms update their bucket and 64 bit sum in a critical section.
+ *
+ *   - counters only increase;
+ *   - gauges hold a signed level, set, moved or raised to a high-water mark;
+ *   - histograms count values in power of two buckets, as the event queue
+ *     monitor does: bucket i counts values in [2^(i-1), 2^i), bucket 0
+ *     counts zeros and the last bucket everything above; they also sum the
+ *     values for the mean.
+ *
+ * Readers see each value atomically but not a snapshot of the registry.
+ */
+class Metrics {
+public:
+    enum counter_t {
+        /** Commands sent to the wifi module. */
+        COUNTER_WIFI_COMMANDS,
+        /** Commands of the wifi module that failed. */
+        COUNTER_WIFI_ERRORS,
+        /** Payload bytes sent on wifi sockets. */
+        COUNTER_WIFI_BYTES_SENT,
+        /** Payload bytes received on wifi sockets. */
+        COUNTER_WIFI_BYTES_RECEIVED,
+        /** Connections of centrals. */
+        COUNTER_BLE_CONNECTIONS,
+        /** Disconnections of centrals. */
+        COUNTER_BLE_DISCONNECTIONS,
+        /** ATT MTU exchanges completed. */
+        COUNTER_BLE_MTU_CHANGES,
+        /** Advertising reports received while scanning. */
+        COUNTER_BLE_ADVERTISING_REPORTS,
+        /** Reads of the clock characteristics. */
+        COUNTER_CLOCK_READS,
+        /** Writes of the clock characteristics. */
+        COUNTER_CLOCK_WRITES,
+        /** Notifications and indications sent by the clock service. */
+        COUNTER_CLOCK_UPDATES_SENT,
+        /** Subscriptions to the clock characteristics. */
+        COUNTER_CLOCK_SUBSCRIPTIONS,
+        /** Bytes of the uplink frames sent, after packing. */
+        COUNTER_UPLINK_BYTES_SENT,
+        /** Uplink frames whose send failed. */
+        COUNTER_UPLINK_SEND_ERRORS,
+        /** Uplink records dropped, neither sent nor stored. */
+        COUNTER_UPLINK_RECORDS_DROPPED,
+        COUNTER_COUNT
+    };
+
+    enum gauge_t {
+        /** Centrals connected. */
+        GAUGE_BLE_CONNECTIONS,
+        /** Largest ATT MTU negotiated. */
+        GAUGE_BLE_ATT_MTU_MAX,
+        GAUGE_COUNT
+    };
+
+    enum histogram_t {
+        /** Duration of the wifi send commands, in us. */
+        HISTOGRAM_WIFI_SEND_US,
+        /** Duration of the wifi receive commands, in us. */
+        HISTOGRAM_WIFI_RECEIVE_US,
+        /** Duration of the other wifi commands (init, join, socket), in us. */
+        HISTOGRAM_WIFI_CONTROL_US,
+        /** Duration of a tick of the clock service, in us. */
+        HISTOGRAM_CLOCK_TICK_US,
+        HISTOGRAM_COUNT
+    };
+
+    static const size_t HISTOGRAM_BUCKETS = 24;
+
+    static void increment(counter_t counter, uint32_t delta = 1)
+    {
+        core_util_atomic_incr_u32(&storage().counters[counter], delta);
+    }
+
+    static uint32_t counter(counter_t counter)
+    {
+        return core_util_atomic_load_u32(&storage().counters[counter]);
+    }
+
+    static void set(gauge_t gauge, int32_t value)
+    {
+        core_util_atomic_store_u32(&storage().gauges[gauge], (uint32_t) value);
+    }
+
+    static void add(gauge_t gauge, int32_t delta)
+    {
+        core_util_atomic_incr_u32(&storage().gauges[gauge], (uint32_t) delta);
+    }
+
+    /**
+     * Raise a gauge to value if it is below; for high-water marks.
+     */
+    static void raise(gauge_t gauge, int32_t value)
+    {
+        volatile uint32_t *ptr = &storage().gauges[gauge];
+        uint32_t current = core_util_atomic_load_u32(ptr);
+        while ((int32_t) current < value && !core_util_atomic_cas_u32(ptr, &current, (uint32_t) value)) {
+        }
+    }
+
+    static int32_t gauge(gauge_t gauge)
+    {
+        return (int32_t) core_util_atomic_load_u32(&storage().gauges[gauge]);
+    }
+
+    static void record(histogram_t histogram, uint32_t value)
+    {
+        histogram_storage_t &h = storage().histograms[histogram];
+        size_t i = bucket(value);
+        core_util_critical_section_enter();
+        h.buckets[i] = h.buckets[i] + 1;
+        h.sum = h.sum + value;
+        core_util_critical_section_exit();
+    }
+
+    static uint32_t count(histogram_t histogram)
+    {
+        const histogram_storage_t &h = storage().histograms[histogram];
+        uint32_t count = 0;
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+            count += core_util_atomic_load_u32(&h.buckets[i]);
+        }
+        return count;
+    }
+
+    static uint32_t mean(histogram_t histogram)
+    {
+        const histogram_storage_t &h = storage().histograms[histogram];
+        core_util_critical_section_enter();
+        uint32_t n = count(histogram);
+        uint64_t sum = h.sum;
+        core_util_critical_section_exit();
+        return n ? (uint32_t)(sum / n) : 0;
+    }
+
+    /**
+     * Upper bound of the bucket holding the given percentile of the values,
+     * 0 if the histogram is empty.
+     */
+    static uint32_t percentile(histogram_t histogram, uint32_t percent)
+    {
+        const histogram_storage_t &h = storage().histograms[histogram];
+        uint32_t n = count(histogram);
+        if (!n) {
+            return 0;
+        }
+        uint64_t rank = ((uint64_t) n * percent + 99) / 100;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+            seen += core_util_atomic_load_u32(&h.buckets[i]);
+            if (seen >= rank) {
+                return upper_bound(i);
+            }
+        }
+        return upper_bound(HISTOGRAM_BUCKETS - 1);
+    }
+
+    /**
+     * Account a command of the wifi module.
+     *
+     * This function is meant to be passed to WIFI_SetCommandHook.
+     */
+    static void when_wifi_command(
+        WIFI_Command_t command, WIFI_Status_t status, uint32_t bytes, uint32_t duration_us
+    ) {
+        increment(COUNTER_WIFI_COMMANDS);
+        if (status != WIFI_STATUS_OK) {
+            increment(COUNTER_WIFI_ERRORS);
+        }
+        switch (command) {
+            case WIFI_COMMAND_SEND:
+                increment(COUNTER_WIFI_BYTES_SENT, bytes);
+                record(HISTOGRAM_WIFI_SEND_US, duration_us);
+                break;
+            case WIFI_COMMAND_RECEIVE:
+                increment(COUNTER_WIFI_BYTES_RECEIVED, bytes);
+                record(HISTOGRAM_WIFI_RECEIVE_US, duration_us);
+                break;
+            default:
+                record(HISTOGRAM_WIFI_CONTROL_US, duration_us);
+                break;
+        }
+    }
+
+    static void print_stats()
+    {
+        printf("node metrics:\r\n");
+        for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+            printf("\t%s %lu\r\n", counter_name(i), (unsigned long) counter((counter_t) i));
+        }
+        for (size_t i = 0; i < GAUGE_COUNT; ++i) {
+            printf("\t%s %ld\r\n", gauge_name(i), (long) gauge((gauge_t) i));
+        }
+        for (size_t i = 0; i < HISTOGRAM_COUNT; ++i) {
+            histogram_t h = (histogram_t) i;
+            printf(
+                "\t%s: %lu, mean %lu, p50 <%lu p90 <%lu p99 <%lu\r\n",
+                histogram_name(i),
+                (unsigned long) count(h),
+                (unsigned long) mean(h),
+                (unsigned long) percentile(h, 50),
+                (unsigned long) percentile(h, 90),
+                (unsigned long) percentile(h, 99)
+            );
+        }
+    }
+
+    static const char *counter_name(size_t counter)
+    {
+        static const char *const names[COUNTER_COUNT] = {
+            "wifi commands", "wifi errors", "wifi bytes sent", "wifi bytes received",
+            "ble connections", "ble disconnections", "ble mtu changes", "ble advertising reports",
+            "clock reads", "clock writes", "clock updates sent", "clock subscriptions",
+            "uplink bytes sent", "uplink send errors", "uplink records dropped"
+        };
+        return names[counter];
+    }
+
+    static const char *gauge_name(size_t gauge)
+    {
+        static const char *const names[GAUGE_COUNT] = {
+            "ble connections open", "ble att mtu max"
+        };
+        return names[gauge];
+    }
+
+    static const char *histogram_name(size_t histogram)
+    {
+        static const char *const names[HISTOGRAM_COUNT] = {
+            "wifi send us", "wifi receive us", "wifi control us", "clock tick us"
+        };
+        return names[histogram];
+    }
+
+private:
+    struct histogram_storage_t {
+        volatile uint32_t buckets[HISTOGRAM_BUCKETS];
+        /* microsecond values wrap a 32 bit sum within hours */
+        volatile uint64_t sum;
+    };
+
+    /* plain old data: zero initialized before main, without a guard */
+    struct storage_t {
+        volatile uint32_t counters[COUNTER_COUNT];
+        volatile uint32_t gauges[GAUGE_COUNT];
+        histogram_storage_t histograms[HISTOGRAM_COUNT];
+    };
+
+    static storage_t &storage()
+    {
+        static storage_t storage;
+        return storage;
+    }
+
+    static size_t bucket(uint32_t value)
+    {
+        size_t i = value ? 32 - __builtin_clz(value) : 0;
+        return i < HISTOGRAM_BUCKETS ? i : HISTOGRAM_BUCKETS - 1;
+    }
+
+    static uint32_t upper_bound(size_t bucket)
+    {
+        return bucket < HISTOGRAM_BUCKETS - 1 ? (uint32_t) 1 << bucket : UINT32_MAX;
+    }
+};
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,260 @@
+#ifndef POWER_MANAGER_H_
+#define POWER_MANAGER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "events/EventQueue.h"
+#include "platform/Callback.h"
+#include "platform/mbed_stats.h"
+#include "platform/NonCopyable.h"
+#include "rtos/Kernel.h"
+#include "hal/us_ticker_api.h"
+
+#include "es_wifi_io.h"
+
+#include "EventQueueMonitor.h"
+
+#ifndef MBED_CONF_APP_POWER_MAX_JOBS
+#define MBED_CONF_APP_POWER_MAX_JOBS 8
+#endif
+
+/**
+ * Power aware scheduling of the periodic work of an event queue.
+ *
+ * Each periodic job declares a slack: the time it may run before or after
+ * its due date. The manager wakes up at the earliest deadline (due date plus
+ * slack) and runs every job whose window is open, so jobs with compatible
+ * periods share a single wakeup and settle on the same phase. Between
+ * wakeups the queue sleeps; with MBED_TICKLESS the RTOS tick is stopped and
+ * the wakeup is programmed on the low power ticker (LPTIM), which lets the
+ * MCU enter deep sleep unless a driver holds the deep sleep lock.
+ *
+ * Each job is timed against its own category of the queue monitor; the
+ * scheduler category times the whole wakeups, jobs included.
+ *
+ * The manager also reports the time spent active, sleeping and deep
+ * sleeping (platform.cpu-stats-enabled) and the time the wifi SPI bus held
+ * the deep sleep lock.
+ */
+class PowerManager : private mbed::NonCopyable<PowerManager> {
+    typedef PowerManager Self;
+
+public:
+    PowerManager(events::EventQueue &event_queue) :
+        _event_queue(event_queue),
+        _job_count(0),
+        _wakeup_id(0),
+        _next_wakeup_ms(0),
+        _wakeups(0),
+        _runs(0)
+    {
+        attach(this);
+    }
+
+    ~PowerManager()
+    {
+        detach(this);
+    }
+
+    /**
+     * Post a periodic job on a queue.
+     *
+     * If a PowerManager is attached to the queue the job is coalesced with
+     * the other periodic jobs of the queue; otherwise it is posted as a
+     * regular periodic event.
+     *
+     * @param[in] event_queue Queue running the job.
+     * @param[in] category Category of the job for the queue monitor.
+     * @param[in] period_ms Period of the job.
+     * @param[in] slack_ms Time the job may run before or after its due date.
+     * @param[in] cb The job.
+     *
+     * @return false if the job could not be posted.
+     */
+    static bool call_every(
+        events::EventQueue &event_queue,
+        EventQueueMonitor::category_t category,
+        uint32_t period_ms,
+        uint32_t slack_ms,
+        mbed::Callback<void()> cb
+    ) {
+        Self *manager = find(event_queue);
+        if (!manager) {
+            return EventQueueMonitor::call_every(event_queue, category, period_ms, cb) != 0;
+        }
+        return manager->add(category, period_ms, slack_ms, cb);
+    }
+
+    /**
+     * Print the time spent in each power state and the coalescing ratio.
+     */
+    void print_stats() const
+    {
+        printf(
+            "power: %lu wakeups for %lu periodic runs, wifi SPI busy %lu ms\r\n",
+            (unsigned long) _wakeups,
+            (unsigned long) _runs,
+            (unsigned long)(SPI_WIFI_GetBusyTime() / 1000)
+        );
+
+#if defined(MBED_CPU_STATS_ENABLED)
+        mbed_stats_cpu_t cpu;
+        mbed_stats_cpu_get(&cpu);
+        uint64_t sleep_us = cpu.sleep_time - cpu.deep_sleep_time;
+        uint64_t active_us = cpu.uptime - cpu.sleep_time;
+        printf(
+            "\tactive %lu ms, sleep %lu ms, deep sleep %lu ms over %lu ms\r\n",
+            (unsigned long)(active_us / 1000),
+            (unsigned long)(sleep_us / 1000),
+            (unsigned long)(cpu.deep_sleep_time / 1000),
+            (unsigned long)(cpu.uptime / 1000)
+        );
+#endif
+    }
+
+private:
+    struct job_t {
+        mbed::Callback<void()> cb;
+        EventQueueMonitor::category_t category;
+        uint32_t period_ms;
+        uint32_t slack_ms;
+        uint64_t due_ms;
+    };
+
+    static const size_t MAX_QUEUES = 4;
+
+    static Self **registry()
+    {
+        static Self *managers[MAX_QUEUES] = { NULL };
+        return managers;
+    }
+
+    static void attach(Self *manager)
+    {
+        Self **managers = registry();
+        for (size_t i = 0; i < MAX_QUEUES; ++i) {
+            if (!managers[i]) {
+                managers[i] = manager;
+                return;
+            }
+        }
+    }
+
+    static void detach(Self *manager)
+    {
+        Self **managers = registry();
+        for (size_t i = 0; i < MAX_QUEUES; ++i) {
+            if (managers[i] == manager) {
+                managers[i] = NULL;
+            }
+        }
+    }
+
+    static Self *find(events::EventQueue &event_queue)
+    {
+        Self **managers = registry();
+        for (size_t i = 0; i < MAX_QUEUES; ++i) {
+            if (managers[i] && &managers[i]->_event_queue == &event_queue) {
+                return managers[i];
+            }
+        }
+        return NULL;
+    }
+
+    bool add(
+        EventQueueMonitor::category_t category,
+        uint32_t period_ms,
+        uint32_t slack_ms,
+        mbed::Callback<void()> cb
+    )
+    {
+        if (_job_count == MBED_CONF_APP_POWER_MAX_JOBS) {
+            return false;
+        }
+
+        // the window of a job never spans more than its period
+        if (slack_ms > period_ms / 2) {
+            slack_ms = period_ms / 2;
+        }
+
+        job_t &job = _jobs[_job_count++];
+        job.cb = cb;
+        job.category = category;
+        job.period_ms = period_ms;
+        job.slack_ms = slack_ms;
+        job.due_ms = rtos::Kernel::get_ms_count() + period_ms;
+
+        arm();
+        return true;
+    }
+
+    /**
+     * Program the wakeup at the earliest deadline of the jobs.
+     */
+    void arm()
+    {
+        uint64_t deadline = UINT64_MAX;
+        for (size_t i = 0; i < _job_count; ++i) {
+            uint64_t job_deadline = _jobs[i].due_ms + _jobs[i].slack_ms;
+            if (job_deadline < deadline) {
+                deadline = job_deadline;
+            }
+        }
+
+        if (_wakeup_id) {
+            if (deadline >= _next_wakeup_ms) {
+                return;
+            }
+            EventQueueMonitor::cancel(_event_queue, _wakeup_id);
+        }
+
+        uint64_t now = rtos::Kernel::get_ms_count();
+        _next_wakeup_ms = deadline;
+        _wakeup_id = EventQueueMonitor::call_in(
+            _event_queue,
+            EventQueueMonitor::EVENT_SCHEDULER,
+            deadline > now ? (int)(deadline - now) : 0,
+            mbed::callback(this, &Self::wakeup)
+        );
+    }
+
+    /**
+     * Run every job whose window is open at the planned wakeup time.
+     */
+    void wakeup()
+    {
+        _wakeup_id = 0;
+        ++_wakeups;
+
+        // times are taken from the planned wakeup so jobs do not drift; a job
+        // run early keeps its rate, a job run late is re-anchored on the
+        // wakeup and joins its phase
+        uint64_t now = _next_wakeup_ms;
+        uint64_t now_ms = rtos::Kernel::get_ms_count();
+        uint32_t now_us = us_ticker_read();
+        for (size_t i = 0; i < _job_count; ++i) {
+            job_t &job = _jobs[i];
+            if (job.due_ms <= now + job.slack_ms) {
+                ++_runs;
+                // latency of the job against its own due date
+                uint32_t due_us = now_us - (uint32_t)((int64_t)(now_ms - job.due_ms) * 1000);
+                job.due_ms = ((job.due_ms > now) ? job.due_ms : now) + job.period_ms;
+                EventQueueMonitor::run_job(_event_queue, job.category, due_us, job.cb);
+            }
+        }
+
+        arm();
+    }
+
+    events::EventQueue &_event_queue;
+    job_t _jobs[MBED_CONF_APP_POWER_MAX_JOBS];
+    size_t _job_count;
+    int _wakeup_id;
+    uint64_t _next_wakeup_ms;
+    uint32_t _wakeups;
+    uint32_t _runs;
+};
+
+#endif /* POWER_MANAGER_H_ */
@@ -0,0 +1,375 @@
+#ifndef SCAN_AGGREGATOR_H_
+#define SCAN_AGGREGATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Aggregate the advertisements received by an observer into one record per
+ * peer and per report window.
+ *
+ * Each peer seen keeps a table entry with the RSSI minimum, maximum and
+ * average over the window, the number of advertisements received and the
+ * hash of the last payload. The table has a fixed size; when it is full the
+ * least recently seen peer already reported is evicted. If every peer has
+ * advertisements pending, the least recently seen one is evicted and its
+ * advertisements are counted as dropped. Peers are looked up through a
+ * hash of their address and kept in two lists, pending and reported, in
+ * the order they were last seen, so the cost of an advertisement does not
+ * grow with the table. Reports carry the pending peers oldest first.
+ *
+ * The aggregator does not depend on the BLE stack so it can be exercised on
+ * the host.
+ *
+ * @tparam TableSize Maximum number of peers tracked at once.
+ */
+template<size_t TableSize>
+class ScanAggregator {
+public:
+    /**
+     * Size of a report header: magic (1), version (1), record count (2),
+     * window duration in ms (4), peers evicted in the window (2).
+     */
+    static const size_t REPORT_HEADER_SIZE = 10;
+
+    /**
+     * Size of a report record: address (6), address type (1), RSSI min,
+     * max and average (3), advertisement count (2), payload hash (4),
+     * payload changed in the window (1).
+     */
+    static const size_t REPORT_RECORD_SIZE = 17;
+
+    static const uint8_t REPORT_MAGIC = 'G';
+    static const uint8_t REPORT_VERSION = 1;
+
+    struct entry_t {
+        uint8_t address[6];
+        uint8_t address_type;
+        int8_t rssi_min;
+        int8_t rssi_max;
+        int32_t rssi_sum;
+        uint16_t count;
+        bool payload_changed;
+        uint32_t payload_hash;
+        uint32_t last_seen_ms;
+        int16_t next;
+        int16_t older;
+        int16_t newer;
+    };
+
+    ScanAggregator() :
+        _used(0),
+        _window_start_ms(0),
+        _evictions(0),
+        _advertisements(0),
+        _dropped(0),
+        _pending(0)
+    {
+        memset(_entries, 0, sizeof(_entries));
+        for (size_t i = 0; i < TableSize; ++i) {
+            _buckets[i] = NO_ENTRY;
+        }
+        _pending_list.newest = _pending_list.oldest = NO_ENTRY;
+        _reported_list.newest = _reported_list.oldest = NO_ENTRY;
+    }
+
+    /**
+     * Account an advertisement.
+     *
+     * @param[in] address Address of the advertiser.
+     * @param[in] address_type Type of the address of the advertiser.
+     * @param[in] rssi Signal strength of the advertisement.
+     * @param[in] payload Advertising payload.
+     * @param[in] length Length of the payload.
+     * @param[in] now_ms Current time.
+     */
+    void observe(
+        const uint8_t address[6], uint8_t address_type, int8_t rssi,
+        const uint8_t *payload, size_t length, uint32_t now_ms
+    ) {
+        ++_advertisements;
+
+        entry_t *entry = find(address, address_type);
+        uint32_t hash = fnv1a(payload, length);
+
+        if (!entry) {
+            entry = evict();
+            memcpy(entry->address, address, 6);
+            entry->address_type = address_type;
+            link(entry);
+            entry->count = 0;
+            entry->payload_changed = true;
+            entry->payload_hash = hash;
+        } else {
+            remove(entry->count ? _pending_list : _reported_list, entry);
+            if (entry->payload_hash != hash) {
+                entry->payload_changed = true;
+                entry->payload_hash = hash;
+            }
+        }
+
+        if (entry->count == 0) {
+            ++_pending;
+            entry->rssi_min = rssi;
+            entry->rssi_max = rssi;
+            entry->rssi_sum = 0;
+        } else {
+            if (rssi < entry->rssi_min) {
+                entry->rssi_min = rssi;
+            }
+            if (rssi > entry->rssi_max) {
+                entry->rssi_max = rssi;
+            }
+        }
+        // the average covers the advertisements counted
+        if (entry->count < UINT16_MAX) {
+            entry->rssi_sum += rssi;
+            ++entry->count;
+        }
+        entry->last_seen_ms = now_ms;
+        push_newest(_pending_list, entry);
+    }
+
+    /**
+     * Number of peers seen in the current window.
+     */
+    size_t pending_records() const
+    {
+        return _pending;
+    }
+
+    /**
+     * Size of the report of the current window.
+     */
+    size_t report_size() const
+    {
+        return REPORT_HEADER_SIZE + pending_records() * REPORT_RECORD_SIZE;
+    }
+
+    /**
+     * Encode the peers seen in the current window.
+     *
+     * Records that do not fit in the buffer stay pending for the next call;
+     * the window is closed once every record has been reported. Callers
+     * drain a window by calling report() until it returns 0.
+     *
+     * @param[out] buffer Destination of the report.
+     * @param[in] size Size of the buffer.
+     * @param[in] now_ms Current time.
+     *
+     * @return The size of the report or 0 if nothing is pending.
+     */
+    size_t report(uint8_t *buffer, size_t size, uint32_t now_ms)
+    {
+        if (size < REPORT_HEADER_SIZE || !_pending) {
+            return 0;
+        }
+
+        uint8_t *p = buffer + REPORT_HEADER_SIZE;
+        uint16_t records = 0;
+
+        for (int16_t i = _pending_list.oldest; i != NO_ENTRY; ) {
+            entry_t &entry = _entries[i];
+            i = entry.newer;
+
+            if ((size_t)(p - buffer) + REPORT_RECORD_SIZE > size) {
+                break;
+            }
+
+            memcpy(p, entry.address, 6);
+            p += 6;
+            *p++ = entry.address_type;
+            *p++ = (uint8_t) entry.rssi_min;
+            *p++ = (uint8_t) entry.rssi_max;
+            *p++ = (uint8_t)(int8_t)(entry.rssi_sum / (int32_t) entry.count);
+            *p++ = entry.count;
+            *p++ = entry.count >> 8;
+            write_le32(p, entry.payload_hash);
+            p += 4;
+            *p++ = entry.payload_changed;
+            ++records;
+
+            entry.count = 0;
+            entry.payload_changed = false;
+            --_pending;
+            remove(_pending_list, &entry);
+            push_newest(_reported_list, &entry);
+        }
+
+        buffer[0] = REPORT_MAGIC;
+        buffer[1] = REPORT_VERSION;
+        buffer[2] = records;
+        buffer[3] = records >> 8;
+        write_le32(buffer + 4, now_ms - _window_start_ms);
+        buffer[8] = _evictions;
+        buffer[9] = _evictions >> 8;
+
+        if (!_pending) {
+            _window_start_ms = now_ms;
+            _evictions = 0;
+        }
+
+        return p - buffer;
+    }
+
+    /**
+     * Number of advertisements observed since construction.
+     */
+    uint32_t advertisements() const
+    {
+        return _advertisements;
+    }
+
+    /**
+     * Number of advertisements dropped with the peer they were pending for.
+     */
+    uint32_t dropped() const
+    {
+        return _dropped;
+    }
+
+    /**
+     * Number of peers evicted in the current window.
+     */
+    uint16_t evictions() const
+    {
+        return _evictions;
+    }
+
+    /**
+     * Hash a payload with 32 bit FNV-1a.
+     */
+    static uint32_t fnv1a(const uint8_t *data, size_t length)
+    {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < length; ++i) {
+            hash ^= data[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+private:
+    static const int16_t NO_ENTRY = -1;
+
+    /**
+     * Entries linked from the most to the least recently seen.
+     */
+    struct list_t {
+        int16_t newest;
+        int16_t oldest;
+    };
+
+    static size_t bucket_of(const uint8_t address[6])
+    {
+        return fnv1a(address, 6) % TableSize;
+    }
+
+    entry_t *find(const uint8_t address[6], uint8_t address_type)
+    {
+        for (int16_t i = _buckets[bucket_of(address)]; i != NO_ENTRY; i = _entries[i].next) {
+            entry_t &entry = _entries[i];
+            if (entry.address_type == address_type &&
+                memcmp(entry.address, address, 6) == 0) {
+                return &entry;
+            }
+        }
+        return NULL;
+    }
+
+    void link(entry_t *entry)
+    {
+        int16_t &head = _buckets[bucket_of(entry->address)];
+        entry->next = head;
+        head = entry - _entries;
+    }
+
+    void unlink(entry_t *entry)
+    {
+        int16_t index = entry - _entries;
+        int16_t *link = &_buckets[bucket_of(entry->address)];
+        while (*link != NO_ENTRY) {
+            if (*link == index) {
+                *link = entry->next;
+                return;
+            }
+            link = &_entries[*link].next;
+        }
+    }
+
+    void push_newest(list_t &list, entry_t *entry)
+    {
+        int16_t index = entry - _entries;
+        entry->older = list.newest;
+        entry->newer = NO_ENTRY;
+        if (list.newest != NO_ENTRY) {
+            _entries[list.newest].newer = index;
+        } else {
+            list.oldest = index;
+        }
+        list.newest = index;
+    }
+
+    void remove(list_t &list, entry_t *entry)
+    {
+        if (entry->older != NO_ENTRY) {
+            _entries[entry->older].newer = entry->newer;
+        } else {
+            list.oldest = entry->newer;
+        }
+        if (entry->newer != NO_ENTRY) {
+            _entries[entry->newer].older = entry->older;
+        } else {
+            list.newest = entry->older;
+        }
+    }
+
+    /**
+     * Return a free entry, else the least recently seen peer already
+     * reported, else the least recently seen peer.
+     */
+    entry_t *evict()
+    {
+        if (_used < TableSize) {
+            return &_entries[_used++];
+        }
+
+        entry_t *victim;
+        if (_reported_list.oldest != NO_ENTRY) {
+            victim = &_entries[_reported_list.oldest];
+            remove(_reported_list, victim);
+        } else {
+            victim = &_entries[_pending_list.oldest];
+            remove(_pending_list, victim);
+            --_pending;
+            _dropped += victim->count;
+        }
+        if (_evictions < UINT16_MAX) {
+            ++_evictions;
+        }
+        unlink(victim);
+        return victim;
+    }
+
+    static void write_le32(uint8_t *dst, uint32_t value)
+    {
+        dst[0] = value;
+        dst[1] = value >> 8;
+        dst[2] = value >> 16;
+        dst[3] = value >> 24;
+    }
+
+    entry_t _entries[TableSize];
+    int16_t _buckets[TableSize];
+    list_t _pending_list;
+    list_t _reported_list;
+    size_t _used;
+    uint32_t _window_start_ms;
+    uint16_t _evictions;
+    uint32_t _advertisements;
+    uint32_t _dropped;
+    size_t _pending;
+};
+
+#endif /* SCAN_AGGREGATOR_H_ */
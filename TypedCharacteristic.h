@@ -0,0 +1,178 @@
+#ifndef TYPED_CHARACTERISTIC_H_
+#define TYPED_CHARACTERISTIC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <limits>
+#include <type_traits>
+
+#include "platform/NonCopyable.h"
+
+#include "ble/GattCharacteristic.h"
+#include "ble/GattServer.h"
+
+/**
+ * Little endian encoding of an integral value.
+ *
+ * The loops run over sizeof(T) and are unrolled by the compiler; single
+ * byte values compile to a plain store.
+ */
+template<typename T>
+struct LittleEndianCodec {
+    static_assert(std::is_integral<T>::value, "only integral values are supported");
+
+    typedef typename std::make_unsigned<T>::type raw_t;
+
+    static const size_t SIZE = sizeof(T);
+
+    static void encode(T value, uint8_t *dst)
+    {
+        raw_t raw = static_cast<raw_t>(value);
+        for (size_t i = 0; i < SIZE; ++i) {
+            dst[i] = static_cast<uint8_t>(raw >> (8 * i));
+        }
+    }
+
+    static T decode(const uint8_t *src)
+    {
+        raw_t raw = 0;
+        for (size_t i = 0; i < SIZE; ++i) {
+            raw |= static_cast<raw_t>(src[i]) << (8 * i);
+        }
+        return static_cast<T>(raw);
+    }
+};
+
+/**
+ * Characteristic holding a single value of type T.
+ *
+ * The value is stored in its little endian wire format. When the properties
+ * allow writes, a write authorization handler generated from Min and Max
+ * rejects writes at an offset, of the wrong length or out of bounds before
+ * they reach the GattServer.
+ *
+ * @tparam T Integral type of the value.
+ * @tparam Properties GattCharacteristic::Properties_t flags of the
+ * characteristic.
+ * @tparam Min Smallest value accepted from clients.
+ * @tparam Max Largest value accepted from clients.
+ */
+template<
+    typename T,
+    uint8_t Properties,
+    T Min = std::numeric_limits<T>::min(),
+    T Max = std::numeric_limits<T>::max()
+>
+class TypedCharacteristic :
+    public GattCharacteristic,
+    private mbed::NonCopyable<TypedCharacteristic<T, Properties, Min, Max> > {
+    typedef TypedCharacteristic Self;
+    typedef LittleEndianCodec<T> codec_t;
+
+    static_assert(Min <= Max, "invalid bounds");
+
+public:
+    static const size_t VALUE_SIZE = codec_t::SIZE;
+
+    static const bool WRITABLE = (Properties & (
+        GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE |
+        GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE
+    )) != 0;
+
+    /**
+     * Construct the characteristic.
+     *
+     * @param[in] uuid The UUID of the characteristic.
+     * @param[in] initial_value Initial value contained by the characteristic.
+     */
+    TypedCharacteristic(const UUID &uuid, T initial_value) :
+        GattCharacteristic(
+            /* UUID */ uuid,
+            /* Initial value */ _value,
+            /* Value size */ VALUE_SIZE,
+            /* Value capacity */ VALUE_SIZE,
+            /* Properties */ Properties,
+            /* Descriptors */ NULL,
+            /* Num descriptors */ 0,
+            /* variable len */ false
+        )
+    {
+        codec_t::encode(initial_value, _value);
+        if (WRITABLE) {
+            setWriteAuthorizationCallback(this, &Self::authorize_write);
+        }
+    }
+
+    /**
+     * Get the value of this characteristic.
+     *
+     * @param[in] server GattServer instance that contain the characteristic
+     * value.
+     * @param[out] dst Variable that will receive the characteristic value.
+     *
+     * @return BLE_ERROR_NONE in case of success or an appropriate error code.
+     */
+    ble_error_t get(GattServer &server, T &dst) const
+    {
+        uint8_t raw[VALUE_SIZE];
+        uint16_t value_length = VALUE_SIZE;
+
+        ble_error_t err = server.read(getValueHandle(), raw, &value_length);
+        if (err) {
+            return err;
+        }
+
+        dst = codec_t::decode(raw);
+        return BLE_ERROR_NONE;
+    }
+
+    /**
+     * Assign a new value to this characteristic.
+     *
+     * @param[in] server GattServer instance that will receive the new value.
+     * @param[in] value The new value to set.
+     * @param[in] local_only Flag that determine if the change should be kept
+     * locally or forwarded to subscribed clients.
+     */
+    ble_error_t set(GattServer &server, T value, bool local_only = false) const
+    {
+        uint8_t raw[VALUE_SIZE];
+        codec_t::encode(value, raw);
+        return server.write(getValueHandle(), raw, VALUE_SIZE, local_only);
+    }
+
+    /**
+     * Check a value written by a client.
+     *
+     * @return The authorization reply for the write.
+     */
+    static GattAuthCallbackReply_t validate(
+        uint16_t offset, uint16_t length, const uint8_t *data
+    ) {
+        if (offset != 0) {
+            return AUTH_CALLBACK_REPLY_ATTERR_INVALID_OFFSET;
+        }
+
+        if (length != VALUE_SIZE) {
+            return AUTH_CALLBACK_REPLY_ATTERR_INVALID_ATT_VAL_LENGTH;
+        }
+
+        T value = codec_t::decode(data);
+        if (value < Min || value > Max) {
+            return AUTH_CALLBACK_REPLY_ATTERR_WRITE_NOT_PERMITTED;
+        }
+
+        return AUTH_CALLBACK_REPLY_SUCCESS;
+    }
+
+private:
+    void authorize_write(GattWriteAuthCallbackParams *e)
+    {
+        e->authorizationReply = validate(e->offset, e->len, e->data);
+    }
+
+    uint8_t _value[VALUE_SIZE];
+};
+
+#endif /* TYPED_CHARACTERISTIC_H_ */
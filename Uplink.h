@@ -0,0 +1,605 @@
+#ifndef UPLINK_H_
+#define UPLINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wifi.h"
+
+#include "events/EventQueue.h"
+#include "hal/us_ticker_api.h"
+#include "platform/Callback.h"
+#include "platform/NonCopyable.h"
+#include "rtos/Kernel.h"
+
+#include "BinaryLog.h"
+#include "EventQueueMonitor.h"
+#include "MetricReporter.h"
+#include "Metrics.h"
+#include "UplinkCodec.h"
+#include "UplinkFrame.h"
+#include "UplinkStore.h"
+
+#ifndef MBED_CONF_APP_UPLINK_FLUSH_DELAY_MS
+#define MBED_CONF_APP_UPLINK_FLUSH_DELAY_MS 200
+#endif
+
+#ifndef MBED_CONF_APP_UPLINK_ACK_POLL_MS
+#define MBED_CONF_APP_UPLINK_ACK_POLL_MS 500
+#endif
+
+#ifndef MBED_CONF_APP_UPLINK_PACK
+#define MBED_CONF_APP_UPLINK_PACK 2
+#endif
+
+/**
+ * Framed uplink of the node to the collector (see UplinkFrame.h).
+ *
+ * Records are gathered in a frame for MBED_CONF_APP_UPLINK_FLUSH_DELAY_MS
+ * after the first one, or until the next record does not fit, and the
+ * frame is sent with a single module command. Every frame carries the node
+ * id, derived from the MAC address of the wifi module, and a sequence
+ * number, so the collector can count the frames lost.
+ *
+ * After a send the module is polled for the cumulative acks of the
+ * collector; the time between the send of a frame and its ack is the end
+ * to end latency of the uplink. Polling stops once every frame is acked or
+ * after a few polls without progress, so a collector that does not ack
+ * costs a bounded number of module commands per frame.
+ *
+ * Frames are packed before they are sent (see UplinkCodec.h) unless
+ * packing does not make them smaller; MBED_CONF_APP_UPLINK_PACK selects
+ * no packing (0), packing of the record headers and payloads (1) or
+ * packing followed by LZ compression (2).
+ *
+ * With a store, the records that cannot be sent are kept in flash, either
+ * while the socket is down or when the send of their frame fails. After the
+ * next successful send the store is drained in full frames, one after the
+ * other, each released once sent. The records stored are sent at least
+ * once.
+ *
+ * With a metric reporter, the duration of the sends and the ack latency
+ * are sampled for its windowed statistics.
+ *
+ * The socket is set by the owner of the link (see LinkSupervisor.h) as it
+ * goes down and up. While it is down the frame pending and the records
+ * appended go to the store; when it is back a hello record is sent and the
+ * store is drained.
+ *
+ * Every function except send() runs on the lane performing the wifi I/O.
+ */
+class Uplink : private mbed::NonCopyable<Uplink> {
+    typedef Uplink Self;
+
+public:
+    /**
+     * Largest frame; the size of a wifi module send command.
+     */
+    static const size_t MAX_FRAME_SIZE = ES_WIFI_PAYLOAD_SIZE;
+
+    /**
+     * Largest record payload.
+     */
+    static const size_t MAX_RECORD_SIZE = MAX_FRAME_SIZE -
+        UplinkFrame::HEADER_SIZE - UplinkFrame::RECORD_HEADER_SIZE - UplinkFrame::CRC_SIZE;
+
+    /**
+     * Largest record payload posted from another lane with send().
+     */
+    static const size_t SMALL_RECORD_SIZE = 16;
+
+    /**
+     * Module timeouts of a send and of a read.
+     */
+    static const uint32_t WRITE_TIMEOUT_MS = 100;
+    static const uint32_t READ_TIMEOUT_MS = 10;
+
+    /**
+     * Polls without a new ack after which polling stops, and module reads
+     * per poll.
+     */
+    static const uint32_t MAX_IDLE_POLLS = 4;
+    static const size_t MAX_READS_PER_POLL = 4;
+
+    /**
+     * Construct the uplink of a module socket and queue a hello record if
+     * it is connected.
+     *
+     * @param[in] wifi_queue Queue of the lane performing the wifi I/O.
+     * @param[in] Socket Module socket connected to the collector; -1 until
+     * set_socket() is called, records are then stored.
+     * @param[in] mac MAC address of the wifi module.
+     * @param[in] store Store of the records not sent, started; NULL to drop
+     * them.
+     * @param[in] metrics Reporter of the send and ack latencies; NULL if
+     * they are not sampled.
+     */
+    Uplink(
+        events::EventQueue &wifi_queue,
+        int32_t Socket,
+        const uint8_t mac[6],
+        UplinkStore *store = NULL,
+        MetricReporter *metrics = NULL
+    ) :
+        _queue(wifi_queue),
+        _socket(Socket),
+        _store(store),
+        _metrics(metrics),
+        _node_id(UplinkFrame::read_le32(mac + 2)),
+        _writer(_frame, sizeof(_frame)),
+#if MBED_CONF_APP_UPLINK_PACK
+        _packer(MBED_CONF_APP_UPLINK_PACK >= 2),
+#endif
+        _sequence(0),
+        _acked(UINT32_MAX),
+        _flush_event(0),
+        _ack_event(0),
+        _drain_event(0),
+        _idle_polls(0),
+        _rx_length(0),
+        _frames_sent(0),
+        _records(0),
+        _records_drained(0),
+        _bytes_sent(0),
+        _send_errors(0),
+        _records_dropped(0),
+        _rtt_total_ms(0),
+        _rtt_samples(0),
+        _rtt_max_ms(0),
+        _frames_packed(0),
+        _bytes_built(0),
+        _pack_us(0)
+    {
+        memcpy(_mac, mac, sizeof(_mac));
+        if (_socket >= 0) {
+            append(UplinkFrame::RECORD_HELLO, _mac, sizeof(_mac));
+        }
+    }
+
+    /**
+     * Subscription to the result of each frame send, for the owner of the
+     * link.
+     */
+    void on_send(mbed::Callback<void(bool)> cb)
+    {
+        _send_cb = cb;
+    }
+
+    /**
+     * Change the module socket connected to the collector.
+     *
+     * On disconnection (-1) the frame pending is moved to the store. On
+     * connection a hello record is sent and the store drained.
+     *
+     * This function is meant to be passed to
+     * LinkSupervisor::on_socket_change.
+     */
+    void set_socket(int32_t socket)
+    {
+        if (socket == _socket) {
+            return;
+        }
+        _socket = socket;
+        if (_ack_event) {
+            EventQueueMonitor::cancel(_queue, _ack_event);
+            _ack_event = 0;
+        }
+        _rx_length = 0;
+        if (_socket < 0) {
+            flush();
+            return;
+        }
+
+        append(UplinkFrame::RECORD_HELLO, _mac, sizeof(_mac));
+        if (_store && !_store->empty() && !_drain_event) {
+            _drain_event = EventQueueMonitor::call(
+                _queue,
+                EventQueueMonitor::EVENT_UPLINK,
+                mbed::callback(this, &Self::drain)
+            );
+        }
+    }
+
+    /**
+     * Whether the module socket is connected to the collector.
+     */
+    bool connected() const
+    {
+        return _socket >= 0;
+    }
+
+    /**
+     * Queue of the lane performing the wifi I/O.
+     */
+    events::EventQueue &queue()
+    {
+        return _queue;
+    }
+
+    /**
+     * Post a small record from any lane.
+     *
+     * @return false if the record is too large or the queue is full.
+     */
+    bool send(uint8_t type, const uint8_t *payload, size_t length)
+    {
+        small_record_t record;
+        if (length > sizeof(record.payload)) {
+            return false;
+        }
+        record.type = type;
+        record.length = length;
+        memcpy(record.payload, payload, length);
+        return _queue.call(this, &Self::append_small, record) != 0;
+    }
+
+    /**
+     * Add a record to the current frame.
+     *
+     * The frame pending is sent first if the record does not fit. The
+     * record goes to the store if the socket is not connected.
+     */
+    void append(uint8_t type, const uint8_t *payload, size_t length)
+    {
+        uint32_t now_ms = (uint32_t) rtos::Kernel::get_ms_count();
+        if (length > MAX_RECORD_SIZE) {
+            ++_records_dropped;
+            Metrics::increment(Metrics::COUNTER_UPLINK_RECORDS_DROPPED);
+            return;
+        }
+        if (_socket < 0) {
+            store(type, now_ms, payload, length);
+            return;
+        }
+
+        if (_writer.record_count() && !_writer.fits(length)) {
+            flush();
+        }
+        if (!_writer.record_count()) {
+            _writer.begin(_node_id, _sequence, now_ms);
+            _flush_event = EventQueueMonitor::call_in(
+                _queue,
+                EventQueueMonitor::EVENT_UPLINK,
+                MBED_CONF_APP_UPLINK_FLUSH_DELAY_MS,
+                mbed::callback(this, &Self::when_flush_delay)
+            );
+        }
+        _writer.append(type, payload, length, now_ms);
+        ++_records;
+    }
+
+    /**
+     * Send the current frame now.
+     */
+    void flush()
+    {
+        if (_flush_event) {
+            EventQueueMonitor::cancel(_queue, _flush_event);
+            _flush_event = 0;
+        }
+
+        size_t length = _writer.finish();
+        if (!length) {
+            return;
+        }
+
+        if (_socket < 0 || !send_frame(length)) {
+            spill(length);
+            return;
+        }
+        if (_store && !_store->empty() && !_drain_event) {
+            _drain_event = EventQueueMonitor::call(
+                _queue,
+                EventQueueMonitor::EVENT_UPLINK,
+                mbed::callback(this, &Self::drain)
+            );
+        }
+    }
+
+    /**
+     * Sequence number of the last frame acked by the collector.
+     */
+    uint32_t acked_sequence() const
+    {
+        return _acked;
+    }
+
+    void print_stats() const
+    {
+        printf(
+            "uplink: %lu frames, %lu records (%lu from the store), %lu bytes, %lu send errors, %lu records dropped\r\n",
+            (unsigned long) _frames_sent,
+            (unsigned long) _records,
+            (unsigned long) _records_drained,
+            (unsigned long) _bytes_sent,
+            (unsigned long) _send_errors,
+            (unsigned long) _records_dropped
+        );
+        printf(
+            "\tacked up to %ld of %ld, ack latency mean %lu max %lu ms\r\n",
+            (long)(int32_t) _acked,
+            (long)(int32_t)(_sequence - 1),
+            (unsigned long)(_rtt_samples ? _rtt_total_ms / _rtt_samples : 0),
+            (unsigned long) _rtt_max_ms
+        );
+        printf(
+            "\t%lu frames packed, %lu bytes built for %lu sent (%lu%%), packing %lu us per frame\r\n",
+            (unsigned long) _frames_packed,
+            (unsigned long) _bytes_built,
+            (unsigned long) _bytes_sent,
+            (unsigned long)(_bytes_built ? (uint64_t) _bytes_sent * 100 / _bytes_built : 0),
+            (unsigned long)(_frames_sent + _send_errors ? _pack_us / (_frames_sent + _send_errors) : 0)
+        );
+    }
+
+private:
+    struct small_record_t {
+        uint8_t type;
+        uint8_t length;
+        uint8_t payload[SMALL_RECORD_SIZE];
+    };
+
+    void append_small(small_record_t record)
+    {
+        append(record.type, record.payload, record.length);
+    }
+
+    void when_flush_delay()
+    {
+        _flush_event = 0;
+        flush();
+    }
+
+    /**
+     * Send the frame held in the frame buffer.
+     *
+     * @return false if the send failed; the sequence number is reused.
+     */
+    bool send_frame(size_t length)
+    {
+        uint8_t *data = _frame;
+#if MBED_CONF_APP_UPLINK_PACK
+        uint32_t start_us = us_ticker_read();
+        size_t packed = _packer.pack(_frame, length, _packed);
+        _pack_us += us_ticker_read() - start_us;
+        if (packed) {
+            data = _packed;
+            length = packed;
+        }
+#endif
+
+        uint32_t sequence = _sequence;
+        uint16_t sent = 0;
+        uint32_t send_us = us_ticker_read();
+        WIFI_Status_t status = WIFI_SendData(_socket, data, length, &sent, WRITE_TIMEOUT_MS);
+        if (_metrics) {
+            _metrics->observe(MetricReporter::METRIC_UPLINK_SEND_US, us_ticker_read() - send_us);
+        }
+        if (_send_cb) {
+            _send_cb(status == WIFI_STATUS_OK);
+        }
+        if (status != WIFI_STATUS_OK) {
+            ++_send_errors;
+            Metrics::increment(Metrics::COUNTER_UPLINK_SEND_ERRORS);
+            LOG_ERROR(LOG_MODULE_WIFI, "> ERROR : Failed to send uplink frame %u.\n", (unsigned) sequence);
+            return false;
+        }
+        ++_sequence;
+        ++_frames_sent;
+        _bytes_sent += sent;
+        Metrics::increment(Metrics::COUNTER_UPLINK_BYTES_SENT, sent);
+        _bytes_built += UplinkFrame::read_le16(_frame + 2);
+        _frames_packed += data != _frame;
+        _send_times_ms[sequence % SEND_TIMES] = (uint32_t) rtos::Kernel::get_ms_count();
+
+        _idle_polls = 0;
+        if (!_ack_event) {
+            _ack_event = EventQueueMonitor::call_in(
+                _queue,
+                EventQueueMonitor::EVENT_UPLINK,
+                MBED_CONF_APP_UPLINK_ACK_POLL_MS,
+                mbed::callback(this, &Self::poll_acks)
+            );
+        }
+        return true;
+    }
+
+    void store(uint8_t type, uint32_t timestamp_ms, const uint8_t *payload, size_t length)
+    {
+        if (!_store || !_store->push(type, timestamp_ms, payload, length)) {
+            ++_records_dropped;
+            Metrics::increment(Metrics::COUNTER_UPLINK_RECORDS_DROPPED);
+        }
+    }
+
+    /**
+     * Move the records of a frame that could not be sent to the store.
+     */
+    void spill(size_t length)
+    {
+        UplinkFrame::header_t header;
+        if (!UplinkFrame::decode_header(_frame, length, header)) {
+            return;
+        }
+        UplinkFrame::RecordIterator records(_frame, header);
+        uint8_t type;
+        uint16_t age_ms;
+        const uint8_t *payload;
+        uint16_t record_length;
+        while (records.next(type, age_ms, payload, record_length)) {
+            store(type, header.timestamp_ms + age_ms, payload, record_length);
+        }
+    }
+
+    /**
+     * Send a full frame of stored records and come back for the next one
+     * until the store is empty.
+     */
+    void drain()
+    {
+        _drain_event = 0;
+
+        // the records waiting in the frame buffer go first
+        flush();
+        if (_socket < 0 || _store->empty()) {
+            return;
+        }
+
+        UplinkStore::record_t record;
+        uint32_t frame_ms = 0;
+        while (_store->peek(record)) {
+            if (!_writer.record_count()) {
+                _writer.begin(_node_id, _sequence, record.timestamp_ms);
+                frame_ms = record.timestamp_ms;
+            } else if (record.timestamp_ms - frame_ms > UINT16_MAX) {
+                // the age of the record cannot be encoded in this frame
+                break;
+            }
+            uint8_t *payload = _writer.reserve(record.type, record.length, record.timestamp_ms);
+            if (!payload) {
+                break;
+            }
+            if (!_store->read(record, payload)) {
+                _writer.finish();
+                _store->rewind();
+                return;
+            }
+        }
+
+        size_t records = _writer.record_count();
+        size_t length = _writer.finish();
+        if (!length) {
+            return;
+        }
+        if (!send_frame(length)) {
+            _store->rewind();
+            return;
+        }
+        _store->commit();
+        _records += records;
+        _records_drained += records;
+
+        if (!_store->empty()) {
+            _drain_event = EventQueueMonitor::call(
+                _queue,
+                EventQueueMonitor::EVENT_UPLINK,
+                mbed::callback(this, &Self::drain)
+            );
+        }
+    }
+
+    /**
+     * Read the acks received by the module.
+     */
+    void poll_acks()
+    {
+        _ack_event = 0;
+        if (_socket < 0) {
+            return;
+        }
+
+        uint32_t acked = _acked;
+        // the acks are cumulative: drain the module to reach the last one
+        for (size_t read = 0; read < MAX_READS_PER_POLL; ++read) {
+            uint16_t requested = sizeof(_rx) - _rx_length;
+            uint16_t received = 0;
+            if (WIFI_ReceiveData(
+                    _socket, _rx + _rx_length, requested, &received, READ_TIMEOUT_MS
+                ) != WIFI_STATUS_OK) {
+                break;
+            }
+            _rx_length += received;
+
+            size_t offset = 0;
+            while (_rx_length - offset >= UplinkFrame::ACK_SIZE) {
+                uint32_t sequence;
+                if (UplinkFrame::decode_ack(_rx + offset, sequence)) {
+                    when_ack(sequence);
+                    offset += UplinkFrame::ACK_SIZE;
+                } else {
+                    // resynchronize on the next magic
+                    ++offset;
+                }
+            }
+            memmove(_rx, _rx + offset, _rx_length - offset);
+            _rx_length -= offset;
+
+            if (received < requested) {
+                break;
+            }
+        }
+
+        _idle_polls = _acked != acked ? 0 : _idle_polls + 1;
+        if (_acked != _sequence - 1 && _idle_polls < MAX_IDLE_POLLS) {
+            _ack_event = EventQueueMonitor::call_in(
+                _queue,
+                EventQueueMonitor::EVENT_UPLINK,
+                MBED_CONF_APP_UPLINK_ACK_POLL_MS,
+                mbed::callback(this, &Self::poll_acks)
+            );
+        }
+    }
+
+    void when_ack(uint32_t sequence)
+    {
+        // ignore stale acks and acks of frames not sent yet
+        if ((int32_t)(sequence - _acked) <= 0 || (int32_t)(sequence - _sequence) >= 0) {
+            return;
+        }
+        _acked = sequence;
+
+        if (_sequence - sequence <= SEND_TIMES) {
+            uint32_t rtt_ms = (uint32_t) rtos::Kernel::get_ms_count() - _send_times_ms[sequence % SEND_TIMES];
+            _rtt_total_ms += rtt_ms;
+            ++_rtt_samples;
+            if (rtt_ms > _rtt_max_ms) {
+                _rtt_max_ms = rtt_ms;
+            }
+            if (_metrics) {
+                _metrics->observe(MetricReporter::METRIC_UPLINK_ACK_MS, rtt_ms);
+            }
+        }
+    }
+
+    static const size_t SEND_TIMES = 8;
+
+    events::EventQueue &_queue;
+    int32_t _socket;
+    UplinkStore *_store;
+    MetricReporter *_metrics;
+    mbed::Callback<void(bool)> _send_cb;
+    uint8_t _mac[6];
+    uint32_t _node_id;
+    uint8_t _frame[MAX_FRAME_SIZE];
+    UplinkFrameWriter _writer;
+#if MBED_CONF_APP_UPLINK_PACK
+    UplinkPacker<MAX_FRAME_SIZE> _packer;
+    uint8_t _packed[MAX_FRAME_SIZE];
+#endif
+    uint32_t _sequence;
+    uint32_t _acked;
+    int _flush_event;
+    int _ack_event;
+    int _drain_event;
+    uint32_t _idle_polls;
+    uint8_t _rx[16 * UplinkFrame::ACK_SIZE];
+    size_t _rx_length;
+    uint32_t _send_times_ms[SEND_TIMES];
+
+    uint32_t _frames_sent;
+    uint32_t _records;
+    uint32_t _records_drained;
+    uint32_t _bytes_sent;
+    uint32_t _send_errors;
+    uint32_t _records_dropped;
+    uint32_t _rtt_total_ms;
+    uint32_t _rtt_samples;
+    uint32_t _rtt_max_ms;
+    uint32_t _frames_packed;
+    uint32_t _bytes_built;
+    uint32_t _pack_us;
+};
+
+#endif /* UPLINK_H_ */
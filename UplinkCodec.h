@@ -0,0 +1,773 @@
+#ifndef UPLINK_CODEC_H_
+#define UPLINK_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ScanAggregator.h"
+#include "UplinkFrame.h"
+
+/**
+ * Packed encoding of the uplink frames.
+ *
+ * A packed frame keeps the header and the CRC of a frame (see
+ * UplinkFrame.h) with version 2, the length of the packed frame and a
+ * packed record section:
+ *   - flags (1); with FLAG_LZ the section is compressed: length of the
+ *     section once decompressed (varint), LZ stream;
+ *   - per record: type (1) with the transform in the top two bits, age as
+ *     the zigzag varint of its delta of delta to the previous records,
+ *     payload length once decoded (varint), payload.
+ *
+ * Payload transforms:
+ *   - TRANSFORM_DELTA: payload of 32 bit words, each as the zigzag varint
+ *     of its difference to the same word of the previous record of the
+ *     same type and length in the frame, so counters sampled in
+ *     consecutive records take a byte or two per word;
+ *   - TRANSFORM_DELTA_OF_DELTA: the same with the difference of the two
+ *     previous records subtracted, so clocks and counters moving at a
+ *     steady rate take a byte per word;
+ *   - TRANSFORM_SCAN_FIELDS: gateway scan report (see ScanAggregator.h)
+ *     with its counts as varints and the RSSI of each peer relative to the
+ *     previous one.
+ * The packer picks the smallest encoding of each record.
+ *
+ * The LZ stream is a sequence of literal runs and matches: token (1) with
+ * the literal count and the match length minus 4 in its high and low
+ * nibbles, 255 bytes extending a nibble of 15, literals, match offset (2),
+ * extension of the match length. The last literal run has no match.
+ *
+ * Record types must stay below 64. Packing is lossless: the collector
+ * unpacks a frame to the frame the node built.
+ *
+ * The codec does not depend on mbed so the collector uses it on the host.
+ */
+class UplinkCodec {
+public:
+    static const uint8_t VERSION = 2;
+
+    static const uint8_t FLAG_LZ = 0x01;
+
+    static const uint8_t TYPE_MASK = 0x3F;
+    static const uint8_t TRANSFORM_MASK = 0xC0;
+    static const uint8_t TRANSFORM_NONE = 0x00;
+    static const uint8_t TRANSFORM_SCAN_FIELDS = 0x40;
+    static const uint8_t TRANSFORM_DELTA = 0x80;
+    static const uint8_t TRANSFORM_DELTA_OF_DELTA = 0xC0;
+
+    /**
+     * Size of the flags of the record section.
+     */
+    static const size_t FLAGS_SIZE = 1;
+
+    static const size_t MAX_VARINT_SIZE = 5;
+
+    static const size_t LZ_HASH_BITS = 8;
+    static const size_t LZ_HASH_SIZE = 1 << LZ_HASH_BITS;
+    static const size_t LZ_MIN_MATCH = 4;
+
+    /**
+     * Offsets in a frame of the last two payloads of each record type, 0
+     * if none; the payload before the last one only if both have the same
+     * length.
+     */
+    struct history_t {
+        uint16_t last[TYPE_MASK + 1];
+        uint16_t before[TYPE_MASK + 1];
+        uint16_t length[TYPE_MASK + 1];
+    };
+
+    static void remember(history_t &history, uint8_t type, size_t offset, size_t length)
+    {
+        history.before[type] =
+            history.last[type] && history.length[type] == length ? history.last[type] : 0;
+        history.last[type] = offset;
+        history.length[type] = length;
+    }
+
+    static uint32_t zigzag(int32_t value)
+    {
+        return ((uint32_t) value << 1) ^ (uint32_t)(value >> 31);
+    }
+
+    static int32_t unzigzag(uint32_t value)
+    {
+        return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+    }
+
+    /**
+     * Write an unsigned LEB128 varint.
+     *
+     * @return The number of bytes written, 0 if it does not fit.
+     */
+    static size_t write_varint(uint8_t *dst, const uint8_t *end, uint32_t value)
+    {
+        uint8_t *p = dst;
+        do {
+            if (p == end) {
+                return 0;
+            }
+            uint8_t byte = value & 0x7F;
+            value >>= 7;
+            *p++ = byte | (value ? 0x80 : 0);
+        } while (value);
+        return p - dst;
+    }
+
+    /**
+     * Append a varint after a previous put_varint(), which returned NULL if
+     * it did not fit.
+     */
+    static uint8_t *put_varint(uint8_t *out, const uint8_t *end, uint32_t value)
+    {
+        if (!out) {
+            return NULL;
+        }
+        size_t written = write_varint(out, end, value);
+        return written ? out + written : NULL;
+    }
+
+    /**
+     * Read an unsigned LEB128 varint of 32 bits at most.
+     */
+    static bool read_varint(const uint8_t *&p, const uint8_t *end, uint32_t &value)
+    {
+        value = 0;
+        for (size_t shift = 0; shift < 7 * MAX_VARINT_SIZE; shift += 7) {
+            if (p == end) {
+                return false;
+            }
+            uint8_t byte = *p++;
+            if (shift == 28 && byte > 0x0F) {
+                return false;
+            }
+            value |= (uint32_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Compress a block.
+     *
+     * @param[in] table Hash table of LZ_HASH_SIZE entries.
+     *
+     * @return The size of the stream, 0 if it does not fit.
+     */
+    static size_t lz_compress(
+        const uint8_t *src, size_t length, uint8_t *dst, size_t size, uint16_t *table
+    ) {
+        memset(table, 0, LZ_HASH_SIZE * sizeof(table[0]));
+
+        uint8_t *out = dst;
+        uint8_t *end = dst + size;
+        size_t anchor = 0;
+        size_t i = 0;
+        while (i + LZ_MIN_MATCH <= length) {
+            uint32_t sequence = UplinkFrame::read_le32(src + i);
+            size_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+            size_t candidate = table[hash];
+            table[hash] = i + 1;
+
+            if (!candidate || UplinkFrame::read_le32(src + candidate - 1) != sequence ||
+                i - (candidate - 1) > UINT16_MAX) {
+                ++i;
+                continue;
+            }
+
+            size_t match = candidate - 1;
+            size_t match_length = LZ_MIN_MATCH;
+            while (i + match_length < length && src[match + match_length] == src[i + match_length]) {
+                ++match_length;
+            }
+            out = lz_sequence(out, end, src + anchor, i - anchor, i - match, match_length);
+            if (!out) {
+                return 0;
+            }
+            i += match_length;
+            anchor = i;
+        }
+
+        out = lz_sequence(out, end, src + anchor, length - anchor, 0, 0);
+        return out ? out - dst : 0;
+    }
+
+    /**
+     * Decompress a block.
+     *
+     * @return The size of the block, 0 if the stream is corrupt or the
+     * block larger than size.
+     */
+    static size_t lz_decompress(const uint8_t *src, size_t length, uint8_t *dst, size_t size)
+    {
+        const uint8_t *in = src;
+        const uint8_t *in_end = src + length;
+        uint8_t *out = dst;
+        uint8_t *out_end = dst + size;
+
+        while (in < in_end) {
+            uint8_t token = *in++;
+            size_t literals = token >> 4;
+            if (!lz_length(in, in_end, literals) ||
+                (size_t)(in_end - in) < literals || (size_t)(out_end - out) < literals) {
+                return 0;
+            }
+            memcpy(out, in, literals);
+            in += literals;
+            out += literals;
+            if (in == in_end) {
+                break;
+            }
+
+            if (in_end - in < 2) {
+                return 0;
+            }
+            size_t offset = UplinkFrame::read_le16(in);
+            in += 2;
+            size_t match_length = token & 0x0F;
+            if (!lz_length(in, in_end, match_length)) {
+                return 0;
+            }
+            match_length += LZ_MIN_MATCH;
+            if (!offset || offset > (size_t)(out - dst) || (size_t)(out_end - out) < match_length) {
+                return 0;
+            }
+            // byte by byte: a match may overlap its own output
+            const uint8_t *from = out - offset;
+            for (size_t k = 0; k < match_length; ++k) {
+                *out++ = *from++;
+            }
+        }
+        return out - dst;
+    }
+
+    /**
+     * Unpack a packed frame checked by check_packed() to the frame the node
+     * built.
+     *
+     * @param[out] frame Destination of the frame.
+     * @param[in] scratch Buffer holding the decompressed record section.
+     *
+     * @return The size of the frame, 0 if the packed frame is corrupt or the
+     * frame larger than size.
+     */
+    static size_t unpack(
+        const uint8_t *packed, size_t length,
+        uint8_t *frame, size_t size,
+        uint8_t *scratch, size_t scratch_size
+    ) {
+        if (length < UplinkFrame::HEADER_SIZE + FLAGS_SIZE + UplinkFrame::CRC_SIZE ||
+            size < UplinkFrame::HEADER_SIZE + UplinkFrame::CRC_SIZE) {
+            return 0;
+        }
+
+        const uint8_t *p = packed + UplinkFrame::HEADER_SIZE;
+        const uint8_t *end = packed + length - UplinkFrame::CRC_SIZE;
+        uint8_t flags = *p++;
+        if (flags & FLAG_LZ) {
+            uint32_t section_length;
+            if (!read_varint(p, end, section_length) || section_length > scratch_size ||
+                lz_decompress(p, end - p, scratch, scratch_size) != section_length) {
+                return 0;
+            }
+            p = scratch;
+            end = scratch + section_length;
+        }
+
+        memcpy(frame, packed, UplinkFrame::HEADER_SIZE);
+        frame[1] = UplinkFrame::VERSION;
+        uint8_t *out = frame + UplinkFrame::HEADER_SIZE;
+        uint8_t *out_end = frame + size - UplinkFrame::CRC_SIZE;
+
+        history_t history;
+        memset(&history, 0, sizeof(history));
+        // modulo 2^32 so corrupt input cannot overflow; ages are 16 bits
+        uint32_t age = 0;
+        uint32_t delta = 0;
+        for (size_t record = 0; record < packed[16]; ++record) {
+            uint32_t dod;
+            uint32_t payload_length;
+            if (p == end) {
+                return 0;
+            }
+            uint8_t type = *p++;
+            if (!read_varint(p, end, dod) || !read_varint(p, end, payload_length) ||
+                (size_t)(out_end - out) < UplinkFrame::RECORD_HEADER_SIZE ||
+                (size_t)(out_end - out) - UplinkFrame::RECORD_HEADER_SIZE < payload_length) {
+                return 0;
+            }
+            delta += (uint32_t) unzigzag(dod);
+            age += delta;
+
+            out[0] = type & TYPE_MASK;
+            UplinkFrame::write_le16(out + 1, age);
+            UplinkFrame::write_le16(out + 3, payload_length);
+            uint8_t *payload = out + UplinkFrame::RECORD_HEADER_SIZE;
+
+            uint8_t record_type = type & TYPE_MASK;
+            bool decoded;
+            switch (type & TRANSFORM_MASK) {
+                case TRANSFORM_SCAN_FIELDS:
+                    decoded = unpack_scan_fields(p, end, payload, payload_length);
+                    break;
+                case TRANSFORM_DELTA:
+                case TRANSFORM_DELTA_OF_DELTA: {
+                    bool dod = (type & TRANSFORM_MASK) == TRANSFORM_DELTA_OF_DELTA;
+                    decoded = history.last[record_type] && history.length[record_type] == payload_length &&
+                        (!dod || history.before[record_type]) &&
+                        unpack_words(
+                            p, end, payload, payload_length,
+                            frame + history.last[record_type],
+                            dod ? frame + history.before[record_type] : NULL
+                        );
+                    break;
+                }
+                default:
+                    decoded = (size_t)(end - p) >= payload_length;
+                    if (decoded) {
+                        memcpy(payload, p, payload_length);
+                        p += payload_length;
+                    }
+                    break;
+            }
+            if (!decoded) {
+                return 0;
+            }
+            remember(history, record_type, payload - frame, payload_length);
+            out = payload + payload_length;
+        }
+        if (p != end) {
+            return 0;
+        }
+
+        size_t frame_length = out - frame + UplinkFrame::CRC_SIZE;
+        UplinkFrame::write_le16(frame + 2, frame_length);
+        UplinkFrame::write_le32(out, UplinkFrame::crc32(frame, out - frame));
+        return frame_length;
+    }
+
+    /**
+     * Check the magic, the length and the CRC of a packed frame.
+     */
+    static bool check_packed(const uint8_t *packed, size_t length)
+    {
+        return length >= UplinkFrame::HEADER_SIZE + FLAGS_SIZE + UplinkFrame::CRC_SIZE &&
+            packed[0] == UplinkFrame::FRAME_MAGIC && packed[1] == VERSION &&
+            UplinkFrame::read_le16(packed + 2) == length &&
+            UplinkFrame::crc32(packed, length - UplinkFrame::CRC_SIZE) ==
+                UplinkFrame::read_le32(packed + length - UplinkFrame::CRC_SIZE);
+    }
+
+    /**
+     * Encode a scan report with its counts as varints.
+     *
+     * @return The end of the encoded report, NULL if the payload is not a
+     * scan report or the encoding does not fit.
+     */
+    static uint8_t *pack_scan_fields(
+        const uint8_t *payload, size_t length, uint8_t *out, const uint8_t *end
+    ) {
+        typedef ScanAggregator<1> report_t;
+        if (length < report_t::REPORT_HEADER_SIZE || payload[0] != report_t::REPORT_MAGIC ||
+            payload[1] != report_t::REPORT_VERSION) {
+            return NULL;
+        }
+        size_t records = UplinkFrame::read_le16(payload + 2);
+        if (length != report_t::REPORT_HEADER_SIZE + records * report_t::REPORT_RECORD_SIZE) {
+            return NULL;
+        }
+
+        out = put_varint(out, end, records);
+        out = put_varint(out, end, UplinkFrame::read_le32(payload + 4));
+        out = put_varint(out, end, UplinkFrame::read_le16(payload + 8));
+        int8_t previous_rssi = 0;
+        for (const uint8_t *r = payload + report_t::REPORT_HEADER_SIZE; r < payload + length;
+             r += report_t::REPORT_RECORD_SIZE) {
+            // address type and payload changed share a byte
+            if (!out || r[6] > 0x7F || r[16] > 1 || (size_t)(end - out) < 7) {
+                return NULL;
+            }
+            memcpy(out, r, 6);
+            out[6] = r[6] | (r[16] << 7);
+            out += 7;
+            int8_t rssi = (int8_t) r[9];
+            out = put_varint(out, end, zigzag(rssi - previous_rssi));
+            out = put_varint(out, end, (uint8_t)(r[9] - r[7]));
+            out = put_varint(out, end, (uint8_t)(r[8] - r[9]));
+            out = put_varint(out, end, UplinkFrame::read_le16(r + 10));
+            if (!out || (size_t)(end - out) < 4) {
+                return NULL;
+            }
+            memcpy(out, r + 12, 4);
+            out += 4;
+            previous_rssi = rssi;
+        }
+        return out;
+    }
+
+    /**
+     * Size of a payload of 32 bit words encoded against the previous
+     * payloads.
+     *
+     * @param[in] before Payload before the last one, NULL for the deltas to
+     * the last one.
+     */
+    static size_t words_size(
+        const uint8_t *payload, size_t length, const uint8_t *last, const uint8_t *before
+    ) {
+        size_t size = 0;
+        for (size_t i = 0; i + 4 <= length; i += 4) {
+            uint32_t code = zigzag(word_residual(payload + i, last + i, before ? before + i : NULL));
+            do {
+                ++size;
+                code >>= 7;
+            } while (code);
+        }
+        return size;
+    }
+
+    /**
+     * Encode a payload of 32 bit words against the previous payloads.
+     *
+     * @return The end of the encoded payload, NULL if it does not fit.
+     */
+    static uint8_t *pack_words(
+        const uint8_t *payload, size_t length, const uint8_t *last, const uint8_t *before,
+        uint8_t *out, const uint8_t *end
+    ) {
+        for (size_t i = 0; i + 4 <= length; i += 4) {
+            out = put_varint(out, end, zigzag(word_residual(payload + i, last + i, before ? before + i : NULL)));
+        }
+        return out;
+    }
+
+private:
+    static int32_t word_residual(const uint8_t *word, const uint8_t *last, const uint8_t *before)
+    {
+        uint32_t delta = UplinkFrame::read_le32(word) - UplinkFrame::read_le32(last);
+        if (before) {
+            delta -= UplinkFrame::read_le32(last) - UplinkFrame::read_le32(before);
+        }
+        return (int32_t) delta;
+    }
+
+    static uint8_t *lz_put_length(uint8_t *out, const uint8_t *end, size_t value)
+    {
+        for (; value >= 255; value -= 255) {
+            if (out == end) {
+                return NULL;
+            }
+            *out++ = 255;
+        }
+        if (out == end) {
+            return NULL;
+        }
+        *out++ = value;
+        return out;
+    }
+
+    /**
+     * Append a literal run followed by a match; no match if match_length
+     * is 0.
+     */
+    static uint8_t *lz_sequence(
+        uint8_t *out, const uint8_t *end,
+        const uint8_t *literals, size_t literal_count,
+        size_t offset, size_t match_length
+    ) {
+        if (out == end) {
+            return NULL;
+        }
+        size_t match_code = match_length ? match_length - LZ_MIN_MATCH : 0;
+        uint8_t *token = out++;
+        *token = (literal_count < 15 ? literal_count : 15) << 4 | (match_code < 15 ? match_code : 15);
+        if (literal_count >= 15 && !(out = lz_put_length(out, end, literal_count - 15))) {
+            return NULL;
+        }
+        if ((size_t)(end - out) < literal_count) {
+            return NULL;
+        }
+        memcpy(out, literals, literal_count);
+        out += literal_count;
+        if (!match_length) {
+            return out;
+        }
+
+        if (end - out < 2) {
+            return NULL;
+        }
+        UplinkFrame::write_le16(out, offset);
+        out += 2;
+        if (match_code >= 15) {
+            out = lz_put_length(out, end, match_code - 15);
+        }
+        return out;
+    }
+
+    static bool lz_length(const uint8_t *&in, const uint8_t *end, size_t &value)
+    {
+        if (value < 15) {
+            return true;
+        }
+        while (in < end) {
+            uint8_t byte = *in++;
+            value += byte;
+            if (byte != 255) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool unpack_words(
+        const uint8_t *&p, const uint8_t *end, uint8_t *payload, size_t length,
+        const uint8_t *last, const uint8_t *before
+    ) {
+        if (length % 4) {
+            return false;
+        }
+        for (size_t i = 0; i < length; i += 4) {
+            uint32_t code;
+            if (!read_varint(p, end, code)) {
+                return false;
+            }
+            uint32_t word = UplinkFrame::read_le32(last + i) + (uint32_t) unzigzag(code);
+            if (before) {
+                word += UplinkFrame::read_le32(last + i) - UplinkFrame::read_le32(before + i);
+            }
+            UplinkFrame::write_le32(payload + i, word);
+        }
+        return true;
+    }
+
+    static bool unpack_scan_fields(
+        const uint8_t *&p, const uint8_t *end, uint8_t *payload, size_t length
+    ) {
+        typedef ScanAggregator<1> report_t;
+        uint32_t records;
+        uint32_t window_ms;
+        uint32_t evictions;
+        if (!read_varint(p, end, records) || !read_varint(p, end, window_ms) ||
+            !read_varint(p, end, evictions) || records > UINT16_MAX || evictions > UINT16_MAX ||
+            length != report_t::REPORT_HEADER_SIZE + records * report_t::REPORT_RECORD_SIZE) {
+            return false;
+        }
+        payload[0] = report_t::REPORT_MAGIC;
+        payload[1] = report_t::REPORT_VERSION;
+        UplinkFrame::write_le16(payload + 2, records);
+        UplinkFrame::write_le32(payload + 4, window_ms);
+        UplinkFrame::write_le16(payload + 8, evictions);
+
+        int8_t previous_rssi = 0;
+        uint8_t *r = payload + report_t::REPORT_HEADER_SIZE;
+        for (size_t i = 0; i < records; ++i, r += report_t::REPORT_RECORD_SIZE) {
+            uint32_t rssi_delta;
+            uint32_t below;
+            uint32_t above;
+            uint32_t count;
+            if (end - p < 7) {
+                return false;
+            }
+            memcpy(r, p, 6);
+            r[6] = p[6] & 0x7F;
+            r[16] = p[6] >> 7;
+            p += 7;
+            if (!read_varint(p, end, rssi_delta) || !read_varint(p, end, below) ||
+                !read_varint(p, end, above) || !read_varint(p, end, count) ||
+                below > UINT8_MAX || above > UINT8_MAX || count > UINT16_MAX || end - p < 4) {
+                return false;
+            }
+            int8_t rssi = (int8_t)(previous_rssi + unzigzag(rssi_delta));
+            r[9] = rssi;
+            r[7] = r[9] - below;
+            r[8] = r[9] + above;
+            UplinkFrame::write_le16(r + 10, count);
+            memcpy(r + 12, p, 4);
+            p += 4;
+            previous_rssi = rssi;
+        }
+        return true;
+    }
+};
+
+/**
+ * Pack the frames of a node before they are sent.
+ *
+ * Holds the record section being packed and the LZ hash table, so packing
+ * does not use the stack of the caller.
+ *
+ * @tparam MaxFrameSize Size of the largest frame packed.
+ */
+template<size_t MaxFrameSize>
+class UplinkPacker {
+public:
+    /**
+     * @param[in] lz Compress the record section once packed.
+     */
+    UplinkPacker(bool lz = true) :
+        _lz(lz)
+    {
+    }
+
+    /**
+     * Pack a frame built by UplinkFrameWriter.
+     *
+     * @param[out] packed Destination of MaxFrameSize bytes.
+     *
+     * @return The size of the packed frame, 0 if packing does not make the
+     * frame smaller; the frame is then sent as is.
+     */
+    size_t pack(const uint8_t *frame, size_t length, uint8_t *packed)
+    {
+        // the frame was just built: its CRC is not checked again
+        if (length > MaxFrameSize || length < UplinkFrame::MIN_FRAME_SIZE ||
+            frame[0] != UplinkFrame::FRAME_MAGIC || frame[1] != UplinkFrame::VERSION) {
+            return 0;
+        }
+        UplinkFrame::header_t header;
+        header.length = length;
+        header.node_id = UplinkFrame::read_le32(frame + 4);
+        header.sequence = UplinkFrame::read_le32(frame + 8);
+        header.timestamp_ms = UplinkFrame::read_le32(frame + 12);
+        header.record_count = frame[16];
+
+        size_t section_length = pack_records(frame, header);
+        if (!section_length) {
+            return 0;
+        }
+
+        // the packed frame has to be smaller than the frame
+        uint8_t *out = packed + UplinkFrame::HEADER_SIZE;
+        uint8_t *end = packed + length - UplinkFrame::CRC_SIZE - 1;
+        if (out + UplinkFrame::CRC_SIZE >= end) {
+            return 0;
+        }
+        uint8_t *flags = out++;
+        *flags = 0;
+        size_t compressed = 0;
+        if (_lz) {
+            size_t prefix = UplinkCodec::write_varint(out, end, section_length);
+            if (prefix) {
+                compressed = UplinkCodec::lz_compress(
+                    _section, section_length, out + prefix, end - out - prefix, _table
+                );
+            }
+            if (compressed && compressed < section_length) {
+                *flags = UplinkCodec::FLAG_LZ;
+                out += prefix + compressed;
+            }
+        }
+        if (!*flags) {
+            if ((size_t)(end - out) < section_length) {
+                return 0;
+            }
+            memcpy(out, _section, section_length);
+            out += section_length;
+        }
+
+        memcpy(packed, frame, UplinkFrame::HEADER_SIZE);
+        packed[1] = UplinkCodec::VERSION;
+        size_t packed_length = out - packed + UplinkFrame::CRC_SIZE;
+        UplinkFrame::write_le16(packed + 2, packed_length);
+        UplinkFrame::write_le32(out, UplinkFrame::crc32(packed, out - packed));
+        return packed_length;
+    }
+
+private:
+    /**
+     * Pack the records of a frame into the section buffer.
+     *
+     * @return The size of the section, 0 if it does not fit.
+     */
+    size_t pack_records(const uint8_t *frame, const UplinkFrame::header_t &header)
+    {
+        memset(&_history, 0, sizeof(_history));
+        uint8_t *out = _section;
+        const uint8_t *end = _section + sizeof(_section);
+        int32_t previous_age = 0;
+        int32_t previous_delta = 0;
+
+        UplinkFrame::RecordIterator records(frame, header);
+        uint8_t type;
+        uint16_t age_ms;
+        const uint8_t *payload;
+        uint16_t length;
+        while (records.next(type, age_ms, payload, length)) {
+            if (type > UplinkCodec::TYPE_MASK || end - out < 1) {
+                return 0;
+            }
+            uint8_t *type_byte = out++;
+            int32_t delta = (int32_t) age_ms - previous_age;
+            out = UplinkCodec::put_varint(out, end, UplinkCodec::zigzag(delta - previous_delta));
+            out = UplinkCodec::put_varint(out, end, length);
+            if (!out) {
+                return 0;
+            }
+            previous_age = age_ms;
+            previous_delta = delta;
+
+            *type_byte = type;
+            uint8_t *transformed = NULL;
+            if (type == UplinkFrame::RECORD_SCAN_REPORT) {
+                transformed = UplinkCodec::pack_scan_fields(payload, length, out, end);
+                if (transformed) {
+                    *type_byte |= UplinkCodec::TRANSFORM_SCAN_FIELDS;
+                }
+            } else if (length && length % 4 == 0 && _history.last[type] && _history.length[type] == length) {
+                transformed = pack_words(payload, length, frame, type, type_byte, out, end);
+            }
+            if (transformed) {
+                out = transformed;
+            } else {
+                if ((size_t)(end - out) < length) {
+                    return 0;
+                }
+                memcpy(out, payload, length);
+                out += length;
+            }
+
+            UplinkCodec::remember(_history, type, payload - frame, length);
+        }
+        return out - _section;
+    }
+
+    /**
+     * Encode a payload of 32 bit words as deltas or deltas of deltas to the
+     * previous payloads of its type, whichever is smaller.
+     *
+     * @return The end of the encoded payload, NULL if it is not smaller
+     * than the payload or does not fit.
+     */
+    uint8_t *pack_words(
+        const uint8_t *payload, size_t length, const uint8_t *frame, uint8_t type,
+        uint8_t *type_byte, uint8_t *out, const uint8_t *end
+    ) {
+        const uint8_t *last = frame + _history.last[type];
+        const uint8_t *before = _history.before[type] ? frame + _history.before[type] : NULL;
+        size_t delta_size = UplinkCodec::words_size(payload, length, last, NULL);
+        size_t dod_size = before ? UplinkCodec::words_size(payload, length, last, before) : SIZE_MAX;
+        if (dod_size < delta_size) {
+            delta_size = dod_size;
+        } else {
+            before = NULL;
+        }
+        if (delta_size >= length) {
+            return NULL;
+        }
+        out = UplinkCodec::pack_words(payload, length, last, before, out, end);
+        if (out) {
+            *type_byte |= before ? UplinkCodec::TRANSFORM_DELTA_OF_DELTA : UplinkCodec::TRANSFORM_DELTA;
+        }
+        return out;
+    }
+
+    bool _lz;
+    UplinkCodec::history_t _history;
+    uint16_t _table[UplinkCodec::LZ_HASH_SIZE];
+    uint8_t _section[MaxFrameSize];
+};
+
+#endif /* UPLINK_CODEC_H_ */
@@ -0,0 +1,333 @@
+#ifndef UPLINK_FRAME_H_
+#define UPLINK_FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Binary frame format of the node uplink.
+ *
+ * A frame carries one or more records of a node; all integers are little
+ * endian:
+ *   - magic (1), version (1), frame length including header and CRC (2);
+ *   - node id (4), sequence number (4), timestamp of the frame in ms of
+ *     the node monotonic clock (4), record count (1);
+ *   - per record: type (1), age of the record relative to the frame
+ *     timestamp in ms (2), payload length (2), payload;
+ *   - CRC-32 (IEEE 802.3) of everything from the magic to the last record
+ *     (4).
+ *
+ * The collector answers with cumulative acks: magic (1), version (1),
+ * sequence number of the last frame received (4) and the CRC-32 of these
+ * 6 bytes (4).
+ *
+ * The magic values are not printable so frames cannot be mistaken for the
+ * text messages and the 'G' scan reports sent by older firmware.
+ *
+ * The codec does not depend on mbed so the collector uses it on the host.
+ */
+class UplinkFrame {
+public:
+    static const uint8_t FRAME_MAGIC = 0xA5;
+    static const uint8_t ACK_MAGIC = 0xAC;
+    static const uint8_t VERSION = 1;
+
+    static const size_t HEADER_SIZE = 17;
+    static const size_t RECORD_HEADER_SIZE = 5;
+    static const size_t CRC_SIZE = 4;
+    static const size_t ACK_SIZE = 10;
+
+    /**
+     * Smallest frame: a header, one empty record and the CRC.
+     */
+    static const size_t MIN_FRAME_SIZE = HEADER_SIZE + RECORD_HEADER_SIZE + CRC_SIZE;
+
+    static const uint8_t MAX_RECORDS = 255;
+
+    enum record_type_t {
+        /** Node opened the uplink, at boot or after a reconnection; payload: wifi MAC (6). */
+        RECORD_HELLO = 1,
+        /**
+         * A central connected; payload: address type (1), address (6). Sent
+         * by older firmware, connections are now summarized by the
+         * METRIC_BLE_CONNECT_MS metric.
+         */
+        RECORD_CONNECT = 2,
+        /** Gateway scan report; payload: the report of ScanAggregator. */
+        RECORD_SCAN_REPORT = 3,
+        /** Window summary of a node metric; payload: a summary of WindowAggregator. */
+        RECORD_METRIC_SUMMARY = 4,
+        /** Value pulled by the GATT client poller; payload: address type (1), address (6), value (up to 9). */
+        RECORD_POLL_SAMPLE = 5
+    };
+
+    struct header_t {
+        uint16_t length;
+        uint32_t node_id;
+        uint32_t sequence;
+        uint32_t timestamp_ms;
+        uint8_t record_count;
+    };
+
+    /**
+     * Update a CRC-32 (IEEE 802.3, reflected) with a block of data.
+     *
+     * @param[in] crc CRC of the previous blocks, 0 for the first one.
+     */
+    static uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc = 0)
+    {
+        static const uint32_t table[16] = {
+            0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+            0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+            0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+            0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+        };
+
+        crc = ~crc;
+        for (size_t i = 0; i < length; ++i) {
+            crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+            crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+        }
+        return ~crc;
+    }
+
+    /**
+     * Length of the frame at the start of a stream.
+     *
+     * @return The frame length, 0 if fewer than 4 bytes are available.
+     */
+    static size_t frame_length(const uint8_t *data, size_t available)
+    {
+        if (available < 4) {
+            return 0;
+        }
+        return read_le16(data + 2);
+    }
+
+    /**
+     * Check and decode the header of a complete frame.
+     *
+     * @return false if the magic, the version, the length or the CRC is
+     * wrong.
+     */
+    static bool decode_header(const uint8_t *frame, size_t length, header_t &header)
+    {
+        if (length < MIN_FRAME_SIZE || frame[0] != FRAME_MAGIC || frame[1] != VERSION ||
+            read_le16(frame + 2) != length) {
+            return false;
+        }
+        if (crc32(frame, length - CRC_SIZE) != read_le32(frame + length - CRC_SIZE)) {
+            return false;
+        }
+        header.length = length;
+        header.node_id = read_le32(frame + 4);
+        header.sequence = read_le32(frame + 8);
+        header.timestamp_ms = read_le32(frame + 12);
+        header.record_count = frame[16];
+        return true;
+    }
+
+    /**
+     * Walk the records of a frame checked by decode_header().
+     */
+    class RecordIterator {
+    public:
+        RecordIterator(const uint8_t *frame, const header_t &header) :
+            _p(frame + HEADER_SIZE),
+            _end(frame + header.length - CRC_SIZE),
+            _remaining(header.record_count)
+        {
+        }
+
+        /**
+         * Move to the next record.
+         *
+         * @return false at the end of the frame or if a record overruns it.
+         */
+        bool next(uint8_t &type, uint16_t &age_ms, const uint8_t *&payload, uint16_t &length)
+        {
+            if (!_remaining || (size_t)(_end - _p) < RECORD_HEADER_SIZE) {
+                return false;
+            }
+            type = _p[0];
+            age_ms = read_le16(_p + 1);
+            length = read_le16(_p + 3);
+            if ((size_t)(_end - _p) - RECORD_HEADER_SIZE < length) {
+                return false;
+            }
+            payload = _p + RECORD_HEADER_SIZE;
+            _p += RECORD_HEADER_SIZE + length;
+            --_remaining;
+            return true;
+        }
+
+    private:
+        const uint8_t *_p;
+        const uint8_t *_end;
+        uint8_t _remaining;
+    };
+
+    /**
+     * Encode a cumulative ack.
+     *
+     * @return ACK_SIZE.
+     */
+    static size_t encode_ack(uint8_t *buffer, uint32_t sequence)
+    {
+        buffer[0] = ACK_MAGIC;
+        buffer[1] = VERSION;
+        write_le32(buffer + 2, sequence);
+        write_le32(buffer + 6, crc32(buffer, 6));
+        return ACK_SIZE;
+    }
+
+    /**
+     * Decode an ack at the start of a buffer holding at least ACK_SIZE
+     * bytes.
+     */
+    static bool decode_ack(const uint8_t *buffer, uint32_t &sequence)
+    {
+        if (buffer[0] != ACK_MAGIC || buffer[1] != VERSION ||
+            crc32(buffer, 6) != read_le32(buffer + 6)) {
+            return false;
+        }
+        sequence = read_le32(buffer + 2);
+        return true;
+    }
+
+    static uint16_t read_le16(const uint8_t *src)
+    {
+        return src[0] | (src[1] << 8);
+    }
+
+    static uint32_t read_le32(const uint8_t *src)
+    {
+        return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t) src[3] << 24);
+    }
+
+    static void write_le16(uint8_t *dst, uint16_t value)
+    {
+        dst[0] = value;
+        dst[1] = value >> 8;
+    }
+
+    static void write_le32(uint8_t *dst, uint32_t value)
+    {
+        dst[0] = value;
+        dst[1] = value >> 8;
+        dst[2] = value >> 16;
+        dst[3] = value >> 24;
+    }
+};
+
+/**
+ * Build a frame record by record in a caller provided buffer.
+ */
+class UplinkFrameWriter {
+public:
+    UplinkFrameWriter(uint8_t *buffer, size_t size) :
+        _buffer(buffer),
+        _size(size),
+        _length(0),
+        _record_count(0),
+        _timestamp_ms(0)
+    {
+    }
+
+    /**
+     * Start a frame; the records appended are stamped relative to now_ms.
+     */
+    void begin(uint32_t node_id, uint32_t sequence, uint32_t now_ms)
+    {
+        _buffer[0] = UplinkFrame::FRAME_MAGIC;
+        _buffer[1] = UplinkFrame::VERSION;
+        UplinkFrame::write_le32(_buffer + 4, node_id);
+        UplinkFrame::write_le32(_buffer + 8, sequence);
+        UplinkFrame::write_le32(_buffer + 12, now_ms);
+        _length = UplinkFrame::HEADER_SIZE;
+        _record_count = 0;
+        _timestamp_ms = now_ms;
+    }
+
+    /**
+     * Whether a record with a payload of the given length still fits,
+     * header and CRC included; a full frame accepts no record, even an
+     * empty one, and nothing fits before begin().
+     */
+    bool fits(size_t length) const
+    {
+        size_t used = _length + UplinkFrame::RECORD_HEADER_SIZE + UplinkFrame::CRC_SIZE;
+        return _length && _record_count < UplinkFrame::MAX_RECORDS &&
+            used <= _size && length <= _size - used;
+    }
+
+    /**
+     * Append a record stamped at now_ms.
+     *
+     * @return false if the record does not fit; the frame is left as is.
+     */
+    bool append(uint8_t type, const uint8_t *payload, size_t length, uint32_t now_ms)
+    {
+        uint8_t *p = reserve(type, length, now_ms);
+        if (!p) {
+            return false;
+        }
+        memcpy(p, payload, length);
+        return true;
+    }
+
+    /**
+     * Append the header of a record stamped at now_ms and return where its
+     * payload goes, for payloads read straight into the frame.
+     *
+     * @return NULL if the record does not fit.
+     */
+    uint8_t *reserve(uint8_t type, size_t length, uint32_t now_ms)
+    {
+        if (!fits(length)) {
+            return NULL;
+        }
+        uint32_t age_ms = now_ms - _timestamp_ms;
+        uint8_t *p = _buffer + _length;
+        p[0] = type;
+        UplinkFrame::write_le16(p + 1, age_ms > UINT16_MAX ? UINT16_MAX : age_ms);
+        UplinkFrame::write_le16(p + 3, length);
+        _length += UplinkFrame::RECORD_HEADER_SIZE + length;
+        ++_record_count;
+        return p + UplinkFrame::RECORD_HEADER_SIZE;
+    }
+
+    size_t record_count() const
+    {
+        return _record_count;
+    }
+
+    /**
+     * Seal the frame with its length, record count and CRC.
+     *
+     * @return The size of the frame or 0 if it holds no record.
+     */
+    size_t finish()
+    {
+        if (!_record_count) {
+            return 0;
+        }
+        size_t length = _length + UplinkFrame::CRC_SIZE;
+        UplinkFrame::write_le16(_buffer + 2, length);
+        _buffer[16] = _record_count;
+        UplinkFrame::write_le32(_buffer + _length, UplinkFrame::crc32(_buffer, _length));
+        _length = 0;
+        _record_count = 0;
+        return length;
+    }
+
+private:
+    uint8_t *_buffer;
+    size_t _size;
+    size_t _length;
+    size_t _record_count;
+    uint32_t _timestamp_ms;
+};
+
+#endif /* UPLINK_FRAME_H_ */
@@ -0,0 +1,612 @@
+#ifndef UPLINK_STORE_H_
+#define UPLINK_STORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wifi.h"
+
+#include "platform/NonCopyable.h"
+#include "BlockDevice.h"
+
+#include "BinaryLog.h"
+#include "UplinkFrame.h"
+
+#ifndef MBED_CONF_APP_UPLINK_STORE_ADDRESS
+#define MBED_CONF_APP_UPLINK_STORE_ADDRESS 0x080E8000
+#endif
+
+#ifndef MBED_CONF_APP_UPLINK_STORE_SIZE
+#define MBED_CONF_APP_UPLINK_STORE_SIZE 0x10000
+#endif
+
+/**
+ * Persistent queue of the uplink records that could not be sent.
+ *
+ * The block device is a ring of erase sectors written in order; each
+ * sector starts with a header holding a magic, the sequence number of the
+ * sector in the ring, its erase count and a released marker programmed
+ * once every record of the sector has been sent. Records are appended
+ * behind the header of the newest sector:
+ *   - payload length including the type (2), truncated CRC-32 of the
+ *     timestamp, type and payload (2), timestamp in ms (4);
+ *   - type (1), payload;
+ * each record padded to the program size of the device.
+ *
+ * Sectors are erased only when the ring comes back to them, so every
+ * sector is erased once per turn of the ring and the wear is spread evenly.
+ * When the ring is full the oldest sector is dropped.
+ *
+ * Records are read in order through a scan cursor and released with
+ * commit() once the frames holding them were sent, or given back with
+ * rewind() if the send failed. Released sectors are marked in flash; the
+ * records of a sector partially sent before a reset are sent again.
+ * At start the headers and the records are checked to find the oldest
+ * record and the end of the newest one; a torn record closes its sector.
+ *
+ * Records stored before a reset carry the clock of the previous boot.
+ *
+ * RAM use does not depend on the size of the device.
+ */
+class UplinkStore : private mbed::NonCopyable<UplinkStore> {
+    typedef UplinkStore Self;
+
+public:
+    /**
+     * Largest program size supported.
+     */
+    static const size_t MAX_PROGRAM_SIZE = 32;
+
+    /**
+     * Largest record payload; the largest payload of an uplink frame.
+     */
+    static const size_t MAX_PAYLOAD_SIZE = ES_WIFI_PAYLOAD_SIZE -
+        UplinkFrame::HEADER_SIZE - UplinkFrame::RECORD_HEADER_SIZE - UplinkFrame::CRC_SIZE;
+
+    /**
+     * Record at the scan cursor.
+     */
+    struct record_t {
+        uint8_t type;
+        uint32_t timestamp_ms;
+        uint16_t length;
+    };
+
+    UplinkStore(mbed::BlockDevice &block_device) :
+        _block_device(block_device),
+        _started(false),
+        _program_size(0),
+        _sector_size(0),
+        _sector_count(0),
+        _header_size(0),
+        _erased(0),
+        _head(NO_SECTOR),
+        _write_offset(0),
+        _tail(NO_SECTOR),
+        _commit_offset(0),
+        _scan_sector(NO_SECTOR),
+        _scan_offset(0),
+        _scanned(0),
+        _active(0),
+        _pending(0),
+        _next_sequence(0),
+        _records_stored(0),
+        _records_sent(0),
+        _records_dropped(0),
+        _sectors_dropped(0),
+        _erases(0),
+        _max_erase_count(0),
+        _release_failures(0),
+        _chunk_length(0)
+    {
+    }
+
+    /**
+     * Initialize the device and recover the records stored before the last
+     * reset.
+     *
+     * @return false if the device cannot be used; records are not stored.
+     */
+    bool start()
+    {
+        int error = _block_device.init();
+        if (error) {
+            LOG_ERROR(LOG_MODULE_WIFI, "Uplink store init failed with error %d.\r\n", error);
+            return false;
+        }
+
+        int erase_value = _block_device.get_erase_value();
+        _program_size = _block_device.get_program_size();
+        _sector_size = _block_device.get_erase_size();
+        _sector_count = _block_device.size() / _sector_size;
+        _header_size = align(HEADER_MARKER_OFFSET) + _program_size;
+
+        if (erase_value < 0 || _program_size > MAX_PROGRAM_SIZE ||
+            sizeof(_chunk) % _program_size || _sector_count < 2 ||
+            _header_size + entry_size(MAX_PAYLOAD_SIZE) > _sector_size) {
+            LOG_ERROR(LOG_MODULE_WIFI, "Uplink store geometry not supported.\r\n");
+            return false;
+        }
+        _erased = (uint8_t) erase_value;
+
+        mount();
+        _started = true;
+        LOG_INFO(LOG_MODULE_WIFI, "Uplink store: %u records pending in %u sectors.\r\n",
+            (unsigned) _pending, (unsigned) _active);
+        return true;
+    }
+
+    /**
+     * Whether no record is waiting to be sent.
+     */
+    bool empty() const
+    {
+        return _pending == 0;
+    }
+
+    /**
+     * Append a record.
+     *
+     * @return false if the store is not started or the record too large.
+     */
+    bool push(uint8_t type, uint32_t timestamp_ms, const uint8_t *payload, size_t length)
+    {
+        if (!_started || length > MAX_PAYLOAD_SIZE) {
+            return false;
+        }
+
+        size_t size = entry_size(length);
+        if (_head == NO_SECTOR || _write_offset + size > _sector_size) {
+            if (!open_sector()) {
+                return false;
+            }
+        }
+
+        uint8_t header[ENTRY_HEADER_SIZE + 1];
+        UplinkFrame::write_le16(header, length + 1);
+        UplinkFrame::write_le32(header + 4, timestamp_ms);
+        header[ENTRY_HEADER_SIZE] = type;
+        uint32_t crc = UplinkFrame::crc32(header + 4, sizeof(header) - 4);
+        crc = UplinkFrame::crc32(payload, length, crc);
+        UplinkFrame::write_le16(header + 2, (uint16_t) crc);
+
+        bd_addr_t address = sector_address(_head) + _write_offset;
+        _chunk_length = 0;
+        if (!stream(address, header, sizeof(header)) ||
+            !stream(address, payload, length) ||
+            !stream_end(address)) {
+            // the sector holds a torn record; the next one is opened
+            _write_offset = _sector_size;
+            return false;
+        }
+
+        _write_offset += size;
+        ++_pending;
+        ++_records_stored;
+        return true;
+    }
+
+    /**
+     * Describe the record at the scan cursor; a record failing its CRC
+     * ends its sector.
+     *
+     * @return false if every record pending was scanned.
+     */
+    bool peek(record_t &record)
+    {
+        while (_scanned < _pending) {
+            if (_scan_offset + ENTRY_HEADER_SIZE + 1 <= _sector_size) {
+                uint8_t header[ENTRY_HEADER_SIZE + 1];
+                if (read(sector_address(_scan_sector) + _scan_offset, header, sizeof(header)) &&
+                    is_entry(header, _scan_offset) &&
+                    check(_scan_sector, _scan_offset, header)) {
+                    record.length = UplinkFrame::read_le16(header) - 1;
+                    record.timestamp_ms = UplinkFrame::read_le32(header + 4);
+                    record.type = header[ENTRY_HEADER_SIZE];
+                    return true;
+                }
+            }
+            if (_scan_sector == _head) {
+                // the pending count disagrees with the flash content
+                _pending = _scanned;
+                break;
+            }
+            _scan_sector = next_sector(_scan_sector);
+            _scan_offset = _header_size;
+        }
+        return false;
+    }
+
+    /**
+     * Read the payload of the record described by peek() and move the scan
+     * cursor to the next record.
+     */
+    bool read(const record_t &record, uint8_t *payload)
+    {
+        bd_addr_t address = sector_address(_scan_sector) + _scan_offset + ENTRY_HEADER_SIZE + 1;
+        if (!read(address, payload, record.length)) {
+            return false;
+        }
+        _scan_offset += entry_size(record.length);
+        ++_scanned;
+        return true;
+    }
+
+    /**
+     * Release the records scanned; the sectors left behind are marked
+     * released.
+     */
+    void commit()
+    {
+        while (_tail != _scan_sector && _active) {
+            release(_tail);
+            _tail = next_sector(_tail);
+        }
+        _commit_offset = _scan_offset;
+        _pending -= _scanned;
+        _records_sent += _scanned;
+        _scanned = 0;
+
+        if (!_pending && _active) {
+            // everything was sent: the sectors left up to the newest one
+            // are released and the next record opens a fresh sector, so
+            // that nothing is sent twice after a reset
+            while (_tail != _head) {
+                release(_tail);
+                _tail = next_sector(_tail);
+            }
+            release(_head);
+            _active = 0;
+            _write_offset = _sector_size;
+        }
+    }
+
+    /**
+     * Give the records scanned back.
+     */
+    void rewind()
+    {
+        _scan_sector = _tail;
+        _scan_offset = _commit_offset;
+        _scanned = 0;
+    }
+
+    void print_stats() const
+    {
+        printf(
+            "uplink store: %lu records pending in %lu/%lu sectors, %lu stored, %lu sent, %lu dropped (%lu sectors)\r\n",
+            (unsigned long) _pending,
+            (unsigned long) _active,
+            (unsigned long) _sector_count,
+            (unsigned long) _records_stored,
+            (unsigned long) _records_sent,
+            (unsigned long) _records_dropped,
+            (unsigned long) _sectors_dropped
+        );
+        printf(
+            "\t%lu sectors erased, highest erase count %lu, %lu releases failed\r\n",
+            (unsigned long) _erases,
+            (unsigned long) _max_erase_count,
+            (unsigned long) _release_failures
+        );
+    }
+
+private:
+    static const uint32_t SECTOR_MAGIC = 0x51504C55; /* "ULPQ" */
+    static const uint32_t NO_SECTOR = UINT32_MAX;
+    static const size_t ENTRY_HEADER_SIZE = 8;
+    static const size_t HEADER_MARKER_OFFSET = 12;
+
+    struct sector_header_t {
+        bool valid;
+        bool released;
+        uint32_t sequence;
+        uint32_t erase_count;
+    };
+
+    /**
+     * Find the ring and the records pending from the sector headers.
+     */
+    void mount()
+    {
+        uint32_t newest_sequence = 0;
+        uint32_t oldest_active_sequence = 0;
+
+        for (uint32_t sector = 0; sector < _sector_count; ++sector) {
+            sector_header_t header;
+            read_header(sector, header);
+            if (!header.valid) {
+                continue;
+            }
+            if (header.erase_count > _max_erase_count) {
+                _max_erase_count = header.erase_count;
+            }
+            if (_head == NO_SECTOR || (int32_t)(header.sequence - newest_sequence) > 0) {
+                _head = sector;
+                newest_sequence = header.sequence;
+            }
+            if (!header.released) {
+                if (_tail == NO_SECTOR || (int32_t)(header.sequence - oldest_active_sequence) < 0) {
+                    _tail = sector;
+                    oldest_active_sequence = header.sequence;
+                }
+            }
+        }
+        _next_sequence = newest_sequence + 1;
+        _write_offset = _sector_size;
+
+        if (_tail == NO_SECTOR) {
+            _active = 0;
+            return;
+        }
+
+        // the sectors between the oldest active one and the newest one are
+        // pending; count their records and find the end of the last one
+        _active = (_head + _sector_count - _tail) % _sector_count + 1;
+        for (uint32_t sector = _tail, i = 0; i < _active; sector = next_sector(sector), ++i) {
+            uint32_t offset = _header_size;
+            bool torn = false;
+            while (offset + ENTRY_HEADER_SIZE + 1 <= _sector_size) {
+                uint8_t header[ENTRY_HEADER_SIZE + 1];
+                if (!read(sector_address(sector) + offset, header, sizeof(header))) {
+                    torn = true;
+                    break;
+                }
+                if (UplinkFrame::read_le16(header) == (uint16_t)(_erased | (_erased << 8))) {
+                    break;
+                }
+                if (!is_entry(header, offset) || !check(sector, offset, header)) {
+                    torn = true;
+                    break;
+                }
+                offset += entry_size(UplinkFrame::read_le16(header) - 1);
+                ++_pending;
+            }
+            if (sector == _head && !torn) {
+                _write_offset = offset;
+            }
+        }
+
+        _commit_offset = _header_size;
+        _scan_sector = _tail;
+        _scan_offset = _header_size;
+    }
+
+    /**
+     * Erase the next sector of the ring and make it the newest.
+     */
+    bool open_sector()
+    {
+        uint32_t sector = _head == NO_SECTOR ? 0 : next_sector(_head);
+
+        if (_active == _sector_count) {
+            drop_oldest();
+        }
+
+        sector_header_t previous;
+        read_header(sector, previous);
+        uint32_t erase_count = previous.valid ? previous.erase_count + 1 : 1;
+
+        if (_block_device.erase(sector_address(sector), _sector_size)) {
+            return false;
+        }
+        ++_erases;
+        if (erase_count > _max_erase_count) {
+            _max_erase_count = erase_count;
+        }
+
+        uint8_t header[HEADER_MARKER_OFFSET];
+        UplinkFrame::write_le32(header, SECTOR_MAGIC);
+        UplinkFrame::write_le32(header + 4, _next_sequence++);
+        UplinkFrame::write_le32(header + 8, erase_count);
+        bd_addr_t address = sector_address(sector);
+        _chunk_length = 0;
+        if (!stream(address, header, sizeof(header)) || !stream_end(address)) {
+            return false;
+        }
+
+        _head = sector;
+        _write_offset = _header_size;
+        if (!_active) {
+            _tail = sector;
+            _commit_offset = _header_size;
+            _scan_sector = sector;
+            _scan_offset = _header_size;
+        }
+        ++_active;
+        return true;
+    }
+
+    /**
+     * Release the oldest sector to make room in a full ring.
+     */
+    void drop_oldest()
+    {
+        uint32_t records = 0;
+        uint32_t offset = _commit_offset;
+        while (offset + ENTRY_HEADER_SIZE + 1 <= _sector_size) {
+            uint8_t header[ENTRY_HEADER_SIZE + 1];
+            if (!read(sector_address(_tail) + offset, header, sizeof(header)) ||
+                !is_entry(header, offset)) {
+                break;
+            }
+            offset += entry_size(UplinkFrame::read_le16(header) - 1);
+            ++records;
+        }
+
+        release(_tail);
+        _tail = next_sector(_tail);
+        _commit_offset = _header_size;
+        _scan_sector = _tail;
+        _scan_offset = _header_size;
+        _scanned = 0;
+        _pending = _pending > records ? _pending - records : 0;
+        _records_dropped += records;
+        ++_sectors_dropped;
+    }
+
+    /**
+     * Mark a sector released; if the marker cannot be programmed the
+     * records of the sector are sent again after a reset.
+     */
+    void release(uint32_t sector)
+    {
+        uint8_t marker[MAX_PROGRAM_SIZE];
+        memset(marker, _erased ^ 0xFF, sizeof(marker));
+        int error = _block_device.program(
+            marker, sector_address(sector) + align(HEADER_MARKER_OFFSET), _program_size
+        );
+        if (error) {
+            ++_release_failures;
+            LOG_WARN(LOG_MODULE_WIFI, "Uplink store: release of sector %u failed with error %d.\r\n",
+                (unsigned) sector, error);
+        }
+        --_active;
+    }
+
+    void read_header(uint32_t sector, sector_header_t &header)
+    {
+        uint8_t raw[HEADER_MARKER_OFFSET];
+        uint8_t marker = _erased;
+        header.valid =
+            read(sector_address(sector), raw, sizeof(raw)) &&
+            read(sector_address(sector) + align(HEADER_MARKER_OFFSET), &marker, 1) &&
+            UplinkFrame::read_le32(raw) == SECTOR_MAGIC;
+        header.sequence = UplinkFrame::read_le32(raw + 4);
+        header.erase_count = UplinkFrame::read_le32(raw + 8);
+        header.released = marker != _erased;
+    }
+
+    /**
+     * Whether an entry header describes a record that fits its sector.
+     */
+    bool is_entry(const uint8_t *header, uint32_t offset) const
+    {
+        uint16_t length = UplinkFrame::read_le16(header);
+        return length >= 1 && length <= MAX_PAYLOAD_SIZE + 1 &&
+            offset + entry_size(length - 1) <= _sector_size;
+    }
+
+    /**
+     * Check the CRC of a record, reading its payload in chunks.
+     */
+    bool check(uint32_t sector, uint32_t offset, const uint8_t *header)
+    {
+        uint16_t length = UplinkFrame::read_le16(header);
+        uint32_t crc = UplinkFrame::crc32(header + 4, ENTRY_HEADER_SIZE + 1 - 4);
+        bd_addr_t address = sector_address(sector) + offset + ENTRY_HEADER_SIZE + 1;
+        for (size_t done = 1; done < length; ) {
+            size_t count = length - done < sizeof(_chunk) ? length - done : sizeof(_chunk);
+            if (!read(address, _chunk, count)) {
+                return false;
+            }
+            crc = UplinkFrame::crc32(_chunk, count, crc);
+            address += count;
+            done += count;
+        }
+        return (uint16_t) crc == UplinkFrame::read_le16(header + 2);
+    }
+
+    /**
+     * Program data through the chunk buffer; address advances with every
+     * chunk programmed.
+     */
+    bool stream(bd_addr_t &address, const uint8_t *data, size_t length)
+    {
+        while (length) {
+            size_t count = sizeof(_chunk) - _chunk_length;
+            if (count > length) {
+                count = length;
+            }
+            memcpy(_chunk + _chunk_length, data, count);
+            _chunk_length += count;
+            data += count;
+            length -= count;
+            if (_chunk_length == sizeof(_chunk)) {
+                if (_block_device.program(_chunk, address, sizeof(_chunk))) {
+                    return false;
+                }
+                address += sizeof(_chunk);
+                _chunk_length = 0;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Program the rest of the chunk buffer padded to the program size.
+     */
+    bool stream_end(bd_addr_t &address)
+    {
+        if (!_chunk_length) {
+            return true;
+        }
+        size_t length = align(_chunk_length);
+        memset(_chunk + _chunk_length, _erased, length - _chunk_length);
+        _chunk_length = 0;
+        if (_block_device.program(_chunk, address, length)) {
+            return false;
+        }
+        address += length;
+        return true;
+    }
+
+    bool read(bd_addr_t address, uint8_t *buffer, size_t length)
+    {
+        return _block_device.read(buffer, address, length) == 0;
+    }
+
+    size_t align(size_t size) const
+    {
+        return (size + _program_size - 1) / _program_size * _program_size;
+    }
+
+    size_t entry_size(size_t payload_length) const
+    {
+        return align(ENTRY_HEADER_SIZE + 1 + payload_length);
+    }
+
+    bd_addr_t sector_address(uint32_t sector) const
+    {
+        return (bd_addr_t) sector * _sector_size;
+    }
+
+    uint32_t next_sector(uint32_t sector) const
+    {
+        return (sector + 1) % _sector_count;
+    }
+
+    mbed::BlockDevice &_block_device;
+    bool _started;
+    uint32_t _program_size;
+    uint32_t _sector_size;
+    uint32_t _sector_count;
+    uint32_t _header_size;
+    uint8_t _erased;
+
+    uint32_t _head;
+    uint32_t _write_offset;
+    uint32_t _tail;
+    uint32_t _commit_offset;
+    uint32_t _scan_sector;
+    uint32_t _scan_offset;
+    uint32_t _scanned;
+    uint32_t _active;
+    uint32_t _pending;
+    uint32_t _next_sequence;
+
+    uint32_t _records_stored;
+    uint32_t _records_sent;
+    uint32_t _records_dropped;
+    uint32_t _sectors_dropped;
+    uint32_t _erases;
+    uint32_t _max_erase_count;
+    uint32_t _release_failures;
+
+    uint8_t _chunk[64];
+    size_t _chunk_length;
+};
+
+#endif /* UPLINK_STORE_H_ */
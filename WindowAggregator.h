@@ -0,0 +1,255 @@
+#ifndef WINDOW_AGGREGATOR_H_
+#define WINDOW_AGGREGATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Statistics of metrics sampled by the node over time windows.
+ *
+ * Each metric has a window and a hop: a window as long as its hop is a
+ * tumbling window, a window of several hops slides by one hop at a time.
+ * A window is kept as a ring of panes, one per hop, each holding the
+ * count, minimum, maximum, mean and sum of squared deviations of the
+ * samples of its hop (Welford); the summary of a window merges its panes.
+ * A sample costs a pane update whatever the window, and the memory is
+ * fixed by the template parameters.
+ *
+ * A summary is produced at the end of each hop for the window ending
+ * there: count, minimum, maximum, mean, population variance and last
+ * sample. Windows without samples produce no summary.
+ *
+ * The aggregator is not thread safe and does not depend on mbed so it can
+ * be exercised on the host.
+ *
+ * @tparam MetricCount Number of metrics, identified by their index.
+ * @tparam MaxPanes Largest number of hops in a window.
+ */
+template<size_t MetricCount, size_t MaxPanes = 8>
+class WindowAggregator {
+public:
+    /**
+     * Size of an encoded summary: metric (4), end of the window in ms of
+     * the node clock (4), window length in ms (4), count (4), minimum,
+     * maximum and last sample (4 each, signed), mean and variance (4 each,
+     * IEEE 754 single precision); all little endian.
+     */
+    static const size_t SUMMARY_SIZE = 36;
+
+    struct summary_t {
+        uint32_t metric;
+        uint32_t end_ms;
+        uint32_t window_ms;
+        uint32_t count;
+        int32_t min;
+        int32_t max;
+        int32_t last;
+        float mean;
+        float variance;
+    };
+
+    WindowAggregator()
+    {
+        memset(_metrics, 0, sizeof(_metrics));
+    }
+
+    /**
+     * Start the windows of a metric; its samples are dropped until then.
+     *
+     * @param[in] window_ms Length of the window.
+     * @param[in] hop_ms Time between two summaries; window_ms for tumbling
+     * windows, a divisor of window_ms for sliding windows.
+     * @param[in] now_ms Start of the first hop.
+     *
+     * @return false if the window cannot be kept in MaxPanes panes.
+     */
+    bool configure(size_t metric, uint32_t window_ms, uint32_t hop_ms, uint32_t now_ms)
+    {
+        if (metric >= MetricCount || !hop_ms || window_ms % hop_ms ||
+            window_ms / hop_ms == 0 || window_ms / hop_ms > MaxPanes) {
+            return false;
+        }
+        metric_t &m = _metrics[metric];
+        memset(&m, 0, sizeof(m));
+        m.pane_count = window_ms / hop_ms;
+        m.hop_ms = hop_ms;
+        m.hop_end_ms = now_ms + hop_ms;
+        return true;
+    }
+
+    /**
+     * Account a sample in the current hop of a metric.
+     */
+    void observe(size_t metric, int32_t value)
+    {
+        if (metric >= MetricCount || !_metrics[metric].pane_count) {
+            return;
+        }
+        metric_t &m = _metrics[metric];
+        pane_t &pane = m.panes[m.current];
+        if (!pane.count || value < pane.min) {
+            pane.min = value;
+        }
+        if (!pane.count || value > pane.max) {
+            pane.max = value;
+        }
+        ++pane.count;
+        float delta = value - pane.mean;
+        pane.mean += delta / pane.count;
+        pane.m2 += delta * (value - pane.mean);
+        m.last = value;
+    }
+
+    /**
+     * Close the hops ended at now_ms and summarize their windows.
+     *
+     * @param[out] summaries Destination of the summaries.
+     * @param[in] max Capacity of summaries; the hops left are closed at the
+     * next call.
+     *
+     * @return The number of summaries written.
+     */
+    size_t poll(uint32_t now_ms, summary_t *summaries, size_t max)
+    {
+        size_t written = 0;
+        for (size_t i = 0; i < MetricCount && written < max; ++i) {
+            metric_t &m = _metrics[i];
+            if (!m.pane_count) {
+                continue;
+            }
+            while ((int32_t)(now_ms - m.hop_end_ms) >= 0 && written < max) {
+                if (summarize(i, summaries[written])) {
+                    ++written;
+                }
+                m.current = (m.current + 1) % m.pane_count;
+                memset(&m.panes[m.current], 0, sizeof(pane_t));
+                m.hop_end_ms += m.hop_ms;
+
+                // after a stall every pane is empty: skip the idle hops
+                uint32_t late_ms = now_ms - m.hop_end_ms;
+                if ((int32_t) late_ms >= 0 && late_ms >= m.hop_ms * m.pane_count) {
+                    memset(m.panes, 0, sizeof(m.panes));
+                    m.hop_end_ms += late_ms / m.hop_ms * m.hop_ms;
+                }
+            }
+        }
+        return written;
+    }
+
+    /**
+     * Encode a summary in SUMMARY_SIZE bytes.
+     */
+    static size_t encode(const summary_t &summary, uint8_t *buffer)
+    {
+        uint32_t mean;
+        uint32_t variance;
+        memcpy(&mean, &summary.mean, sizeof(mean));
+        memcpy(&variance, &summary.variance, sizeof(variance));
+        write_le32(buffer, summary.metric);
+        write_le32(buffer + 4, summary.end_ms);
+        write_le32(buffer + 8, summary.window_ms);
+        write_le32(buffer + 12, summary.count);
+        write_le32(buffer + 16, summary.min);
+        write_le32(buffer + 20, summary.max);
+        write_le32(buffer + 24, summary.last);
+        write_le32(buffer + 28, mean);
+        write_le32(buffer + 32, variance);
+        return SUMMARY_SIZE;
+    }
+
+    /**
+     * Decode a summary of SUMMARY_SIZE bytes.
+     */
+    static void decode(const uint8_t *buffer, summary_t &summary)
+    {
+        uint32_t mean = read_le32(buffer + 28);
+        uint32_t variance = read_le32(buffer + 32);
+        summary.metric = read_le32(buffer);
+        summary.end_ms = read_le32(buffer + 4);
+        summary.window_ms = read_le32(buffer + 8);
+        summary.count = read_le32(buffer + 12);
+        summary.min = (int32_t) read_le32(buffer + 16);
+        summary.max = (int32_t) read_le32(buffer + 20);
+        summary.last = (int32_t) read_le32(buffer + 24);
+        memcpy(&summary.mean, &mean, sizeof(mean));
+        memcpy(&summary.variance, &variance, sizeof(variance));
+    }
+
+private:
+    struct pane_t {
+        uint32_t count;
+        int32_t min;
+        int32_t max;
+        float mean;
+        float m2;
+    };
+
+    struct metric_t {
+        pane_t panes[MaxPanes];
+        uint32_t pane_count;
+        uint32_t current;
+        uint32_t hop_ms;
+        uint32_t hop_end_ms;
+        int32_t last;
+    };
+
+    /**
+     * Merge the panes of the window ending with the current hop (Chan et
+     * al. pairwise update).
+     *
+     * @return false if the window has no sample.
+     */
+    bool summarize(size_t metric, summary_t &summary) const
+    {
+        const metric_t &m = _metrics[metric];
+        uint32_t count = 0;
+        float mean = 0;
+        float m2 = 0;
+        for (size_t p = 0; p < m.pane_count; ++p) {
+            const pane_t &pane = m.panes[p];
+            if (!pane.count) {
+                continue;
+            }
+            if (!count || pane.min < summary.min) {
+                summary.min = pane.min;
+            }
+            if (!count || pane.max > summary.max) {
+                summary.max = pane.max;
+            }
+            uint32_t merged = count + pane.count;
+            float delta = pane.mean - mean;
+            mean += delta * pane.count / merged;
+            m2 += pane.m2 + delta * delta * ((float) count * pane.count / merged);
+            count = merged;
+        }
+        if (!count) {
+            return false;
+        }
+        summary.metric = metric;
+        summary.end_ms = m.hop_end_ms;
+        summary.window_ms = m.hop_ms * m.pane_count;
+        summary.count = count;
+        summary.last = m.last;
+        summary.mean = mean;
+        summary.variance = m2 / count;
+        return true;
+    }
+
+    static uint32_t read_le32(const uint8_t *src)
+    {
+        return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t) src[3] << 24);
+    }
+
+    static void write_le32(uint8_t *dst, uint32_t value)
+    {
+        dst[0] = value;
+        dst[1] = value >> 8;
+        dst[2] = value >> 16;
+        dst[3] = value >> 24;
+    }
+
+    metric_t _metrics[MetricCount];
+};
+
+#endif /* WINDOW_AGGREGATOR_H_ */
@@ -0,0 +1,145 @@
+#ifndef WRITE_AUTHORIZATION_TABLE_H_
+#define WRITE_AUTHORIZATION_TABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "platform/NonCopyable.h"
+
+#include "ble/GattCharacteristic.h"
+
+/**
+ * Write authorization of the characteristics of a service, indexed by
+ * attribute handle.
+ *
+ * The attributes of a service occupy a contiguous range of handles; the
+ * validator of a characteristic value is stored at its offset from the first
+ * handle registered so a write is authorized with a single array access.
+ * Outcomes are counted instead of logged so the BLE callbacks stay short.
+ *
+ * @tparam Capacity Number of consecutive handles covered by the table.
+ */
+template<size_t Capacity>
+class WriteAuthorizationTable : private mbed::NonCopyable<WriteAuthorizationTable<Capacity> > {
+    typedef WriteAuthorizationTable Self;
+
+public:
+    /**
+     * Check of a write: offset, length and value.
+     */
+    typedef GattAuthCallbackReply_t (*validator_t)(
+        uint16_t offset, uint16_t length, const uint8_t *data
+    );
+
+    struct stats_t {
+        uint32_t accepted;
+        uint32_t invalid_offset;
+        uint32_t invalid_length;
+        uint32_t rejected_value;
+        uint32_t unknown_handle;
+    };
+
+    WriteAuthorizationTable() : _base(0), _registered(0)
+    {
+        for (size_t i = 0; i < Capacity; ++i) {
+            _validators[i] = NULL;
+        }
+        reset_stats();
+    }
+
+    /**
+     * Route the write authorization of a characteristic through the table.
+     *
+     * The characteristic must be registered in the GattServer and its type
+     * must provide a static validate function such as TypedCharacteristic.
+     *
+     * @return false if the handle of the characteristic is out of the range
+     * of the table.
+     */
+    template<typename Characteristic>
+    bool add(Characteristic &characteristic)
+    {
+        if (!add(characteristic.getValueHandle(), &Characteristic::validate)) {
+            return false;
+        }
+        characteristic.setWriteAuthorizationCallback(this, &Self::authorize);
+        return true;
+    }
+
+    /**
+     * Register the validator of an attribute handle.
+     *
+     * The first handle registered is the base of the table; characteristics
+     * are expected to be registered in increasing handle order.
+     */
+    bool add(GattAttribute::Handle_t handle, validator_t validator)
+    {
+        if (!_registered) {
+            _base = handle;
+        }
+
+        if (handle < _base || (size_t)(handle - _base) >= Capacity) {
+            return false;
+        }
+
+        _validators[handle - _base] = validator;
+        ++_registered;
+        return true;
+    }
+
+    /**
+     * Write authorization handler of the characteristics registered.
+     */
+    void authorize(GattWriteAuthCallbackParams *e)
+    {
+        size_t index = e->handle - _base;
+        validator_t validator = (e->handle >= _base && index < Capacity) ?
+            _validators[index] : NULL;
+
+        if (!validator) {
+            ++_stats.unknown_handle;
+            e->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_WRITE_NOT_PERMITTED;
+            return;
+        }
+
+        GattAuthCallbackReply_t reply = validator(e->offset, e->len, e->data);
+        switch (reply) {
+            case AUTH_CALLBACK_REPLY_SUCCESS:
+                ++_stats.accepted;
+                break;
+            case AUTH_CALLBACK_REPLY_ATTERR_INVALID_OFFSET:
+                ++_stats.invalid_offset;
+                break;
+            case AUTH_CALLBACK_REPLY_ATTERR_INVALID_ATT_VAL_LENGTH:
+                ++_stats.invalid_length;
+                break;
+            default:
+                ++_stats.rejected_value;
+                break;
+        }
+
+        e->authorizationReply = reply;
+    }
+
+    const stats_t &stats() const
+    {
+        return _stats;
+    }
+
+    void reset_stats()
+    {
+        _stats.accepted = 0;
+        _stats.invalid_offset = 0;
+        _stats.invalid_length = 0;
+        _stats.rejected_value = 0;
+        _stats.unknown_handle = 0;
+    }
+
+private:
+    GattAttribute::Handle_t _base;
+    size_t _registered;
+    validator_t _validators[Capacity];
+    stats_t _stats;
+};
+
+#endif /* WRITE_AUTHORIZATION_TABLE_H_ */
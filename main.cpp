@@ -12,23 +12,54 @@
 #include "ble/GapAdvertisingData.h"
 #include "ble/GattServer.h"
 
+#include "BulkDataService.h"
+#include "DiagnosticsService.h"
+#include "ConnectionPolicy.h"
+#include "AdvertisingPolicy.h"
+#include "BroadcastPayload.h"
+#include "BLEGateway.h"
+#include "GattClientPoller.h"
+#include "TypedCharacteristic.h"
+#include "WriteAuthorizationTable.h"
+#include "BinaryLog.h"
+#include "EventQueueMonitor.h"
+#include "EventLane.h"
+#include "LinkSupervisor.h"
+#include "PowerManager.h"
+#include "BondingManager.h"
+#include "MetricReporter.h"
+#include "Metrics.h"
+#include "Uplink.h"
+#include "UplinkFrame.h"
+#include "UplinkStore.h"
+#if COMPONENT_FLASHIAP
+#include "FlashIAPBlockDevice.h"
+#endif
+
 // #include "pretty_printer.h"
 /*------------------------------------------------------------------------------
 Hyperterminal settings: 115200 bauds, 8-bit data, no parity
 
 This example 
   - connects to a wifi network (SSID & PWD to set in mbed_app.json)
-  - Connects to a TCP server (set the address in RemoteIP)
-  - Sends "Hello" to the server when data is received
+  - Connects to a TCP server (set the address in RemoteIP), and reconnects
+    with backoff whenever the link is lost (LinkSupervisor.h)
+  - Sends a hello frame, then the uplink records in binary frames
+    (UplinkFrame.h); records that cannot be sent are kept in flash and
+    sent once the link is back (UplinkStore.h)
+  - Uploads per-window statistics of the uplink latencies and of the BLE
+    connections (time to connect, duration) instead of a record per event
+    (MetricReporter.h)
+  - Exposes snapshots of the node health (CPU load, heap, stacks, event
+    queue and wifi latencies, uplink counters) in a diagnostics GATT
+    service, readable without the wifi link (DiagnosticsService.h)
 
 This example uses SPI3 ( PE_0 PC_10 PC_12 PC_11), wifi_wakeup pin (PB_13), 
 wifi_dataready pin (PE_1), wifi reset pin (PE_8)
 ------------------------------------------------------------------------------*/
 
 /* Private defines -----------------------------------------------------------*/
-#define WIFI_WRITE_TIMEOUT 100
-#define WIFI_READ_TIMEOUT  100
-#define CONNECTION_TRIAL_MAX          10
+#define SERVER_PORT                   8002
 
 /* Private typedef------------------------------------------------------------*/
 /* Private macro -------------------------------------------------------------*/
@@ -37,25 +68,73 @@ Serial pc(SERIAL_TX, SERIAL_RX);
 uint8_t RemoteIP[] = {MBED_CONF_APP_SERVER_IP_1,MBED_CONF_APP_SERVER_IP_2,MBED_CONF_APP_SERVER_IP_3, MBED_CONF_APP_SERVER_IP_4};
 
 char* modulename;
-uint8_t TxData[] = "STM32 : Hello!\n";
 uint16_t RxLen;
 uint8_t  MAC_Addr[6]; 
-uint8_t  IP_Addr[4]; 
 // ble section
 using mbed::callback;
 
-class BLEProcess : private mbed::NonCopyable<BLEProcess> {
+// peripheral and poller links are allocated from the same table of the stack
+static_assert(
+    MBED_CONF_APP_BLE_MAX_CONNECTIONS <= MBED_CONF_APP_BLE_CONNECTION_BUDGET,
+    "ble-max-connections exceeds the links of the stack (ble-connection-budget)"
+);
+#if MBED_CONF_APP_POLLER_ENABLE
+static_assert(
+    MBED_CONF_APP_POLLER_MAX_CONNECTIONS < MBED_CONF_APP_BLE_CONNECTION_BUDGET,
+    "poller-max-connections leaves no link for the centrals (ble-connection-budget)"
+);
+#endif
+
+class BLEProcess : private mbed::NonCopyable<BLEProcess>,
+                   public ble::Gap::EventHandler,
+                   public GattServer::EventHandler {
 public:
+    /**
+     * Maximum number of characteristics subscribed per connection that are
+     * tracked.
+     */
+    static const size_t MAX_SUBSCRIPTIONS = 8;
+
+    /**
+     * State of a connection with a central.
+     */
+    struct connection_state_t {
+        bool in_use;
+        ble::connection_handle_t handle;
+        BLEProtocol::AddressType_t peer_address_type;
+        BLEProtocol::AddressBytes_t peer_address;
+        uint16_t att_mtu;
+        uint32_t connected_ms;
+        size_t subscription_count;
+        GattAttribute::Handle_t subscriptions[MAX_SUBSCRIPTIONS];
+    };
+
     /**
      * Construct a BLEProcess from an event queue and a ble interface.
      *
      * Call start() to initiate ble processing.
      */
-    BLEProcess(events::EventQueue &event_queue, BLE &ble_interface,  int32_t Socket) :
+    BLEProcess(
+        events::EventQueue &event_queue,
+        BLE &ble_interface,
+        MetricReporter &metrics
+    ) :
         _event_queue(event_queue),
         _ble_interface(ble_interface),
-        _socket(Socket),
-        _post_init_cb() {
+        _metrics(metrics),
+        _post_init_cb_count(0),
+        _connection_policy(event_queue, ble_interface),
+        _advertising_policy(event_queue, ble_interface),
+        _connection_count(0),
+        _link_count_source(),
+        _connections_total(0),
+        _broadcast_source_count(0),
+        _broadcast_period_ms(0),
+        _broadcast_sequence(0),
+        _advertising_report_cb() {
+            for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+                _connections[i].in_use = false;
+            }
         }
         
 
@@ -67,12 +146,18 @@ public:
    /**
      * Subscription to the ble interface initialization event.
      *
+     * Up to MAX_INIT_CALLBACKS subscribers are called in registration order.
+     *
      * @param[in] cb The callback object that will be called when the ble
      * interface is initialized.
      */
     void on_init(mbed::Callback<void(BLE&, events::EventQueue&)> cb)
     {
-        _post_init_cb = cb;
+        if (_post_init_cb_count == MAX_INIT_CALLBACKS) {
+            LOG_ERROR(LOG_MODULE_BLE, "Error: too many ble init subscribers.\r\n");
+            return;
+        }
+        _post_init_cb[_post_init_cb_count++] = cb;
     }
 
     /**
@@ -80,10 +165,10 @@ public:
      */
     bool start()
     {
-        printf("Ble process started.\r\n");
+        LOG_INFO(LOG_MODULE_BLE, "Ble process started.\r\n");
 
         if (_ble_interface.hasInitialized()) {
-            printf("Error: the ble instance has already been initialized.\r\n");
+            LOG_ERROR(LOG_MODULE_BLE, "Error: the ble instance has already been initialized.\r\n");
             return false;
         }
 
@@ -96,13 +181,179 @@ public:
         );
 
         if (error) {
-            printf("Error: %u returned by BLE::init.\r\n", error);
+            LOG_ERROR(LOG_MODULE_BLE, "Error: %u returned by BLE::init.\r\n", error);
             return false;
         }
 
         return true;
     }
 
+    /**
+     * Add a contributor to the telemetry broadcast in the advertising payload.
+     *
+     * Up to MAX_BROADCAST_SOURCES contributors fill their fields of the
+     * broadcast data at each refresh; connection related fields are filled by
+     * the BLEProcess.
+     */
+    void add_broadcast_source(mbed::Callback<void(broadcast_data_t&)> cb)
+    {
+        if (_broadcast_source_count == MAX_BROADCAST_SOURCES) {
+            LOG_ERROR(LOG_MODULE_BLE, "Error: too many broadcast sources.\r\n");
+            return;
+        }
+        _broadcast_sources[_broadcast_source_count++] = cb;
+    }
+
+    /**
+     * Refresh the broadcast telemetry periodically.
+     *
+     * Must be called before start().
+     *
+     * @param[in] period_ms Refresh period; 0 disables periodic refreshes.
+     */
+    void set_broadcast_period(uint32_t period_ms)
+    {
+        _broadcast_period_ms = period_ms;
+    }
+
+    /**
+     * Subscription to the advertising reports received while scanning.
+     */
+    void on_advertising_report(mbed::Callback<void(const ble::AdvertisingReportEvent&)> cb)
+    {
+        _advertising_report_cb = cb;
+    }
+
+    /**
+     * Access the policy selecting the parameters of each connection.
+     */
+    ConnectionPolicy &connection_policy()
+    {
+        return _connection_policy;
+    }
+
+    /**
+     * Access the policy selecting the advertising interval.
+     */
+    AdvertisingPolicy &advertising_policy()
+    {
+        return _advertising_policy;
+    }
+
+    /**
+     * Access the state of a connection.
+     *
+     * @return NULL if there is no such connection.
+     */
+    const connection_state_t *get_connection(ble::connection_handle_t handle) const
+    {
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            if (_connections[i].in_use && _connections[i].handle == handle) {
+                return &_connections[i];
+            }
+        }
+        return NULL;
+    }
+
+    /**
+     * Number of centrals currently connected.
+     */
+    size_t connection_count() const
+    {
+        return _connection_count;
+    }
+
+    /**
+     * Number of links held by the peripheral role, plus the one kept for
+     * the next central while advertising.
+     */
+    size_t reserved_link_count() const
+    {
+        bool advertising = _advertising_policy.phase() != AdvertisingPolicy::PHASE_STOPPED;
+        return _connection_count + (advertising ? 1 : 0);
+    }
+
+    /**
+     * Set the source of the number of links opened in the central role;
+     * they count against MBED_CONF_APP_BLE_CONNECTION_BUDGET.
+     */
+    void set_link_count_source(mbed::Callback<size_t()> cb)
+    {
+        _link_count_source = cb;
+    }
+
+    /**
+     * ATT MTU in use on a connection; the default MTU if the connection is
+     * unknown.
+     */
+    uint16_t att_mtu(ble::connection_handle_t handle) const
+    {
+        const connection_state_t *connection = get_connection(handle);
+        if (!connection) {
+            return DEFAULT_ATT_MTU;
+        }
+        return connection->att_mtu;
+    }
+
+    /**
+     * Refresh in every connection the subscription state of a characteristic.
+     *
+     * Services call it when a client enables or disables updates of one of
+     * their characteristics.
+     */
+    void update_subscriptions(const GattCharacteristic &characteristic)
+    {
+        GattServer &server = _ble_interface.gattServer();
+        GattAttribute::Handle_t value_handle = characteristic.getValueHandle();
+
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            connection_state_t &connection = _connections[i];
+            if (!connection.in_use) {
+                continue;
+            }
+
+            bool enabled = false;
+            if (server.areUpdatesEnabled(connection.handle, characteristic, &enabled)) {
+                continue;
+            }
+
+            size_t index = 0;
+            while (index < connection.subscription_count &&
+                   connection.subscriptions[index] != value_handle) {
+                ++index;
+            }
+            bool present = index < connection.subscription_count;
+
+            if (enabled && !present && connection.subscription_count < MAX_SUBSCRIPTIONS) {
+                connection.subscriptions[connection.subscription_count++] = value_handle;
+            } else if (!enabled && present) {
+                connection.subscriptions[index] =
+                    connection.subscriptions[--connection.subscription_count];
+            }
+        }
+    }
+
+    /**
+     * Number of connections subscribed to a characteristic value.
+     */
+    size_t subscriber_count(GattAttribute::Handle_t value_handle) const
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            const connection_state_t &connection = _connections[i];
+            if (!connection.in_use) {
+                continue;
+            }
+            for (size_t j = 0; j < connection.subscription_count; ++j) {
+                if (connection.subscriptions[j] == value_handle) {
+                    ++count;
+                    break;
+                }
+            }
+        }
+        return count;
+    }
+
     /**
      * Close existing connections and stop the process.
      */
@@ -110,7 +361,7 @@ public:
     {
         if (_ble_interface.hasInitialized()) {
             _ble_interface.shutdown();
-            printf("Ble process stopped.");
+            LOG_INFO(LOG_MODULE_BLE, "Ble process stopped.\r\n");
         }
     }
 
@@ -121,7 +372,11 @@ private:
      */
     void schedule_ble_events(BLE::OnEventsToProcessCallbackContext *event)
     {
-        _event_queue.call(mbed::callback(&event->ble, &BLE::processEvents));
+        EventQueueMonitor::call(
+            _event_queue,
+            EventQueueMonitor::EVENT_BLE_STACK,
+            mbed::callback(&event->ble, &BLE::processEvents)
+        );
     }
 
     /**
@@ -132,116 +387,290 @@ private:
     void when_init_complete(BLE::InitializationCompleteCallbackContext *event)
     {
         if (event->error) {
-            printf("Error %u during the initialization\r\n", event->error);
+            LOG_ERROR(LOG_MODULE_BLE, "Error %u during the initialization\r\n", event->error);
             return;
         }
-        printf("Ble instance initialized\r\n");
+        LOG_INFO(LOG_MODULE_BLE, "Ble instance initialized\r\n");
 
         Gap &gap = _ble_interface.gap();
         gap.onConnection(this, &BLEProcess::when_connection);
         gap.onDisconnection(this, &BLEProcess::when_disconnection);
+        gap.setEventHandler(this);
+        _ble_interface.gattServer().setEventHandler(this);
 
-        if (!set_advertising_parameters()) {
-            return;
+        _ble_interface.gattServer().onDataWritten(
+            &_connection_policy, &ConnectionPolicy::when_data_written
+        );
+
+        // security and services are set up before the device becomes
+        // connectable
+        for (size_t i = 0; i < _post_init_cb_count; ++i) {
+            _post_init_cb[i](_ble_interface, _event_queue);
         }
 
         if (!set_advertising_data()) {
             return;
         }
 
-        if (!start_advertising()) {
+        if (!_advertising_policy.start()) {
             return;
         }
 
-        if (_post_init_cb) {
-            _post_init_cb(_ble_interface, _event_queue);
+        // the broadcast may be refreshed within half a period of its due
+        // date so it shares the wakeups of the other periodic jobs
+        if (_broadcast_period_ms && _broadcast_source_count) {
+            PowerManager::call_every(
+                _event_queue,
+                EventQueueMonitor::EVENT_BROADCAST,
+                _broadcast_period_ms,
+                _broadcast_period_ms / 2,
+                mbed::callback(this, &BLEProcess::refresh_broadcast)
+            );
         }
     }
 
     void when_connection(const Gap::ConnectionCallbackParams_t *connection_event)
     {
-        
-        printf("Connected.\r\n");
+        // links opened in the central role belong to the GATT client poller
+        if (connection_event->role != Gap::PERIPHERAL) {
+            return;
+        }
+
+        LOG_INFO(LOG_MODULE_BLE, "Connected.\r\n");
+        _connection_policy.when_connection(connection_event);
+        // connections are uploaded as windowed statistics of their time to
+        // connect, not one record each
+        _metrics.observe(MetricReporter::METRIC_BLE_CONNECT_MS, _advertising_policy.when_connection());
+
+        ++_connections_total;
+        Metrics::increment(Metrics::COUNTER_BLE_CONNECTIONS);
+        connection_state_t *connection = allocate_connection(connection_event->handle);
+        if (connection) {
+            connection->peer_address_type = connection_event->peerAddrType;
+            memcpy(connection->peer_address, connection_event->peerAddr, sizeof(connection->peer_address));
+            connection->att_mtu = DEFAULT_ATT_MTU;
+            connection->connected_ms = (uint32_t) rtos::Kernel::get_ms_count();
+            connection->subscription_count = 0;
+        }
+        LOG_INFO(LOG_MODULE_BLE, "%u central(s) connected\r\n", (unsigned) _connection_count);
+
+        // the controller stops advertising once connected; keep accepting
+        // centrals at a low duty cycle until the connection table is full
+        if (has_room()) {
+            _advertising_policy.resume();
+        }
+
         BLE &ble = _ble_interface;
         uint8_t address[6];
-        uint8_t TxData[] = "connect";
-
-        uint16_t Datalen;
         BLEProtocol::AddressType_t typeP;
         ble.gap().getAddress(&typeP, address);
-        printf("%d:%d:%d:%d:%d:%d\n", address[5], address[4], address[3], address[2], address[1], address[0]);
+        LOG_INFO(LOG_MODULE_BLE, "%d:%d:%d:%d:%d:%d\n", address[5], address[4], address[3], address[2], address[1], address[0]);
+
+        // request the largest ATT MTU configured; bulk transfers use it
+        ble_error_t error = ble.gattClient().negotiateAttMtu(connection_event->handle);
+        if (error) {
+            LOG_ERROR(LOG_MODULE_BLE, "Error %u during ATT MTU negotiation.\r\n", error);
+        }
         // tr_info("when_connection(); address: %s, type: %d", tr_array(address, 6), typeP);
-        if(WIFI_SendData(_socket, TxData, sizeof(TxData), &Datalen, WIFI_WRITE_TIMEOUT) != WIFI_STATUS_OK) {
-            printf("> ERROR : Failed to send Data.\n");   
-        } 
     }
 
     void when_disconnection(const Gap::DisconnectionCallbackParams_t *event)
     {
-        
-        printf("Disconnected.\r\n");
-        start_advertising();
+        if (!get_connection(event->handle)) {
+            // a link of the central role freed a slot for the next central
+            if (_advertising_policy.phase() == AdvertisingPolicy::PHASE_STOPPED &&
+                _connection_count && has_room()) {
+                _advertising_policy.resume();
+            }
+            return;
+        }
+
+        LOG_INFO(LOG_MODULE_BLE, "Disconnected.\r\n");
+        Metrics::increment(Metrics::COUNTER_BLE_DISCONNECTIONS);
+        _connection_policy.when_disconnection(event);
+        release_connection(event->handle);
+
+        // the central may come back soon: advertise fast again
+        _advertising_policy.start();
     }
 
-    bool start_advertising(void)
+    /**
+     * Record the ATT MTU negotiated on a connection.
+     */
+    virtual void onAttMtuChange(ble::connection_handle_t connectionHandle, uint16_t attMtuSize)
     {
-        Gap &gap = _ble_interface.gap();
+        LOG_INFO(LOG_MODULE_BLE, "ATT MTU changed to %u on connection %u\r\n", attMtuSize, connectionHandle);
 
-        /* Start advertising the set */
-        ble_error_t error = gap.startAdvertising(ble::LEGACY_ADVERTISING_HANDLE);
+        Metrics::increment(Metrics::COUNTER_BLE_MTU_CHANGES);
+        Metrics::raise(Metrics::GAUGE_BLE_ATT_MTU_MAX, attMtuSize);
+        connection_state_t *connection = find_connection(connectionHandle);
+        if (connection) {
+            connection->att_mtu = attMtuSize;
+        }
+    }
 
-        if (error) {
-            printf("Error %u during gap.startAdvertising.\r\n", error);
-            return false;
-        } else {
-            printf("Advertising started.\r\n");
-            return true;
+    /**
+     * True if another central can be accepted: the connection table and
+     * the links left by the central role both have room for it.
+     */
+    bool has_room() const
+    {
+        size_t links = _connection_count + (_link_count_source ? _link_count_source() : 0);
+        return _connection_count < MBED_CONF_APP_BLE_MAX_CONNECTIONS &&
+            links < MBED_CONF_APP_BLE_CONNECTION_BUDGET;
+    }
+
+    connection_state_t *find_connection(ble::connection_handle_t handle)
+    {
+        return const_cast<connection_state_t *>(get_connection(handle));
+    }
+
+    connection_state_t *allocate_connection(ble::connection_handle_t handle)
+    {
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            if (!_connections[i].in_use) {
+                _connections[i].in_use = true;
+                _connections[i].handle = handle;
+                ++_connection_count;
+                Metrics::set(Metrics::GAUGE_BLE_CONNECTIONS, _connection_count);
+                return &_connections[i];
+            }
+        }
+        LOG_ERROR(LOG_MODULE_BLE, "Error: connection table full.\r\n");
+        return NULL;
+    }
+
+    void release_connection(ble::connection_handle_t handle)
+    {
+        for (size_t i = 0; i < MBED_CONF_APP_BLE_MAX_CONNECTIONS; ++i) {
+            if (_connections[i].in_use && _connections[i].handle == handle) {
+                _metrics.observe(
+                    MetricReporter::METRIC_BLE_CONNECTION_MS,
+                    (uint32_t) rtos::Kernel::get_ms_count() - _connections[i].connected_ms
+                );
+                _connections[i].in_use = false;
+                --_connection_count;
+                Metrics::set(Metrics::GAUGE_BLE_CONNECTIONS, _connection_count);
+                return;
+            }
+        }
+    }
+
+    /**
+     * Forward advertising reports to the subscriber of on_advertising_report.
+     */
+    virtual void onAdvertisingReport(const ble::AdvertisingReportEvent &event)
+    {
+        Metrics::increment(Metrics::COUNTER_BLE_ADVERTISING_REPORTS);
+        if (_advertising_report_cb) {
+            _advertising_report_cb(event);
         }
     }
 
-    bool set_advertising_parameters()
+    /**
+     * Forward the parameters negotiated by the controller to the policy.
+     */
+    virtual void onConnectionParametersUpdateComplete(
+        const ble::ConnectionParametersUpdateCompleteEvent &event
+    ) {
+        _connection_policy.when_parameters_updated(event);
+    }
+
+    void refresh_broadcast()
+    {
+        update_advertising_payload();
+    }
+
+    bool set_advertising_data()
     {
         Gap &gap = _ble_interface.gap();
 
-        ble_error_t error = gap.setAdvertisingParameters(
+        /* The name goes in the scan response to leave room in the
+         * advertising payload for the broadcast telemetry */
+        ble_error_t error = gap.setAdvertisingScanResponse(
             ble::LEGACY_ADVERTISING_HANDLE,
-            ble::AdvertisingParameters()
+            ble::AdvertisingDataSimpleBuilder<ble::LEGACY_ADVERTISING_MAX_SIZE>()
+                .setName("Final Project 2019")
+                .getAdvertisingData()
         );
 
         if (error) {
-            printf("Gap::setAdvertisingParameters() failed with error %d", error);
+            LOG_ERROR(LOG_MODULE_BLE, "Gap::setAdvertisingScanResponse() failed with error %d\r\n", error);
             return false;
         }
 
-        return true;
+        return update_advertising_payload();
     }
 
-    bool set_advertising_data()
+    /**
+     * Build the advertising payload: flags followed by the broadcast
+     * telemetry when broadcast is enabled.
+     *
+     * The controller accepts a new payload while advertising; observers pick
+     * it up on the next advertising event without the set being restarted.
+     */
+    bool update_advertising_payload()
     {
         Gap &gap = _ble_interface.gap();
 
-        /* Use the simple builder to construct the payload; it fails at runtime
+        /* Use the builder to construct the payload; it fails at runtime
          * if there is not enough space left in the buffer */
+        ble::AdvertisingDataBuilder builder(_advertising_buffer, sizeof(_advertising_buffer));
+        builder.setFlags();
+
+        if (_broadcast_source_count) {
+            broadcast_data_t data;
+            memset(&data, 0, sizeof(data));
+            data.connections = _connection_count;
+            data.uptime_s = rtos::Kernel::get_ms_count() / 1000;
+            data.counters[broadcast_data_t::COUNTER_CONNECTIONS_TOTAL] = _connections_total;
+            for (size_t i = 0; i < _broadcast_source_count; ++i) {
+                _broadcast_sources[i](data);
+            }
+
+            uint8_t manufacturer_data[BROADCAST_PAYLOAD_SIZE];
+            size_t length = broadcast_encode(
+                data, _broadcast_sequence++, manufacturer_data, sizeof(manufacturer_data)
+            );
+            builder.setManufacturerSpecificData(
+                mbed::Span<const uint8_t>(manufacturer_data, length)
+            );
+        }
+
         ble_error_t error = gap.setAdvertisingPayload(
             ble::LEGACY_ADVERTISING_HANDLE,
-            ble::AdvertisingDataSimpleBuilder<ble::LEGACY_ADVERTISING_MAX_SIZE>()
-                .setFlags()
-                .setName("Final Project 2019")
-                .getAdvertisingData()
+            builder.getAdvertisingData()
         );
 
         if (error) {
-            printf("Gap::setAdvertisingPayload() failed with error %d", error);
+            LOG_ERROR(LOG_MODULE_BLE, "Gap::setAdvertisingPayload() failed with error %d\r\n", error);
             return false;
         }
 
         return true;
     }
 
+    static const size_t MAX_INIT_CALLBACKS = 6;
+    static const uint16_t DEFAULT_ATT_MTU = 23;
+    static const size_t MAX_BROADCAST_SOURCES = 4;
+
     events::EventQueue &_event_queue;
     BLE &_ble_interface;
-    mbed::Callback<void(BLE&, events::EventQueue&)> _post_init_cb;
-    int32_t _socket;
+    MetricReporter &_metrics;
+    mbed::Callback<void(BLE&, events::EventQueue&)> _post_init_cb[MAX_INIT_CALLBACKS];
+    size_t _post_init_cb_count;
+    ConnectionPolicy _connection_policy;
+    AdvertisingPolicy _advertising_policy;
+    connection_state_t _connections[MBED_CONF_APP_BLE_MAX_CONNECTIONS];
+    size_t _connection_count;
+    mbed::Callback<size_t()> _link_count_source;
+    uint32_t _connections_total;
+    uint8_t _advertising_buffer[ble::LEGACY_ADVERTISING_MAX_SIZE];
+    mbed::Callback<void(broadcast_data_t&)> _broadcast_sources[MAX_BROADCAST_SOURCES];
+    size_t _broadcast_source_count;
+    uint32_t _broadcast_period_ms;
+    uint8_t _broadcast_sequence;
+    mbed::Callback<void(const ble::AdvertisingReportEvent&)> _advertising_report_cb;
 };
 
 class ClockService {
@@ -252,6 +681,7 @@ public:
         _hour_char("485f4145-52b9-4644-af1f-7a6b9322490f", 0),
         _minute_char("0a924ca7-87cd-4699-a3bd-abdcd9cf126a", 0),
         _second_char("8dd6a1b7-bc75-4741-8a26-264af75807de", 0),
+        _current_time_char(GattCharacteristic::UUID_CURRENT_TIME_CHAR),
         _smart_home(
             /* uuid */ "51311102-030e-485f-b122-f8f381aa84ed",
             /* characteristics */ _clock_characteristics,
@@ -259,41 +689,115 @@ public:
                                      sizeof(_clock_characteristics[0])
         ),
         _server(NULL),
-        _event_queue(NULL)
+        _event_queue(NULL),
+        _subscription_cb(),
+        _subscriber_count_source()
     {
+        _stats.reads = 0;
+        _stats.writes = 0;
+        _stats.updates_sent = 0;
+
         // update internal pointers (value, descriptors and characteristics array)
         _clock_characteristics[0] = &_hour_char;
         _clock_characteristics[1] = &_minute_char;
         _clock_characteristics[2] = &_second_char;
+        _clock_characteristics[3] = &_current_time_char;
+    }
+
 
-        // setup authorization handlers
-        _hour_char.setWriteAuthorizationCallback(this, &Self::authorize_client_write);
-        _minute_char.setWriteAuthorizationCallback(this, &Self::authorize_client_write);
-        _second_char.setWriteAuthorizationCallback(this, &Self::authorize_client_write);
+
+    /**
+     * Subscription to the changes of client subscriptions.
+     *
+     * Values are written once to the GattServer which notifies every
+     * subscribed connection; this hook lets the owner of the connections keep
+     * track of who is subscribed to what.
+     *
+     * @param[in] cb Callback invoked with the characteristic affected.
+     */
+    void on_subscription_change(mbed::Callback<void(const GattCharacteristic&)> cb)
+    {
+        _subscription_cb = cb;
     }
 
+    /**
+     * Set the source of the number of connections subscribed to a
+     * characteristic value.
+     *
+     * The stack reports sent notifications without their characteristic;
+     * updates of the clock are counted when a value is written instead,
+     * once per subscribed connection.
+     */
+    void set_subscriber_count_source(mbed::Callback<size_t(GattAttribute::Handle_t)> cb)
+    {
+        _subscriber_count_source = cb;
+    }
+
+    /**
+     * Fill the time fields of the broadcast telemetry.
+     */
+    void fill_broadcast(broadcast_data_t &data)
+    {
+        if (!_server) {
+            return;
+        }
 
+        _hour_char.get(*_server, data.hour);
+        _minute_char.get(*_server, data.minute);
+        _second_char.get(*_server, data.second);
+    }
+
+    /**
+     * Print the access counters of the service.
+     *
+     * Meant to be called periodically, outside of the BLE callbacks.
+     */
+    void print_stats() const
+    {
+        const WriteAuthorizationTable<CLOCK_ATTRIBUTES_COUNT>::stats_t &auth =
+            _write_authorizations.stats();
+
+        printf(
+            "clock service: %lu reads, %lu writes, %lu updates sent\r\n",
+            (unsigned long) _stats.reads,
+            (unsigned long) _stats.writes,
+            (unsigned long) _stats.updates_sent
+        );
+        printf(
+            "\twrite authorization: %lu accepted, %lu invalid offset, "
+            "%lu invalid length, %lu rejected value, %lu unknown handle\r\n",
+            (unsigned long) auth.accepted,
+            (unsigned long) auth.invalid_offset,
+            (unsigned long) auth.invalid_length,
+            (unsigned long) auth.rejected_value,
+            (unsigned long) auth.unknown_handle
+        );
+    }
 
     void start(BLE &ble_interface, events::EventQueue &event_queue)
     {
          if (_event_queue) {
             return;
         }
-        printf("coooooonnect");
         _server = &ble_interface.gattServer();
         _event_queue = &event_queue;
 
         // register the service
-        printf("Adding demo service\r\n");
+        LOG_INFO(LOG_MODULE_CLOCK, "Adding demo service\r\n");
         ble_error_t err = _server->addService(_smart_home);
 
         if (err) {
-            printf("Error %u during demo service registration.\r\n", err);
+            LOG_ERROR(LOG_MODULE_CLOCK, "Error %u during demo service registration.\r\n", err);
             return;
         }
 
+        // values written by clients are checked against the bounds of the
+        // characteristics
+        _write_authorizations.add(_hour_char);
+        _write_authorizations.add(_minute_char);
+        _write_authorizations.add(_second_char);
+
         // read write handler
-        _server->onDataSent(as_cb(&Self::when_data_sent));
         _server->onDataWritten(as_cb(&Self::when_data_written));
         _server->onDataRead(as_cb(&Self::when_data_read));
 
@@ -303,23 +807,37 @@ public:
         _server->onConfirmationReceived(as_cb(&Self::when_confirmation_received));
 
         // print the handles
-        printf("clock service registered\r\n");
-        printf("service handle: %u\r\n", _smart_home.getHandle());
-        printf("\thour characteristic value handle %u\r\n", _hour_char.getValueHandle());
-        printf("\tminute characteristic value handle %u\r\n", _minute_char.getValueHandle());
-        printf("\tsecond characteristic value handle %u\r\n", _second_char.getValueHandle());
-
-        _event_queue->call_every(1000 /* ms */, callback(this, &Self::increment_second));
+        LOG_INFO(LOG_MODULE_CLOCK, "clock service registered\r\n");
+        LOG_INFO(LOG_MODULE_CLOCK, "service handle: %u\r\n", _smart_home.getHandle());
+        LOG_INFO(LOG_MODULE_CLOCK, "\thour characteristic value handle %u\r\n", _hour_char.getValueHandle());
+        LOG_INFO(LOG_MODULE_CLOCK, "\tminute characteristic value handle %u\r\n", _minute_char.getValueHandle());
+        LOG_INFO(LOG_MODULE_CLOCK, "\tsecond characteristic value handle %u\r\n", _second_char.getValueHandle());
+        LOG_INFO(LOG_MODULE_CLOCK, "\tcurrent time characteristic value handle %u\r\n", _current_time_char.getValueHandle());
+
+        // the tick has no slack: it anchors the wakeups of the queue
+        PowerManager::call_every(
+            *_event_queue,
+            EventQueueMonitor::EVENT_CLOCK_TICK,
+            1000 /* ms */,
+            0 /* slack */,
+            callback(this, &Self::increment_second)
+        );
     }
 
 private:
 
     /**
-     * Handler called when a notification or an indication has been sent.
+     * Account the notifications sent after a write of a clock value.
      */
-    void when_data_sent(unsigned count)
+    void account_update(const GattCharacteristic &characteristic)
     {
-        printf("sent %u updates\r\n", count);
+        if (!_subscriber_count_source) {
+            return;
+        }
+
+        size_t count = _subscriber_count_source(characteristic.getValueHandle());
+        _stats.updates_sent += count;
+        Metrics::increment(Metrics::COUNTER_CLOCK_UPDATES_SENT, count);
     }
 
     /**
@@ -327,28 +845,13 @@ private:
      */
     void when_data_written(const GattWriteCallbackParams *e)
     {
-        printf("data written:\r\n");
-        printf("\tconnection handle: %u\r\n", e->connHandle);
-        printf("\tattribute handle: %u", e->handle);
-        if (e->handle == _hour_char.getValueHandle()) {
-            printf(" (hour characteristic)\r\n");
-        } else if (e->handle == _minute_char.getValueHandle()) {
-            printf(" (minute characteristic)\r\n");
-        } else if (e->handle == _second_char.getValueHandle()) {
-            printf(" (second characteristic)\r\n");
-        } else {
-            printf("\r\n");
-        }
-        printf("\twrite operation: %u\r\n", e->writeOp);
-        printf("\toffset: %u\r\n", e->offset);
-        printf("\tlength: %u\r\n", e->len);
-        printf("\t data: ");
-
-        for (size_t i = 0; i < e->len; ++i) {
-            printf("%02X", e->data[i]);
+        if (e->handle == _hour_char.getValueHandle() ||
+            e->handle == _minute_char.getValueHandle() ||
+            e->handle == _second_char.getValueHandle()) {
+            ++_stats.writes;
+            Metrics::increment(Metrics::COUNTER_CLOCK_WRITES);
+            update_current_time();
         }
-
-        printf("\r\n");
     }
 
     /**
@@ -356,18 +859,20 @@ private:
      */
     void when_data_read(const GattReadCallbackParams *e)
     {
-        printf("data read:\r\n");
-        printf("\tconnection handle: %u\r\n", e->connHandle);
-        printf("\tattribute handle: %u", e->handle);
-        if (e->handle == _hour_char.getValueHandle()) {
-            printf(" (hour characteristic)\r\n");
-        } else if (e->handle == _minute_char.getValueHandle()) {
-            printf(" (minute characteristic)\r\n");
-        } else if (e->handle == _second_char.getValueHandle()) {
-            printf(" (second characteristic)\r\n");
-        } else {
-            printf("\r\n");
+        // the handler sees the reads of every service of the server
+        bool clock_value = false;
+        for (size_t i = 0; i < CLOCK_CHARACTERISTICS_COUNT; ++i) {
+            if (_clock_characteristics[i]->getValueHandle() == e->handle) {
+                clock_value = true;
+                break;
+            }
         }
+        if (!clock_value) {
+            return;
+        }
+
+        ++_stats.reads;
+        Metrics::increment(Metrics::COUNTER_CLOCK_READS);
     }
 
     /**
@@ -377,7 +882,9 @@ private:
      */
     void when_update_enabled(GattAttribute::Handle_t handle)
     {
-        printf("update enabled on handle %d\r\n", handle);
+        LOG_INFO(LOG_MODULE_CLOCK, "update enabled on handle %d\r\n", handle);
+        Metrics::increment(Metrics::COUNTER_CLOCK_SUBSCRIPTIONS);
+        notify_subscription_change(handle);
     }
 
     /**
@@ -388,61 +895,55 @@ private:
      */
     void when_update_disabled(GattAttribute::Handle_t handle)
     {
-        printf("update disabled on handle %d\r\n", handle);
+        LOG_INFO(LOG_MODULE_CLOCK, "update disabled on handle %d\r\n", handle);
+        notify_subscription_change(handle);
     }
 
     /**
-     * Handler called when an indication confirmation has been received.
-     *
-     * @param handle Handle of the characteristic value that has emitted the
-     * indication.
+     * Forward a change of subscription to the subscriber of
+     * on_subscription_change.
      */
-    void when_confirmation_received(GattAttribute::Handle_t handle)
+    void notify_subscription_change(GattAttribute::Handle_t handle)
     {
-        printf("confirmation received on handle %d\r\n", handle);
+        if (!_subscription_cb) {
+            return;
+        }
+
+        for (size_t i = 0; i < CLOCK_CHARACTERISTICS_COUNT; ++i) {
+            if (_clock_characteristics[i]->getValueHandle() == handle) {
+                _subscription_cb(*_clock_characteristics[i]);
+                return;
+            }
+        }
     }
 
     /**
-     * Handler called when a write request is received.
+     * Handler called when an indication confirmation has been received.
      *
-     * This handler verify that the value submitted by the client is valid before
-     * authorizing the operation.
+     * @param handle Handle of the characteristic value that has emitted the
+     * indication.
      */
-    void authorize_client_write(GattWriteAuthCallbackParams *e)
+    void when_confirmation_received(GattAttribute::Handle_t handle)
     {
-        printf("characteristic %u write authorization\r\n", e->handle);
-
-        if (e->offset != 0) {
-            printf("Error invalid offset\r\n");
-            e->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_INVALID_OFFSET;
-            return;
-        }
-
-        if (e->len != 1) {
-            printf("Error invalid len\r\n");
-            e->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_INVALID_ATT_VAL_LENGTH;
-            return;
-        }
-
-        if ((e->data[0] >= 60) ||
-            ((e->data[0] >= 24) && (e->handle == _hour_char.getValueHandle()))) {
-            printf("Error invalid data\r\n");
-            e->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_WRITE_NOT_PERMITTED;
-            return;
-        }
-
-        e->authorizationReply = AUTH_CALLBACK_REPLY_SUCCESS;
+        LOG_INFO(LOG_MODULE_CLOCK, "confirmation received on handle %d\r\n", handle);
     }
 
     /**
      * Increment the second counter.
      */
     void increment_second(void)
+    {
+        uint32_t start_us = us_ticker_read();
+        advance_second();
+        Metrics::record(Metrics::HISTOGRAM_CLOCK_TICK_US, us_ticker_read() - start_us);
+    }
+
+    void advance_second(void)
     {
         uint8_t second = 0;
         ble_error_t err = _second_char.get(*_server, second);
         if (err) {
-            printf("read of the second value returned error %u\r\n", err);
+            LOG_ERROR(LOG_MODULE_CLOCK, "read of the second value returned error %u\r\n", err);
             return;
         }
 
@@ -450,13 +951,16 @@ private:
 
         err = _second_char.set(*_server, second);
         if (err) {
-            printf("write of the second value returned error %u\r\n", err);
+            LOG_ERROR(LOG_MODULE_CLOCK, "write of the second value returned error %u\r\n", err);
             return;
         }
+        account_update(_second_char);
 
         if (second == 0) {
             increment_minute();
         }
+
+        update_current_time();
     }
 
     /**
@@ -467,7 +971,7 @@ private:
         uint8_t minute = 0;
         ble_error_t err = _minute_char.get(*_server, minute);
         if (err) {
-            printf("read of the minute value returned error %u\r\n", err);
+            LOG_ERROR(LOG_MODULE_CLOCK, "read of the minute value returned error %u\r\n", err);
             return;
         }
 
@@ -475,9 +979,10 @@ private:
 
         err = _minute_char.set(*_server, minute);
         if (err) {
-            printf("write of the minute value returned error %u\r\n", err);
+            LOG_ERROR(LOG_MODULE_CLOCK, "write of the minute value returned error %u\r\n", err);
             return;
         }
+        account_update(_minute_char);
 
         if (minute == 0) {
             increment_hour();
@@ -492,7 +997,7 @@ private:
         uint8_t hour = 0;
         ble_error_t err = _hour_char.get(*_server, hour);
         if (err) {
-            printf("read of the hour value returned error %u\r\n", err);
+            LOG_ERROR(LOG_MODULE_CLOCK, "read of the hour value returned error %u\r\n", err);
             return;
         }
 
@@ -500,9 +1005,43 @@ private:
 
         err = _hour_char.set(*_server, hour);
         if (err) {
-            printf("write of the hour value returned error %u\r\n", err);
+            LOG_ERROR(LOG_MODULE_CLOCK, "write of the hour value returned error %u\r\n", err);
+            return;
+        }
+        account_update(_hour_char);
+    }
+
+    /**
+     * Mirror the hour, minute and second characteristics into the packed
+     * current time characteristic.
+     *
+     * Clients subscribed to the packed characteristic receive a single
+     * notification per tick instead of up to three.
+     */
+    void update_current_time(void)
+    {
+        uint8_t hour = 0;
+        uint8_t minute = 0;
+        uint8_t second = 0;
+
+        ble_error_t err = _hour_char.get(*_server, hour);
+        if (!err) {
+            err = _minute_char.get(*_server, minute);
+        }
+        if (!err) {
+            err = _second_char.get(*_server, second);
+        }
+        if (err) {
+            LOG_ERROR(LOG_MODULE_CLOCK, "read of the time values returned error %u\r\n", err);
             return;
         }
+
+        err = _current_time_char.set(*_server, hour, minute, second);
+        if (err) {
+            LOG_ERROR(LOG_MODULE_CLOCK, "write of the current time value returned error %u\r\n", err);
+            return;
+        }
+        account_update(_current_time_char);
     }
 
 private:
@@ -517,93 +1056,110 @@ private:
     }
 
     /**
-     * Read, Write, Notify, Indicate  Characteristic declaration helper.
+     * Read, Notify characteristic holding the time packed in the format of
+     * the Current Time characteristic (0x2A2B) of the Current Time Service.
      *
-     * @tparam T type of data held by the characteristic.
+     * Layout (little endian): year (2), month, day, hours, minutes, seconds,
+     * day of week, fractions256, adjust reason. The clock has no notion of
+     * date so year, month, day and day of week are reported as 0 (unknown).
      */
-    template<typename T>
-    class ReadWriteNotifyIndicateCharacteristic : public GattCharacteristic {
+    class CurrentTimeCharacteristic : public GattCharacteristic {
     public:
+        static const uint8_t VALUE_SIZE = 10;
+
         /**
-         * Construct a characteristic that can be read or written and emit
-         * notification or indication.
+         * Construct a packed current time characteristic initialized at
+         * midnight.
          *
          * @param[in] uuid The UUID of the characteristic.
-         * @param[in] initial_value Initial value contained by the characteristic.
          */
-        ReadWriteNotifyIndicateCharacteristic(const UUID & uuid, const T& initial_value) :
+        CurrentTimeCharacteristic(const UUID & uuid) :
             GattCharacteristic(
                 /* UUID */ uuid,
-                /* Initial value */ &_value,
+                /* Initial value */ _value,
                 /* Value size */ sizeof(_value),
                 /* Value capacity */ sizeof(_value),
                 /* Properties */ GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ |
-                                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE |
-                                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY |
-                                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_INDICATE,
+                                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY,
                 /* Descriptors */ NULL,
                 /* Num descriptors */ 0,
                 /* variable len */ false
-            ),
-            _value(initial_value) {
+            ) {
+            memset(_value, 0, sizeof(_value));
         }
 
         /**
-         * Get the value of this characteristic.
+         * Assign a new time to this characteristic.
          *
-         * @param[in] server GattServer instance that contain the characteristic
-         * value.
-         * @param[in] dst Variable that will receive the characteristic value.
-         *
-         * @return BLE_ERROR_NONE in case of success or an appropriate error code.
-         */
-        ble_error_t get(GattServer &server, T& dst) const
-        {
-            uint16_t value_length = sizeof(dst);
-            return server.read(getValueHandle(), &dst, &value_length);
-        }
-
-        /**
-         * Assign a new value to this characteristic.
+         * The whole value is written at once so subscribed clients receive a
+         * single notification.
          *
          * @param[in] server GattServer instance that will receive the new value.
-         * @param[in] value The new value to set.
+         * @param[in] hour Hours since midnight.
+         * @param[in] minute Minutes of the hour.
+         * @param[in] second Seconds of the minute.
          * @param[in] local_only Flag that determine if the change should be kept
          * locally or forwarded to subscribed clients.
          */
         ble_error_t set(
-            GattServer &server, const uint8_t &value, bool local_only = false
-        ) const {
-            return server.write(getValueHandle(), &value, sizeof(value), local_only);
+            GattServer &server, uint8_t hour, uint8_t minute, uint8_t second,
+            bool local_only = false
+        ) {
+            _value[HOURS_OFFSET] = hour;
+            _value[MINUTES_OFFSET] = minute;
+            _value[SECONDS_OFFSET] = second;
+            return server.write(getValueHandle(), _value, sizeof(_value), local_only);
         }
 
     private:
-        uint8_t _value;
+        static const uint8_t HOURS_OFFSET = 4;
+        static const uint8_t MINUTES_OFFSET = 5;
+        static const uint8_t SECONDS_OFFSET = 6;
+
+        uint8_t _value[VALUE_SIZE];
     };
 
-    ReadWriteNotifyIndicateCharacteristic<uint8_t> _hour_char;
-    ReadWriteNotifyIndicateCharacteristic<uint8_t> _minute_char;
-    ReadWriteNotifyIndicateCharacteristic<uint8_t> _second_char;
+    static const uint8_t READ_WRITE_NOTIFY_INDICATE =
+        GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ |
+        GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE |
+        GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY |
+        GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_INDICATE;
+
+    // writes out of these bounds are rejected by the characteristics
+    TypedCharacteristic<uint8_t, READ_WRITE_NOTIFY_INDICATE, 0, 23> _hour_char;
+    TypedCharacteristic<uint8_t, READ_WRITE_NOTIFY_INDICATE, 0, 59> _minute_char;
+    TypedCharacteristic<uint8_t, READ_WRITE_NOTIFY_INDICATE, 0, 59> _second_char;
+    CurrentTimeCharacteristic _current_time_char;
+
+    static const size_t CLOCK_CHARACTERISTICS_COUNT = 4;
+
+    // declaration, value and CCCD of each characteristic
+    static const size_t CLOCK_ATTRIBUTES_COUNT = 3 * CLOCK_CHARACTERISTICS_COUNT;
 
     // list of the characteristics of the clock service
-    GattCharacteristic* _clock_characteristics[3];
+    GattCharacteristic* _clock_characteristics[CLOCK_CHARACTERISTICS_COUNT];
 
     // demo service
     GattService _smart_home;
 
     GattServer* _server;
     events::EventQueue *_event_queue;
-    
-    uint16_t Datalen;
-    uint8_t RxData [500];
-   
+    mbed::Callback<void(const GattCharacteristic&)> _subscription_cb;
+    mbed::Callback<size_t(GattAttribute::Handle_t)> _subscriber_count_source;
+
+    WriteAuthorizationTable<CLOCK_ATTRIBUTES_COUNT> _write_authorizations;
+
+    struct {
+        uint32_t reads;
+        uint32_t writes;
+        uint32_t updates_sent;
+    } _stats;
 };
- uint16_t Trials = CONNECTION_TRIAL_MAX;
- int32_t Socket = -1;
 // main section
 int main()
 {
     pc.baud(115200);
+    BinaryLog::instance().start();
     // BLE &ble = BLE::Instance();
    
 
@@ -620,6 +1176,7 @@ int main()
     printf("************************************************************\n");
 
     /*Initialize  WIFI module */
+    WIFI_SetCommandHook(&Metrics::when_wifi_command);
     if(WIFI_Init() ==  WIFI_STATUS_OK) {
         printf("> WIFI Module Initialized.\n");  
         if(WIFI_GetMAC_Address(MAC_Addr) == WIFI_STATUS_OK) {
@@ -633,71 +1190,135 @@ int main()
         } else {
             printf("> ERROR : CANNOT get MAC address\n");
         }
-    
-        if( WIFI_Connect(MBED_CONF_APP_WIFI_SSID, MBED_CONF_APP_WIFI_PASSWORD, WIFI_ECN_WPA2_PSK) == WIFI_STATUS_OK) {
-            printf("> es-wifi module connected \n");
-            if(WIFI_GetIP_Address(IP_Addr) == WIFI_STATUS_OK) {
-                printf("> es-wifi module got IP Address : %d.%d.%d.%d\n",     
-                       IP_Addr[0],
-                       IP_Addr[1],
-                       IP_Addr[2],
-                       IP_Addr[3]); 
-        
-                printf("> Trying to connect to Server: %d.%d.%d.%d:8002 ...\n",     
-                       RemoteIP[0],
-                       RemoteIP[1],
-                       RemoteIP[2],
-                       RemoteIP[3]);
-        
-                while (Trials--){ 
-                    if( WIFI_OpenClientConnection(0, WIFI_TCP_PROTOCOL, "TCP_CLIENT", RemoteIP, 8002, 0) == WIFI_STATUS_OK){
-                        printf("> TCP Connection opened successfully.\n"); 
-                        Socket = 0;
-                    }
-                }
-                if(!Trials) {
-                    printf("> ERROR : Cannot open Connection\n");
-                }
-            } else {
-                printf("> ERROR : es-wifi module CANNOT get IP address\n");
-            }
-        } else {
-            printf("> ERROR : es-wifi module NOT connected\n");
-        }
+        printf("> Link to server: %d.%d.%d.%d:%d\n",
+               RemoteIP[0],
+               RemoteIP[1],
+               RemoteIP[2],
+               RemoteIP[3],
+               SERVER_PORT);
     } else {
         printf("> ERROR : WIFI Module cannot be initialized.\n"); 
     }
 
     printf("start ble init");
     BLE &ble_interface = BLE::Instance();
-    events::EventQueue event_queue;
-    ClockService demo_service;
-    BLEProcess ble_process(event_queue, ble_interface, Socket);
 
+    // BLE stack and services, application work and blocking wifi I/O are
+    // dispatched by separate threads so uplink traffic cannot delay the stack
+    // the lanes and the modules live in static storage: the main thread stack
+    // (rtos.main-thread-stack-size, 4 kB by default) cannot hold them
+    static EventLane ble_lane("ble", MBED_CONF_APP_BLE_LANE_PRIORITY, MBED_CONF_APP_BLE_LANE_STACK_SIZE);
+    static EventLane app_lane("app", MBED_CONF_APP_APP_LANE_PRIORITY, MBED_CONF_APP_APP_LANE_STACK_SIZE);
+    static EventLane wifi_lane("wifi", MBED_CONF_APP_WIFI_LANE_PRIORITY, MBED_CONF_APP_WIFI_LANE_STACK_SIZE);
+    static EventQueueMonitor ble_monitor(ble_lane.queue());
+    static EventQueueMonitor app_monitor(app_lane.queue());
+    static EventQueueMonitor wifi_monitor(wifi_lane.queue());
+    static PowerManager power_manager(ble_lane.queue());
+
+    events::EventQueue &event_queue = ble_lane.queue();
+    events::EventQueue &app_queue = app_lane.queue();
+    static ClockService demo_service;
+    static BulkDataService bulk_service;
+    static DiagnosticsService diagnostics_service(app_queue);
+    static MetricReporter metrics(wifi_lane.queue());
+    // the supervisor owns the link; the uplink stores records while it is down
+    static LinkSupervisor link(
+        wifi_lane.queue(), RemoteIP, SERVER_PORT, UplinkFrame::read_le32(MAC_Addr + 2) ^ us_ticker_read()
+    );
+#if COMPONENT_FLASHIAP
+    // records that cannot be sent wait in flash for the link to come back
+    static FlashIAPBlockDevice uplink_store_device(
+        MBED_CONF_APP_UPLINK_STORE_ADDRESS, MBED_CONF_APP_UPLINK_STORE_SIZE
+    );
+    static UplinkStore uplink_store(uplink_store_device);
+    static Uplink uplink(
+        wifi_lane.queue(), -1, MAC_Addr, uplink_store.start() ? &uplink_store : NULL, &metrics
+    );
+    app_queue.call_every(60000, &uplink_store, &UplinkStore::print_stats);
+#else
+    static Uplink uplink(wifi_lane.queue(), -1, MAC_Addr, NULL, &metrics);
+#endif
+    static BLEProcess ble_process(event_queue, ble_interface, metrics);
+    metrics.start(callback(&uplink, &Uplink::append));
+    link.on_socket_change(callback(&uplink, &Uplink::set_socket));
+    uplink.on_send(callback(&link, &LinkSupervisor::when_send));
+    link.start();
+
+#if MBED_CONF_APP_SECURITY_ENABLE
+    static BondingManager bonding_manager;
+    ble_process.on_init(callback(&bonding_manager, &BondingManager::start));
+    app_queue.call_every(60000, &bonding_manager, &BondingManager::print_stats);
+#endif
     ble_process.on_init(callback(&demo_service, &ClockService::start));
+    ble_process.on_init(callback(&bulk_service, &BulkDataService::start));
+    diagnostics_service.add_lane(ble_lane, ble_monitor);
+    diagnostics_service.add_lane(app_lane, app_monitor);
+    diagnostics_service.add_lane(wifi_lane, wifi_monitor);
+    ble_process.on_init(callback(&diagnostics_service, &DiagnosticsService::start));
+    demo_service.on_subscription_change(callback(
+        &ble_process, &BLEProcess::update_subscriptions
+    ));
+    demo_service.set_subscriber_count_source(callback(
+        &ble_process, &BLEProcess::subscriber_count
+    ));
+    ble_process.add_broadcast_source(callback(&demo_service, &ClockService::fill_broadcast));
+    ble_process.add_broadcast_source(callback(&bulk_service, &BulkDataService::fill_broadcast));
+    ble_process.set_broadcast_period(MBED_CONF_APP_BLE_BROADCAST_PERIOD_MS);
+    app_queue.call_every(60000, &demo_service, &ClockService::print_stats);
+    app_queue.call_every(60000, &ble_monitor, &EventQueueMonitor::print_stats);
+    app_queue.call_every(60000, &app_monitor, &EventQueueMonitor::print_stats);
+    app_queue.call_every(60000, &wifi_monitor, &EventQueueMonitor::print_stats);
+    app_queue.call_every(60000, &power_manager, &PowerManager::print_stats);
+    app_queue.call_every(60000, &link, &LinkSupervisor::print_stats);
+    app_queue.call_every(60000, &uplink, &Uplink::print_stats);
+    app_queue.call_every(60000, &metrics, &MetricReporter::print_stats);
+    app_queue.call_every(60000, &Metrics::print_stats);
+    app_queue.call_every(60000, &diagnostics_service, &DiagnosticsService::print_stats);
+    app_queue.call_every(60000, &ble_process.advertising_policy(), &AdvertisingPolicy::print_stats);
+
+    // the button brings advertising back to the fast interval
+    InterruptIn button(BLE_BUTTON_PIN_NAME, BLE_BUTTON_PIN_PULL);
+    button.fall(callback(&ble_process.advertising_policy(), &AdvertisingPolicy::request_boost));
+#if MBED_CONF_APP_GATEWAY_ENABLE
+    static BLEGateway gateway(uplink);
+    ble_process.on_init(callback(&gateway, &BLEGateway::start));
+    ble_process.on_advertising_report(callback(&gateway, &BLEGateway::when_advertising_report));
+    app_queue.call_every(60000, &gateway, &BLEGateway::print_stats);
+#endif
+#if MBED_CONF_APP_POLLER_ENABLE
+    static GattClientPoller poller(
+        uplink,
+        UUID(MBED_CONF_APP_POLLER_SERVICE_UUID),
+        UUID(MBED_CONF_APP_POLLER_CHARACTERISTIC_UUID)
+    );
+    poller.add_peers(
+        MBED_CONF_APP_POLLER_PEERS,
+        MBED_CONF_APP_POLLER_PEERS_RANDOM ?
+            ble::peer_address_type_t::RANDOM : ble::peer_address_type_t::PUBLIC,
+        MBED_CONF_APP_POLLER_SUBSCRIBE
+    );
+    // both roles share the links of the stack
+    poller.set_link_count_source(callback(&ble_process, &BLEProcess::reserved_link_count));
+    ble_process.set_link_count_source(callback(&poller, &GattClientPoller::link_count));
+    ble_process.on_init(callback(&poller, &GattClientPoller::start));
+    app_queue.call_every(60000, &poller, &GattClientPoller::print_stats);
+#endif
+    bulk_service.set_att_mtu_source(callback(&ble_process, &BLEProcess::att_mtu));
+    // the log records are buffered for the bulk transfers
+    BinaryLog::instance().set_sink(callback(&bulk_service, &BulkDataService::push));
+    diagnostics_service.set_att_mtu_source(callback(&ble_process, &BLEProcess::att_mtu));
+    bulk_service.on_transfer(callback(
+        &ble_process.connection_policy(), &ConnectionPolicy::set_transfer_active
+    ));
 
     // bind the event queue to the ble interface, initialize the interface
-    // and start advertising
-    ble_process.start();
-    event_queue.dispatch_forever();
-    // Process the event queue.
-    
-
-    
-    
-    
-    // while(1){
-    //     if(Socket != -1) {
-    //         if(WIFI_ReceiveData(Socket, RxData, sizeof(RxData), &Datalen, WIFI_READ_TIMEOUT) == WIFI_STATUS_OK){
-    //             if(Datalen > 0) {
-    //                 if(WIFI_SendData(Socket, TxData, sizeof(TxData), &Datalen, WIFI_WRITE_TIMEOUT) != WIFI_STATUS_OK) {
-    //                     printf("> ERROR : Failed to send Data.\n");   
-    //                 } 
-    //             }
-    //         } else {
-    //             printf("> ERROR : Failed to Receive Data.\n");  
-    //         }
-    //     }
-    // }
-    
+    // and start advertising; the BLE API is only used from the ble lane
+    event_queue.call(&ble_process, &BLEProcess::start);
+    ble_lane.start();
+    app_lane.start();
+    wifi_lane.start();
+
+    // the lanes run forever
+    ble_lane.join();
+    return 0;
 }
@@ -0,0 +1,168 @@
+/*
+ * Host benchmark of the gateway scan aggregation.
+ *
+ * Simulates a population of advertisers heard by the gateway scanner and
+ * compares the scan rate (advertisements per second entering the
+ * aggregator) with the uplink rate (reports and bytes per second leaving on
+ * the TCP socket), against a naive uplink sending one message per
+ * advertisement. Evicted counts peers pushed out of a full table within a
+ * window; their advertisements are missing from the reports.
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -I. tools/bench/scan_aggregator_bench.cpp -o scan_aggregator_bench
+ *   ./scan_aggregator_bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <vector>
+
+#include "ScanAggregator.h"
+
+namespace {
+
+const uint32_t SIMULATED_MS = 60000;
+const uint32_t REPORT_PERIOD_MS = 5000;
+const size_t MAX_REPORT_SIZE = 1200;
+/* advertisement record in a naive uplink: address, type, rssi, payload */
+const size_t NAIVE_MESSAGE_SIZE = 6 + 1 + 1 + 31;
+
+struct advertiser_t;
+
+struct advertisement_t {
+    const advertiser_t *advertiser;
+    int8_t rssi;
+};
+
+struct advertiser_t {
+    uint8_t address[6];
+    uint32_t interval_ms;
+    uint32_t next_ms;
+    uint8_t payload[31];
+    uint8_t payload_length;
+};
+
+uint32_t random_u32(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+double now_s()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+template<size_t TableSize>
+void run(size_t advertiser_count, uint32_t scan_duty_percent)
+{
+    uint32_t rng = 0x12345678u + advertiser_count;
+    std::vector<advertiser_t> advertisers(advertiser_count);
+
+    for (size_t i = 0; i < advertiser_count; ++i) {
+        advertiser_t &a = advertisers[i];
+        for (size_t b = 0; b < 6; ++b) {
+            a.address[b] = random_u32(rng);
+        }
+        a.interval_ms = 100 + random_u32(rng) % 900;
+        a.next_ms = random_u32(rng) % a.interval_ms;
+        a.payload_length = 10 + random_u32(rng) % 21;
+        for (size_t b = 0; b < a.payload_length; ++b) {
+            a.payload[b] = random_u32(rng);
+        }
+    }
+
+    ScanAggregator<TableSize> aggregator;
+    uint8_t report[MAX_REPORT_SIZE];
+    uint64_t heard = 0;
+    uint64_t reports = 0;
+    uint64_t report_bytes = 0;
+    double aggregate_s = 0;
+
+    std::vector<advertisement_t> heard_now;
+    uint64_t evictions = 0;
+
+    for (uint32_t now = 0; now < SIMULATED_MS; ++now) {
+        heard_now.clear();
+        for (size_t i = 0; i < advertiser_count; ++i) {
+            advertiser_t &a = advertisers[i];
+            if (a.next_ms != now) {
+                continue;
+            }
+            /* advertising delay of 0-10 ms as required by the spec */
+            a.next_ms = now + a.interval_ms + random_u32(rng) % 10;
+
+            /* the scanner listens scan_duty_percent of the time */
+            if (random_u32(rng) % 100 >= scan_duty_percent) {
+                continue;
+            }
+
+            /* payload counter changes every 10 advertisements */
+            if (random_u32(rng) % 10 == 0) {
+                ++a.payload[0];
+            }
+
+            advertisement_t adv = { &a, (int8_t)(-40 - (int8_t)(random_u32(rng) % 50)) };
+            heard_now.push_back(adv);
+        }
+
+        /* only the aggregation is timed, not the simulation */
+        double start = now_s();
+        for (size_t i = 0; i < heard_now.size(); ++i) {
+            const advertiser_t &a = *heard_now[i].advertiser;
+            aggregator.observe(a.address, 0, heard_now[i].rssi, a.payload, a.payload_length, now);
+        }
+        aggregate_s += now_s() - start;
+        heard += heard_now.size();
+
+        if (now && now % REPORT_PERIOD_MS == 0) {
+            /* a window larger than a report is split over several sends */
+            start = now_s();
+            size_t length;
+            while ((length = aggregator.report(report, sizeof(report), now))) {
+                ++reports;
+                report_bytes += length;
+                evictions += report[8] | (report[9] << 8);
+            }
+            aggregate_s += now_s() - start;
+        }
+    }
+
+    double seconds = SIMULATED_MS / 1000.0;
+    printf(
+        "%6zu %6zu %5u%% | %9.0f %8.1f | %7.2f %9.0f %8llu | %9.0f %10.0f | %6.1fx\n",
+        advertiser_count, TableSize, scan_duty_percent,
+        heard / seconds,
+        heard ? aggregate_s * 1e9 / heard : 0.0,
+        reports / seconds,
+        report_bytes / seconds,
+        (unsigned long long) evictions,
+        heard / seconds,
+        heard * NAIVE_MESSAGE_SIZE / seconds,
+        report_bytes ? (double)(heard * NAIVE_MESSAGE_SIZE) / report_bytes : 0.0
+    );
+}
+
+} // namespace
+
+int main()
+{
+    printf("simulated %u s, report period %u ms, max report %zu bytes\n\n",
+           SIMULATED_MS / 1000, REPORT_PERIOD_MS, MAX_REPORT_SIZE);
+    printf("  peers  table  duty |  scan adv/s  ns/adv | rep/s   rep B/s  evicted"
+           " | naive msg/s  naive B/s | saving\n");
+
+    const size_t populations[] = { 50, 100, 250, 500, 1000 };
+    for (size_t i = 0; i < sizeof(populations) / sizeof(populations[0]); ++i) {
+        run<64>(populations[i], 50);
+        run<256>(populations[i], 50);
+        run<1024>(populations[i], 50);
+    }
+
+    return 0;
+}
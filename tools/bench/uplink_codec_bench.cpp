@@ -0,0 +1,284 @@
+/*
+ * Host benchmark of the uplink frame packing.
+ *
+ * Builds the frames a node sends in a few traffic mixes, packs them with
+ * varint and delta coding only (level 1) and followed by LZ compression
+ * (level 2), checks that every frame unpacks to the frame built and
+ * prints, per mix and level, the bytes per frame before and after packing,
+ * the compression ratio and the time to pack and unpack a record:
+ *   - connect: a connect record per frame, as sent live;
+ *   - scan live: a gateway scan report per frame, as sent live;
+ *   - scan drain: full frames of consecutive scan reports, as sent when
+ *     the flash store drains after an outage;
+ *   - counters: full frames of periodic samples of a few counters and a
+ *     clock (record type 63, synthetic), the shape of telemetry records.
+ *
+ * The times are those of the host. On the node Uplink::print_stats
+ * reports the packing time per frame in microseconds; at the 80 MHz of
+ * the L475 a microsecond is 80 cycles.
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -I. tools/bench/uplink_codec_bench.cpp -o uplink_codec_bench
+ *   ./uplink_codec_bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include "ScanAggregator.h"
+#include "UplinkCodec.h"
+#include "UplinkFrame.h"
+
+namespace {
+
+/* size of a send command of the wifi module */
+const size_t MAX_FRAME_SIZE = 1200;
+const size_t MAX_RECORD_SIZE = MAX_FRAME_SIZE -
+    UplinkFrame::HEADER_SIZE - UplinkFrame::RECORD_HEADER_SIZE - UplinkFrame::CRC_SIZE;
+const uint8_t RECORD_COUNTERS = 63;
+const size_t FRAMES_PER_MIX = 2000;
+const int REPEATS = 20;
+
+typedef std::vector<uint8_t> frame_t;
+
+uint32_t random_u32(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+double now_s()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Frames of records appended in order, a new frame when a record does not
+ * fit or when its age cannot be encoded, as Uplink::drain does.
+ */
+class FrameBuilder {
+public:
+    FrameBuilder(std::vector<frame_t> &frames, bool one_per_frame) :
+        _frames(frames),
+        _writer(_buffer, sizeof(_buffer)),
+        _one_per_frame(one_per_frame),
+        _sequence(0),
+        _frame_ms(0)
+    {
+    }
+
+    void add(uint8_t type, const uint8_t *payload, size_t length, uint32_t now_ms)
+    {
+        if (_writer.record_count() &&
+            (_one_per_frame || !_writer.fits(length) || now_ms - _frame_ms > UINT16_MAX)) {
+            finish();
+        }
+        if (!_writer.record_count()) {
+            _writer.begin(0xC47F5100, _sequence++, now_ms);
+            _frame_ms = now_ms;
+        }
+        _writer.append(type, payload, length, now_ms);
+    }
+
+    void finish()
+    {
+        size_t length = _writer.finish();
+        if (length) {
+            _frames.push_back(frame_t(_buffer, _buffer + length));
+        }
+    }
+
+private:
+    std::vector<frame_t> &_frames;
+    uint8_t _buffer[MAX_FRAME_SIZE];
+    UplinkFrameWriter _writer;
+    bool _one_per_frame;
+    uint32_t _sequence;
+    uint32_t _frame_ms;
+};
+
+void build_connects(std::vector<frame_t> &frames, uint32_t &rng)
+{
+    FrameBuilder builder(frames, true);
+    uint32_t now_ms = 0;
+    while (frames.size() < FRAMES_PER_MIX) {
+        uint8_t record[7];
+        record[0] = random_u32(rng) % 2;
+        for (size_t i = 1; i < sizeof(record); ++i) {
+            record[i] = random_u32(rng);
+        }
+        now_ms += 1000 + random_u32(rng) % 60000;
+        builder.add(UplinkFrame::RECORD_CONNECT, record, sizeof(record), now_ms);
+    }
+    builder.finish();
+}
+
+void build_scan_reports(std::vector<frame_t> &frames, uint32_t &rng, size_t peers, bool drain)
+{
+    struct peer_t {
+        uint8_t address[6];
+        uint8_t payload[20];
+        int8_t rssi;
+    };
+    std::vector<peer_t> population(peers);
+    for (size_t i = 0; i < peers; ++i) {
+        for (size_t b = 0; b < 6; ++b) {
+            population[i].address[b] = random_u32(rng);
+        }
+        for (size_t b = 0; b < sizeof(population[i].payload); ++b) {
+            population[i].payload[b] = random_u32(rng);
+        }
+        population[i].rssi = -40 - (int8_t)(random_u32(rng) % 50);
+    }
+
+    FrameBuilder builder(frames, !drain);
+    ScanAggregator<64> aggregator;
+    uint8_t report[MAX_RECORD_SIZE];
+    uint32_t now_ms = 0;
+    while (frames.size() < FRAMES_PER_MIX) {
+        // a 5 s window: each peer advertises every 100-1000 ms, the payload
+        // counter changes now and then
+        for (size_t i = 0; i < peers; ++i) {
+            peer_t &peer = population[i];
+            size_t heard = 5 + random_u32(rng) % 45;
+            if (random_u32(rng) % 10 == 0) {
+                ++peer.payload[0];
+            }
+            for (size_t k = 0; k < heard; ++k) {
+                int8_t rssi = peer.rssi + (int8_t)(random_u32(rng) % 9) - 4;
+                aggregator.observe(peer.address, 0, rssi, peer.payload, sizeof(peer.payload), now_ms);
+            }
+        }
+        now_ms += 5000;
+        size_t length;
+        while ((length = aggregator.report(report, sizeof(report), now_ms))) {
+            builder.add(UplinkFrame::RECORD_SCAN_REPORT, report, length, now_ms);
+        }
+    }
+    builder.finish();
+}
+
+void build_counters(std::vector<frame_t> &frames, uint32_t &rng)
+{
+    FrameBuilder builder(frames, false);
+    uint32_t counters[4] = { 0, 1000, 50000, 7 };
+    uint32_t now_ms = 0;
+    while (frames.size() < FRAMES_PER_MIX) {
+        uint8_t record[24];
+        now_ms += 1000;
+        counters[0] += 1;
+        counters[1] += random_u32(rng) % 4;
+        counters[2] += 100 + random_u32(rng) % 50;
+        if (random_u32(rng) % 20 == 0) {
+            ++counters[3];
+        }
+        UplinkFrame::write_le32(record, now_ms);
+        for (size_t i = 0; i < 4; ++i) {
+            UplinkFrame::write_le32(record + 4 + 4 * i, counters[i]);
+        }
+        // a gauge around a mean
+        UplinkFrame::write_le32(record + 20, 3300 + random_u32(rng) % 16);
+        builder.add(RECORD_COUNTERS, record, sizeof(record), now_ms);
+    }
+    builder.finish();
+}
+
+size_t record_count(const std::vector<frame_t> &frames)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < frames.size(); ++i) {
+        count += frames[i][16];
+    }
+    return count;
+}
+
+void run(const char *name, const std::vector<frame_t> &frames, bool lz)
+{
+    static UplinkPacker<MAX_FRAME_SIZE> packer_lz(true);
+    static UplinkPacker<MAX_FRAME_SIZE> packer(false);
+    static uint8_t packed[MAX_FRAME_SIZE];
+    static uint8_t unpacked[65536];
+    static uint8_t scratch[65536];
+    UplinkPacker<MAX_FRAME_SIZE> &p = lz ? packer_lz : packer;
+
+    std::vector<frame_t> results(frames.size());
+    uint64_t built = 0;
+    uint64_t sent = 0;
+    double start = now_s();
+    for (int repeat = 0; repeat < REPEATS; ++repeat) {
+        for (size_t i = 0; i < frames.size(); ++i) {
+            size_t length = p.pack(&frames[i][0], frames[i].size(), packed);
+            if (repeat == 0) {
+                results[i] = length ? frame_t(packed, packed + length) : frames[i];
+            }
+        }
+    }
+    double pack_s = (now_s() - start) / REPEATS;
+
+    start = now_s();
+    for (int repeat = 0; repeat < REPEATS; ++repeat) {
+        for (size_t i = 0; i < frames.size(); ++i) {
+            const frame_t &result = results[i];
+            if (result[1] != UplinkCodec::VERSION) {
+                continue;
+            }
+            size_t length = UplinkCodec::unpack(
+                &result[0], result.size(), unpacked, sizeof(unpacked), scratch, sizeof(scratch)
+            );
+            if (repeat == 0 && (!UplinkCodec::check_packed(&result[0], result.size()) ||
+                    length != frames[i].size() || memcmp(unpacked, &frames[i][0], length))) {
+                printf("%s: frame %zu does not unpack to the frame built\n", name, i);
+                exit(1);
+            }
+        }
+    }
+    double unpack_s = (now_s() - start) / REPEATS;
+
+    for (size_t i = 0; i < frames.size(); ++i) {
+        built += frames[i].size();
+        sent += results[i].size();
+    }
+    size_t records = record_count(frames);
+    printf(
+        "%-10s %5d | %6zu %7.1f | %8.1f %8.1f | %5.2fx | %7.0f %9.0f\n",
+        name, lz ? 2 : 1,
+        frames.size(), (double) records / frames.size(),
+        (double) built / frames.size(), (double) sent / frames.size(),
+        (double) built / sent,
+        pack_s * 1e9 / records, unpack_s * 1e9 / records
+    );
+}
+
+} // namespace
+
+int main()
+{
+    printf("%zu frames per mix, frames of %zu bytes at most\n\n", FRAMES_PER_MIX, MAX_FRAME_SIZE);
+    printf("mix        level | frames rec/frm | built B  sent B   | ratio  | pack ns/rec unpack ns/rec\n");
+
+    uint32_t rng = 0x12345678u;
+    std::vector<frame_t> connects;
+    std::vector<frame_t> scan_live;
+    std::vector<frame_t> scan_drain;
+    std::vector<frame_t> counters;
+    build_connects(connects, rng);
+    build_scan_reports(scan_live, rng, 20, false);
+    build_scan_reports(scan_drain, rng, 10, true);
+    build_counters(counters, rng);
+
+    for (int lz = 0; lz < 2; ++lz) {
+        run("connect", connects, lz);
+        run("scan live", scan_live, lz);
+        run("scan drain", scan_drain, lz);
+        run("counters", counters, lz);
+    }
+
+    return 0;
+}
@@ -0,0 +1,949 @@
+/*
+ * Reference collector of the node uplink (TCP port 8002).
+ *
+ * Each worker thread owns a listening socket bound with SO_REUSEPORT, an
+ * epoll instance and the connections it accepted; the kernel spreads the
+ * incoming connections over the workers and a connection never leaves its
+ * worker, so workers share nothing but their counters and the sequence
+ * state of the nodes. Workers are pinned to a core each.
+ *
+ * Data is received straight into a per connection buffer and parsed in
+ * place; only the tail of a message split between two reads is moved to
+ * the front of the buffer.
+ *
+ * The uplink stream carries binary frames of records (see UplinkFrame.h);
+ * every read that completes frames is answered with a cumulative ack of
+ * the last one. Frames with a bad CRC are skipped and gaps in the sequence
+ * numbers of a node are counted as lost frames; the expected sequence of
+ * a node survives its reconnections, which may land on another worker,
+ * and is only reset by the hello record of a boot. Metric summaries (see
+ * MetricReporter.h) are decoded and reported per metric. Packed frames (see
+ * UplinkCodec.h) are unpacked before they are accounted. The messages of
+ * older firmware are still accepted:
+ *   - text messages terminated by NUL or a newline ("connect");
+ *   - gateway scan reports: magic 'G', version 1, record count (2), window
+ *     (4), evictions (2), then 17 bytes per record (see ScanAggregator.h).
+ *
+ * Every report period the collector prints the connections, the ingest
+ * rate (bytes and messages per second), the time from the readiness of a
+ * socket to the end of the parsing of its data (p50/p99/max) and the
+ * busy ratio of each worker; a worker close to 100% is the point of
+ * saturation. With --metrics-port the same figures are served as text on
+ * HTTP for scrapers.
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -std=gnu++17 -pthread -I. tools/collector/collector.cpp -o collector
+ *   ./collector --port 8002 --workers 4 --report-s 5
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <thread>
+#include <vector>
+
+#include "ScanAggregator.h"
+#include "UplinkCodec.h"
+#include "UplinkFrame.h"
+#include "WindowAggregator.h"
+
+namespace {
+
+typedef ScanAggregator<1> scan_report_t;
+typedef WindowAggregator<1> metric_window_t;
+
+/* metrics of MetricReporter; summaries of other metrics are ignored */
+const size_t MAX_METRICS = 8;
+const char *const metric_names[MAX_METRICS] = {
+    "uplink_send_us", "uplink_ack_ms", "ble_connection_ms", "ble_connect_ms",
+    "metric_4", "metric_5", "metric_6", "metric_7"
+};
+
+/* receive buffer of a connection; larger than any message of the node */
+const size_t BUFFER_SIZE = 4096;
+
+/* largest frame once unpacked; the length of a frame is 16 bits */
+const size_t UNPACKED_SIZE = 65536;
+
+/* frames are unpacked in buffers of the worker thread */
+thread_local uint8_t unpacked_frame[UNPACKED_SIZE];
+thread_local uint8_t unpack_scratch[UNPACKED_SIZE];
+
+const size_t MAX_EVENTS = 256;
+
+/* log2 buckets of the latency histogram, in microseconds */
+const size_t LATENCY_BUCKETS = 24;
+
+std::atomic<bool> stopping(false);
+
+uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+enum message_type_t {
+    MESSAGE_TEXT,
+    MESSAGE_SCAN_REPORT,
+    MESSAGE_FRAME,
+    MESSAGE_TYPE_COUNT
+};
+
+/**
+ * Counters of a worker; written by the worker only, read by the reporter.
+ */
+struct alignas(64) worker_stats_t {
+    std::atomic<uint64_t> accepted;
+    std::atomic<uint64_t> closed;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> messages[MESSAGE_TYPE_COUNT];
+    std::atomic<uint64_t> scan_records;
+    std::atomic<uint64_t> frame_records;
+    std::atomic<uint64_t> metric_summaries[MAX_METRICS];
+    std::atomic<uint64_t> metric_samples[MAX_METRICS];
+    std::atomic<int64_t> metric_sum[MAX_METRICS];
+    std::atomic<int64_t> metric_max[MAX_METRICS];
+    std::atomic<uint64_t> frames_lost;
+    std::atomic<uint64_t> crc_errors;
+    std::atomic<uint64_t> acks;
+    std::atomic<uint64_t> packed_frames;
+    std::atomic<uint64_t> packed_bytes;
+    std::atomic<uint64_t> unpacked_bytes;
+    std::atomic<uint64_t> unpack_errors;
+    std::atomic<uint64_t> garbage_bytes;
+    std::atomic<uint64_t> busy_us;
+    std::atomic<uint64_t> latency[LATENCY_BUCKETS];
+    std::atomic<uint64_t> latency_max_us;
+};
+
+/**
+ * Next sequence number expected from each node, shared by the workers.
+ */
+class NodeTable {
+public:
+    /**
+     * Account a frame of a node.
+     *
+     * A node restarts its sequence numbers at 0 when it boots and opens the
+     * uplink with a hello record; after a reconnection it carries on with
+     * the sequence numbers of the previous connection. Frames older than
+     * the expected one are retransmissions and leave the state untouched.
+     *
+     * @param[in] hello True if the frame holds a hello record.
+     *
+     * @return The number of frames lost before this one.
+     */
+    uint32_t account(uint32_t node_id, uint32_t sequence, bool hello)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::unordered_map<uint32_t, uint32_t>::iterator node = _next_sequence.find(node_id);
+        if (node == _next_sequence.end()) {
+            _next_sequence[node_id] = sequence + 1;
+            return 0;
+        }
+
+        int32_t gap = (int32_t)(sequence - node->second);
+        if (gap < 0) {
+            if (hello) {
+                // the node rebooted
+                node->second = sequence + 1;
+            }
+            return 0;
+        }
+        node->second = sequence + 1;
+        return gap;
+    }
+
+private:
+    std::mutex _mutex;
+    std::unordered_map<uint32_t, uint32_t> _next_sequence;
+};
+
+NodeTable nodes;
+
+/**
+ * Uplink stream parser of a connection.
+ */
+class Connection {
+public:
+    Connection(int fd) :
+        _fd(fd),
+        _length(0),
+        _last_sequence(0),
+        _ack_pending(false)
+    {
+    }
+
+    int fd() const
+    {
+        return _fd;
+    }
+
+    /**
+     * Read everything available and parse the complete messages.
+     *
+     * @return false once the peer closed the connection or on error.
+     */
+    bool receive(worker_stats_t &stats)
+    {
+        while (true) {
+            ssize_t count = recv(_fd, _buffer + _length, BUFFER_SIZE - _length, 0);
+            if (count > 0) {
+                stats.bytes.fetch_add(count, std::memory_order_relaxed);
+                _length += count;
+                parse(stats);
+                send_ack(stats);
+                continue;
+            }
+            if (count == 0) {
+                return false;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+    }
+
+private:
+    void parse(worker_stats_t &stats)
+    {
+        size_t offset = 0;
+        while (offset < _length) {
+            size_t size = message_size(_buffer + offset, _length - offset, stats);
+            if (!size) {
+                break;
+            }
+            offset += size;
+        }
+
+        if (offset == 0 && _length == BUFFER_SIZE) {
+            // no message fits in the buffer: drop it and resynchronize
+            stats.garbage_bytes.fetch_add(_length, std::memory_order_relaxed);
+            _length = 0;
+            return;
+        }
+        if (offset) {
+            memmove(_buffer, _buffer + offset, _length - offset);
+            _length -= offset;
+        }
+    }
+
+    /**
+     * Size of the message at the start of data and account it.
+     *
+     * @return 0 if the message is incomplete.
+     */
+    size_t message_size(const uint8_t *data, size_t length, worker_stats_t &stats)
+    {
+        if (data[0] == UplinkFrame::FRAME_MAGIC) {
+            return frame_size(data, length, stats);
+        }
+        if (data[0] == scan_report_t::REPORT_MAGIC) {
+            if (length < 2) {
+                return 0;
+            }
+            if (data[1] == scan_report_t::REPORT_VERSION) {
+                if (length < scan_report_t::REPORT_HEADER_SIZE) {
+                    return 0;
+                }
+                uint16_t records = data[2] | (data[3] << 8);
+                size_t size = scan_report_t::REPORT_HEADER_SIZE +
+                    (size_t) records * scan_report_t::REPORT_RECORD_SIZE;
+                if (length < size) {
+                    return 0;
+                }
+                stats.messages[MESSAGE_SCAN_REPORT].fetch_add(1, std::memory_order_relaxed);
+                stats.scan_records.fetch_add(records, std::memory_order_relaxed);
+                return size;
+            }
+        }
+
+        const void *end = memchr(data, '\0', length);
+        const void *newline = memchr(data, '\n', length);
+        if (!end || (newline && newline < end)) {
+            end = newline;
+        }
+        if (!end) {
+            return 0;
+        }
+        stats.messages[MESSAGE_TEXT].fetch_add(1, std::memory_order_relaxed);
+        return (const uint8_t *) end - data + 1;
+    }
+
+    /**
+     * Size of the frame at the start of data; account its records and its
+     * sequence number.
+     */
+    size_t frame_size(const uint8_t *data, size_t length, worker_stats_t &stats)
+    {
+        if (length < 4) {
+            return 0;
+        }
+        size_t size = UplinkFrame::frame_length(data, length);
+        if (size < UplinkFrame::MIN_FRAME_SIZE || size > BUFFER_SIZE) {
+            // not a frame: skip the magic and resynchronize
+            stats.garbage_bytes.fetch_add(1, std::memory_order_relaxed);
+            return 1;
+        }
+        if (length < size) {
+            return 0;
+        }
+
+        const uint8_t *frame = data;
+        size_t frame_length = size;
+        if (data[1] == UplinkCodec::VERSION) {
+            if (!UplinkCodec::check_packed(data, size)) {
+                stats.crc_errors.fetch_add(1, std::memory_order_relaxed);
+                return size;
+            }
+            frame_length = UplinkCodec::unpack(
+                data, size, unpacked_frame, sizeof(unpacked_frame),
+                unpack_scratch, sizeof(unpack_scratch)
+            );
+            if (!frame_length) {
+                stats.unpack_errors.fetch_add(1, std::memory_order_relaxed);
+                return size;
+            }
+            frame = unpacked_frame;
+            stats.packed_frames.fetch_add(1, std::memory_order_relaxed);
+            stats.packed_bytes.fetch_add(size, std::memory_order_relaxed);
+            stats.unpacked_bytes.fetch_add(frame_length, std::memory_order_relaxed);
+        }
+
+        UplinkFrame::header_t header;
+        if (!UplinkFrame::decode_header(frame, frame_length, header)) {
+            stats.crc_errors.fetch_add(1, std::memory_order_relaxed);
+            return size;
+        }
+        stats.messages[MESSAGE_FRAME].fetch_add(1, std::memory_order_relaxed);
+
+        _last_sequence = header.sequence;
+        _ack_pending = true;
+
+        UplinkFrame::RecordIterator records(frame, header);
+        uint8_t type;
+        uint16_t age_ms;
+        const uint8_t *payload;
+        uint16_t payload_length;
+        bool hello = false;
+        while (records.next(type, age_ms, payload, payload_length)) {
+            stats.frame_records.fetch_add(1, std::memory_order_relaxed);
+            if (type == UplinkFrame::RECORD_HELLO) {
+                hello = true;
+            }
+            if (type == UplinkFrame::RECORD_SCAN_REPORT &&
+                payload_length >= scan_report_t::REPORT_HEADER_SIZE) {
+                stats.scan_records.fetch_add(payload[2] | (payload[3] << 8), std::memory_order_relaxed);
+            }
+            if (type == UplinkFrame::RECORD_METRIC_SUMMARY &&
+                payload_length >= metric_window_t::SUMMARY_SIZE) {
+                account_summary(payload, stats);
+            }
+        }
+
+        uint32_t lost = nodes.account(header.node_id, header.sequence, hello);
+        if (lost) {
+            stats.frames_lost.fetch_add(lost, std::memory_order_relaxed);
+        }
+        return size;
+    }
+
+    /**
+     * Account a window summary of a node metric: the samples, their sum
+     * to derive the mean over a report period, and the largest sample.
+     */
+    static void account_summary(const uint8_t *payload, worker_stats_t &stats)
+    {
+        metric_window_t::summary_t summary;
+        metric_window_t::decode(payload, summary);
+        if (summary.metric >= MAX_METRICS) {
+            return;
+        }
+
+        size_t metric = summary.metric;
+        stats.metric_summaries[metric].fetch_add(1, std::memory_order_relaxed);
+        stats.metric_samples[metric].fetch_add(summary.count, std::memory_order_relaxed);
+        stats.metric_sum[metric].fetch_add(
+            (int64_t)((double) summary.mean * summary.count), std::memory_order_relaxed
+        );
+        int64_t max = stats.metric_max[metric].load(std::memory_order_relaxed);
+        while (summary.max > max &&
+               !stats.metric_max[metric].compare_exchange_weak(max, summary.max)) {
+        }
+    }
+
+    /**
+     * Ack the last frame received; a lost ack is superseded by the next.
+     */
+    void send_ack(worker_stats_t &stats)
+    {
+        if (!_ack_pending) {
+            return;
+        }
+        _ack_pending = false;
+
+        uint8_t ack[UplinkFrame::ACK_SIZE];
+        UplinkFrame::encode_ack(ack, _last_sequence);
+        if (send(_fd, ack, sizeof(ack), MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t) sizeof(ack)) {
+            stats.acks.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    int _fd;
+    size_t _length;
+    uint32_t _last_sequence;
+    bool _ack_pending;
+    uint8_t _buffer[BUFFER_SIZE];
+};
+
+int listen_on(uint16_t port)
+{
+    int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int one = 1;
+    int zero = 0;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+
+    struct sockaddr_in6 address;
+    memset(&address, 0, sizeof(address));
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_any;
+    address.sin6_port = htons(port);
+
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) || listen(fd, SOMAXCONN)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+class Worker {
+public:
+    Worker(unsigned index, uint16_t port) :
+        _index(index),
+        _port(port),
+        _listen_fd(-1),
+        _epoll_fd(-1)
+    {
+        memset((void *) &_stats, 0, sizeof(_stats));
+    }
+
+    ~Worker()
+    {
+        for (size_t i = 0; i < _connections.size(); ++i) {
+            if (_connections[i]) {
+                close(_connections[i]->fd());
+                delete _connections[i];
+            }
+        }
+        if (_epoll_fd >= 0) {
+            close(_epoll_fd);
+        }
+        if (_listen_fd >= 0) {
+            close(_listen_fd);
+        }
+    }
+
+    bool open()
+    {
+        _listen_fd = listen_on(_port);
+        _epoll_fd = epoll_create1(0);
+        if (_listen_fd < 0 || _epoll_fd < 0) {
+            return false;
+        }
+        return watch(_listen_fd, EPOLLIN);
+    }
+
+    void run()
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(_index % std::thread::hardware_concurrency(), &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+        struct epoll_event events[MAX_EVENTS];
+        while (!stopping.load(std::memory_order_relaxed)) {
+            int count = epoll_wait(_epoll_fd, events, MAX_EVENTS, 200);
+            if (count <= 0) {
+                continue;
+            }
+
+            uint64_t ready_us = now_us();
+            for (int i = 0; i < count; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == _listen_fd) {
+                    accept_all();
+                } else {
+                    serve(fd, ready_us);
+                }
+            }
+            _stats.busy_us.fetch_add(now_us() - ready_us, std::memory_order_relaxed);
+        }
+    }
+
+    worker_stats_t &stats()
+    {
+        return _stats;
+    }
+
+private:
+    bool watch(int fd, uint32_t events)
+    {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.fd = fd;
+        return epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+
+    void accept_all()
+    {
+        while (true) {
+            int fd = accept4(_listen_fd, NULL, NULL, SOCK_NONBLOCK);
+            if (fd < 0) {
+                return;
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            if ((size_t) fd >= _connections.size()) {
+                _connections.resize(fd + 1, NULL);
+            }
+            _connections[fd] = new Connection(fd);
+            if (!watch(fd, EPOLLIN | EPOLLRDHUP | EPOLLET)) {
+                drop(fd);
+                continue;
+            }
+            _stats.accepted.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void serve(int fd, uint64_t ready_us)
+    {
+        Connection *connection = _connections[fd];
+        if (!connection) {
+            return;
+        }
+        if (!connection->receive(_stats)) {
+            drop(fd);
+            return;
+        }
+        record_latency(now_us() - ready_us);
+    }
+
+    void drop(int fd)
+    {
+        epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+        delete _connections[fd];
+        _connections[fd] = NULL;
+        _stats.closed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void record_latency(uint64_t us)
+    {
+        size_t bucket = 0;
+        while (bucket + 1 < LATENCY_BUCKETS && (1ULL << bucket) <= us) {
+            ++bucket;
+        }
+        _stats.latency[bucket].fetch_add(1, std::memory_order_relaxed);
+        uint64_t max_us = _stats.latency_max_us.load(std::memory_order_relaxed);
+        while (us > max_us && !_stats.latency_max_us.compare_exchange_weak(max_us, us)) {
+        }
+    }
+
+    unsigned _index;
+    uint16_t _port;
+    int _listen_fd;
+    int _epoll_fd;
+    std::vector<Connection *> _connections;
+    worker_stats_t _stats;
+};
+
+/**
+ * Totals of the workers at a point in time.
+ */
+struct snapshot_t {
+    uint64_t time_us;
+    uint64_t accepted;
+    uint64_t closed;
+    uint64_t bytes;
+    uint64_t messages[MESSAGE_TYPE_COUNT];
+    uint64_t scan_records;
+    uint64_t frame_records;
+    uint64_t metric_summaries[MAX_METRICS];
+    uint64_t metric_samples[MAX_METRICS];
+    int64_t metric_sum[MAX_METRICS];
+    int64_t metric_max[MAX_METRICS];
+    uint64_t frames_lost;
+    uint64_t crc_errors;
+    uint64_t acks;
+    uint64_t packed_frames;
+    uint64_t packed_bytes;
+    uint64_t unpacked_bytes;
+    uint64_t unpack_errors;
+    uint64_t garbage_bytes;
+    uint64_t latency[LATENCY_BUCKETS];
+    uint64_t latency_max_us;
+    std::vector<uint64_t> busy_us;
+};
+
+snapshot_t take_snapshot(std::vector<Worker *> &workers)
+{
+    snapshot_t snapshot = snapshot_t();
+    snapshot.time_us = now_us();
+    for (size_t metric = 0; metric < MAX_METRICS; ++metric) {
+        snapshot.metric_max[metric] = INT64_MIN;
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+        worker_stats_t &stats = workers[i]->stats();
+        snapshot.accepted += stats.accepted.load();
+        snapshot.closed += stats.closed.load();
+        snapshot.bytes += stats.bytes.load();
+        for (size_t type = 0; type < MESSAGE_TYPE_COUNT; ++type) {
+            snapshot.messages[type] += stats.messages[type].load();
+        }
+        snapshot.scan_records += stats.scan_records.load();
+        snapshot.frame_records += stats.frame_records.load();
+        for (size_t metric = 0; metric < MAX_METRICS; ++metric) {
+            snapshot.metric_summaries[metric] += stats.metric_summaries[metric].load();
+            snapshot.metric_samples[metric] += stats.metric_samples[metric].load();
+            snapshot.metric_sum[metric] += stats.metric_sum[metric].load();
+            // the maximum is reset at each snapshot
+            int64_t metric_max = stats.metric_max[metric].exchange(INT64_MIN);
+            if (metric_max > snapshot.metric_max[metric]) {
+                snapshot.metric_max[metric] = metric_max;
+            }
+        }
+        snapshot.frames_lost += stats.frames_lost.load();
+        snapshot.crc_errors += stats.crc_errors.load();
+        snapshot.acks += stats.acks.load();
+        snapshot.packed_frames += stats.packed_frames.load();
+        snapshot.packed_bytes += stats.packed_bytes.load();
+        snapshot.unpacked_bytes += stats.unpacked_bytes.load();
+        snapshot.unpack_errors += stats.unpack_errors.load();
+        snapshot.garbage_bytes += stats.garbage_bytes.load();
+        for (size_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+            snapshot.latency[bucket] += stats.latency[bucket].load();
+        }
+        // the maximum is reset at each snapshot
+        uint64_t latency_max_us = stats.latency_max_us.exchange(0);
+        if (latency_max_us > snapshot.latency_max_us) {
+            snapshot.latency_max_us = latency_max_us;
+        }
+        snapshot.busy_us.push_back(stats.busy_us.load());
+    }
+    return snapshot;
+}
+
+/**
+ * Upper bound of the bucket holding the given quantile of the samples
+ * taken between two snapshots.
+ */
+uint64_t quantile_us(const snapshot_t &from, const snapshot_t &to, double quantile)
+{
+    uint64_t total = 0;
+    for (size_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+        total += to.latency[bucket] - from.latency[bucket];
+    }
+    if (!total) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(quantile * total);
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+        seen += to.latency[bucket] - from.latency[bucket];
+        if (seen > rank) {
+            return 1ULL << bucket;
+        }
+    }
+    return 1ULL << (LATENCY_BUCKETS - 1);
+}
+
+std::string format_report(const snapshot_t &from, const snapshot_t &to, bool prometheus)
+{
+    double seconds = (to.time_us - from.time_us) / 1e6;
+    if (seconds <= 0) {
+        seconds = 1;
+    }
+    uint64_t messages = 0;
+    for (size_t type = 0; type < MESSAGE_TYPE_COUNT; ++type) {
+        messages += to.messages[type] - from.messages[type];
+    }
+
+    char line[256];
+    std::string report;
+    if (prometheus) {
+        snprintf(line, sizeof(line),
+            "collector_connections %llu\n"
+            "collector_accepted_total %llu\n"
+            "collector_bytes_total %llu\n"
+            "collector_text_messages_total %llu\n"
+            "collector_scan_reports_total %llu\n"
+            "collector_scan_records_total %llu\n"
+            "collector_garbage_bytes_total %llu\n",
+            (unsigned long long)(to.accepted - to.closed),
+            (unsigned long long) to.accepted,
+            (unsigned long long) to.bytes,
+            (unsigned long long) to.messages[MESSAGE_TEXT],
+            (unsigned long long) to.messages[MESSAGE_SCAN_REPORT],
+            (unsigned long long) to.scan_records,
+            (unsigned long long) to.garbage_bytes
+        );
+        report += line;
+        snprintf(line, sizeof(line),
+            "collector_frames_total %llu\n"
+            "collector_frame_records_total %llu\n"
+            "collector_frames_lost_total %llu\n"
+            "collector_frame_crc_errors_total %llu\n"
+            "collector_acks_total %llu\n",
+            (unsigned long long) to.messages[MESSAGE_FRAME],
+            (unsigned long long) to.frame_records,
+            (unsigned long long) to.frames_lost,
+            (unsigned long long) to.crc_errors,
+            (unsigned long long) to.acks
+        );
+        report += line;
+        snprintf(line, sizeof(line),
+            "collector_packed_frames_total %llu\n"
+            "collector_packed_bytes_total %llu\n"
+            "collector_unpacked_bytes_total %llu\n"
+            "collector_unpack_errors_total %llu\n",
+            (unsigned long long) to.packed_frames,
+            (unsigned long long) to.packed_bytes,
+            (unsigned long long) to.unpacked_bytes,
+            (unsigned long long) to.unpack_errors
+        );
+        report += line;
+        snprintf(line, sizeof(line),
+            "collector_ingest_bytes_per_second %.0f\n"
+            "collector_ingest_messages_per_second %.0f\n"
+            "collector_latency_us{quantile=\"0.5\"} %llu\n"
+            "collector_latency_us{quantile=\"0.99\"} %llu\n"
+            "collector_latency_max_us %llu\n",
+            (to.bytes - from.bytes) / seconds, messages / seconds,
+            (unsigned long long) quantile_us(from, to, 0.5),
+            (unsigned long long) quantile_us(from, to, 0.99),
+            (unsigned long long) to.latency_max_us
+        );
+        report += line;
+        for (size_t i = 0; i < to.busy_us.size(); ++i) {
+            snprintf(line, sizeof(line), "collector_worker_busy_ratio{worker=\"%zu\"} %.3f\n",
+                i, (to.busy_us[i] - from.busy_us[i]) / 1e6 / seconds);
+            report += line;
+        }
+        for (size_t metric = 0; metric < MAX_METRICS; ++metric) {
+            if (!to.metric_summaries[metric]) {
+                continue;
+            }
+            snprintf(line, sizeof(line),
+                "collector_node_metric_summaries_total{metric=\"%s\"} %llu\n"
+                "collector_node_metric_samples_total{metric=\"%s\"} %llu\n",
+                metric_names[metric], (unsigned long long) to.metric_summaries[metric],
+                metric_names[metric], (unsigned long long) to.metric_samples[metric]
+            );
+            report += line;
+        }
+        return report;
+    }
+
+    snprintf(line, sizeof(line),
+        "connections %llu (+%llu -%llu), %.0f B/s, %.0f msg/s (%llu text, %llu scan reports, %llu records), %llu garbage bytes\n",
+        (unsigned long long)(to.accepted - to.closed),
+        (unsigned long long)(to.accepted - from.accepted),
+        (unsigned long long)(to.closed - from.closed),
+        (to.bytes - from.bytes) / seconds, messages / seconds,
+        (unsigned long long)(to.messages[MESSAGE_TEXT] - from.messages[MESSAGE_TEXT]),
+        (unsigned long long)(to.messages[MESSAGE_SCAN_REPORT] - from.messages[MESSAGE_SCAN_REPORT]),
+        (unsigned long long)(to.scan_records - from.scan_records),
+        (unsigned long long)(to.garbage_bytes - from.garbage_bytes)
+    );
+    report += line;
+    snprintf(line, sizeof(line), "\tframes %llu (%llu records, %llu lost, %llu CRC errors), %llu acks\n",
+        (unsigned long long)(to.messages[MESSAGE_FRAME] - from.messages[MESSAGE_FRAME]),
+        (unsigned long long)(to.frame_records - from.frame_records),
+        (unsigned long long)(to.frames_lost - from.frames_lost),
+        (unsigned long long)(to.crc_errors - from.crc_errors),
+        (unsigned long long)(to.acks - from.acks)
+    );
+    report += line;
+    uint64_t packed_bytes = to.packed_bytes - from.packed_bytes;
+    uint64_t unpacked_bytes = to.unpacked_bytes - from.unpacked_bytes;
+    snprintf(line, sizeof(line), "\tpacked frames %llu, %llu bytes for %llu unpacked (%.0f%%), %llu unpack errors\n",
+        (unsigned long long)(to.packed_frames - from.packed_frames),
+        (unsigned long long) packed_bytes,
+        (unsigned long long) unpacked_bytes,
+        unpacked_bytes ? 100.0 * packed_bytes / unpacked_bytes : 0.0,
+        (unsigned long long)(to.unpack_errors - from.unpack_errors)
+    );
+    report += line;
+    snprintf(line, sizeof(line), "\tlatency p50 <%lluus p99 <%lluus max %lluus, busy",
+        (unsigned long long) quantile_us(from, to, 0.5),
+        (unsigned long long) quantile_us(from, to, 0.99),
+        (unsigned long long) to.latency_max_us
+    );
+    report += line;
+    for (size_t i = 0; i < to.busy_us.size(); ++i) {
+        snprintf(line, sizeof(line), " %.0f%%", 100.0 * (to.busy_us[i] - from.busy_us[i]) / 1e6 / seconds);
+        report += line;
+    }
+    report += "\n";
+    for (size_t metric = 0; metric < MAX_METRICS; ++metric) {
+        uint64_t summaries = to.metric_summaries[metric] - from.metric_summaries[metric];
+        uint64_t samples = to.metric_samples[metric] - from.metric_samples[metric];
+        if (!summaries) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "\tmetric %s: %llu summaries of %llu samples, mean %.1f, max %lld\n",
+            metric_names[metric],
+            (unsigned long long) summaries,
+            (unsigned long long) samples,
+            samples ? (double)(to.metric_sum[metric] - from.metric_sum[metric]) / samples : 0.0,
+            (long long) to.metric_max[metric]
+        );
+        report += line;
+    }
+    return report;
+}
+
+/**
+ * Serve the metrics of the last report period to a scraper.
+ */
+void serve_metrics(int listen_fd, const std::string &metrics)
+{
+    int fd = accept4(listen_fd, NULL, NULL, 0);
+    if (fd < 0) {
+        return;
+    }
+    char request[1024];
+    struct timeval timeout = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (recv(fd, request, sizeof(request), 0) > 0) {
+        char header[128];
+        int length = snprintf(header, sizeof(header),
+            "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\n\r\n",
+            metrics.size());
+        if (send(fd, header, length, MSG_NOSIGNAL) == length) {
+            send(fd, metrics.data(), metrics.size(), MSG_NOSIGNAL);
+        }
+    }
+    close(fd);
+}
+
+void stop(int)
+{
+    stopping.store(true);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    uint16_t port = 8002;
+    uint16_t metrics_port = 0;
+    unsigned worker_count = std::thread::hardware_concurrency();
+    unsigned report_s = 5;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        unsigned long value = strtoul(argv[i + 1], NULL, 0);
+        if (!strcmp(argv[i], "--port")) {
+            port = value;
+        } else if (!strcmp(argv[i], "--workers")) {
+            worker_count = value;
+        } else if (!strcmp(argv[i], "--report-s")) {
+            report_s = value;
+        } else if (!strcmp(argv[i], "--metrics-port")) {
+            metrics_port = value;
+        } else {
+            fprintf(stderr, "usage: %s [--port N] [--workers N] [--report-s N] [--metrics-port N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!worker_count) {
+        worker_count = 1;
+    }
+    if (!report_s) {
+        report_s = 1;
+    }
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<Worker *> workers;
+    for (unsigned i = 0; i < worker_count; ++i) {
+        workers.push_back(new Worker(i, port));
+        if (!workers.back()->open()) {
+            fprintf(stderr, "cannot listen on port %u: %s\n", port, strerror(errno));
+            return 1;
+        }
+    }
+
+    int metrics_fd = -1;
+    if (metrics_port) {
+        metrics_fd = listen_on(metrics_port);
+        if (metrics_fd < 0) {
+            fprintf(stderr, "cannot listen on port %u: %s\n", metrics_port, strerror(errno));
+            return 1;
+        }
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers.size(); ++i) {
+        threads.push_back(std::thread(&Worker::run, workers[i]));
+    }
+    printf("collector: %u workers on port %u\n", worker_count, port);
+    fflush(stdout);
+
+    // the main thread reports and answers the metrics scrapers
+    snapshot_t last = take_snapshot(workers);
+    std::string metrics = format_report(last, last, true);
+    uint64_t next_report_us = last.time_us + report_s * 1000000ULL;
+    while (!stopping.load()) {
+        if (metrics_fd >= 0) {
+            serve_metrics(metrics_fd, metrics);
+        }
+        usleep(metrics_fd >= 0 ? 1000 : 100000);
+        if (now_us() < next_report_us) {
+            continue;
+        }
+        snapshot_t current = take_snapshot(workers);
+        fputs(format_report(last, current, false).c_str(), stdout);
+        fflush(stdout);
+        metrics = format_report(last, current, true);
+        last = current;
+        next_report_us += report_s * 1000000ULL;
+    }
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+        delete workers[i];
+    }
+    if (metrics_fd >= 0) {
+        close(metrics_fd);
+    }
+    return 0;
+}
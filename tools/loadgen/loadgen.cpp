@@ -0,0 +1,1297 @@
+/*
+ * Fleet load generator of the node uplink (TCP port 8002).
+ *
+ * Every emulated node is a thread following the uplink of the firmware
+ * against its own emulated es-wifi module: the reconnection of
+ * LinkSupervisor and the batching, store and drain of Uplink, re-stated on
+ * a thread of its own since the firmware classes run on an event queue
+ * (see LinkSupervisor.h and Uplink.h). The frame writer, packer, store,
+ * aggregators and every constant come from the firmware headers and its
+ * configuration, built as for the host simulation. The module implements
+ * WIFI_OpenClientConnection, WIFI_SendData, WIFI_ReceiveData and
+ * WIFI_CloseClientConnection on a real TCP socket and blocks the node for
+ * the time the real module would take:
+ *   - each AT command costs a command time plus an exponential jitter; the
+ *     driver issues 5 commands to open a socket (P0, P1, P4, P3, P6=1), 2
+ *     to close it, 3 to send (P0, S2, S3) and 4 to receive (P0, R1, R2,
+ *     R0);
+ *   - the payload crosses the SPI bus at a fixed rate (10 MHz 16 bit
+ *     frames with the CMD/DATA ready handshakes, about a byte per us);
+ *   - a send fails when the socket does not take the payload within the
+ *     S2 timeout of the uplink.
+ * Each node draws its command time and bus rate around the defaults
+ * (--spread) so that the fleet does not move in lockstep. Each message is
+ * a record: a summary of the connections of the node (--connect-share, see
+ * MetricReporter.h) or a gateway scan report. Records are gathered in a
+ * frame until the flush delay of the uplink or until the next one does not
+ * fit, and frames are packed as on the node (--pack, see UplinkCodec.h).
+ *
+ * A node opens its connection after a random fraction of the minimum
+ * backoff and reopens it, after the same delay, once --reconnect-after
+ * sends failed in a row. A failed open is retried after the exponential
+ * backoff of the supervisor, half of it random, from a generator seeded
+ * per node. While the link is down, and when the send of a frame fails,
+ * the records go to an uplink store in RAM sized as the one in flash; once
+ * the link is back the store is drained in full frames, back to back.
+ *
+ * The generator sweeps the fleet size (--nodes) and the message rate of a
+ * node (--rate, messages per second); each step boots the whole fleet at
+ * once, runs for --step-s and prints one line:
+ *   - offered messages and sent frames per second and the uplink
+ *     throughput;
+ *   - the latency of a message from its scheduled time to the end of the
+ *     send of its frame (p50/p99/p99.9/max), which includes the flush
+ *     delay, the wait behind earlier frames on the wifi lane and the time
+ *     spent in the store;
+ *   - the time from the send of a frame to the poll that read its ack
+ *     (p50/p99);
+ *   - the failed sends, the records stored and drained, the socket opens,
+ *     the failed opens, the largest number of opens in one second (the
+ *     reconnect storms) and the nodes left without a connection.
+ *
+ * Build the host simulation first for its mbed_config.h, then build and
+ * run from the repository root, next to a collector:
+ *   make -C tools/sim
+ *   g++ -O2 -std=gnu++17 -pthread -I. -Itools/sim -Itools/sim/shim \
+ *       -include tools/sim/build/mbed_config.h tools/loadgen/loadgen.cpp -o loadgen
+ *   ./loadgen --host 127.0.0.1 --nodes 10,100,1000 --rate 1,10 --step-s 10
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifndef MBED_CONF_APP_UPLINK_STORE_SIZE
+#error "build with the mbed_config.h of the host simulation"
+#endif
+
+/* the nodes do not log; the log of the firmware is not thread safe on the host */
+#undef MBED_CONF_APP_LOG_LEVEL
+#define MBED_CONF_APP_LOG_LEVEL 0
+
+#include "wifi.h"
+#include "BlockDevice.h"
+#include "LinkSupervisor.h"
+#include "MetricReporter.h"
+#include "ScanAggregator.h"
+#include "Uplink.h"
+#include "UplinkCodec.h"
+#include "UplinkFrame.h"
+#include "UplinkStore.h"
+#include "WindowAggregator.h"
+
+namespace {
+
+/* SERVER_PORT of main.cpp */
+const uint16_t UPLINK_PORT = 8002;
+
+/* send times kept to measure the ack latency */
+const size_t SEND_TIMES = 64;
+
+/* AT commands issued by the es-wifi driver (es_wifi.c) */
+const unsigned OPEN_COMMANDS = 5;
+const unsigned CLOSE_COMMANDS = 2;
+const unsigned SEND_COMMANDS = 3;
+const unsigned RECEIVE_COMMANDS = 4;
+
+/* log-linear latency histogram: 16 buckets per power of two microseconds */
+const unsigned LATENCY_SUB_BITS = 4;
+const size_t LATENCY_BUCKETS = (32 - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS;
+
+/* stack of a node thread */
+const size_t NODE_STACK_SIZE = 128 * 1024;
+
+uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void sleep_until_us(uint64_t deadline_us)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline_us / 1000000;
+    ts.tv_nsec = (deadline_us % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+struct options_t {
+    struct sockaddr_in server;
+    std::vector<unsigned> nodes;
+    std::vector<double> rates;
+    unsigned step_s;
+    unsigned settle_s;
+    double command_us;
+    double command_jitter_us;
+    double spi_bytes_per_us;
+    double spread;
+    unsigned connect_timeout_ms;
+    unsigned reconnect_after;
+    unsigned peers;
+    double connect_share;
+    unsigned pack;
+    unsigned seed;
+};
+
+/**
+ * Latency histogram of a node; merged into the step totals at its end.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram() : _count(0), _max_us(0)
+    {
+        memset(_buckets, 0, sizeof(_buckets));
+    }
+
+    void add(uint64_t us)
+    {
+        if (us > UINT32_MAX) {
+            us = UINT32_MAX;
+        }
+        ++_buckets[bucket_of((uint32_t) us)];
+        ++_count;
+        if (us > _max_us) {
+            _max_us = us;
+        }
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+            _buckets[i] += other._buckets[i];
+        }
+        _count += other._count;
+        if (other._max_us > _max_us) {
+            _max_us = other._max_us;
+        }
+    }
+
+    uint64_t count() const
+    {
+        return _count;
+    }
+
+    uint64_t max_us() const
+    {
+        return _max_us;
+    }
+
+    /**
+     * Upper bound of the bucket holding the quantile.
+     */
+    uint64_t quantile_us(double quantile) const
+    {
+        if (!_count) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(quantile * _count);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+            seen += _buckets[i];
+            if (seen > rank) {
+                uint64_t bound = upper_bound_of(i);
+                return bound < _max_us ? bound : _max_us;
+            }
+        }
+        return _max_us;
+    }
+
+private:
+    static size_t bucket_of(uint32_t us)
+    {
+        if (us < (1U << LATENCY_SUB_BITS)) {
+            return us;
+        }
+        unsigned exponent = 31 - __builtin_clz(us);
+        unsigned shift = exponent - LATENCY_SUB_BITS;
+        return ((shift + 1) << LATENCY_SUB_BITS) +
+            ((us >> shift) & ((1U << LATENCY_SUB_BITS) - 1));
+    }
+
+    static uint64_t upper_bound_of(size_t bucket)
+    {
+        if (bucket < (1U << LATENCY_SUB_BITS)) {
+            return bucket;
+        }
+        unsigned shift = (bucket >> LATENCY_SUB_BITS) - 1;
+        uint64_t mantissa = (bucket & ((1U << LATENCY_SUB_BITS) - 1)) | (1U << LATENCY_SUB_BITS);
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    uint64_t _buckets[LATENCY_BUCKETS];
+    uint64_t _count;
+    uint64_t _max_us;
+};
+
+/**
+ * Counters of a node; written by its thread only, summed after the step.
+ */
+struct node_stats_t {
+    uint64_t messages;
+    uint64_t sends;
+    uint64_t send_failures;
+    uint64_t bytes;
+    uint64_t opens;
+    uint64_t open_failures;
+    uint64_t module_busy_us;
+    uint64_t frames_acked;
+    uint64_t records_sent;
+    uint64_t records_stored;
+    uint64_t records_drained;
+    uint64_t records_dropped;
+    LatencyHistogram latency;
+    LatencyHistogram ack_latency;
+};
+
+/**
+ * Opens of the whole fleet per second of the step.
+ */
+class OpenTimeline {
+public:
+    OpenTimeline(uint64_t start_us, unsigned seconds) :
+        _start_us(start_us), _bins(seconds + 1)
+    {
+        for (size_t i = 0; i < _bins.size(); ++i) {
+            _bins[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void add(uint64_t time_us)
+    {
+        size_t bin = (time_us - _start_us) / 1000000;
+        if (bin >= _bins.size()) {
+            bin = _bins.size() - 1;
+        }
+        _bins[bin].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint32_t peak() const
+    {
+        uint32_t peak = 0;
+        for (size_t i = 0; i < _bins.size(); ++i) {
+            uint32_t value = _bins[i].load(std::memory_order_relaxed);
+            if (value > peak) {
+                peak = value;
+            }
+        }
+        return peak;
+    }
+
+private:
+    uint64_t _start_us;
+    std::vector<std::atomic<uint32_t> > _bins;
+};
+
+/**
+ * Emulated es-wifi module of a node: one socket on a real TCP connection.
+ */
+class EmulatedModule {
+public:
+    EmulatedModule(const options_t &options, std::mt19937 &random, node_stats_t &stats,
+                   OpenTimeline &opens) :
+        _options(options),
+        _random(random),
+        _stats(stats),
+        _opens(opens),
+        _fd(-1)
+    {
+        std::uniform_real_distribution<double> spread(1 - options.spread, 1 + options.spread);
+        _command_us = options.command_us * spread(random);
+        _spi_bytes_per_us = options.spi_bytes_per_us * spread(random);
+    }
+
+    ~EmulatedModule()
+    {
+        close_socket();
+    }
+
+    WIFI_Status_t open(const uint8_t *ipaddr, uint16_t port)
+    {
+        // reopening a socket of the module drops its previous connection
+        close_socket();
+        busy(OPEN_COMMANDS, 0);
+        ++_stats.opens;
+        _opens.add(now_us());
+
+        _fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (_fd < 0) {
+            ++_stats.open_failures;
+            return WIFI_STATUS_ERROR;
+        }
+        int one = 1;
+        setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        struct sockaddr_in address = _options.server;
+        memcpy(&address.sin_addr, ipaddr, 4);
+        address.sin_port = htons(port);
+        if (connect(_fd, (struct sockaddr *) &address, sizeof(address)) < 0 &&
+            errno != EINPROGRESS) {
+            return open_failed();
+        }
+        if (!wait(POLLOUT, _options.connect_timeout_ms)) {
+            return open_failed();
+        }
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error) {
+            return open_failed();
+        }
+        return WIFI_STATUS_OK;
+    }
+
+    WIFI_Status_t close()
+    {
+        busy(CLOSE_COMMANDS, 0);
+        close_socket();
+        return WIFI_STATUS_OK;
+    }
+
+    WIFI_Status_t send(const uint8_t *data, uint16_t length, uint16_t *sent, uint32_t timeout_ms)
+    {
+        *sent = 0;
+        if (length > ES_WIFI_PAYLOAD_SIZE) {
+            length = ES_WIFI_PAYLOAD_SIZE;
+        }
+        busy(SEND_COMMANDS, length);
+        if (_fd < 0) {
+            return WIFI_STATUS_ERROR;
+        }
+
+        size_t offset = 0;
+        uint64_t deadline_us = now_us() + timeout_ms * 1000ULL;
+        while (offset < length) {
+            ssize_t count = ::send(_fd, data + offset, length - offset, MSG_NOSIGNAL);
+            if (count > 0) {
+                offset += count;
+                continue;
+            }
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                close_socket();
+                return WIFI_STATUS_ERROR;
+            }
+            uint64_t now = now_us();
+            if (now >= deadline_us || !wait(POLLOUT, (deadline_us - now + 999) / 1000)) {
+                return WIFI_STATUS_ERROR;
+            }
+        }
+        *sent = length;
+        return WIFI_STATUS_OK;
+    }
+
+    WIFI_Status_t receive(uint8_t *data, uint16_t length, uint16_t *received, uint32_t timeout_ms)
+    {
+        *received = 0;
+        busy(RECEIVE_COMMANDS, 0);
+        if (_fd < 0) {
+            return WIFI_STATUS_ERROR;
+        }
+        if (!wait(POLLIN, timeout_ms)) {
+            return WIFI_STATUS_OK;
+        }
+        ssize_t count = recv(_fd, data, length, MSG_DONTWAIT);
+        if (count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            close_socket();
+            return WIFI_STATUS_ERROR;
+        }
+        if (count > 0) {
+            busy(0, count);
+            *received = count;
+        }
+        return WIFI_STATUS_OK;
+    }
+
+private:
+    /**
+     * Block the node for the AT commands and the SPI transfer of a payload.
+     */
+    void busy(unsigned commands, size_t bytes)
+    {
+        std::exponential_distribution<double> jitter(1 / _options.command_jitter_us);
+        double us = bytes / _spi_bytes_per_us;
+        for (unsigned i = 0; i < commands; ++i) {
+            us += _command_us + (_options.command_jitter_us > 0 ? jitter(_random) : 0);
+        }
+        _stats.module_busy_us += (uint64_t) us;
+        sleep_until_us(now_us() + (uint64_t) us);
+    }
+
+    bool wait(short events, unsigned timeout_ms)
+    {
+        struct pollfd pfd;
+        pfd.fd = _fd;
+        pfd.events = events;
+        while (true) {
+            int ready = poll(&pfd, 1, timeout_ms);
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            return ready > 0 && !(pfd.revents & (POLLERR | POLLHUP));
+        }
+    }
+
+    WIFI_Status_t open_failed()
+    {
+        ++_stats.open_failures;
+        close_socket();
+        return WIFI_STATUS_ERROR;
+    }
+
+    void close_socket()
+    {
+        if (_fd >= 0) {
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+
+    const options_t &_options;
+    std::mt19937 &_random;
+    node_stats_t &_stats;
+    OpenTimeline &_opens;
+    int _fd;
+    double _command_us;
+    double _spi_bytes_per_us;
+};
+
+/* module of the node running on the calling thread */
+thread_local EmulatedModule *current_module = NULL;
+
+/**
+ * Internal flash of the node holding its uplink store: STM32L4 pages of
+ * 2 kB programmed by double words.
+ */
+class RamBlockDevice : public mbed::BlockDevice {
+public:
+    RamBlockDevice() : _memory(MBED_CONF_APP_UPLINK_STORE_SIZE, ERASE_VALUE)
+    {
+    }
+
+    int init()
+    {
+        return 0;
+    }
+
+    int deinit()
+    {
+        return 0;
+    }
+
+    int read(void *buffer, bd_addr_t addr, bd_size_t size)
+    {
+        memcpy(buffer, &_memory[addr], size);
+        return 0;
+    }
+
+    int program(const void *buffer, bd_addr_t addr, bd_size_t size)
+    {
+        const uint8_t *data = (const uint8_t *) buffer;
+        for (bd_size_t i = 0; i < size; ++i) {
+            _memory[addr + i] &= data[i];
+        }
+        return 0;
+    }
+
+    int erase(bd_addr_t addr, bd_size_t size)
+    {
+        memset(&_memory[addr], ERASE_VALUE, size);
+        return 0;
+    }
+
+    bd_size_t get_read_size() const
+    {
+        return 1;
+    }
+
+    bd_size_t get_program_size() const
+    {
+        return 8;
+    }
+
+    bd_size_t get_erase_size() const
+    {
+        return 2048;
+    }
+
+    int get_erase_value() const
+    {
+        return ERASE_VALUE;
+    }
+
+    bd_size_t size() const
+    {
+        return _memory.size();
+    }
+
+private:
+    static const uint8_t ERASE_VALUE = 0xFF;
+
+    std::vector<uint8_t> _memory;
+};
+
+/**
+ * An emulated node: the reconnection of LinkSupervisor and the batching,
+ * store and drain of Uplink on its own module. Each function is named
+ * after the firmware function it follows; the event queue of the wifi lane
+ * is the loop of run().
+ */
+class Node {
+public:
+    Node(unsigned id, const options_t &options, OpenTimeline &opens) :
+        _id(id),
+        _options(options),
+        _random(options.seed * 7919 + id),
+        _stats(),
+        _module(options, _random, _stats, opens),
+        _packer(options.pack >= 2),
+        _store(_flash),
+        _socket(-1),
+        _attempt(0),
+        _send_errors(0),
+        _thread(),
+        _boot_us(0),
+        _writer(_frame, sizeof(_frame)),
+        _sequence(0),
+        _acked(UINT32_MAX),
+        _flush_us(0),
+        _poll_us(0),
+        _drain_due(false),
+        _idle_polls(0),
+        _rx_length(0)
+    {
+    }
+
+    bool start(uint64_t end_us, double rate)
+    {
+        _end_us = end_us;
+        _rate = rate;
+
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setstacksize(&attributes, NODE_STACK_SIZE);
+        int error = pthread_create(&_thread, &attributes, &Node::thread_main, this);
+        pthread_attr_destroy(&attributes);
+        return error == 0;
+    }
+
+    void join()
+    {
+        pthread_join(_thread, NULL);
+    }
+
+    const node_stats_t &stats() const
+    {
+        return _stats;
+    }
+
+    bool connected() const
+    {
+        return _socket != -1;
+    }
+
+private:
+    static void *thread_main(void *self)
+    {
+        static_cast<Node *>(self)->run();
+        return NULL;
+    }
+
+    void run()
+    {
+        current_module = &_module;
+        _boot_us = now_us();
+        _store.start();
+
+        uint64_t period_us = (uint64_t)(1e6 / _rate);
+        std::uniform_real_distribution<double> phase(0, 1);
+        std::uniform_real_distribution<double> kind(0, 1);
+        uint64_t message_us = now_us() + (uint64_t)(phase(_random) * period_us);
+        uint64_t open_us = now_us() + jitter(MBED_CONF_APP_LINK_BACKOFF_MIN_MS) * 1000ULL;
+
+        for (;;) {
+            if (_drain_due) {
+                drain();
+            } else {
+                uint64_t next_us = message_us;
+                if (_socket == -1 && open_us < next_us) {
+                    next_us = open_us;
+                }
+                if (_flush_us && _flush_us < next_us) {
+                    next_us = _flush_us;
+                }
+                if (_poll_us && _poll_us < next_us) {
+                    next_us = _poll_us;
+                }
+                if (next_us >= _end_us) {
+                    break;
+                }
+                sleep_until_us(next_us);
+
+                if (next_us == message_us) {
+                    ++_stats.messages;
+                    if (kind(_random) < _options.connect_share) {
+                        send_connect(message_us);
+                    } else {
+                        upload(message_us);
+                    }
+                    message_us += period_us;
+                } else if (next_us == _flush_us) {
+                    flush();
+                } else if (next_us == _poll_us) {
+                    _poll_us = 0;
+                    poll_acks();
+                } else if (connect()) {
+                    set_socket(LinkSupervisor::SOCKET);
+                } else {
+                    open_us = now_us() + retry_ms() * 1000ULL;
+                }
+            }
+
+            if (_options.reconnect_after && _send_errors >= _options.reconnect_after) {
+                WIFI_CloseClientConnection(_socket);
+                set_socket(-1);
+                open_us = now_us() + jitter(MBED_CONF_APP_LINK_BACKOFF_MIN_MS) * 1000ULL;
+            }
+        }
+        current_module = NULL;
+    }
+
+    /**
+     * Connecting step of LinkSupervisor.
+     */
+    bool connect()
+    {
+        uint8_t RemoteIP[4];
+        memcpy(RemoteIP, &_options.server.sin_addr, sizeof(RemoteIP));
+
+        if (WIFI_OpenClientConnection(
+                LinkSupervisor::SOCKET, WIFI_TCP_PROTOCOL, "TCP_CLIENT", RemoteIP, UPLINK_PORT, 0
+            ) != WIFI_STATUS_OK) {
+            return false;
+        }
+        _attempt = 0;
+        _send_errors = 0;
+        return true;
+    }
+
+    /**
+     * LinkSupervisor::retry: delay of the next attempt, equal jitter over
+     * the exponential backoff.
+     */
+    uint32_t retry_ms()
+    {
+        uint32_t delay_ms = (uint32_t) MBED_CONF_APP_LINK_BACKOFF_MIN_MS << _attempt;
+        if (delay_ms > MBED_CONF_APP_LINK_BACKOFF_MAX_MS) {
+            delay_ms = MBED_CONF_APP_LINK_BACKOFF_MAX_MS;
+        }
+        if (_attempt < LinkSupervisor::MAX_ATTEMPT_SHIFT) {
+            ++_attempt;
+        }
+        return delay_ms / 2 + jitter(delay_ms / 2 + 1);
+    }
+
+    /**
+     * LinkSupervisor::jitter: random delay in [0, range_ms).
+     */
+    uint32_t jitter(uint32_t range_ms)
+    {
+        return range_ms ? _random() % range_ms : 0;
+    }
+
+    /**
+     * Clock of the node, rtos::Kernel::get_ms_count.
+     */
+    uint32_t clock_ms() const
+    {
+        return (uint32_t)((now_us() - _boot_us) / 1000);
+    }
+
+    /**
+     * Uplink::set_socket.
+     */
+    void set_socket(int32_t socket)
+    {
+        _socket = socket;
+        _poll_us = 0;
+        _rx_length = 0;
+        if (_socket < 0) {
+            flush();
+            return;
+        }
+
+        uint8_t mac[6] = { 0xC4, 0x7F, 0x51, (uint8_t)(_id >> 16), (uint8_t)(_id >> 8), (uint8_t) _id };
+        append(UplinkFrame::RECORD_HELLO, mac, sizeof(mac), now_us());
+        if (!_store.empty()) {
+            _drain_due = true;
+        }
+    }
+
+    /**
+     * Uplink::append; time_us is when the message was due, for its
+     * latency.
+     */
+    void append(uint8_t type, const uint8_t *payload, size_t length, uint64_t time_us)
+    {
+        uint32_t now_ms = clock_ms();
+        if (_socket < 0) {
+            store(type, now_ms, payload, length);
+            return;
+        }
+
+        if (_writer.record_count() && !_writer.fits(length)) {
+            flush();
+        }
+        if (!_writer.record_count()) {
+            _writer.begin(_id, _sequence, now_ms);
+            _flush_us = now_us() + MBED_CONF_APP_UPLINK_FLUSH_DELAY_MS * 1000ULL;
+        }
+        _writer.append(type, payload, length, now_ms);
+        _due_us[_writer.record_count() - 1] = time_us;
+    }
+
+    /**
+     * Uplink::flush.
+     */
+    void flush()
+    {
+        _flush_us = 0;
+        size_t records = _writer.record_count();
+        size_t length = _writer.finish();
+        if (!length) {
+            return;
+        }
+
+        if (_socket < 0 || !send_frame(length)) {
+            spill(length);
+            return;
+        }
+        uint64_t now = now_us();
+        for (size_t i = 0; i < records; ++i) {
+            _stats.latency.add(now - _due_us[i]);
+        }
+        _stats.records_sent += records;
+        if (!_store.empty()) {
+            _drain_due = true;
+        }
+    }
+
+    /**
+     * Uplink::send_frame and LinkSupervisor::when_send.
+     */
+    bool send_frame(size_t length)
+    {
+        uint8_t *data = _frame;
+        size_t packed = _options.pack ? _packer.pack(_frame, length, _packed) : 0;
+        if (packed) {
+            data = _packed;
+            length = packed;
+        }
+
+        uint32_t sequence = _sequence;
+        uint16_t sent = 0;
+        ++_stats.sends;
+        if (WIFI_SendData(_socket, data, length, &sent, Uplink::WRITE_TIMEOUT_MS) != WIFI_STATUS_OK) {
+            ++_stats.send_failures;
+            ++_send_errors;
+            return false;
+        }
+        _send_errors = 0;
+        ++_sequence;
+        _stats.bytes += sent;
+        _send_times_us[sequence % SEND_TIMES] = now_us();
+
+        _idle_polls = 0;
+        if (!_poll_us) {
+            _poll_us = now_us() + MBED_CONF_APP_UPLINK_ACK_POLL_MS * 1000ULL;
+        }
+        return true;
+    }
+
+    /**
+     * Uplink::store.
+     */
+    void store(uint8_t type, uint32_t timestamp_ms, const uint8_t *payload, size_t length)
+    {
+        if (_store.push(type, timestamp_ms, payload, length)) {
+            ++_stats.records_stored;
+        } else {
+            ++_stats.records_dropped;
+        }
+    }
+
+    /**
+     * Uplink::spill.
+     */
+    void spill(size_t length)
+    {
+        UplinkFrame::header_t header;
+        if (!UplinkFrame::decode_header(_frame, length, header)) {
+            return;
+        }
+        UplinkFrame::RecordIterator records(_frame, header);
+        uint8_t type;
+        uint16_t age_ms;
+        const uint8_t *payload;
+        uint16_t record_length;
+        while (records.next(type, age_ms, payload, record_length)) {
+            store(type, header.timestamp_ms + age_ms, payload, record_length);
+        }
+    }
+
+    /**
+     * Uplink::drain: one full frame of stored records, then back to the
+     * loop for the next one.
+     */
+    void drain()
+    {
+        _drain_due = false;
+
+        flush();
+        if (_socket < 0 || _store.empty()) {
+            return;
+        }
+
+        UplinkStore::record_t record;
+        uint32_t frame_ms = 0;
+        while (_store.peek(record)) {
+            if (!_writer.record_count()) {
+                _writer.begin(_id, _sequence, record.timestamp_ms);
+                frame_ms = record.timestamp_ms;
+            } else if (record.timestamp_ms - frame_ms > UINT16_MAX) {
+                break;
+            }
+            uint8_t *payload = _writer.reserve(record.type, record.length, record.timestamp_ms);
+            if (!payload) {
+                break;
+            }
+            if (!_store.read(record, payload)) {
+                _writer.finish();
+                _store.rewind();
+                return;
+            }
+            _stored_ms[_writer.record_count() - 1] = record.timestamp_ms;
+        }
+
+        size_t records = _writer.record_count();
+        size_t length = _writer.finish();
+        if (!length) {
+            return;
+        }
+        if (!send_frame(length)) {
+            _store.rewind();
+            return;
+        }
+        _store.commit();
+        uint32_t now_ms = clock_ms();
+        for (size_t i = 0; i < records; ++i) {
+            _stats.latency.add((uint64_t)(now_ms - _stored_ms[i]) * 1000);
+        }
+        _stats.records_sent += records;
+        _stats.records_drained += records;
+
+        if (!_store.empty()) {
+            _drain_due = true;
+        }
+    }
+
+    /**
+     * Uplink::poll_acks.
+     */
+    void poll_acks()
+    {
+        if (_socket < 0) {
+            return;
+        }
+
+        uint32_t acked = _acked;
+        for (size_t read = 0; read < Uplink::MAX_READS_PER_POLL; ++read) {
+            uint16_t requested = sizeof(_rx) - _rx_length;
+            uint16_t received = 0;
+            if (WIFI_ReceiveData(
+                    _socket, _rx + _rx_length, requested, &received, Uplink::READ_TIMEOUT_MS
+                ) != WIFI_STATUS_OK) {
+                break;
+            }
+            _rx_length += received;
+
+            size_t offset = 0;
+            while (_rx_length - offset >= UplinkFrame::ACK_SIZE) {
+                uint32_t sequence;
+                if (UplinkFrame::decode_ack(_rx + offset, sequence)) {
+                    when_ack(sequence);
+                    offset += UplinkFrame::ACK_SIZE;
+                } else {
+                    ++offset;
+                }
+            }
+            memmove(_rx, _rx + offset, _rx_length - offset);
+            _rx_length -= offset;
+
+            if (received < requested) {
+                break;
+            }
+        }
+
+        _idle_polls = _acked != acked ? 0 : _idle_polls + 1;
+        if (_acked != _sequence - 1 && _idle_polls < Uplink::MAX_IDLE_POLLS) {
+            _poll_us = now_us() + MBED_CONF_APP_UPLINK_ACK_POLL_MS * 1000ULL;
+        }
+    }
+
+    void when_ack(uint32_t sequence)
+    {
+        if ((int32_t)(sequence - _acked) <= 0 || (int32_t)(sequence - _sequence) >= 0) {
+            return;
+        }
+        uint64_t now = now_us();
+        for (uint32_t acked = _acked + 1; acked != sequence + 1; ++acked) {
+            ++_stats.frames_acked;
+            if (_sequence - acked <= SEND_TIMES) {
+                _stats.ack_latency.add(now - _send_times_us[acked % SEND_TIMES]);
+            }
+        }
+        _acked = sequence;
+    }
+
+    /**
+     * Summary of the time to connect of the centrals, METRIC_BLE_CONNECT_MS
+     * of MetricReporter.
+     */
+    void send_connect(uint64_t time_us)
+    {
+        WindowAggregator<1>::summary_t summary;
+        summary.metric = MetricReporter::METRIC_BLE_CONNECT_MS;
+        summary.end_ms = clock_ms();
+        summary.window_ms = 60000;
+        summary.count = 1 + _random() % 4;
+        summary.min = 100 + _random() % 400;
+        summary.max = summary.min + _random() % 2000;
+        summary.last = summary.max;
+        summary.mean = (summary.min + summary.max) / 2.0f;
+        summary.variance = 0;
+
+        uint8_t record[WindowAggregator<1>::SUMMARY_SIZE];
+        WindowAggregator<1>::encode(summary, record);
+        append(UplinkFrame::RECORD_METRIC_SUMMARY, record, sizeof(record), time_us);
+    }
+
+    /**
+     * Report of BLEGateway::send_report over a window in which the node
+     * saw --peers advertisers.
+     */
+    void upload(uint64_t time_us)
+    {
+        uint32_t now_ms = clock_ms();
+        for (unsigned peer = 0; peer < _options.peers; ++peer) {
+            uint8_t address[6] = {
+                (uint8_t) peer, (uint8_t)(peer >> 8), (uint8_t) _id,
+                (uint8_t)(_id >> 8), (uint8_t)(_id >> 16), 0xC0
+            };
+            uint8_t payload[3] = { 0x02, 0x01, (uint8_t) _random() };
+            _aggregator.observe(address, 0, -40 - (int8_t)(peer % 50), payload, sizeof(payload), now_ms);
+        }
+
+        size_t length = _aggregator.report(_report, sizeof(_report), now_ms);
+        if (length) {
+            append(UplinkFrame::RECORD_SCAN_REPORT, _report, length, time_us);
+        }
+    }
+
+    unsigned _id;
+    const options_t &_options;
+    std::mt19937 _random;
+    node_stats_t _stats;
+    EmulatedModule _module;
+    UplinkPacker<Uplink::MAX_FRAME_SIZE> _packer;
+    RamBlockDevice _flash;
+    UplinkStore _store;
+    int32_t _socket;
+    unsigned _attempt;
+    unsigned _send_errors;
+    pthread_t _thread;
+    uint64_t _end_us;
+    double _rate;
+    uint64_t _boot_us;
+    ScanAggregator<64> _aggregator;
+    uint8_t _report[Uplink::MAX_RECORD_SIZE];
+    uint8_t _frame[Uplink::MAX_FRAME_SIZE];
+    uint8_t _packed[Uplink::MAX_FRAME_SIZE];
+    UplinkFrameWriter _writer;
+    uint64_t _due_us[UplinkFrame::MAX_RECORDS];
+    uint32_t _stored_ms[UplinkFrame::MAX_RECORDS];
+    uint32_t _sequence;
+    uint32_t _acked;
+    uint64_t _flush_us;
+    uint64_t _poll_us;
+    bool _drain_due;
+    unsigned _idle_polls;
+    uint8_t _rx[16 * UplinkFrame::ACK_SIZE];
+    size_t _rx_length;
+    uint64_t _send_times_us[SEND_TIMES];
+};
+
+/**
+ * Boot a fleet, run it for a step and print its figures.
+ */
+void run_step(const options_t &options, unsigned node_count, double rate)
+{
+    uint64_t start_us = now_us();
+    uint64_t end_us = start_us + options.step_s * 1000000ULL;
+    OpenTimeline opens(start_us, options.step_s);
+
+    std::vector<Node *> nodes;
+    for (unsigned i = 0; i < node_count; ++i) {
+        nodes.push_back(new Node(i, options, opens));
+    }
+    size_t started = 0;
+    for (; started < nodes.size(); ++started) {
+        if (!nodes[started]->start(end_us, rate)) {
+            fprintf(stderr, "cannot start node %u: %s\n", (unsigned) started, strerror(errno));
+            break;
+        }
+    }
+
+    node_stats_t total = node_stats_t();
+    unsigned unconnected = 0;
+    for (size_t i = 0; i < started; ++i) {
+        nodes[i]->join();
+        const node_stats_t &stats = nodes[i]->stats();
+        total.messages += stats.messages;
+        total.sends += stats.sends;
+        total.send_failures += stats.send_failures;
+        total.bytes += stats.bytes;
+        total.opens += stats.opens;
+        total.open_failures += stats.open_failures;
+        total.module_busy_us += stats.module_busy_us;
+        total.frames_acked += stats.frames_acked;
+        total.records_sent += stats.records_sent;
+        total.records_stored += stats.records_stored;
+        total.records_drained += stats.records_drained;
+        total.records_dropped += stats.records_dropped;
+        total.latency.merge(stats.latency);
+        total.ack_latency.merge(stats.ack_latency);
+        if (!nodes[i]->connected()) {
+            ++unconnected;
+        }
+    }
+    double seconds = (now_us() - start_us) / 1e6;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        delete nodes[i];
+    }
+
+    printf("%6u %7.2f %9.1f %9.1f %9.1f %8.2f %8.2f %8.2f %8.2f %9.1f %8.1f %8.1f %6llu %7llu %7llu %6llu %6llu %6u %5u %5.1f\n",
+        node_count,
+        rate,
+        node_count * rate,
+        (total.sends - total.send_failures) / seconds,
+        total.bytes / seconds / 1000,
+        total.latency.quantile_us(0.5) / 1000.0,
+        total.latency.quantile_us(0.99) / 1000.0,
+        total.latency.quantile_us(0.999) / 1000.0,
+        total.latency.max_us() / 1000.0,
+        total.frames_acked / seconds,
+        total.ack_latency.quantile_us(0.5) / 1000.0,
+        total.ack_latency.quantile_us(0.99) / 1000.0,
+        (unsigned long long) total.send_failures,
+        (unsigned long long) total.records_stored,
+        (unsigned long long) total.records_drained,
+        (unsigned long long) total.opens,
+        (unsigned long long) total.open_failures,
+        opens.peak(),
+        unconnected,
+        node_count ? 100.0 * total.module_busy_us / (seconds * 1e6 * node_count) : 0.0
+    );
+    fflush(stdout);
+}
+
+template<typename T>
+std::vector<T> parse_list(const char *text)
+{
+    std::vector<T> values;
+    while (*text) {
+        char *end;
+        double value = strtod(text, &end);
+        if (end == text) {
+            break;
+        }
+        values.push_back((T) value);
+        text = *end == ',' ? end + 1 : end;
+    }
+    return values;
+}
+
+void raise_file_limit()
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+} // namespace
+
+/*
+ * es-wifi driver API on the module of the calling node
+ */
+extern "C" {
+
+WIFI_Status_t WIFI_OpenClientConnection(
+    uint32_t socket, WIFI_Protocol_t type, const char *name, uint8_t *ipaddr,
+    uint16_t port, uint16_t local_port
+) {
+    (void) socket;
+    (void) type;
+    (void) name;
+    (void) local_port;
+    return current_module ? current_module->open(ipaddr, port) : WIFI_STATUS_ERROR;
+}
+
+WIFI_Status_t WIFI_CloseClientConnection(uint32_t socket)
+{
+    (void) socket;
+    return current_module ? current_module->close() : WIFI_STATUS_ERROR;
+}
+
+WIFI_Status_t WIFI_SendData(
+    uint8_t socket, uint8_t *pdata, uint16_t Reqlen, uint16_t *SentDatalen, uint32_t Timeout
+) {
+    (void) socket;
+    if (!current_module) {
+        *SentDatalen = 0;
+        return WIFI_STATUS_ERROR;
+    }
+    return current_module->send(pdata, Reqlen, SentDatalen, Timeout);
+}
+
+WIFI_Status_t WIFI_ReceiveData(
+    uint8_t socket, uint8_t *pdata, uint16_t Reqlen, uint16_t *RcvDatalen, uint32_t Timeout
+) {
+    (void) socket;
+    if (!current_module) {
+        *RcvDatalen = 0;
+        return WIFI_STATUS_ERROR;
+    }
+    return current_module->receive(pdata, Reqlen, RcvDatalen, Timeout);
+}
+
+} // extern "C"
+
+int main(int argc, char **argv)
+{
+    options_t options;
+    memset(&options.server, 0, sizeof(options.server));
+    options.server.sin_family = AF_INET;
+    options.server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    options.nodes.push_back(100);
+    options.rates.push_back(1);
+    options.step_s = 10;
+    options.settle_s = 2;
+    options.command_us = 1000;
+    options.command_jitter_us = 200;
+    options.spi_bytes_per_us = 1;
+    options.spread = 0.2;
+    options.connect_timeout_ms = 5000;
+    options.reconnect_after = MBED_CONF_APP_LINK_MAX_SEND_ERRORS;
+    options.peers = 16;
+    options.connect_share = 0.1;
+    options.pack = MBED_CONF_APP_UPLINK_PACK;
+    options.seed = 1;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const char *value = argv[i + 1];
+        if (!strcmp(argv[i], "--host")) {
+            if (inet_pton(AF_INET, value, &options.server.sin_addr) != 1) {
+                fprintf(stderr, "bad IPv4 address: %s\n", value);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--nodes")) {
+            options.nodes = parse_list<unsigned>(value);
+        } else if (!strcmp(argv[i], "--rate")) {
+            options.rates = parse_list<double>(value);
+        } else if (!strcmp(argv[i], "--step-s")) {
+            options.step_s = strtoul(value, NULL, 0);
+        } else if (!strcmp(argv[i], "--settle-s")) {
+            options.settle_s = strtoul(value, NULL, 0);
+        } else if (!strcmp(argv[i], "--command-us")) {
+            options.command_us = strtod(value, NULL);
+        } else if (!strcmp(argv[i], "--jitter-us")) {
+            options.command_jitter_us = strtod(value, NULL);
+        } else if (!strcmp(argv[i], "--spi-bytes-per-us")) {
+            options.spi_bytes_per_us = strtod(value, NULL);
+        } else if (!strcmp(argv[i], "--spread")) {
+            options.spread = strtod(value, NULL);
+        } else if (!strcmp(argv[i], "--connect-timeout-ms")) {
+            options.connect_timeout_ms = strtoul(value, NULL, 0);
+        } else if (!strcmp(argv[i], "--reconnect-after")) {
+            options.reconnect_after = strtoul(value, NULL, 0);
+        } else if (!strcmp(argv[i], "--peers")) {
+            options.peers = strtoul(value, NULL, 0);
+        } else if (!strcmp(argv[i], "--connect-share")) {
+            options.connect_share = strtod(value, NULL);
+        } else if (!strcmp(argv[i], "--pack")) {
+            options.pack = strtoul(value, NULL, 0);
+        } else if (!strcmp(argv[i], "--seed")) {
+            options.seed = strtoul(value, NULL, 0);
+        } else {
+            fprintf(stderr,
+                "usage: %s [--host A.B.C.D] [--nodes N,N..] [--rate R,R..] [--step-s N]\n"
+                "    [--settle-s N] [--command-us US] [--jitter-us US] [--spi-bytes-per-us R]\n"
+                "    [--spread F] [--connect-timeout-ms N] [--reconnect-after N] [--peers N]\n"
+                "    [--connect-share F] [--pack 0|1|2] [--seed N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (options.nodes.empty() || options.rates.empty() || !options.step_s ||
+        options.spi_bytes_per_us <= 0 || options.spread < 0 || options.spread >= 1) {
+        fprintf(stderr, "bad sweep or module parameters\n");
+        return 1;
+    }
+    for (size_t i = 0; i < options.rates.size(); ++i) {
+        if (options.rates[i] <= 0) {
+            fprintf(stderr, "rates must be positive\n");
+            return 1;
+        }
+    }
+
+    raise_file_limit();
+
+    char host[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &options.server.sin_addr, host, sizeof(host));
+    printf("loadgen: %s:%u, %u s per step, command %.0f us (+%.0f), SPI %.2f bytes/us\n",
+        host, UPLINK_PORT, options.step_s, options.command_us, options.command_jitter_us,
+        options.spi_bytes_per_us);
+    printf("%6s %7s %9s %9s %9s %8s %8s %8s %8s %9s %8s %8s %6s %7s %7s %6s %6s %6s %5s %5s\n",
+        "nodes", "rate", "offered/s", "frames/s", "kB/s", "p50 ms", "p99 ms", "p999 ms",
+        "max ms", "acked/s", "ack p50", "ack p99", "fails", "stored", "drained", "opens", "openf", "open/s",
+        "down", "busy%");
+    fflush(stdout);
+
+    for (size_t n = 0; n < options.nodes.size(); ++n) {
+        for (size_t r = 0; r < options.rates.size(); ++r) {
+            run_step(options, options.nodes[n], options.rates[r]);
+            sleep(options.settle_s);
+        }
+    }
+    return 0;
+}
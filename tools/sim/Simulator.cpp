@@ -0,0 +1,114 @@
+#include "Simulator.h"
+
+#include <math.h>
+
+namespace sim {
+
+Simulator &Simulator::instance()
+{
+    static Simulator simulator;
+    return simulator;
+}
+
+Simulator::Simulator() :
+    _now_us(0),
+    _end_us(UINT64_MAX),
+    _sequence(0),
+    _tasks_run(0),
+    _random_state(1),
+    _next_id(1),
+    _stopped(false),
+    _running(false)
+{
+}
+
+int Simulator::post(uint64_t delay_us, task_t task, uint64_t period_us)
+{
+    int id = _next_id++;
+    if (_next_id <= 0) {
+        _next_id = 1;
+    }
+
+    task_state_t &state = _tasks[id];
+    state.task = task;
+    state.period_us = period_us;
+    schedule(id, _now_us + delay_us);
+    return id;
+}
+
+bool Simulator::cancel(int id)
+{
+    // the agenda entry is skipped when it comes due
+    return _tasks.erase(id) != 0;
+}
+
+void Simulator::schedule(int id, uint64_t due_us)
+{
+    entry_t entry = { due_us, _sequence++, id };
+    _agenda.push(entry);
+}
+
+void Simulator::run()
+{
+    _running = true;
+    _stopped = false;
+
+    while (!_stopped && !_agenda.empty()) {
+        entry_t entry = _agenda.top();
+        if (entry.due_us > _end_us) {
+            break;
+        }
+        _agenda.pop();
+
+        std::unordered_map<int, task_state_t>::iterator it = _tasks.find(entry.id);
+        if (it == _tasks.end()) {
+            continue;
+        }
+
+        // a task that ran late (after a blocking call) runs now
+        if (entry.due_us > _now_us) {
+            _now_us = entry.due_us;
+        }
+
+        task_t task = it->second.task;
+        uint64_t period_us = it->second.period_us;
+        if (period_us) {
+            schedule(entry.id, entry.due_us + period_us);
+        } else {
+            _tasks.erase(it);
+        }
+
+        ++_tasks_run;
+        task();
+    }
+
+    if (_end_us != UINT64_MAX && _now_us < _end_us && !_stopped) {
+        _now_us = _end_us;
+    }
+    _running = false;
+}
+
+uint32_t Simulator::random()
+{
+    _random_state ^= _random_state >> 12;
+    _random_state ^= _random_state << 25;
+    _random_state ^= _random_state >> 27;
+    return (uint32_t)((_random_state * 2685821657736338717ULL) >> 32);
+}
+
+uint64_t Simulator::uniform(uint64_t low, uint64_t high)
+{
+    if (high <= low) {
+        return low;
+    }
+    uint64_t value = ((uint64_t) random() << 32) | random();
+    return low + value % (high - low + 1);
+}
+
+uint64_t Simulator::exponential(uint64_t mean)
+{
+    double u = (random() + 1.0) / 4294967297.0;
+    return (uint64_t)(-log(u) * mean);
+}
+
+} // namespace sim
@@ -0,0 +1,148 @@
+/*
+ * Deterministic discrete event core of the host simulation.
+ *
+ * Every event queue, timer and simulated radio activity of the node is a
+ * task in a single agenda ordered by virtual due time, then by posting
+ * order. Virtual time only moves when the next task is due or when a
+ * blocking call consumes time (advance()); a run with the same seed and
+ * the same options always produces the same sequence of events.
+ *
+ * All lanes of the application share the host thread: a blocking call on
+ * one lane delays the others, which is pessimistic for the wifi lane.
+ */
+#ifndef SIM_SIMULATOR_H_
+#define SIM_SIMULATOR_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace sim {
+
+class Simulator {
+public:
+    typedef std::function<void()> task_t;
+
+    static Simulator &instance();
+
+    /**
+     * Current virtual time.
+     */
+    uint64_t now_us() const
+    {
+        return _now_us;
+    }
+
+    /**
+     * Schedule a task.
+     *
+     * @param[in] delay_us Delay from now.
+     * @param[in] task The task.
+     * @param[in] period_us If not 0 the task is rescheduled with this period
+     * after each run until cancelled.
+     *
+     * @return Identifier of the task, never 0.
+     */
+    int post(uint64_t delay_us, task_t task, uint64_t period_us = 0);
+
+    /**
+     * Cancel a pending task; a periodic task may cancel itself.
+     */
+    bool cancel(int id);
+
+    /**
+     * Consume virtual time inside the running task, as a blocking call
+     * does.
+     */
+    void advance(uint64_t us)
+    {
+        _now_us += us;
+    }
+
+    /**
+     * Run tasks until the end time is reached or stop() is called.
+     */
+    void run();
+
+    void set_end(uint64_t end_us)
+    {
+        _end_us = end_us;
+    }
+
+    void stop()
+    {
+        _stopped = true;
+    }
+
+    bool running() const
+    {
+        return _running;
+    }
+
+    uint64_t tasks_run() const
+    {
+        return _tasks_run;
+    }
+
+    /**
+     * Deterministic pseudo random numbers (xorshift64*).
+     */
+    void seed(uint64_t seed)
+    {
+        _random_state = seed ? seed : 1;
+    }
+
+    uint32_t random();
+
+    /**
+     * Uniform integer in [low, high].
+     */
+    uint64_t uniform(uint64_t low, uint64_t high);
+
+    /**
+     * Exponentially distributed duration of the given mean.
+     */
+    uint64_t exponential(uint64_t mean);
+
+private:
+    struct entry_t {
+        uint64_t due_us;
+        uint64_t sequence;
+        int id;
+
+        bool operator>(const entry_t &other) const
+        {
+            if (due_us != other.due_us) {
+                return due_us > other.due_us;
+            }
+            return sequence > other.sequence;
+        }
+    };
+
+    struct task_state_t {
+        task_t task;
+        uint64_t period_us;
+    };
+
+    Simulator();
+
+    void schedule(int id, uint64_t due_us);
+
+    std::priority_queue<entry_t, std::vector<entry_t>, std::greater<entry_t> > _agenda;
+    std::unordered_map<int, task_state_t> _tasks;
+    uint64_t _now_us;
+    uint64_t _end_us;
+    uint64_t _sequence;
+    uint64_t _tasks_run;
+    uint64_t _random_state;
+    int _next_id;
+    bool _stopped;
+    bool _running;
+};
+
+} // namespace sim
+
+#endif /* SIM_SIMULATOR_H_ */
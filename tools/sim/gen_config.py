@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Generate mbed_config.h for the host simulation from mbed_app.json.
+
+Mirrors what the mbed tools do for the application: every entry of the
+"config" section becomes MBED_CONF_APP_<NAME> (or its macro_name), then the
+overrides of "*" and of the target are applied; overrides of other libraries
+become MBED_CONF_<LIBRARY>_<NAME>. Target settings (target.*) and settings
+of libraries absent from the host (FlashIAP, platform statistics) are
+ignored.
+
+Usage: gen_config.py <mbed_app.json> <output> [--target NAME] [--set name=value ...]
+"""
+import argparse
+import json
+import re
+
+IGNORED_PREFIXES = ('target.', 'platform.', 'flashiap-block-device.')
+
+# the simulated board has a single button
+HOST_SETTINGS = {
+    'ble_button_pin_name': 'USER_BUTTON',
+}
+
+
+def macro(name, prefix='MBED_CONF_APP_'):
+    return prefix + re.sub(r'[^A-Za-z0-9]', '_', name).upper()
+
+
+def value_of(value):
+    if isinstance(value, bool):
+        return '1' if value else '0'
+    return str(value)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('app_json')
+    parser.add_argument('output')
+    parser.add_argument('--target', default='DISCO_L475VG_IOT01A')
+    parser.add_argument('--set', action='append', default=[], metavar='NAME=VALUE')
+    args = parser.parse_args()
+
+    with open(args.app_json) as f:
+        app = json.load(f)
+
+    names = {}
+    values = {}
+    for name, entry in app.get('config', {}).items():
+        names[name] = entry.get('macro_name', macro(name))
+        if 'value' in entry:
+            values[name] = entry['value']
+
+    overrides = dict(app.get('target_overrides', {}).get('*', {}))
+    overrides.update(app.get('target_overrides', {}).get(args.target, {}))
+    overrides.update(HOST_SETTINGS)
+    for setting in args.set:
+        name, _, value = setting.partition('=')
+        overrides[name] = json.loads(value) if value in ('true', 'false') else value
+
+    for name, value in overrides.items():
+        if name.startswith(IGNORED_PREFIXES):
+            continue
+        if name.startswith('app.'):
+            name = name[len('app.'):]
+        if name not in names:
+            # setting of another library
+            library, _, setting = name.partition('.')
+            names[name] = macro(library + '_' + setting, 'MBED_CONF_')
+        values[name] = value
+
+    lines = ['/* Generated by gen_config.py from %s; do not edit. */' % args.app_json,
+             '#ifndef SIM_MBED_CONFIG_H_', '#define SIM_MBED_CONFIG_H_', '']
+    for name in sorted(values, key=lambda n: names[n]):
+        lines.append('#define %-50s %s' % (names[name], value_of(values[name])))
+    lines += ['', '#endif /* SIM_MBED_CONFIG_H_ */', '']
+    content = '\n'.join(lines)
+
+    # keep the file untouched when nothing changed so nothing is rebuilt
+    try:
+        with open(args.output) as f:
+            if f.read() == content:
+                return
+    except IOError:
+        pass
+    with open(args.output, 'w') as f:
+        f.write(content)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,1675 @@
+/*
+ * Host shim of the mbed BLE API (mbed-os 5.15 subset used by the node).
+ *
+ * The peripheral role is simulated: advertising, connections from
+ * simulated centrals, the GATT server with subscriptions, notifications
+ * limited by transmit buffers and drained at each connection event, write
+ * authorization, ATT MTU exchange, connection parameter updates, pairing
+ * and encryption resumption with a bond table. Scanning delivers the
+ * advertisements injected by the simulation driver. The central role
+ * (connect, discovery, GATT client reads) is not simulated and fails with
+ * BLE_ERROR_NOT_IMPLEMENTED.
+ *
+ * Stack events reach the application as on the target: the stack signals
+ * onEventsToProcess, the application posts BLE::processEvents on its
+ * queue, and processEvents delivers the pending callbacks.
+ */
+#ifndef SIM_BLE_BLE_H_
+#define SIM_BLE_BLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "platform/Callback.h"
+#include "platform/NonCopyable.h"
+#include "platform/Span.h"
+
+enum ble_error_t {
+    BLE_ERROR_NONE = 0,
+    BLE_ERROR_BUFFER_OVERFLOW = 1,
+    BLE_ERROR_NOT_IMPLEMENTED = 2,
+    BLE_ERROR_PARAM_OUT_OF_RANGE = 3,
+    BLE_ERROR_INVALID_PARAM = 4,
+    BLE_STACK_BUSY = 5,
+    BLE_ERROR_INVALID_STATE = 6,
+    BLE_ERROR_NO_MEM = 7,
+    BLE_ERROR_OPERATION_NOT_PERMITTED = 8,
+    BLE_ERROR_INITIALIZATION_INCOMPLETE = 9,
+    BLE_ERROR_ALREADY_INITIALIZED = 10,
+    BLE_ERROR_UNSPECIFIED = 11,
+    BLE_ERROR_INTERNAL_STACK_FAILURE = 12,
+    BLE_ERROR_NOT_FOUND = 13
+};
+
+/*
+ * Callbacks
+ */
+
+template<typename ContextType>
+class FunctionPointerWithContext {
+public:
+    FunctionPointerWithContext(void (*function)(ContextType) = NULL)
+    {
+        if (function) {
+            _function = function;
+        }
+    }
+
+    template<typename T>
+    FunctionPointerWithContext(T *object, void (T::*member)(ContextType)) :
+        _function([object, member](ContextType context) { (object->*member)(context); })
+    {
+    }
+
+    void call(ContextType context) const
+    {
+        if (_function) {
+            _function(context);
+        }
+    }
+
+    void operator()(ContextType context) const
+    {
+        call(context);
+    }
+
+    explicit operator bool() const
+    {
+        return static_cast<bool>(_function);
+    }
+
+private:
+    std::function<void(ContextType)> _function;
+};
+
+template<typename T, typename ContextType>
+FunctionPointerWithContext<ContextType> makeFunctionPointer(
+    T *object, void (T::*member)(ContextType)
+) {
+    return FunctionPointerWithContext<ContextType>(object, member);
+}
+
+/**
+ * Chain of callbacks invoked in registration order.
+ */
+template<typename ContextType>
+class CallChainOfFunctionPointersWithContext {
+public:
+    void add(const FunctionPointerWithContext<ContextType> &function)
+    {
+        _functions.push_back(function);
+    }
+
+    void call(ContextType context) const
+    {
+        for (size_t i = 0; i < _functions.size(); ++i) {
+            _functions[i].call(context);
+        }
+    }
+
+    bool hasCallbacksAttached() const
+    {
+        return !_functions.empty();
+    }
+
+private:
+    std::vector<FunctionPointerWithContext<ContextType> > _functions;
+};
+
+/*
+ * Common types
+ */
+
+namespace BLEProtocol {
+
+enum AddressType_t {
+    PUBLIC = 0,
+    RANDOM_STATIC,
+    RANDOM_PRIVATE_RESOLVABLE,
+    RANDOM_PRIVATE_NON_RESOLVABLE
+};
+
+static const size_t ADDR_LEN = 6;
+typedef uint8_t AddressBytes_t[ADDR_LEN];
+
+} // namespace BLEProtocol
+
+namespace ble {
+
+typedef uint16_t connection_handle_t;
+typedef uint8_t advertising_handle_t;
+
+static const advertising_handle_t LEGACY_ADVERTISING_HANDLE = 0x00;
+static const uint8_t LEGACY_ADVERTISING_MAX_SIZE = 0x1F;
+
+/**
+ * Duration expressed in a number of time base units (in microseconds).
+ */
+template<typename Rep, uint32_t TB>
+class Duration {
+public:
+    Duration() : _value(0) {}
+
+    explicit Duration(Rep value) : _value(value) {}
+
+    template<typename OtherRep, uint32_t OtherTB>
+    explicit Duration(Duration<OtherRep, OtherTB> other) :
+        _value((Rep)(((uint64_t) other.value() * OtherTB) / TB))
+    {
+    }
+
+    Rep value() const
+    {
+        return _value;
+    }
+
+    uint32_t valueInMs() const
+    {
+        return (uint32_t)(((uint64_t) _value * TB) / 1000);
+    }
+
+    uint64_t valueInUs() const
+    {
+        return (uint64_t) _value * TB;
+    }
+
+private:
+    Rep _value;
+};
+
+typedef Duration<uint32_t, 1000> millisecond_t;
+typedef Duration<uint32_t, 625> adv_interval_t;
+typedef Duration<uint16_t, 1250> conn_interval_t;
+typedef Duration<uint16_t, 10000> supervision_timeout_t;
+typedef Duration<uint16_t, 625> scan_interval_t;
+typedef Duration<uint16_t, 625> scan_window_t;
+typedef Duration<uint16_t, 625> conn_event_length_t;
+typedef Duration<uint16_t, 10000> scan_duration_t;
+typedef Duration<uint16_t, 1280000> scan_period_t;
+
+class slave_latency_t {
+public:
+    explicit slave_latency_t(uint16_t value = 0) : _value(value) {}
+
+    uint16_t value() const
+    {
+        return _value;
+    }
+
+private:
+    uint16_t _value;
+};
+
+#define SIM_BLE_SAFE_ENUM(name, ...)                            \
+    struct name {                                               \
+        enum type { __VA_ARGS__ };                              \
+        name() : _value(type()) {}                              \
+        name(type value) : _value(value) {}                     \
+        type value() const { return _value; }                   \
+        bool operator==(name other) const                       \
+        {                                                       \
+            return _value == other._value;                      \
+        }                                                       \
+        bool operator!=(name other) const                       \
+        {                                                       \
+            return _value != other._value;                      \
+        }                                                       \
+    private:                                                    \
+        type _value;                                            \
+    }
+
+SIM_BLE_SAFE_ENUM(peer_address_type_t,
+    PUBLIC = 0, RANDOM, PUBLIC_IDENTITY, RANDOM_STATIC_IDENTITY, ANONYMOUS = 0xFF
+);
+SIM_BLE_SAFE_ENUM(own_address_type_t,
+    PUBLIC = 0, RANDOM, RESOLVABLE_PRIVATE_ADDRESS_PUBLIC_FALLBACK,
+    RESOLVABLE_PRIVATE_ADDRESS_RANDOM_FALLBACK
+);
+SIM_BLE_SAFE_ENUM(advertising_type_t,
+    CONNECTABLE_UNDIRECTED, CONNECTABLE_DIRECTED, SCANNABLE_UNDIRECTED,
+    NON_CONNECTABLE_UNDIRECTED, CONNECTABLE_DIRECTED_LOW_DUTY
+);
+SIM_BLE_SAFE_ENUM(phy_t, NONE = 0, LE_1M = 1, LE_2M = 2, LE_CODED = 3);
+SIM_BLE_SAFE_ENUM(local_disconnection_reason_t,
+    AUTHENTICATION_FAILURE = 0x05, USER_TERMINATION = 0x13, LOW_RESOURCES = 0x14,
+    POWER_OFF = 0x15, UNSUPPORTED_REMOTE_FEATURE = 0x1A, PAIRING_WITH_UNIT_KEY_NOT_SUPPORTED = 0x29,
+    UNACCEPTABLE_CONNECTION_PARAMETERS = 0x3B
+);
+SIM_BLE_SAFE_ENUM(disconnection_reason_t,
+    AUTHENTICATION_FAILURE = 0x05, CONNECTION_TIMEOUT = 0x08, REMOTE_USER_TERMINATED_CONNECTION = 0x13,
+    REMOTE_DEV_TERMINATION_DUE_TO_LOW_RESOURCES = 0x14, REMOTE_DEV_TERMINATION_DUE_TO_POWER_OFF = 0x15,
+    LOCAL_HOST_TERMINATED_CONNECTION = 0x16, UNACCEPTABLE_CONNECTION_PARAMETERS = 0x3B
+);
+SIM_BLE_SAFE_ENUM(link_encryption_t,
+    NOT_ENCRYPTED, ENCRYPTION_IN_PROGRESS, ENCRYPTED, ENCRYPTED_WITH_MITM,
+    ENCRYPTED_WITH_SC_AND_MITM
+);
+
+/**
+ * Bluetooth device address, least significant byte first.
+ */
+class address_t {
+public:
+    address_t()
+    {
+        memset(_bytes, 0, sizeof(_bytes));
+    }
+
+    explicit address_t(const uint8_t *bytes)
+    {
+        memcpy(_bytes, bytes, sizeof(_bytes));
+    }
+
+    const uint8_t *data() const
+    {
+        return _bytes;
+    }
+
+    uint8_t operator[](size_t index) const
+    {
+        return _bytes[index];
+    }
+
+    size_t size() const
+    {
+        return sizeof(_bytes);
+    }
+
+    bool operator<(const address_t &other) const
+    {
+        return memcmp(_bytes, other._bytes, sizeof(_bytes)) < 0;
+    }
+
+    bool operator==(const address_t &other) const
+    {
+        return memcmp(_bytes, other._bytes, sizeof(_bytes)) == 0;
+    }
+
+private:
+    uint8_t _bytes[BLEProtocol::ADDR_LEN];
+};
+
+struct peripheral_privacy_configuration_t {
+    bool use_non_resolvable_random_address;
+    enum resolution_strategy_t {
+        DO_NOT_RESOLVE,
+        REJECT_NON_RESOLVED_ADDRESS,
+        PERFORM_PAIRING_PROCEDURE,
+        PERFORM_AUTHENTICATION_PROCEDURE
+    } resolution_strategy;
+};
+
+struct central_privay_configuration_t {
+    bool use_non_resolvable_random_address;
+    enum resolution_strategy_t {
+        DO_NOT_RESOLVE,
+        RESOLVE_AND_FORWARD,
+        RESOLVE_AND_FILTER
+    } resolution_strategy;
+};
+
+class AdvertisingParameters {
+public:
+    AdvertisingParameters(
+        advertising_type_t type = advertising_type_t::CONNECTABLE_UNDIRECTED,
+        adv_interval_t min_interval = adv_interval_t(0x0800),
+        adv_interval_t max_interval = adv_interval_t(0x0800),
+        bool legacy = true
+    ) :
+        _type(type),
+        _min_interval(min_interval),
+        _max_interval(max_interval),
+        _legacy(legacy)
+    {
+    }
+
+    advertising_type_t getType() const
+    {
+        return _type;
+    }
+
+    adv_interval_t getMinPrimaryInterval() const
+    {
+        return _min_interval;
+    }
+
+    adv_interval_t getMaxPrimaryInterval() const
+    {
+        return _max_interval;
+    }
+
+private:
+    advertising_type_t _type;
+    adv_interval_t _min_interval;
+    adv_interval_t _max_interval;
+    bool _legacy;
+};
+
+class ScanParameters {
+public:
+    ScanParameters(
+        phy_t phy = phy_t::LE_1M,
+        scan_interval_t interval = scan_interval_t(0x10),
+        scan_window_t window = scan_window_t(0x10),
+        bool active_scanning = false
+    ) :
+        _interval(interval),
+        _window(window),
+        _active(active_scanning)
+    {
+        (void) phy;
+    }
+
+    scan_interval_t interval() const
+    {
+        return _interval;
+    }
+
+    scan_window_t window() const
+    {
+        return _window;
+    }
+
+private:
+    scan_interval_t _interval;
+    scan_window_t _window;
+    bool _active;
+};
+
+class ConnectionParameters {
+public:
+    ConnectionParameters() {}
+};
+
+/**
+ * Builder of advertising payloads made of AD structures.
+ */
+class AdvertisingDataBuilder {
+public:
+    AdvertisingDataBuilder(uint8_t *buffer, size_t size) :
+        _buffer(buffer),
+        _capacity(size),
+        _size(0)
+    {
+    }
+
+    ble_error_t setFlags(uint8_t flags = 0x06)
+    {
+        return append(0x01, &flags, 1);
+    }
+
+    ble_error_t setName(const char *name, bool complete = true)
+    {
+        return append(complete ? 0x09 : 0x08, (const uint8_t *) name, strlen(name));
+    }
+
+    ble_error_t setManufacturerSpecificData(mbed::Span<const uint8_t> data)
+    {
+        return append(0xFF, data.data(), data.size());
+    }
+
+    mbed::Span<const uint8_t> getAdvertisingData() const
+    {
+        return mbed::Span<const uint8_t>(_buffer, _size);
+    }
+
+private:
+    ble_error_t append(uint8_t type, const uint8_t *data, size_t length)
+    {
+        if (_size + 2 + length > _capacity) {
+            return BLE_ERROR_BUFFER_OVERFLOW;
+        }
+        _buffer[_size++] = (uint8_t)(length + 1);
+        _buffer[_size++] = type;
+        memcpy(_buffer + _size, data, length);
+        _size += length;
+        return BLE_ERROR_NONE;
+    }
+
+    uint8_t *_buffer;
+    size_t _capacity;
+    size_t _size;
+};
+
+template<size_t DataSize>
+class AdvertisingDataSimpleBuilder {
+public:
+    AdvertisingDataSimpleBuilder() : _builder(_buffer, DataSize) {}
+
+    AdvertisingDataSimpleBuilder &setFlags(uint8_t flags = 0x06)
+    {
+        _builder.setFlags(flags);
+        return *this;
+    }
+
+    AdvertisingDataSimpleBuilder &setName(const char *name, bool complete = true)
+    {
+        _builder.setName(name, complete);
+        return *this;
+    }
+
+    mbed::Span<const uint8_t> getAdvertisingData() const
+    {
+        return _builder.getAdvertisingData();
+    }
+
+private:
+    uint8_t _buffer[DataSize];
+    AdvertisingDataBuilder _builder;
+};
+
+class AdvertisingReportEvent {
+public:
+    AdvertisingReportEvent(
+        peer_address_type_t peer_address_type,
+        const address_t &peer_address,
+        int8_t rssi,
+        mbed::Span<const uint8_t> payload
+    ) :
+        _peer_address_type(peer_address_type),
+        _peer_address(peer_address),
+        _rssi(rssi),
+        _payload(payload)
+    {
+    }
+
+    const peer_address_type_t &getPeerAddressType() const
+    {
+        return _peer_address_type;
+    }
+
+    const address_t &getPeerAddress() const
+    {
+        return _peer_address;
+    }
+
+    int8_t getRssi() const
+    {
+        return _rssi;
+    }
+
+    mbed::Span<const uint8_t> getPayload() const
+    {
+        return _payload;
+    }
+
+private:
+    peer_address_type_t _peer_address_type;
+    address_t _peer_address;
+    int8_t _rssi;
+    mbed::Span<const uint8_t> _payload;
+};
+
+class ConnectionParametersUpdateCompleteEvent {
+public:
+    ConnectionParametersUpdateCompleteEvent(
+        ble_error_t status,
+        connection_handle_t handle,
+        conn_interval_t interval,
+        slave_latency_t latency,
+        supervision_timeout_t timeout
+    ) :
+        _status(status),
+        _handle(handle),
+        _interval(interval),
+        _latency(latency),
+        _timeout(timeout)
+    {
+    }
+
+    ble_error_t getStatus() const
+    {
+        return _status;
+    }
+
+    connection_handle_t getConnectionHandle() const
+    {
+        return _handle;
+    }
+
+    const conn_interval_t &getConnectionInterval() const
+    {
+        return _interval;
+    }
+
+    const slave_latency_t &getSlaveLatency() const
+    {
+        return _latency;
+    }
+
+    const supervision_timeout_t &getSupervisionTimeout() const
+    {
+        return _timeout;
+    }
+
+private:
+    ble_error_t _status;
+    connection_handle_t _handle;
+    conn_interval_t _interval;
+    slave_latency_t _latency;
+    supervision_timeout_t _timeout;
+};
+
+} // namespace ble
+
+/*
+ * GATT
+ */
+
+class UUID {
+public:
+    typedef uint16_t ShortUUIDBytes_t;
+    static const unsigned LENGTH_OF_LONG_UUID = 16;
+    typedef uint8_t LongUUIDBytes_t[LENGTH_OF_LONG_UUID];
+
+    enum UUID_Type_t {
+        UUID_TYPE_SHORT = 0,
+        UUID_TYPE_LONG = 1
+    };
+
+    UUID(ShortUUIDBytes_t short_uuid = 0) :
+        _type(UUID_TYPE_SHORT),
+        _short_uuid(short_uuid)
+    {
+        memset(_long_uuid, 0, sizeof(_long_uuid));
+    }
+
+    /**
+     * Parse a 128-bit UUID in its textual form; dashes are ignored.
+     */
+    UUID(const char *string) :
+        _type(UUID_TYPE_LONG),
+        _short_uuid(0)
+    {
+        memset(_long_uuid, 0, sizeof(_long_uuid));
+        size_t index = 0;
+        for (const char *c = string; *c && index < 2 * LENGTH_OF_LONG_UUID; ++c) {
+            int nibble = hex(*c);
+            if (nibble < 0) {
+                continue;
+            }
+            // stored least significant byte first as on air
+            uint8_t &byte = _long_uuid[LENGTH_OF_LONG_UUID - 1 - index / 2];
+            byte = (index % 2) ? (uint8_t)(byte | nibble) : (uint8_t)(nibble << 4);
+            ++index;
+        }
+        _short_uuid = (uint16_t)((_long_uuid[13] << 8) | _long_uuid[12]);
+    }
+
+    UUID_Type_t shortOrLong() const
+    {
+        return _type;
+    }
+
+    ShortUUIDBytes_t getShortUUID() const
+    {
+        return _short_uuid;
+    }
+
+    const uint8_t *getBaseUUID() const
+    {
+        return _type == UUID_TYPE_SHORT ?
+            reinterpret_cast<const uint8_t *>(&_short_uuid) : _long_uuid;
+    }
+
+    uint8_t getLen() const
+    {
+        return _type == UUID_TYPE_SHORT ? sizeof(ShortUUIDBytes_t) : LENGTH_OF_LONG_UUID;
+    }
+
+    bool operator==(const UUID &other) const
+    {
+        if (_type != other._type) {
+            return false;
+        }
+        if (_type == UUID_TYPE_SHORT) {
+            return _short_uuid == other._short_uuid;
+        }
+        return memcmp(_long_uuid, other._long_uuid, sizeof(_long_uuid)) == 0;
+    }
+
+    bool operator!=(const UUID &other) const
+    {
+        return !(*this == other);
+    }
+
+private:
+    static int hex(char c)
+    {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f') {
+            return c - 'a' + 10;
+        }
+        if (c >= 'A' && c <= 'F') {
+            return c - 'A' + 10;
+        }
+        return -1;
+    }
+
+    UUID_Type_t _type;
+    ShortUUIDBytes_t _short_uuid;
+    LongUUIDBytes_t _long_uuid;
+};
+
+static const uint16_t BLE_UUID_DESCRIPTOR_CLIENT_CHAR_CONFIG = 0x2902;
+
+enum GattAuthCallbackReply_t {
+    AUTH_CALLBACK_REPLY_SUCCESS = 0x00,
+    AUTH_CALLBACK_REPLY_ATTERR_INVALID_HANDLE = 0x0101,
+    AUTH_CALLBACK_REPLY_ATTERR_READ_NOT_PERMITTED = 0x0102,
+    AUTH_CALLBACK_REPLY_ATTERR_WRITE_NOT_PERMITTED = 0x0103,
+    AUTH_CALLBACK_REPLY_ATTERR_INVALID_PDU = 0x0104,
+    AUTH_CALLBACK_REPLY_ATTERR_INSUFFICIENT_AUTHENTICATION = 0x0105,
+    AUTH_CALLBACK_REPLY_ATTERR_REQUEST_NOT_SUPPORTED = 0x0106,
+    AUTH_CALLBACK_REPLY_ATTERR_INVALID_OFFSET = 0x0107,
+    AUTH_CALLBACK_REPLY_ATTERR_INSUFFICIENT_AUTHORIZATION = 0x0108,
+    AUTH_CALLBACK_REPLY_ATTERR_PREPARE_QUEUE_FULL = 0x0109,
+    AUTH_CALLBACK_REPLY_ATTERR_ATTRIBUTE_NOT_FOUND = 0x010A,
+    AUTH_CALLBACK_REPLY_ATTERR_ATTRIBUTE_NOT_LONG = 0x010B,
+    AUTH_CALLBACK_REPLY_ATTERR_INSUFFICIENT_ENCRYPTION_KEY_SIZE = 0x010C,
+    AUTH_CALLBACK_REPLY_ATTERR_INVALID_ATT_VAL_LENGTH = 0x010D,
+    AUTH_CALLBACK_REPLY_ATTERR_UNLIKELY_ERROR = 0x010E,
+    AUTH_CALLBACK_REPLY_ATTERR_INSUFFICIENT_ENCRYPTION = 0x010F,
+    AUTH_CALLBACK_REPLY_ATTERR_UNSUPPORTED_GROUP_TYPE = 0x0110,
+    AUTH_CALLBACK_REPLY_ATTERR_INSUFFICIENT_RESOURCES = 0x0111
+};
+
+enum HVXType_t {
+    BLE_HVX_NOTIFICATION = 0x01,
+    BLE_HVX_INDICATION = 0x02
+};
+
+struct GattWriteCallbackParams {
+    enum WriteOp_t {
+        OP_INVALID = 0x00,
+        OP_WRITE_REQ = 0x01,
+        OP_WRITE_CMD = 0x02,
+        OP_SIGN_WRITE_CMD = 0x03,
+        OP_PREP_WRITE_REQ = 0x04,
+        OP_EXEC_WRITE_REQ_CANCEL = 0x05,
+        OP_EXEC_WRITE_REQ_NOW = 0x06
+    };
+
+    ble::connection_handle_t connHandle;
+    uint16_t handle;
+    WriteOp_t writeOp;
+    uint16_t offset;
+    uint16_t len;
+    const uint8_t *data;
+};
+
+struct GattReadCallbackParams {
+    ble::connection_handle_t connHandle;
+    uint16_t handle;
+    uint16_t offset;
+    uint16_t len;
+    const uint8_t *data;
+    ble_error_t status;
+};
+
+struct GattHVXCallbackParams {
+    ble::connection_handle_t connHandle;
+    uint16_t handle;
+    HVXType_t type;
+    uint16_t len;
+    const uint8_t *data;
+};
+
+struct GattWriteAuthCallbackParams {
+    ble::connection_handle_t connHandle;
+    uint16_t handle;
+    uint16_t offset;
+    uint16_t len;
+    const uint8_t *data;
+    GattAuthCallbackReply_t authorizationReply;
+};
+
+class GattAttribute {
+public:
+    typedef uint16_t Handle_t;
+    static const Handle_t INVALID_HANDLE = 0x0000;
+
+    GattAttribute(
+        const UUID &uuid,
+        uint8_t *value = NULL,
+        uint16_t length = 0,
+        uint16_t max_length = 0,
+        bool variable_length = true
+    ) :
+        _uuid(uuid),
+        _value(value),
+        _length(length),
+        _max_length(max_length),
+        _variable_length(variable_length),
+        _handle(INVALID_HANDLE)
+    {
+    }
+
+    Handle_t getHandle() const
+    {
+        return _handle;
+    }
+
+    void setHandle(Handle_t handle)
+    {
+        _handle = handle;
+    }
+
+    const UUID &getUUID() const
+    {
+        return _uuid;
+    }
+
+    uint8_t *getValuePtr()
+    {
+        return _value;
+    }
+
+    uint16_t getLength() const
+    {
+        return _length;
+    }
+
+    uint16_t getMaxLength() const
+    {
+        return _max_length;
+    }
+
+    bool hasVariableLength() const
+    {
+        return _variable_length;
+    }
+
+private:
+    UUID _uuid;
+    uint8_t *_value;
+    uint16_t _length;
+    uint16_t _max_length;
+    bool _variable_length;
+    Handle_t _handle;
+};
+
+class GattCharacteristic {
+public:
+    enum {
+        UUID_CURRENT_TIME_CHAR = 0x2A2B,
+        UUID_BATTERY_LEVEL_CHAR = 0x2A19,
+        UUID_TEMPERATURE_CHAR = 0x2A6E
+    };
+
+    enum Properties_t {
+        BLE_GATT_CHAR_PROPERTIES_NONE = 0x00,
+        BLE_GATT_CHAR_PROPERTIES_BROADCAST = 0x01,
+        BLE_GATT_CHAR_PROPERTIES_READ = 0x02,
+        BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE = 0x04,
+        BLE_GATT_CHAR_PROPERTIES_WRITE = 0x08,
+        BLE_GATT_CHAR_PROPERTIES_NOTIFY = 0x10,
+        BLE_GATT_CHAR_PROPERTIES_INDICATE = 0x20,
+        BLE_GATT_CHAR_PROPERTIES_AUTHENTICATED_SIGNED_WRITES = 0x40,
+        BLE_GATT_CHAR_PROPERTIES_EXTENDED_PROPERTIES = 0x80
+    };
+
+    GattCharacteristic(
+        const UUID &uuid,
+        uint8_t *value = NULL,
+        uint16_t length = 0,
+        uint16_t max_length = 0,
+        uint8_t properties = BLE_GATT_CHAR_PROPERTIES_NONE,
+        GattAttribute *descriptors[] = NULL,
+        unsigned descriptor_count = 0,
+        bool variable_length = true
+    ) :
+        _value_attribute(uuid, value, length, max_length, variable_length),
+        _properties(properties)
+    {
+        (void) descriptors;
+        (void) descriptor_count;
+    }
+
+    virtual ~GattCharacteristic() {}
+
+    void setWriteAuthorizationCallback(void (*callback)(GattWriteAuthCallbackParams *))
+    {
+        _write_authorization = callback;
+    }
+
+    template<typename T>
+    void setWriteAuthorizationCallback(T *object, void (T::*member)(GattWriteAuthCallbackParams *))
+    {
+        _write_authorization = FunctionPointerWithContext<GattWriteAuthCallbackParams *>(object, member);
+    }
+
+    bool isWriteAuthorizationEnabled() const
+    {
+        return static_cast<bool>(_write_authorization);
+    }
+
+    GattAuthCallbackReply_t authorizeWrite(GattWriteAuthCallbackParams *params)
+    {
+        if (!_write_authorization) {
+            return AUTH_CALLBACK_REPLY_SUCCESS;
+        }
+        params->authorizationReply = AUTH_CALLBACK_REPLY_SUCCESS;
+        _write_authorization(params);
+        return params->authorizationReply;
+    }
+
+    GattAttribute &getValueAttribute()
+    {
+        return _value_attribute;
+    }
+
+    const GattAttribute &getValueAttribute() const
+    {
+        return _value_attribute;
+    }
+
+    GattAttribute::Handle_t getValueHandle() const
+    {
+        return _value_attribute.getHandle();
+    }
+
+    uint8_t getProperties() const
+    {
+        return _properties;
+    }
+
+private:
+    GattAttribute _value_attribute;
+    uint8_t _properties;
+    FunctionPointerWithContext<GattWriteAuthCallbackParams *> _write_authorization;
+};
+
+class GattService {
+public:
+    GattService(const UUID &uuid, GattCharacteristic *characteristics[], unsigned count) :
+        _uuid(uuid),
+        _characteristics(characteristics),
+        _count(count),
+        _handle(0)
+    {
+    }
+
+    const UUID &getUUID() const
+    {
+        return _uuid;
+    }
+
+    uint16_t getHandle() const
+    {
+        return _handle;
+    }
+
+    void setHandle(uint16_t handle)
+    {
+        _handle = handle;
+    }
+
+    uint8_t getCharacteristicCount() const
+    {
+        return _count;
+    }
+
+    GattCharacteristic *getCharacteristic(uint8_t index)
+    {
+        return index < _count ? _characteristics[index] : NULL;
+    }
+
+private:
+    UUID _uuid;
+    GattCharacteristic **_characteristics;
+    unsigned _count;
+    uint16_t _handle;
+};
+
+class GattServer : private mbed::NonCopyable<GattServer> {
+public:
+    struct EventHandler {
+        virtual ~EventHandler() {}
+
+        virtual void onAttMtuChange(ble::connection_handle_t connectionHandle, uint16_t attMtuSize)
+        {
+            (void) connectionHandle;
+            (void) attMtuSize;
+        }
+    };
+
+    typedef FunctionPointerWithContext<unsigned> DataSentCallback_t;
+    typedef FunctionPointerWithContext<const GattWriteCallbackParams *> DataWrittenCallback_t;
+    typedef FunctionPointerWithContext<const GattReadCallbackParams *> DataReadCallback_t;
+    typedef FunctionPointerWithContext<GattAttribute::Handle_t> EventCallback_t;
+
+    GattServer();
+
+    void setEventHandler(EventHandler *handler)
+    {
+        _event_handler = handler;
+    }
+
+    EventHandler *getEventHandler()
+    {
+        return _event_handler;
+    }
+
+    ble_error_t addService(GattService &service);
+
+    ble_error_t read(GattAttribute::Handle_t handle, uint8_t *buffer, uint16_t *length);
+    ble_error_t read(
+        ble::connection_handle_t connection, GattAttribute::Handle_t handle,
+        uint8_t *buffer, uint16_t *length
+    );
+
+    ble_error_t write(
+        GattAttribute::Handle_t handle, const uint8_t *value, uint16_t size,
+        bool local_only = false
+    );
+    ble_error_t write(
+        ble::connection_handle_t connection, GattAttribute::Handle_t handle,
+        const uint8_t *value, uint16_t size, bool local_only = false
+    );
+
+    ble_error_t areUpdatesEnabled(const GattCharacteristic &characteristic, bool *enabled);
+    ble_error_t areUpdatesEnabled(
+        ble::connection_handle_t connection, const GattCharacteristic &characteristic,
+        bool *enabled
+    );
+
+    void onDataSent(const DataSentCallback_t &callback)
+    {
+        _data_sent.add(callback);
+    }
+
+    void onDataWritten(const DataWrittenCallback_t &callback)
+    {
+        _data_written.add(callback);
+    }
+
+    template<typename T>
+    void onDataWritten(T *object, void (T::*member)(const GattWriteCallbackParams *))
+    {
+        _data_written.add(DataWrittenCallback_t(object, member));
+    }
+
+    ble_error_t onDataRead(const DataReadCallback_t &callback)
+    {
+        _data_read.add(callback);
+        return BLE_ERROR_NONE;
+    }
+
+    void onUpdatesEnabled(const EventCallback_t &callback)
+    {
+        _updates_enabled.add(callback);
+    }
+
+    void onUpdatesDisabled(const EventCallback_t &callback)
+    {
+        _updates_disabled.add(callback);
+    }
+
+    void onConfirmationReceived(const EventCallback_t &callback)
+    {
+        _confirmation_received.add(callback);
+    }
+
+    /*
+     * Simulation interface, used by the simulated centrals.
+     */
+
+    struct sim_stats_t {
+        uint64_t notifications;
+        uint64_t notification_bytes;
+        uint64_t notifications_dropped;
+        uint64_t client_writes;
+        uint64_t client_writes_rejected;
+        uint64_t client_reads;
+    };
+
+    /**
+     * Description of an attribute for the simulated clients.
+     */
+    struct sim_attribute_t {
+        GattAttribute::Handle_t handle;
+        GattAttribute::Handle_t cccd_handle;
+        uint8_t properties;
+        uint16_t max_length;
+        bool variable_length;
+    };
+
+    /**
+     * Value attributes of the characteristics registered.
+     */
+    std::vector<sim_attribute_t> sim_characteristics() const;
+
+    ble_error_t sim_client_write(
+        ble::connection_handle_t connection, GattAttribute::Handle_t handle,
+        const uint8_t *data, uint16_t length
+    );
+
+    ble_error_t sim_client_read(ble::connection_handle_t connection, GattAttribute::Handle_t handle);
+
+    void sim_connected(ble::connection_handle_t connection, uint64_t interval_us);
+    void sim_disconnected(ble::connection_handle_t connection);
+    void sim_set_interval(ble::connection_handle_t connection, uint64_t interval_us);
+    void sim_set_mtu(ble::connection_handle_t connection, uint16_t mtu);
+
+    const sim_stats_t &sim_stats() const
+    {
+        return _sim_stats;
+    }
+
+private:
+    struct attribute_t {
+        UUID uuid;
+        GattCharacteristic *characteristic;
+        bool is_cccd;
+        std::vector<uint8_t> value;
+    };
+
+    struct link_t {
+        uint64_t interval_us;
+        uint16_t mtu;
+        unsigned in_flight;
+        bool drain_scheduled;
+        std::map<GattAttribute::Handle_t, uint16_t> cccd;
+    };
+
+    attribute_t *find(GattAttribute::Handle_t handle);
+    ble_error_t notify(ble::connection_handle_t connection, link_t &link, attribute_t &attribute);
+    void drain(ble::connection_handle_t connection);
+
+    EventHandler *_event_handler;
+    std::vector<attribute_t> _attributes;
+    std::map<ble::connection_handle_t, link_t> _links;
+    CallChainOfFunctionPointersWithContext<unsigned> _data_sent;
+    CallChainOfFunctionPointersWithContext<const GattWriteCallbackParams *> _data_written;
+    CallChainOfFunctionPointersWithContext<const GattReadCallbackParams *> _data_read;
+    CallChainOfFunctionPointersWithContext<GattAttribute::Handle_t> _updates_enabled;
+    CallChainOfFunctionPointersWithContext<GattAttribute::Handle_t> _updates_disabled;
+    CallChainOfFunctionPointersWithContext<GattAttribute::Handle_t> _confirmation_received;
+    sim_stats_t _sim_stats;
+};
+
+class GattClient;
+
+class DiscoveredCharacteristicDescriptor {
+public:
+    DiscoveredCharacteristicDescriptor() : _handle(0) {}
+
+    const UUID &getUUID() const
+    {
+        return _uuid;
+    }
+
+    GattAttribute::Handle_t getAttributeHandle() const
+    {
+        return _handle;
+    }
+
+private:
+    UUID _uuid;
+    GattAttribute::Handle_t _handle;
+};
+
+class DiscoveredCharacteristic;
+
+struct CharacteristicDescriptorDiscovery {
+    struct DiscoveryCallbackParams_t {
+        const DiscoveredCharacteristic &characteristic;
+        const DiscoveredCharacteristicDescriptor &descriptor;
+    };
+
+    struct TerminationCallbackParams_t {
+        const DiscoveredCharacteristic &characteristic;
+        ble_error_t status;
+        uint8_t error_code;
+    };
+
+    typedef FunctionPointerWithContext<const DiscoveryCallbackParams_t *> DiscoveryCallback_t;
+    typedef FunctionPointerWithContext<const TerminationCallbackParams_t *> TerminationCallback_t;
+};
+
+class DiscoveredCharacteristic {
+public:
+    DiscoveredCharacteristic() : _client(NULL), _value_handle(0) {}
+
+    GattAttribute::Handle_t getValueHandle() const
+    {
+        return _value_handle;
+    }
+
+    const UUID &getUUID() const
+    {
+        return _uuid;
+    }
+
+    GattClient *getGattClient() const
+    {
+        return _client;
+    }
+
+    ble_error_t discoverDescriptors(
+        const CharacteristicDescriptorDiscovery::DiscoveryCallback_t &on_descriptor,
+        const CharacteristicDescriptorDiscovery::TerminationCallback_t &on_termination
+    ) const
+    {
+        (void) on_descriptor;
+        (void) on_termination;
+        return BLE_ERROR_NOT_IMPLEMENTED;
+    }
+
+private:
+    GattClient *_client;
+    UUID _uuid;
+    GattAttribute::Handle_t _value_handle;
+};
+
+class DiscoveredService;
+
+class GattClient : private mbed::NonCopyable<GattClient> {
+public:
+    enum WriteOp_t {
+        GATT_OP_WRITE_REQ = 0x01,
+        GATT_OP_WRITE_CMD = 0x02
+    };
+
+    typedef FunctionPointerWithContext<const GattReadCallbackParams *> ReadCallback_t;
+    typedef FunctionPointerWithContext<const GattHVXCallbackParams *> HVXCallback_t;
+    typedef FunctionPointerWithContext<const DiscoveredService *> ServiceCallback_t;
+    typedef FunctionPointerWithContext<const DiscoveredCharacteristic *> CharacteristicCallback_t;
+    typedef FunctionPointerWithContext<ble::connection_handle_t> TerminationCallback_t;
+
+    GattClient() {}
+
+    ble_error_t negotiateAttMtu(ble::connection_handle_t connection);
+
+    ble_error_t launchServiceDiscovery(
+        ble::connection_handle_t connection,
+        ServiceCallback_t service_callback,
+        CharacteristicCallback_t characteristic_callback,
+        const UUID &service_uuid,
+        const UUID &characteristic_uuid
+    ) {
+        (void) connection;
+        (void) service_callback;
+        (void) characteristic_callback;
+        (void) service_uuid;
+        (void) characteristic_uuid;
+        return BLE_ERROR_NOT_IMPLEMENTED;
+    }
+
+    void terminateCharacteristicDescriptorDiscovery(const DiscoveredCharacteristic &characteristic)
+    {
+        (void) characteristic;
+    }
+
+    ble_error_t read(ble::connection_handle_t connection, GattAttribute::Handle_t handle, uint16_t offset) const
+    {
+        (void) connection;
+        (void) handle;
+        (void) offset;
+        return BLE_ERROR_NOT_IMPLEMENTED;
+    }
+
+    ble_error_t write(
+        WriteOp_t op, ble::connection_handle_t connection, GattAttribute::Handle_t handle,
+        size_t length, const uint8_t *value
+    ) const
+    {
+        (void) op;
+        (void) connection;
+        (void) handle;
+        (void) length;
+        (void) value;
+        return BLE_ERROR_NOT_IMPLEMENTED;
+    }
+
+    void onDataRead(const ReadCallback_t &callback)
+    {
+        _data_read.add(callback);
+    }
+
+    void onHVX(const HVXCallback_t &callback)
+    {
+        _hvx.add(callback);
+    }
+
+    void onServiceDiscoveryTermination(const TerminationCallback_t &callback)
+    {
+        _discovery_termination = callback;
+    }
+
+private:
+    CallChainOfFunctionPointersWithContext<const GattReadCallbackParams *> _data_read;
+    CallChainOfFunctionPointersWithContext<const GattHVXCallbackParams *> _hvx;
+    TerminationCallback_t _discovery_termination;
+};
+
+/*
+ * GAP
+ */
+
+namespace ble {
+
+class Gap : private mbed::NonCopyable<Gap> {
+public:
+    struct EventHandler {
+        virtual ~EventHandler() {}
+
+        virtual void onAdvertisingReport(const AdvertisingReportEvent &event)
+        {
+            (void) event;
+        }
+
+        virtual void onConnectionParametersUpdateComplete(
+            const ConnectionParametersUpdateCompleteEvent &event
+        ) {
+            (void) event;
+        }
+    };
+
+    enum Role_t {
+        PERIPHERAL = 0x1,
+        CENTRAL = 0x2
+    };
+
+    enum DisconnectionReason_t {
+        CONNECTION_TIMEOUT = 0x08,
+        REMOTE_USER_TERMINATED_CONNECTION = 0x13,
+        LOCAL_HOST_TERMINATED_CONNECTION = 0x16
+    };
+
+    /**
+     * Intervals in 1.25 ms units, supervision timeout in 10 ms units.
+     */
+    struct ConnectionParams_t {
+        uint16_t minConnectionInterval;
+        uint16_t maxConnectionInterval;
+        uint16_t slaveLatency;
+        uint16_t connectionSupervisionTimeout;
+    };
+
+    struct ConnectionCallbackParams_t {
+        connection_handle_t handle;
+        Role_t role;
+        BLEProtocol::AddressType_t peerAddrType;
+        BLEProtocol::AddressBytes_t peerAddr;
+        BLEProtocol::AddressType_t ownAddrType;
+        BLEProtocol::AddressBytes_t ownAddr;
+        const ConnectionParams_t *connectionParams;
+    };
+
+    struct DisconnectionCallbackParams_t {
+        connection_handle_t handle;
+        DisconnectionReason_t reason;
+    };
+
+    Gap();
+
+    void setEventHandler(EventHandler *handler)
+    {
+        _event_handler = handler;
+    }
+
+    template<typename T>
+    void onConnection(T *object, void (T::*member)(const ConnectionCallbackParams_t *))
+    {
+        _connection.add(FunctionPointerWithContext<const ConnectionCallbackParams_t *>(object, member));
+    }
+
+    template<typename T>
+    void onDisconnection(T *object, void (T::*member)(const DisconnectionCallbackParams_t *))
+    {
+        _disconnection.add(FunctionPointerWithContext<const DisconnectionCallbackParams_t *>(object, member));
+    }
+
+    ble_error_t getAddress(BLEProtocol::AddressType_t *type, BLEProtocol::AddressBytes_t address);
+
+    ble_error_t setAdvertisingParameters(advertising_handle_t handle, const AdvertisingParameters &params);
+    ble_error_t setAdvertisingPayload(advertising_handle_t handle, mbed::Span<const uint8_t> payload);
+    ble_error_t setAdvertisingScanResponse(advertising_handle_t handle, mbed::Span<const uint8_t> response);
+    ble_error_t startAdvertising(advertising_handle_t handle);
+    ble_error_t stopAdvertising(advertising_handle_t handle);
+    bool isAdvertisingActive(advertising_handle_t handle);
+
+    ble_error_t setScanParameters(const ScanParameters &params);
+    ble_error_t startScan();
+    ble_error_t stopScan();
+
+    ble_error_t connect(
+        peer_address_type_t peer_address_type, const address_t &peer_address,
+        const ConnectionParameters &params
+    ) {
+        (void) peer_address_type;
+        (void) peer_address;
+        (void) params;
+        return BLE_ERROR_NOT_IMPLEMENTED;
+    }
+
+    ble_error_t cancelConnect()
+    {
+        return BLE_ERROR_NOT_IMPLEMENTED;
+    }
+
+    ble_error_t disconnect(connection_handle_t handle, local_disconnection_reason_t reason);
+
+    ble_error_t updateConnectionParameters(
+        connection_handle_t handle,
+        conn_interval_t min_interval,
+        conn_interval_t max_interval,
+        slave_latency_t latency,
+        supervision_timeout_t timeout,
+        conn_event_length_t min_event_length = conn_event_length_t(0),
+        conn_event_length_t max_event_length = conn_event_length_t(0)
+    );
+
+    ble_error_t setPeripheralPrivacyConfiguration(const peripheral_privacy_configuration_t *config)
+    {
+        (void) config;
+        return BLE_ERROR_NONE;
+    }
+
+    ble_error_t setCentralPrivacyConfiguration(const central_privay_configuration_t *config)
+    {
+        (void) config;
+        return BLE_ERROR_NONE;
+    }
+
+    ble_error_t enablePrivacy(bool enable)
+    {
+        _privacy = enable;
+        return BLE_ERROR_NONE;
+    }
+
+    /*
+     * Simulation interface, used by the simulated centrals and advertisers.
+     */
+
+    struct sim_stats_t {
+        uint64_t advertising_us;
+        uint64_t advertising_events;
+        uint64_t advertising_restarts;
+        uint64_t payload_updates;
+        uint64_t broadcasts_decoded;
+        uint64_t broadcasts_invalid;
+        uint64_t connections;
+        uint64_t disconnections;
+        uint64_t parameter_updates;
+        uint64_t advertising_reports;
+    };
+
+    /**
+     * Connect a central at the next advertising event.
+     *
+     * @return false if the device is not connectable.
+     */
+    bool sim_connect(const address_t &peer, BLEProtocol::AddressType_t type);
+
+    /**
+     * Disconnect a central, as if the central terminated the link.
+     */
+    void sim_disconnect(connection_handle_t handle);
+
+    /**
+     * Deliver an advertisement to the scanner, if scanning.
+     */
+    void sim_advertising_report(
+        const address_t &peer, peer_address_type_t type, int8_t rssi,
+        const uint8_t *payload, size_t length
+    );
+
+    bool sim_scanning() const
+    {
+        return _scanning;
+    }
+
+    bool sim_connected(connection_handle_t handle) const
+    {
+        return _links.count(handle) != 0;
+    }
+
+    const sim_stats_t &sim_stats() const;
+
+private:
+    struct link_t {
+        address_t peer;
+        ConnectionParams_t params;
+    };
+
+    void account_advertising();
+
+    EventHandler *_event_handler;
+    CallChainOfFunctionPointersWithContext<const ConnectionCallbackParams_t *> _connection;
+    CallChainOfFunctionPointersWithContext<const DisconnectionCallbackParams_t *> _disconnection;
+    bool _advertising;
+    uint64_t _advertising_interval_us;
+    uint64_t _advertising_since_us;
+    bool _connect_pending;
+    bool _scanning;
+    bool _privacy;
+    connection_handle_t _next_handle;
+    std::map<connection_handle_t, link_t> _links;
+    mutable sim_stats_t _sim_stats;
+};
+
+} // namespace ble
+
+using ble::Gap;
+
+/*
+ * Security Manager
+ */
+
+class SecurityManager : private mbed::NonCopyable<SecurityManager> {
+public:
+    enum SecurityIOCapabilities_t {
+        IO_CAPS_DISPLAY_ONLY = 0x00,
+        IO_CAPS_DISPLAY_YESNO = 0x01,
+        IO_CAPS_KEYBOARD_ONLY = 0x02,
+        IO_CAPS_NONE = 0x03,
+        IO_CAPS_KEYBOARD_DISPLAY = 0x04
+    };
+
+    enum SecurityCompletionStatus_t {
+        SEC_STATUS_SUCCESS = 0x00,
+        SEC_STATUS_TIMEOUT = 0x01,
+        SEC_STATUS_PDU_INVALID = 0x02,
+        SEC_STATUS_UNSPECIFIED = 0x88
+    };
+
+    static const unsigned PASSKEY_LEN = 6;
+    typedef uint8_t Passkey_t[PASSKEY_LEN];
+
+    struct EventHandler {
+        virtual ~EventHandler() {}
+
+        virtual void pairingRequest(ble::connection_handle_t connectionHandle)
+        {
+            (void) connectionHandle;
+        }
+
+        virtual void pairingResult(
+            ble::connection_handle_t connectionHandle, SecurityCompletionStatus_t result
+        ) {
+            (void) connectionHandle;
+            (void) result;
+        }
+
+        virtual void linkEncryptionResult(
+            ble::connection_handle_t connectionHandle, ble::link_encryption_t result
+        ) {
+            (void) connectionHandle;
+            (void) result;
+        }
+    };
+
+    SecurityManager();
+
+    ble_error_t init(
+        bool enable_bonding = true,
+        bool require_mitm = true,
+        SecurityIOCapabilities_t iocaps = IO_CAPS_NONE,
+        const Passkey_t passkey = NULL,
+        bool signing = true,
+        const char *db_path = NULL
+    );
+
+    void setEventHandler(EventHandler *handler)
+    {
+        _event_handler = handler;
+    }
+
+    ble_error_t preserveBondingStateOnReset(bool enable)
+    {
+        (void) enable;
+        return BLE_ERROR_NONE;
+    }
+
+    ble_error_t setPairingRequestAuthorisation(bool required)
+    {
+        _authorisation_required = required;
+        return BLE_ERROR_NONE;
+    }
+
+    ble_error_t acceptPairingRequest(ble::connection_handle_t connection);
+
+    ble_error_t setLinkEncryption(ble::connection_handle_t connection, ble::link_encryption_t encryption);
+
+    ble_error_t purgeAllBondingState()
+    {
+        _bonds.clear();
+        return BLE_ERROR_NONE;
+    }
+
+    /*
+     * Simulation interface
+     */
+
+    void sim_connected(ble::connection_handle_t connection, const ble::address_t &peer, uint64_t interval_us);
+    void sim_disconnected(ble::connection_handle_t connection);
+
+    size_t sim_bond_count() const
+    {
+        return _bonds.size();
+    }
+
+private:
+    struct link_t {
+        ble::address_t peer;
+        uint64_t interval_us;
+        bool encrypting;
+    };
+
+    EventHandler *_event_handler;
+    bool _initialized;
+    bool _bonding;
+    bool _authorisation_required;
+    std::set<ble::address_t> _bonds;
+    std::map<ble::connection_handle_t, link_t> _links;
+};
+
+/*
+ * BLE instance
+ */
+
+class BLE : private mbed::NonCopyable<BLE> {
+public:
+    typedef unsigned InstanceID_t;
+
+    struct InitializationCompleteCallbackContext {
+        BLE &ble;
+        ble_error_t error;
+    };
+
+    struct OnEventsToProcessCallbackContext {
+        BLE &ble;
+    };
+
+    typedef FunctionPointerWithContext<OnEventsToProcessCallbackContext *> OnEventsToProcessCallback_t;
+
+    static BLE &Instance(InstanceID_t id = 0);
+
+    template<typename T>
+    ble_error_t init(T *object, void (T::*member)(InitializationCompleteCallbackContext *))
+    {
+        return init(FunctionPointerWithContext<InitializationCompleteCallbackContext *>(object, member));
+    }
+
+    ble_error_t init(FunctionPointerWithContext<InitializationCompleteCallbackContext *> callback);
+
+    bool hasInitialized() const
+    {
+        return _initialized;
+    }
+
+    ble_error_t shutdown()
+    {
+        _initialized = false;
+        return BLE_ERROR_NONE;
+    }
+
+    void onEventsToProcess(const OnEventsToProcessCallback_t &callback)
+    {
+        _on_events_to_process = callback;
+    }
+
+    /**
+     * Deliver the pending stack events to the application.
+     */
+    void processEvents();
+
+    ble::Gap &gap()
+    {
+        return _gap;
+    }
+
+    GattServer &gattServer()
+    {
+        return _gatt_server;
+    }
+
+    GattClient &gattClient()
+    {
+        return _gatt_client;
+    }
+
+    SecurityManager &securityManager()
+    {
+        return _security_manager;
+    }
+
+    /**
+     * Queue a stack event for the application, after a delay.
+     */
+    void sim_post(uint64_t delay_us, std::function<void()> event);
+
+    uint64_t sim_events_processed() const
+    {
+        return _events_processed;
+    }
+
+private:
+    BLE();
+
+    void signal();
+
+    bool _initialized;
+    OnEventsToProcessCallback_t _on_events_to_process;
+    std::deque<std::function<void()> > _pending;
+    bool _signalled;
+    uint64_t _events_processed;
+    ble::Gap _gap;
+    GattServer _gatt_server;
+    GattClient _gatt_client;
+    SecurityManager _security_manager;
+};
+
+#endif /* SIM_BLE_BLE_H_ */
@@ -0,0 +1,7 @@
+/* Host shim: the whole BLE API is declared in ble/BLE.h. */
+#ifndef SIM_BLE_GATT_CHARACTERISTIC_H_
+#define SIM_BLE_GATT_CHARACTERISTIC_H_
+
+#include "ble/BLE.h"
+
+#endif /* SIM_BLE_GATT_CHARACTERISTIC_H_ */
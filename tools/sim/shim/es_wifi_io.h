@@ -0,0 +1,23 @@
+/*
+ * Host shim of the es-wifi SPI layer: only the bus accounting is used by
+ * the application.
+ */
+#ifndef SIM_ES_WIFI_IO_H_
+#define SIM_ES_WIFI_IO_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Time the SPI bus held the deep sleep lock, in microseconds.
+ */
+uint32_t SPI_WIFI_GetBusyTime(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM_ES_WIFI_IO_H_ */
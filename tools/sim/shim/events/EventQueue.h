@@ -0,0 +1,127 @@
+/*
+ * Host shim of events::EventQueue.
+ *
+ * Events are tasks of the simulator agenda; every queue shares the virtual
+ * time base and dispatch happens inside Simulator::run(), whichever thread
+ * is supposed to dispatch the queue.
+ */
+#ifndef SIM_EVENTS_EVENT_QUEUE_H_
+#define SIM_EVENTS_EVENT_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <type_traits>
+
+#include "platform/Callback.h"
+
+#include "Simulator.h"
+
+#ifndef EVENTS_QUEUE_SIZE
+#define EVENTS_QUEUE_SIZE (32 * 32)
+#endif
+
+namespace events {
+
+class EventQueue {
+public:
+    EventQueue(unsigned size = EVENTS_QUEUE_SIZE, unsigned char *buffer = NULL) :
+        _posted(0)
+    {
+        (void) size;
+        (void) buffer;
+    }
+
+    template<typename... Args>
+    int call(Args... args)
+    {
+        return post(0, 0, bind(args...));
+    }
+
+    template<typename... Args>
+    int call_in(int ms, Args... args)
+    {
+        return post(ms, 0, bind(args...));
+    }
+
+    template<typename... Args>
+    int call_every(int ms, Args... args)
+    {
+        return post(ms, ms, bind(args...));
+    }
+
+    bool cancel(int id)
+    {
+        return sim::Simulator::instance().cancel(id);
+    }
+
+    /**
+     * Dispatch happens in the simulator; the lane threads never run.
+     */
+    void dispatch_forever()
+    {
+        sim::Simulator::instance().run();
+    }
+
+    void dispatch(int ms = -1)
+    {
+        (void) ms;
+        sim::Simulator::instance().run();
+    }
+
+    void break_dispatch()
+    {
+        sim::Simulator::instance().stop();
+    }
+
+    uint32_t posted() const
+    {
+        return _posted;
+    }
+
+private:
+    int post(int delay_ms, int period_ms, sim::Simulator::task_t task)
+    {
+        ++_posted;
+        return sim::Simulator::instance().post(
+            (uint64_t) delay_ms * 1000, task, (uint64_t) period_ms * 1000
+        );
+    }
+
+    template<typename... T>
+    struct first_is_method : std::false_type {
+    };
+
+    template<typename T0, typename... T>
+    struct first_is_method<T0, T...> : std::is_member_function_pointer<T0> {
+    };
+
+    /**
+     * Bind a function and its arguments or an object, a member function
+     * and its arguments.
+     */
+    template<typename F, typename... Args>
+    static sim::Simulator::task_t bind(F f, Args... args)
+    {
+        return bind_tagged(typename first_is_method<Args...>::type(), f, args...);
+    }
+
+    template<typename F, typename... Args>
+    static sim::Simulator::task_t bind_tagged(std::false_type, F f, Args... args)
+    {
+        return [f, args...]() { f(args...); };
+    }
+
+    template<typename O, typename M, typename... Args>
+    static sim::Simulator::task_t bind_tagged(std::true_type, O *obj, M method, Args... args)
+    {
+        return [obj, method, args...]() { (obj->*method)(args...); };
+    }
+
+    uint32_t _posted;
+};
+
+} // namespace events
+
+#endif /* SIM_EVENTS_EVENT_QUEUE_H_ */
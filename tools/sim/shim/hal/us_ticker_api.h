@@ -0,0 +1,16 @@
+/*
+ * Host shim of the microsecond ticker on the simulated time base.
+ */
+#ifndef SIM_HAL_US_TICKER_API_H_
+#define SIM_HAL_US_TICKER_API_H_
+
+#include <stdint.h>
+
+#include "Simulator.h"
+
+inline uint32_t us_ticker_read(void)
+{
+    return (uint32_t) sim::Simulator::instance().now_us();
+}
+
+#endif /* SIM_HAL_US_TICKER_API_H_ */
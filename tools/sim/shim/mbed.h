@@ -0,0 +1,131 @@
+/*
+ * Host shim of mbed.h: the drivers used by the application.
+ */
+#ifndef SIM_MBED_H_
+#define SIM_MBED_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "platform/Callback.h"
+#include "platform/NonCopyable.h"
+#include "platform/mbed_critical.h"
+#include "events/EventQueue.h"
+#include "rtos/Kernel.h"
+#include "rtos/Thread.h"
+#include "rtos/ThisThread.h"
+#include "hal/us_ticker_api.h"
+
+typedef enum {
+    SERIAL_TX,
+    SERIAL_RX,
+    USER_BUTTON,
+    BUTTON1,
+    SW2,
+    NC
+} PinName;
+
+typedef enum {
+    PullNone,
+    PullUp,
+    PullDown
+} PinMode;
+
+namespace mbed {
+
+/**
+ * The console is the standard output of the host.
+ */
+class Serial : private NonCopyable<Serial> {
+public:
+    Serial(PinName tx, PinName rx, int baud = 9600)
+    {
+        (void) tx;
+        (void) rx;
+        (void) baud;
+    }
+
+    void baud(int baudrate)
+    {
+        (void) baudrate;
+    }
+};
+
+/**
+ * Buttons are pressed by the simulation driver with sim_press().
+ */
+class InterruptIn : private NonCopyable<InterruptIn> {
+public:
+    static const size_t MAX_INSTANCES = 4;
+
+    InterruptIn(PinName pin, PinMode mode = PullNone) : _pin(pin)
+    {
+        (void) mode;
+        for (size_t i = 0; i < MAX_INSTANCES; ++i) {
+            if (!registry()[i]) {
+                registry()[i] = this;
+                break;
+            }
+        }
+    }
+
+    ~InterruptIn()
+    {
+        for (size_t i = 0; i < MAX_INSTANCES; ++i) {
+            if (registry()[i] == this) {
+                registry()[i] = NULL;
+            }
+        }
+    }
+
+    /**
+     * Press and release the buttons attached to a pin.
+     */
+    static void sim_press(PinName pin)
+    {
+        for (size_t i = 0; i < MAX_INSTANCES; ++i) {
+            if (registry()[i] && registry()[i]->_pin == pin) {
+                registry()[i]->press();
+            }
+        }
+    }
+
+    void rise(Callback<void()> cb)
+    {
+        _rise = cb;
+    }
+
+    void fall(Callback<void()> cb)
+    {
+        _fall = cb;
+    }
+
+private:
+    static InterruptIn **registry()
+    {
+        static InterruptIn *instances[MAX_INSTANCES] = { NULL };
+        return instances;
+    }
+
+    void press()
+    {
+        if (_fall) {
+            _fall();
+        }
+        if (_rise) {
+            _rise();
+        }
+    }
+
+    PinName _pin;
+    Callback<void()> _rise;
+    Callback<void()> _fall;
+};
+
+} // namespace mbed
+
+using namespace mbed;
+using namespace rtos;
+
+#endif /* SIM_MBED_H_ */
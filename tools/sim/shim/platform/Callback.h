@@ -0,0 +1,101 @@
+/*
+ * Host shim of mbed::Callback.
+ */
+#ifndef SIM_PLATFORM_CALLBACK_H_
+#define SIM_PLATFORM_CALLBACK_H_
+
+#include <functional>
+
+namespace mbed {
+
+template<typename F>
+class Callback;
+
+template<typename R, typename... Args>
+class Callback<R(Args...)> {
+public:
+    Callback() {}
+
+    Callback(R (*func)(Args...))
+    {
+        if (func) {
+            _function = func;
+        }
+    }
+
+    template<typename T, typename U>
+    Callback(U *obj, R (T::*method)(Args...)) :
+        _function([obj, method](Args... args) -> R { return (obj->*method)(args...); })
+    {
+    }
+
+    template<typename T, typename U>
+    Callback(const U *obj, R (T::*method)(Args...) const) :
+        _function([obj, method](Args... args) -> R { return (obj->*method)(args...); })
+    {
+    }
+
+    template<typename T, typename U>
+    Callback(U *obj, R (T::*method)(Args...) const) :
+        _function([obj, method](Args... args) -> R { return (obj->*method)(args...); })
+    {
+    }
+
+    template<typename U>
+    Callback(R (*func)(U *, Args...), U *arg) :
+        _function([func, arg](Args... args) -> R { return func(arg, args...); })
+    {
+    }
+
+    R call(Args... args) const
+    {
+        return _function(args...);
+    }
+
+    R operator()(Args... args) const
+    {
+        return _function(args...);
+    }
+
+    explicit operator bool() const
+    {
+        return static_cast<bool>(_function);
+    }
+
+private:
+    std::function<R(Args...)> _function;
+};
+
+template<typename R, typename... Args>
+Callback<R(Args...)> callback(R (*func)(Args...))
+{
+    return Callback<R(Args...)>(func);
+}
+
+template<typename T, typename U, typename R, typename... Args>
+Callback<R(Args...)> callback(U *obj, R (T::*method)(Args...))
+{
+    return Callback<R(Args...)>(obj, method);
+}
+
+template<typename T, typename U, typename R, typename... Args>
+Callback<R(Args...)> callback(const U *obj, R (T::*method)(Args...) const)
+{
+    return Callback<R(Args...)>(obj, method);
+}
+
+template<typename T, typename U, typename R, typename... Args>
+Callback<R(Args...)> callback(U *obj, R (T::*method)(Args...) const)
+{
+    return Callback<R(Args...)>(obj, method);
+}
+
+template<typename U, typename R, typename... Args>
+Callback<R(Args...)> callback(R (*func)(U *, Args...), U *arg)
+{
+    return Callback<R(Args...)>(func, arg);
+}
+
+} // namespace mbed
+
+#endif /* SIM_PLATFORM_CALLBACK_H_ */
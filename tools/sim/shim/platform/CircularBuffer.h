@@ -0,0 +1,76 @@
+/*
+ * Host shim of mbed::CircularBuffer.
+ */
+#ifndef SIM_PLATFORM_CIRCULAR_BUFFER_H_
+#define SIM_PLATFORM_CIRCULAR_BUFFER_H_
+
+#include <stdint.h>
+
+namespace mbed {
+
+template<typename T, uint32_t BufferSize, typename CounterType = uint32_t>
+class CircularBuffer {
+public:
+    CircularBuffer() : _head(0), _tail(0), _full(false) {}
+
+    void push(const T &data)
+    {
+        if (_full) {
+            _tail = incr(_tail);
+        }
+        _pool[_head] = data;
+        _head = incr(_head);
+        _full = (_head == _tail);
+    }
+
+    bool pop(T &data)
+    {
+        if (empty()) {
+            return false;
+        }
+        data = _pool[_tail];
+        _tail = incr(_tail);
+        _full = false;
+        return true;
+    }
+
+    bool empty() const
+    {
+        return _head == _tail && !_full;
+    }
+
+    bool full() const
+    {
+        return _full;
+    }
+
+    CounterType size() const
+    {
+        if (_full) {
+            return BufferSize;
+        }
+        return (_head >= _tail) ? (_head - _tail) : (BufferSize + _head - _tail);
+    }
+
+    void reset()
+    {
+        _head = 0;
+        _tail = 0;
+        _full = false;
+    }
+
+private:
+    static CounterType incr(CounterType index)
+    {
+        return (index + 1) % BufferSize;
+    }
+
+    T _pool[BufferSize];
+    CounterType _head;
+    CounterType _tail;
+    bool _full;
+};
+
+} // namespace mbed
+
+#endif /* SIM_PLATFORM_CIRCULAR_BUFFER_H_ */
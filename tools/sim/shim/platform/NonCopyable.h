@@ -0,0 +1,22 @@
+/*
+ * Host shim of mbed::NonCopyable.
+ */
+#ifndef SIM_PLATFORM_NON_COPYABLE_H_
+#define SIM_PLATFORM_NON_COPYABLE_H_
+
+namespace mbed {
+
+template<typename T>
+class NonCopyable {
+protected:
+    NonCopyable() {}
+    ~NonCopyable() {}
+
+private:
+    NonCopyable(const NonCopyable &);
+    NonCopyable &operator=(const NonCopyable &);
+};
+
+} // namespace mbed
+
+#endif /* SIM_PLATFORM_NON_COPYABLE_H_ */
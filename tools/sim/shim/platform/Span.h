@@ -0,0 +1,63 @@
+/*
+ * Host shim of mbed::Span, limited to dynamic extents.
+ */
+#ifndef SIM_PLATFORM_SPAN_H_
+#define SIM_PLATFORM_SPAN_H_
+
+#include <stddef.h>
+
+namespace mbed {
+
+template<typename T>
+class Span {
+public:
+    Span() : _data(NULL), _size(0) {}
+
+    Span(T *data, size_t size) : _data(data), _size(size) {}
+
+    template<size_t N>
+    Span(T (&array)[N]) : _data(array), _size(N) {}
+
+    template<typename U>
+    Span(const Span<U> &other) : _data(other.data()), _size(other.size()) {}
+
+    T *data() const
+    {
+        return _data;
+    }
+
+    size_t size() const
+    {
+        return _size;
+    }
+
+    bool empty() const
+    {
+        return _size == 0;
+    }
+
+    T &operator[](size_t index) const
+    {
+        return _data[index];
+    }
+
+private:
+    T *_data;
+    size_t _size;
+};
+
+template<typename T>
+Span<T> make_Span(T *data, size_t size)
+{
+    return Span<T>(data, size);
+}
+
+template<typename T>
+Span<const T> make_const_Span(const T *data, size_t size)
+{
+    return Span<const T>(data, size);
+}
+
+} // namespace mbed
+
+#endif /* SIM_PLATFORM_SPAN_H_ */
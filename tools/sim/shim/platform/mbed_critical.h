@@ -0,0 +1,46 @@
+/*
+ * Host shim of the mbed critical section and atomic helpers.
+ *
+ * The simulation runs every lane on a single host thread, so critical
+ * sections are empty and atomics are plain accesses.
+ */
+#ifndef SIM_PLATFORM_MBED_CRITICAL_H_
+#define SIM_PLATFORM_MBED_CRITICAL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+inline void core_util_critical_section_enter(void) {}
+inline void core_util_critical_section_exit(void) {}
+
+inline uint32_t core_util_atomic_load_u32(const volatile uint32_t *ptr)
+{
+    return *ptr;
+}
+
+inline void core_util_atomic_store_u32(volatile uint32_t *ptr, uint32_t value)
+{
+    *ptr = value;
+}
+
+inline uint32_t core_util_atomic_incr_u32(volatile uint32_t *ptr, uint32_t delta)
+{
+    return *ptr += delta;
+}
+
+inline uint32_t core_util_atomic_decr_u32(volatile uint32_t *ptr, uint32_t delta)
+{
+    return *ptr -= delta;
+}
+
+inline bool core_util_atomic_cas_u32(volatile uint32_t *ptr, uint32_t *expected, uint32_t desired)
+{
+    if (*ptr == *expected) {
+        *ptr = desired;
+        return true;
+    }
+    *expected = *ptr;
+    return false;
+}
+
+#endif /* SIM_PLATFORM_MBED_CRITICAL_H_ */
@@ -0,0 +1,17 @@
+/*
+ * Host shim of the mbed statistics; CPU statistics are not simulated
+ * (MBED_CPU_STATS_ENABLED stays undefined).
+ */
+#ifndef SIM_PLATFORM_MBED_STATS_H_
+#define SIM_PLATFORM_MBED_STATS_H_
+
+#include <stdint.h>
+
+typedef struct {
+    uint64_t uptime;
+    uint64_t idle_time;
+    uint64_t sleep_time;
+    uint64_t deep_sleep_time;
+} mbed_stats_cpu_t;
+
+#endif /* SIM_PLATFORM_MBED_STATS_H_ */
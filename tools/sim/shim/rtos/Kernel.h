@@ -0,0 +1,22 @@
+/*
+ * Host shim of rtos::Kernel on the simulated time base.
+ */
+#ifndef SIM_RTOS_KERNEL_H_
+#define SIM_RTOS_KERNEL_H_
+
+#include <stdint.h>
+
+#include "Simulator.h"
+
+namespace rtos {
+namespace Kernel {
+
+inline uint64_t get_ms_count()
+{
+    return sim::Simulator::instance().now_us() / 1000;
+}
+
+} // namespace Kernel
+} // namespace rtos
+
+#endif /* SIM_RTOS_KERNEL_H_ */
@@ -0,0 +1,22 @@
+/*
+ * Host shim of rtos::ThisThread; a sleep consumes virtual time.
+ */
+#ifndef SIM_RTOS_THIS_THREAD_H_
+#define SIM_RTOS_THIS_THREAD_H_
+
+#include <stdint.h>
+
+#include "Simulator.h"
+
+namespace rtos {
+namespace ThisThread {
+
+inline void sleep_for(uint32_t ms)
+{
+    sim::Simulator::instance().advance((uint64_t) ms * 1000);
+}
+
+} // namespace ThisThread
+} // namespace rtos
+
+#endif /* SIM_RTOS_THIS_THREAD_H_ */
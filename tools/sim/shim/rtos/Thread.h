@@ -0,0 +1,100 @@
+/*
+ * Host shim of rtos::Thread.
+ *
+ * Threads are not run: event queues are dispatched by the simulator and
+ * the other threads of the application (the logger) are replaced by
+ * periodic tasks of the simulation driver. Joining a thread runs the
+ * simulation to its end. Stack usage is not simulated.
+ */
+#ifndef SIM_RTOS_THREAD_H_
+#define SIM_RTOS_THREAD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "platform/Callback.h"
+#include "platform/NonCopyable.h"
+
+#include "Simulator.h"
+
+typedef enum {
+    osPriorityIdle = 1,
+    osPriorityLow = 8,
+    osPriorityBelowNormal = 16,
+    osPriorityNormal = 24,
+    osPriorityAboveNormal = 32,
+    osPriorityHigh = 40,
+    osPriorityRealtime = 48
+} osPriority;
+
+typedef enum {
+    osOK = 0,
+    osError = -1
+} osStatus;
+
+namespace rtos {
+
+class Thread : private mbed::NonCopyable<Thread> {
+public:
+    Thread(
+        osPriority priority = osPriorityNormal,
+        uint32_t stack_size = 4096,
+        unsigned char *stack_mem = NULL,
+        const char *name = NULL
+    ) :
+        _priority(priority),
+        _stack_size(stack_size),
+        _name(name),
+        _started(false)
+    {
+        (void) stack_mem;
+    }
+
+    osStatus start(mbed::Callback<void()> task)
+    {
+        (void) task;
+        if (_started) {
+            return osError;
+        }
+        _started = true;
+        return osOK;
+    }
+
+    osStatus join()
+    {
+        if (!sim::Simulator::instance().running()) {
+            sim::Simulator::instance().run();
+        }
+        return osOK;
+    }
+
+    osPriority get_priority() const
+    {
+        return _priority;
+    }
+
+    const char *get_name() const
+    {
+        return _name;
+    }
+
+    uint32_t stack_size() const
+    {
+        return _stack_size;
+    }
+
+    uint32_t max_stack() const
+    {
+        return 0;
+    }
+
+private:
+    osPriority _priority;
+    uint32_t _stack_size;
+    const char *_name;
+    bool _started;
+};
+
+} // namespace rtos
+
+#endif /* SIM_RTOS_THREAD_H_ */
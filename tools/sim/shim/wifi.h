@@ -0,0 +1,100 @@
+/*
+ * Host shim of the es-wifi driver API (DISCO_L475VG_IOT01A_wifi/wifi.h).
+ *
+ * The module is simulated by sim_wifi.cpp: it joins the network at once and
+ * every send blocks the calling lane for the time of the SPI transfer and
+ * of the module command.
+ */
+#ifndef SIM_WIFI_H_
+#define SIM_WIFI_H_
+
+#include <stdint.h>
+
+#include "es_wifi_io.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* largest payload of a module command (es_wifi.h) */
+#define ES_WIFI_PAYLOAD_SIZE 1200
+
+typedef enum {
+    WIFI_ECN_OPEN = 0x00,
+    WIFI_ECN_WEP = 0x01,
+    WIFI_ECN_WPA_PSK = 0x02,
+    WIFI_ECN_WPA2_PSK = 0x03,
+    WIFI_ECN_WPA_WPA2_PSK = 0x04,
+} WIFI_Ecn_t;
+
+typedef enum {
+    WIFI_TCP_PROTOCOL = 0,
+    WIFI_UDP_PROTOCOL = 1,
+} WIFI_Protocol_t;
+
+typedef enum {
+    WIFI_STATUS_OK = 0,
+    WIFI_STATUS_ERROR = 1,
+    WIFI_STATUS_NOT_SUPPORTED = 2,
+    WIFI_STATUS_JOINED = 3,
+    WIFI_STATUS_ASSIGNED = 4,
+} WIFI_Status_t;
+
+typedef enum {
+    WIFI_COMMAND_INIT = 0,
+    WIFI_COMMAND_JOIN = 1,
+    WIFI_COMMAND_DISCONNECT = 2,
+    WIFI_COMMAND_OPEN = 3,
+    WIFI_COMMAND_CLOSE = 4,
+    WIFI_COMMAND_SEND = 5,
+    WIFI_COMMAND_RECEIVE = 6,
+    WIFI_COMMAND_STATUS = 7,
+} WIFI_Command_t;
+
+typedef void (*WIFI_CommandHook_t)(
+    WIFI_Command_t command, WIFI_Status_t status, uint32_t bytes, uint32_t duration_us
+);
+
+WIFI_Status_t WIFI_Init(void);
+void WIFI_SetCommandHook(WIFI_CommandHook_t hook);
+WIFI_Status_t WIFI_Connect(const char *SSID, const char *Password, WIFI_Ecn_t ecn);
+WIFI_Status_t WIFI_GetIP_Address(uint8_t *ipaddr);
+WIFI_Status_t WIFI_CheckConnection(uint8_t *ipaddr);
+WIFI_Status_t WIFI_GetMAC_Address(uint8_t *mac);
+WIFI_Status_t WIFI_Disconnect(void);
+WIFI_Status_t WIFI_OpenClientConnection(
+    uint32_t socket, WIFI_Protocol_t type, const char *name, uint8_t *ipaddr,
+    uint16_t port, uint16_t local_port
+);
+WIFI_Status_t WIFI_CloseClientConnection(uint32_t socket);
+WIFI_Status_t WIFI_SendData(
+    uint8_t socket, uint8_t *pdata, uint16_t Reqlen, uint16_t *SentDatalen, uint32_t Timeout
+);
+WIFI_Status_t WIFI_ReceiveData(
+    uint8_t socket, uint8_t *pdata, uint16_t Reqlen, uint16_t *RcvDatalen, uint32_t Timeout
+);
+
+/*
+ * Simulation interface
+ */
+
+typedef struct {
+    uint32_t sends;
+    uint32_t send_failures;
+    uint64_t bytes;
+    uint64_t busy_us;
+    uint32_t joins;
+    uint32_t join_failures;
+    uint32_t ap_reboots;
+} sim_wifi_stats_t;
+
+const sim_wifi_stats_t *sim_wifi_stats(void);
+
+/* the access point drops its stations and refuses them for down_us */
+void sim_wifi_ap_reboot(uint64_t down_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM_WIFI_H_ */
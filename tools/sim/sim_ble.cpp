@@ -0,0 +1,884 @@
+/*
+ * Simulated BLE controller and host behind the BLE API shim.
+ *
+ * Timing model:
+ *   - a central connects at the next advertising event;
+ *   - every exchange with a central (write, read, MTU exchange, parameter
+ *     update) completes after one or a few connection intervals;
+ *   - notifications take a transmit buffer; buffers are freed four per
+ *     connection event and reported by onDataSent;
+ *   - pairing takes eight connection intervals, resuming encryption two.
+ */
+#include "ble/BLE.h"
+
+#include <algorithm>
+
+#include "Simulator.h"
+#include "BroadcastPayload.h"
+
+namespace {
+
+/* transmit buffers of a link, as the Cordio ACL buffers */
+const unsigned TX_BUFFERS = 8;
+
+/* packets sent per connection event */
+const unsigned PACKETS_PER_EVENT = 4;
+
+/* ATT MTU accepted by the simulated centrals */
+const uint16_t PEER_ATT_MTU = 185;
+
+/* ATT MTU requested by the stack (cordio.desired-att-mtu) */
+#ifdef MBED_CONF_CORDIO_DESIRED_ATT_MTU
+const uint16_t LOCAL_ATT_MTU = MBED_CONF_CORDIO_DESIRED_ATT_MTU;
+#else
+const uint16_t LOCAL_ATT_MTU = 23;
+#endif
+
+/* parameters of a new connection: 30 ms, latency 0, 5 s timeout */
+const uint16_t INITIAL_INTERVAL = 24;
+const uint16_t INITIAL_TIMEOUT = 500;
+
+/* random delay added by the controller to every advertising interval */
+const uint64_t ADVERTISING_DELAY_MAX_US = 10000;
+
+sim::Simulator &simulator()
+{
+    return sim::Simulator::instance();
+}
+
+uint64_t interval_us(uint16_t interval)
+{
+    return (uint64_t) interval * 1250;
+}
+
+} // namespace
+
+/*
+ * BLE
+ */
+
+BLE &BLE::Instance(InstanceID_t id)
+{
+    (void) id;
+    static BLE instance;
+    return instance;
+}
+
+BLE::BLE() :
+    _initialized(false),
+    _signalled(false),
+    _events_processed(0)
+{
+}
+
+ble_error_t BLE::init(FunctionPointerWithContext<InitializationCompleteCallbackContext *> callback)
+{
+    if (_initialized) {
+        return BLE_ERROR_ALREADY_INITIALIZED;
+    }
+
+    // the controller reset and the stack setup take a few milliseconds
+    sim_post(5000, [this, callback]() {
+        _initialized = true;
+        InitializationCompleteCallbackContext context = { *this, BLE_ERROR_NONE };
+        callback.call(&context);
+    });
+    return BLE_ERROR_NONE;
+}
+
+void BLE::sim_post(uint64_t delay_us, std::function<void()> event)
+{
+    simulator().post(delay_us, [this, event]() {
+        _pending.push_back(event);
+        signal();
+    });
+}
+
+void BLE::signal()
+{
+    if (_signalled || !_on_events_to_process) {
+        return;
+    }
+    _signalled = true;
+    OnEventsToProcessCallbackContext context = { *this };
+    _on_events_to_process.call(&context);
+}
+
+void BLE::processEvents()
+{
+    _signalled = false;
+
+    // events queued by the callbacks are delivered at the next signal
+    std::deque<std::function<void()> > events;
+    events.swap(_pending);
+    while (!events.empty()) {
+        std::function<void()> event = events.front();
+        events.pop_front();
+        ++_events_processed;
+        event();
+    }
+
+    if (!_pending.empty()) {
+        signal();
+    }
+}
+
+/*
+ * Gap
+ */
+
+namespace ble {
+
+Gap::Gap() :
+    _event_handler(NULL),
+    _advertising(false),
+    _advertising_interval_us(0),
+    _advertising_since_us(0),
+    _connect_pending(false),
+    _scanning(false),
+    _privacy(false),
+    _next_handle(0)
+{
+    memset(&_sim_stats, 0, sizeof(_sim_stats));
+}
+
+ble_error_t Gap::getAddress(BLEProtocol::AddressType_t *type, BLEProtocol::AddressBytes_t address)
+{
+    static const uint8_t own_address[BLEProtocol::ADDR_LEN] = { 0x5A, 0x31, 0x4E, 0x7C, 0x80, 0xC6 };
+    *type = _privacy ? BLEProtocol::RANDOM_PRIVATE_RESOLVABLE : BLEProtocol::RANDOM_STATIC;
+    memcpy(address, own_address, sizeof(own_address));
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t Gap::setAdvertisingParameters(advertising_handle_t handle, const AdvertisingParameters &params)
+{
+    if (handle != LEGACY_ADVERTISING_HANDLE) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    if (_advertising) {
+        return BLE_ERROR_INVALID_STATE;
+    }
+    _advertising_interval_us = params.getMaxPrimaryInterval().valueInUs();
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t Gap::setAdvertisingPayload(advertising_handle_t handle, mbed::Span<const uint8_t> payload)
+{
+    if (handle != LEGACY_ADVERTISING_HANDLE) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    if (payload.size() > LEGACY_ADVERTISING_MAX_SIZE) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    ++_sim_stats.payload_updates;
+
+    /* decode the broadcast field as an observer would, to check the encoder */
+    size_t offset = 0;
+    while (offset + 1 < payload.size()) {
+        size_t length = payload[offset];
+        if (length == 0 || offset + 1 + length > payload.size()) {
+            break;
+        }
+        if (payload[offset + 1] == 0xFF) {
+            broadcast_data_t data;
+            uint8_t sequence;
+            if (broadcast_decode(payload.data() + offset + 2, length - 1, data, sequence)) {
+                ++_sim_stats.broadcasts_decoded;
+            } else {
+                ++_sim_stats.broadcasts_invalid;
+            }
+        }
+        offset += 1 + length;
+    }
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t Gap::setAdvertisingScanResponse(advertising_handle_t handle, mbed::Span<const uint8_t> response)
+{
+    return setAdvertisingPayload(handle, response);
+}
+
+ble_error_t Gap::startAdvertising(advertising_handle_t handle)
+{
+    if (handle != LEGACY_ADVERTISING_HANDLE) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    if (!_advertising_interval_us) {
+        return BLE_ERROR_INVALID_STATE;
+    }
+    if (_advertising) {
+        return BLE_ERROR_NONE;
+    }
+    _advertising = true;
+    _advertising_since_us = simulator().now_us();
+    ++_sim_stats.advertising_restarts;
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t Gap::stopAdvertising(advertising_handle_t handle)
+{
+    if (handle != LEGACY_ADVERTISING_HANDLE) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    account_advertising();
+    _advertising = false;
+    return BLE_ERROR_NONE;
+}
+
+bool Gap::isAdvertisingActive(advertising_handle_t handle)
+{
+    return handle == LEGACY_ADVERTISING_HANDLE && _advertising;
+}
+
+void Gap::account_advertising()
+{
+    if (!_advertising) {
+        return;
+    }
+    uint64_t now = simulator().now_us();
+    uint64_t elapsed = now - _advertising_since_us;
+    _sim_stats.advertising_us += elapsed;
+    _sim_stats.advertising_events += elapsed / (_advertising_interval_us + ADVERTISING_DELAY_MAX_US / 2);
+    _advertising_since_us = now;
+}
+
+const Gap::sim_stats_t &Gap::sim_stats() const
+{
+    const_cast<Gap *>(this)->account_advertising();
+    return _sim_stats;
+}
+
+ble_error_t Gap::setScanParameters(const ScanParameters &params)
+{
+    (void) params;
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t Gap::startScan()
+{
+    _scanning = true;
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t Gap::stopScan()
+{
+    _scanning = false;
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t Gap::disconnect(connection_handle_t handle, local_disconnection_reason_t reason)
+{
+    (void) reason;
+    if (!_links.count(handle)) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+
+    // the link is terminated at the next connection event
+    uint64_t delay = interval_us(_links[handle].params.maxConnectionInterval);
+    BLE::Instance().sim_post(delay, [this, handle]() {
+        if (!_links.count(handle)) {
+            return;
+        }
+        _links.erase(handle);
+        ++_sim_stats.disconnections;
+        BLE::Instance().gattServer().sim_disconnected(handle);
+        BLE::Instance().securityManager().sim_disconnected(handle);
+        DisconnectionCallbackParams_t params = { handle, LOCAL_HOST_TERMINATED_CONNECTION };
+        _disconnection.call(&params);
+    });
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t Gap::updateConnectionParameters(
+    connection_handle_t handle,
+    conn_interval_t min_interval,
+    conn_interval_t max_interval,
+    slave_latency_t latency,
+    supervision_timeout_t timeout,
+    conn_event_length_t min_event_length,
+    conn_event_length_t max_event_length
+) {
+    (void) min_interval;
+    (void) min_event_length;
+    (void) max_event_length;
+    if (!_links.count(handle)) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+
+    // the central answers the request and the new parameters apply at an
+    // instant a few connection events later
+    uint64_t delay = 6 * interval_us(_links[handle].params.maxConnectionInterval);
+    BLE::Instance().sim_post(delay, [this, handle, max_interval, latency, timeout]() {
+        if (!_links.count(handle)) {
+            return;
+        }
+        ConnectionParams_t &params = _links[handle].params;
+        params.minConnectionInterval = max_interval.value();
+        params.maxConnectionInterval = max_interval.value();
+        params.slaveLatency = latency.value();
+        params.connectionSupervisionTimeout = timeout.value();
+        ++_sim_stats.parameter_updates;
+        BLE::Instance().gattServer().sim_set_interval(handle, interval_us(max_interval.value()));
+        if (_event_handler) {
+            _event_handler->onConnectionParametersUpdateComplete(
+                ConnectionParametersUpdateCompleteEvent(
+                    BLE_ERROR_NONE, handle, max_interval, latency, timeout
+                )
+            );
+        }
+    });
+    return BLE_ERROR_NONE;
+}
+
+bool Gap::sim_connect(const address_t &peer, BLEProtocol::AddressType_t type)
+{
+    if (!_advertising || _connect_pending) {
+        return false;
+    }
+
+    // the connection request answers the next advertising event
+    _connect_pending = true;
+    uint64_t delay = simulator().uniform(0, _advertising_interval_us + ADVERTISING_DELAY_MAX_US);
+    simulator().post(delay, [this, peer, type]() {
+        _connect_pending = false;
+        if (!_advertising) {
+            return;
+        }
+        // the controller stops advertising once connected
+        account_advertising();
+        _advertising = false;
+
+        connection_handle_t handle = _next_handle++;
+        link_t &link = _links[handle];
+        link.peer = peer;
+        link.params.minConnectionInterval = INITIAL_INTERVAL;
+        link.params.maxConnectionInterval = INITIAL_INTERVAL;
+        link.params.slaveLatency = 0;
+        link.params.connectionSupervisionTimeout = INITIAL_TIMEOUT;
+        ++_sim_stats.connections;
+
+        BLE::Instance().gattServer().sim_connected(handle, interval_us(INITIAL_INTERVAL));
+        BLE::Instance().securityManager().sim_connected(handle, peer, interval_us(INITIAL_INTERVAL));
+
+        BLE::Instance().sim_post(0, [this, handle, type]() {
+            if (!_links.count(handle)) {
+                return;
+            }
+            link_t &link = _links[handle];
+            ConnectionCallbackParams_t params;
+            memset(&params, 0, sizeof(params));
+            params.handle = handle;
+            params.role = PERIPHERAL;
+            params.peerAddrType = type;
+            memcpy(params.peerAddr, link.peer.data(), sizeof(params.peerAddr));
+            getAddress(&params.ownAddrType, params.ownAddr);
+            params.connectionParams = &link.params;
+            _connection.call(&params);
+        });
+    });
+    return true;
+}
+
+void Gap::sim_disconnect(connection_handle_t handle)
+{
+    BLE::Instance().sim_post(0, [this, handle]() {
+        if (!_links.count(handle)) {
+            return;
+        }
+        _links.erase(handle);
+        ++_sim_stats.disconnections;
+        BLE::Instance().gattServer().sim_disconnected(handle);
+        BLE::Instance().securityManager().sim_disconnected(handle);
+        DisconnectionCallbackParams_t params = { handle, REMOTE_USER_TERMINATED_CONNECTION };
+        _disconnection.call(&params);
+    });
+}
+
+void Gap::sim_advertising_report(
+    const address_t &peer, peer_address_type_t type, int8_t rssi,
+    const uint8_t *payload, size_t length
+) {
+    if (!_scanning) {
+        return;
+    }
+    std::vector<uint8_t> data(payload, payload + length);
+    BLE::Instance().sim_post(0, [this, peer, type, rssi, data]() {
+        if (!_scanning || !_event_handler) {
+            return;
+        }
+        ++_sim_stats.advertising_reports;
+        _event_handler->onAdvertisingReport(AdvertisingReportEvent(
+            type, peer, rssi, mbed::Span<const uint8_t>(data.data(), data.size())
+        ));
+    });
+}
+
+} // namespace ble
+
+/*
+ * GattServer
+ */
+
+GattServer::GattServer() :
+    _event_handler(NULL)
+{
+    memset(&_sim_stats, 0, sizeof(_sim_stats));
+    // handle 0 is invalid
+    _attributes.resize(1);
+}
+
+GattServer::attribute_t *GattServer::find(GattAttribute::Handle_t handle)
+{
+    if (handle == 0 || handle >= _attributes.size()) {
+        return NULL;
+    }
+    return &_attributes[handle];
+}
+
+ble_error_t GattServer::addService(GattService &service)
+{
+    attribute_t declaration = { service.getUUID(), NULL, false, std::vector<uint8_t>() };
+    service.setHandle(_attributes.size());
+    _attributes.push_back(declaration);
+
+    for (uint8_t i = 0; i < service.getCharacteristicCount(); ++i) {
+        GattCharacteristic *characteristic = service.getCharacteristic(i);
+        GattAttribute &value = characteristic->getValueAttribute();
+
+        // characteristic declaration
+        attribute_t attribute = { UUID(0x2803), NULL, false, std::vector<uint8_t>() };
+        _attributes.push_back(attribute);
+
+        // value
+        attribute.uuid = value.getUUID();
+        attribute.characteristic = characteristic;
+        attribute.value.assign(value.getValuePtr(), value.getValuePtr() + value.getLength());
+        value.setHandle(_attributes.size());
+        _attributes.push_back(attribute);
+
+        if (characteristic->getProperties() & (
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY |
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_INDICATE)) {
+            attribute_t cccd = { UUID(BLE_UUID_DESCRIPTOR_CLIENT_CHAR_CONFIG), characteristic, true, std::vector<uint8_t>(2) };
+            _attributes.push_back(cccd);
+        }
+    }
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t GattServer::read(GattAttribute::Handle_t handle, uint8_t *buffer, uint16_t *length)
+{
+    attribute_t *attribute = find(handle);
+    if (!attribute || attribute->is_cccd) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    if (*length < attribute->value.size()) {
+        *length = attribute->value.size();
+        return BLE_ERROR_PARAM_OUT_OF_RANGE;
+    }
+    *length = attribute->value.size();
+    if (*length) {
+        memcpy(buffer, attribute->value.data(), *length);
+    }
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t GattServer::read(
+    ble::connection_handle_t connection, GattAttribute::Handle_t handle,
+    uint8_t *buffer, uint16_t *length
+) {
+    (void) connection;
+    return read(handle, buffer, length);
+}
+
+ble_error_t GattServer::write(
+    GattAttribute::Handle_t handle, const uint8_t *value, uint16_t size, bool local_only
+) {
+    attribute_t *attribute = find(handle);
+    if (!attribute || attribute->is_cccd || !attribute->characteristic) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    if (size > attribute->characteristic->getValueAttribute().getMaxLength()) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    attribute->value.assign(value, value + size);
+
+    if (local_only) {
+        return BLE_ERROR_NONE;
+    }
+
+    // as Cordio, updates are sent to every subscribed client; a client
+    // without buffer misses the update
+    for (std::map<ble::connection_handle_t, link_t>::iterator it = _links.begin(); it != _links.end(); ++it) {
+        notify(it->first, it->second, *attribute);
+    }
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t GattServer::write(
+    ble::connection_handle_t connection, GattAttribute::Handle_t handle,
+    const uint8_t *value, uint16_t size, bool local_only
+) {
+    attribute_t *attribute = find(handle);
+    if (!attribute || attribute->is_cccd || !attribute->characteristic) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    if (size > attribute->characteristic->getValueAttribute().getMaxLength()) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    attribute->value.assign(value, value + size);
+
+    if (local_only) {
+        return BLE_ERROR_NONE;
+    }
+
+    std::map<ble::connection_handle_t, link_t>::iterator it = _links.find(connection);
+    if (it == _links.end()) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    return notify(connection, it->second, *attribute);
+}
+
+ble_error_t GattServer::notify(ble::connection_handle_t connection, link_t &link, attribute_t &attribute)
+{
+    GattAttribute::Handle_t handle = attribute.characteristic->getValueHandle();
+    std::map<GattAttribute::Handle_t, uint16_t>::iterator cccd = link.cccd.find(handle);
+    if (cccd == link.cccd.end() || !cccd->second) {
+        return BLE_ERROR_NONE;
+    }
+
+    if (link.in_flight == TX_BUFFERS) {
+        ++_sim_stats.notifications_dropped;
+        return BLE_ERROR_NO_MEM;
+    }
+
+    ++link.in_flight;
+    ++_sim_stats.notifications;
+    _sim_stats.notification_bytes += std::min<size_t>(attribute.value.size(), link.mtu - 3);
+
+    if (cccd->second & BLE_HVX_INDICATION && !(cccd->second & BLE_HVX_NOTIFICATION)) {
+        // the confirmation comes back one connection event later
+        BLE::Instance().sim_post(2 * link.interval_us, [this, connection, handle]() {
+            if (_links.count(connection)) {
+                _confirmation_received.call(handle);
+            }
+        });
+    }
+
+    if (!link.drain_scheduled) {
+        link.drain_scheduled = true;
+        simulator().post(link.interval_us, [this, connection]() { drain(connection); });
+    }
+    return BLE_ERROR_NONE;
+}
+
+void GattServer::drain(ble::connection_handle_t connection)
+{
+    std::map<ble::connection_handle_t, link_t>::iterator it = _links.find(connection);
+    if (it == _links.end()) {
+        return;
+    }
+    link_t &link = it->second;
+    link.drain_scheduled = false;
+
+    unsigned sent = std::min(link.in_flight, PACKETS_PER_EVENT);
+    link.in_flight -= sent;
+    if (link.in_flight) {
+        link.drain_scheduled = true;
+        simulator().post(link.interval_us, [this, connection]() { drain(connection); });
+    }
+
+    BLE::Instance().sim_post(0, [this, connection, sent]() {
+        if (_links.count(connection)) {
+            _data_sent.call(sent);
+        }
+    });
+}
+
+ble_error_t GattServer::areUpdatesEnabled(const GattCharacteristic &characteristic, bool *enabled)
+{
+    *enabled = false;
+    for (std::map<ble::connection_handle_t, link_t>::iterator it = _links.begin(); it != _links.end(); ++it) {
+        bool link_enabled = false;
+        areUpdatesEnabled(it->first, characteristic, &link_enabled);
+        *enabled = *enabled || link_enabled;
+    }
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t GattServer::areUpdatesEnabled(
+    ble::connection_handle_t connection, const GattCharacteristic &characteristic, bool *enabled
+) {
+    std::map<ble::connection_handle_t, link_t>::iterator it = _links.find(connection);
+    if (it == _links.end()) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    std::map<GattAttribute::Handle_t, uint16_t>::iterator cccd =
+        it->second.cccd.find(characteristic.getValueHandle());
+    *enabled = cccd != it->second.cccd.end() && cccd->second != 0;
+    return BLE_ERROR_NONE;
+}
+
+std::vector<GattServer::sim_attribute_t> GattServer::sim_characteristics() const
+{
+    std::vector<sim_attribute_t> characteristics;
+    for (size_t handle = 1; handle < _attributes.size(); ++handle) {
+        const attribute_t &attribute = _attributes[handle];
+        if (!attribute.characteristic || attribute.is_cccd) {
+            continue;
+        }
+        const GattAttribute &value = attribute.characteristic->getValueAttribute();
+        sim_attribute_t description;
+        description.handle = handle;
+        description.cccd_handle = 0;
+        if (handle + 1 < _attributes.size() && _attributes[handle + 1].is_cccd) {
+            description.cccd_handle = handle + 1;
+        }
+        description.properties = attribute.characteristic->getProperties();
+        description.max_length = value.getMaxLength();
+        description.variable_length = value.hasVariableLength();
+        characteristics.push_back(description);
+    }
+    return characteristics;
+}
+
+ble_error_t GattServer::sim_client_write(
+    ble::connection_handle_t connection, GattAttribute::Handle_t handle,
+    const uint8_t *data, uint16_t length
+) {
+    std::map<ble::connection_handle_t, link_t>::iterator it = _links.find(connection);
+    if (it == _links.end()) {
+        return BLE_ERROR_INVALID_STATE;
+    }
+
+    std::vector<uint8_t> value(data, data + length);
+    BLE::Instance().sim_post(it->second.interval_us, [this, connection, handle, value]() {
+        std::map<ble::connection_handle_t, link_t>::iterator it = _links.find(connection);
+        attribute_t *attribute = find(handle);
+        if (it == _links.end() || !attribute || !attribute->characteristic) {
+            return;
+        }
+        ++_sim_stats.client_writes;
+        GattAttribute::Handle_t value_handle = attribute->characteristic->getValueHandle();
+
+        if (attribute->is_cccd) {
+            uint16_t flags = value.size() >= 2 ? (uint16_t)(value[0] | (value[1] << 8)) : 0;
+            uint16_t &cccd = it->second.cccd[value_handle];
+            bool was_enabled = cccd != 0;
+            cccd = flags;
+            if (flags && !was_enabled) {
+                _updates_enabled.call(value_handle);
+            } else if (!flags && was_enabled) {
+                _updates_disabled.call(value_handle);
+            }
+            return;
+        }
+
+        GattCharacteristic &characteristic = *attribute->characteristic;
+        if (!(characteristic.getProperties() & (
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE |
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE)) ||
+            value.size() > characteristic.getValueAttribute().getMaxLength()) {
+            ++_sim_stats.client_writes_rejected;
+            return;
+        }
+
+        GattWriteAuthCallbackParams authorization = {
+            connection, handle, 0, (uint16_t) value.size(), value.data(), AUTH_CALLBACK_REPLY_SUCCESS
+        };
+        if (characteristic.authorizeWrite(&authorization) != AUTH_CALLBACK_REPLY_SUCCESS) {
+            ++_sim_stats.client_writes_rejected;
+            return;
+        }
+
+        attribute->value = value;
+        GattWriteCallbackParams params = {
+            connection, handle, GattWriteCallbackParams::OP_WRITE_REQ, 0,
+            (uint16_t) value.size(), value.data()
+        };
+        _data_written.call(&params);
+    });
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t GattServer::sim_client_read(ble::connection_handle_t connection, GattAttribute::Handle_t handle)
+{
+    std::map<ble::connection_handle_t, link_t>::iterator it = _links.find(connection);
+    if (it == _links.end()) {
+        return BLE_ERROR_INVALID_STATE;
+    }
+
+    BLE::Instance().sim_post(it->second.interval_us, [this, connection, handle]() {
+        attribute_t *attribute = find(handle);
+        if (!_links.count(connection) || !attribute || attribute->is_cccd) {
+            return;
+        }
+        ++_sim_stats.client_reads;
+        GattReadCallbackParams params = {
+            connection, handle, 0, (uint16_t) attribute->value.size(),
+            attribute->value.data(), BLE_ERROR_NONE
+        };
+        _data_read.call(&params);
+    });
+    return BLE_ERROR_NONE;
+}
+
+void GattServer::sim_connected(ble::connection_handle_t connection, uint64_t interval_us)
+{
+    link_t &link = _links[connection];
+    link.interval_us = interval_us;
+    link.mtu = 23;
+    link.in_flight = 0;
+    link.drain_scheduled = false;
+    link.cccd.clear();
+}
+
+void GattServer::sim_disconnected(ble::connection_handle_t connection)
+{
+    _links.erase(connection);
+}
+
+void GattServer::sim_set_interval(ble::connection_handle_t connection, uint64_t interval_us)
+{
+    std::map<ble::connection_handle_t, link_t>::iterator it = _links.find(connection);
+    if (it != _links.end()) {
+        it->second.interval_us = interval_us;
+    }
+}
+
+void GattServer::sim_set_mtu(ble::connection_handle_t connection, uint16_t mtu)
+{
+    std::map<ble::connection_handle_t, link_t>::iterator it = _links.find(connection);
+    if (it == _links.end()) {
+        return;
+    }
+    it->second.mtu = mtu;
+    if (_event_handler) {
+        _event_handler->onAttMtuChange(connection, mtu);
+    }
+}
+
+/*
+ * GattClient
+ */
+
+ble_error_t GattClient::negotiateAttMtu(ble::connection_handle_t connection)
+{
+    if (!BLE::Instance().gap().sim_connected(connection)) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    // exchange MTU request and response
+    BLE::Instance().sim_post(2 * interval_us(INITIAL_INTERVAL), [connection]() {
+        BLE::Instance().gattServer().sim_set_mtu(connection, std::min(LOCAL_ATT_MTU, PEER_ATT_MTU));
+    });
+    return BLE_ERROR_NONE;
+}
+
+/*
+ * SecurityManager
+ */
+
+SecurityManager::SecurityManager() :
+    _event_handler(NULL),
+    _initialized(false),
+    _bonding(false),
+    _authorisation_required(false)
+{
+}
+
+ble_error_t SecurityManager::init(
+    bool enable_bonding,
+    bool require_mitm,
+    SecurityIOCapabilities_t iocaps,
+    const Passkey_t passkey,
+    bool signing,
+    const char *db_path
+) {
+    (void) require_mitm;
+    (void) iocaps;
+    (void) passkey;
+    (void) signing;
+    (void) db_path;
+    _initialized = true;
+    _bonding = enable_bonding;
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t SecurityManager::setLinkEncryption(
+    ble::connection_handle_t connection, ble::link_encryption_t encryption
+) {
+    if (!_initialized) {
+        return BLE_ERROR_INITIALIZATION_INCOMPLETE;
+    }
+    std::map<ble::connection_handle_t, link_t>::iterator it = _links.find(connection);
+    if (it == _links.end()) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    if (encryption == ble::link_encryption_t::NOT_ENCRYPTED || it->second.encrypting) {
+        return BLE_ERROR_NONE;
+    }
+    it->second.encrypting = true;
+
+    if (_bonds.count(it->second.peer)) {
+        // the central starts encryption with the stored long term key
+        BLE::Instance().sim_post(2 * it->second.interval_us, [this, connection]() {
+            if (_links.count(connection) && _event_handler) {
+                _event_handler->linkEncryptionResult(connection, ble::link_encryption_t::ENCRYPTED);
+            }
+        });
+        return BLE_ERROR_NONE;
+    }
+
+    // the security request makes the central start pairing
+    BLE::Instance().sim_post(it->second.interval_us, [this, connection]() {
+        if (!_links.count(connection)) {
+            return;
+        }
+        if (_authorisation_required) {
+            if (_event_handler) {
+                _event_handler->pairingRequest(connection);
+            }
+        } else {
+            acceptPairingRequest(connection);
+        }
+    });
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t SecurityManager::acceptPairingRequest(ble::connection_handle_t connection)
+{
+    std::map<ble::connection_handle_t, link_t>::iterator it = _links.find(connection);
+    if (it == _links.end()) {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+
+    // feature exchange, confirm and random values, key distribution
+    BLE::Instance().sim_post(8 * it->second.interval_us, [this, connection]() {
+        std::map<ble::connection_handle_t, link_t>::iterator it = _links.find(connection);
+        if (it == _links.end()) {
+            return;
+        }
+        if (_bonding) {
+            _bonds.insert(it->second.peer);
+        }
+        if (_event_handler) {
+            _event_handler->pairingResult(connection, SEC_STATUS_SUCCESS);
+            _event_handler->linkEncryptionResult(connection, ble::link_encryption_t::ENCRYPTED);
+        }
+    });
+    return BLE_ERROR_NONE;
+}
+
+void SecurityManager::sim_connected(
+    ble::connection_handle_t connection, const ble::address_t &peer, uint64_t interval_us
+) {
+    link_t &link = _links[connection];
+    link.peer = peer;
+    link.interval_us = interval_us;
+    link.encrypting = false;
+}
+
+void SecurityManager::sim_disconnected(ble::connection_handle_t connection)
+{
+    _links.erase(connection);
+}
@@ -0,0 +1,498 @@
+/*
+ * Driver of the host simulation of the node.
+ *
+ * Runs the unmodified application (main.cpp, renamed node_main) against the
+ * simulated BLE stack and wifi module, in virtual time, with a population
+ * of simulated centrals. Each central stays idle for an exponentially
+ * distributed time, connects while the node advertises, subscribes to the
+ * characteristics that notify, writes valid and invalid values, reads, and
+ * disconnects at the end of its session. Centrals keep their address, so
+ * later sessions resume encryption with the bond of the first one.
+ *
+ * The application prints its periodic statistics; the driver adds a report
+ * of the simulated radio and uplink at the end of the run.
+ *
+ * Usage: sim [options]
+ *   --duration-s N     virtual time simulated (default 600)
+ *   --seed N           seed of the random generator (default 1)
+ *   --centrals N       number of simulated centrals (default 4)
+ *   --idle-s N         mean time between two sessions of a central (default 20)
+ *   --session-s N      mean duration of a session (default 30)
+ *   --action-ms N      mean time between two requests of a central (default 2000)
+ *   --advertisers N    advertisers heard while scanning (default 0)
+ *   --button-s N       period of the button presses, 0 for none (default 0)
+ *   --ap-reboot-s N    period of the reboots of the access point, down for
+ *                      AP_DOWN_US each, 0 for none (default 0)
+ *   --quiet            drop the output of the application, report on stderr
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include "mbed.h"
+#include "wifi.h"
+
+#include "ble/BLE.h"
+
+#include "BinaryLog.h"
+#include "Simulator.h"
+
+int node_main();
+
+namespace {
+
+struct options_t {
+    uint64_t duration_s;
+    uint64_t seed;
+    unsigned centrals;
+    uint64_t idle_s;
+    uint64_t session_s;
+    uint64_t action_ms;
+    unsigned advertisers;
+    uint64_t button_s;
+    uint64_t ap_reboot_s;
+    bool quiet;
+};
+
+/* valid writes are of the exact value size; other writes are random */
+const unsigned INVALID_WRITE_PERCENT = 20;
+
+/* period at which the logger thread would format the pending records */
+const uint64_t LOG_FLUSH_PERIOD_US = MBED_CONF_APP_LOG_FLUSH_PERIOD_MS * 1000;
+
+/* time an access point takes to reboot */
+const uint64_t AP_DOWN_US = 30000000;
+
+sim::Simulator &simulator()
+{
+    return sim::Simulator::instance();
+}
+
+class Central {
+public:
+    Central(unsigned index, const options_t &options) :
+        _options(options),
+        _connected(false),
+        _handle(0),
+        _session_id(0),
+        _sessions(0),
+        _failed_attempts(0)
+    {
+        uint8_t address[BLEProtocol::ADDR_LEN] = {
+            (uint8_t) index, (uint8_t)(index >> 8), 0x10, 0x20, 0x30, 0x40 | 0x80
+        };
+        _address = ble::address_t(address);
+    }
+
+    void start()
+    {
+        wait_idle();
+    }
+
+    bool owns(const ble::address_t &address) const
+    {
+        return address == _address;
+    }
+
+    void when_connection(ble::connection_handle_t handle)
+    {
+        _connected = true;
+        _handle = handle;
+        ++_sessions;
+        ++_session_id;
+
+        // discovery before the first request
+        unsigned session = _session_id;
+        simulator().post(100000, [this, session]() { subscribe(session); });
+        simulator().post(
+            simulator().exponential(_options.session_s * 1000000),
+            [this, session]() { end_session(session); }
+        );
+        schedule_action();
+    }
+
+    void when_disconnection()
+    {
+        if (!_connected) {
+            return;
+        }
+        _connected = false;
+        ++_session_id;
+        wait_idle();
+    }
+
+    unsigned sessions() const
+    {
+        return _sessions;
+    }
+
+    unsigned failed_attempts() const
+    {
+        return _failed_attempts;
+    }
+
+private:
+    void wait_idle()
+    {
+        simulator().post(
+            simulator().exponential(_options.idle_s * 1000000),
+            [this]() { connect(); }
+        );
+    }
+
+    void connect()
+    {
+        if (_connected) {
+            return;
+        }
+        if (!BLE::Instance().gap().sim_connect(_address, BLEProtocol::RANDOM_PRIVATE_RESOLVABLE)) {
+            // not connectable yet; the scanner keeps listening
+            ++_failed_attempts;
+            simulator().post(simulator().uniform(100000, 500000), [this]() { connect(); });
+        }
+    }
+
+    void subscribe(unsigned session)
+    {
+        if (!_connected || session != _session_id) {
+            return;
+        }
+        GattServer &server = BLE::Instance().gattServer();
+        std::vector<GattServer::sim_attribute_t> characteristics = server.sim_characteristics();
+        for (size_t i = 0; i < characteristics.size(); ++i) {
+            if (!characteristics[i].cccd_handle || simulator().uniform(0, 99) >= 75) {
+                continue;
+            }
+            uint8_t cccd[2] = { BLE_HVX_NOTIFICATION, 0 };
+            server.sim_client_write(_handle, characteristics[i].cccd_handle, cccd, sizeof(cccd));
+        }
+    }
+
+    void schedule_action()
+    {
+        unsigned session = _session_id;
+        simulator().post(
+            simulator().exponential(_options.action_ms * 1000),
+            [this, session]() { act(session); }
+        );
+    }
+
+    void act(unsigned session)
+    {
+        if (!_connected || session != _session_id) {
+            return;
+        }
+
+        GattServer &server = BLE::Instance().gattServer();
+        std::vector<GattServer::sim_attribute_t> characteristics = server.sim_characteristics();
+        if (!characteristics.empty()) {
+            const GattServer::sim_attribute_t &target =
+                characteristics[simulator().uniform(0, characteristics.size() - 1)];
+
+            bool writable = target.properties & (
+                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE |
+                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE
+            );
+            if (writable && simulator().uniform(0, 1)) {
+                write(target);
+            } else {
+                server.sim_client_read(_handle, target.handle);
+            }
+        }
+        schedule_action();
+    }
+
+    void write(const GattServer::sim_attribute_t &target)
+    {
+        uint8_t value[32];
+        size_t length = target.max_length;
+        if (length > sizeof(value)) {
+            length = sizeof(value);
+        }
+
+        if (simulator().uniform(0, 99) < INVALID_WRITE_PERCENT) {
+            // random bytes of a random length
+            length = simulator().uniform(0, length);
+            for (size_t i = 0; i < length; ++i) {
+                value[i] = (uint8_t) simulator().random();
+            }
+        } else {
+            // small values are in the range of the clock characteristics
+            memset(value, 0, sizeof(value));
+            value[0] = (uint8_t) simulator().uniform(0, 23);
+        }
+        BLE::Instance().gattServer().sim_client_write(_handle, target.handle, value, length);
+    }
+
+    void end_session(unsigned session)
+    {
+        if (!_connected || session != _session_id) {
+            return;
+        }
+        BLE::Instance().gap().sim_disconnect(_handle);
+    }
+
+    const options_t &_options;
+    ble::address_t _address;
+    bool _connected;
+    ble::connection_handle_t _handle;
+    unsigned _session_id;
+    unsigned _sessions;
+    unsigned _failed_attempts;
+};
+
+/**
+ * Observes the connections of the node to route them to the centrals.
+ */
+class Population {
+public:
+    Population(const options_t &options) : _options(options)
+    {
+        for (unsigned i = 0; i < options.centrals; ++i) {
+            _centrals.push_back(new Central(i + 1, options));
+        }
+    }
+
+    ~Population()
+    {
+        for (size_t i = 0; i < _centrals.size(); ++i) {
+            delete _centrals[i];
+        }
+    }
+
+    void start()
+    {
+        Gap &gap = BLE::Instance().gap();
+        gap.onConnection(this, &Population::when_connection);
+        gap.onDisconnection(this, &Population::when_disconnection);
+
+        for (size_t i = 0; i < _centrals.size(); ++i) {
+            _centrals[i]->start();
+        }
+
+        if (_options.advertisers) {
+            simulator().post(100000, [this]() { advertise(); }, 100000);
+        }
+        if (_options.button_s) {
+            uint64_t period_us = _options.button_s * 1000000;
+            simulator().post(period_us, []() { InterruptIn::sim_press(BLE_BUTTON_PIN_NAME); }, period_us);
+        }
+    }
+
+    void print_report(FILE *out) const
+    {
+        unsigned sessions = 0;
+        unsigned failed_attempts = 0;
+        for (size_t i = 0; i < _centrals.size(); ++i) {
+            sessions += _centrals[i]->sessions();
+            failed_attempts += _centrals[i]->failed_attempts();
+        }
+        fprintf(
+            out, "sim centrals: %u sessions, %u attempts while not connectable\r\n",
+            sessions, failed_attempts
+        );
+    }
+
+private:
+    void when_connection(const Gap::ConnectionCallbackParams_t *event)
+    {
+        if (event->role != Gap::PERIPHERAL) {
+            return;
+        }
+        ble::address_t address(event->peerAddr);
+        for (size_t i = 0; i < _centrals.size(); ++i) {
+            if (_centrals[i]->owns(address)) {
+                _centrals[i]->when_connection(event->handle);
+                _handles.push_back(std::make_pair(event->handle, _centrals[i]));
+            }
+        }
+    }
+
+    void when_disconnection(const Gap::DisconnectionCallbackParams_t *event)
+    {
+        for (size_t i = 0; i < _handles.size(); ++i) {
+            if (_handles[i].first == event->handle) {
+                _handles[i].second->when_disconnection();
+                _handles.erase(_handles.begin() + i);
+                return;
+            }
+        }
+    }
+
+    /**
+     * Every advertiser advertises about once per second.
+     */
+    void advertise()
+    {
+        Gap &gap = BLE::Instance().gap();
+        if (!gap.sim_scanning()) {
+            return;
+        }
+        for (unsigned i = 0; i < _options.advertisers; ++i) {
+            if (simulator().uniform(0, 9)) {
+                continue;
+            }
+            uint8_t address[BLEProtocol::ADDR_LEN] = {
+                (uint8_t) i, (uint8_t)(i >> 8), 0xA0, 0xB0, 0xC0, 0xD0
+            };
+            uint8_t payload[] = { 0x02, 0x01, 0x06, 0x05, 0xFF, 0x59, 0x00, (uint8_t) i, (uint8_t) simulator().random() };
+            gap.sim_advertising_report(
+                ble::address_t(address), ble::peer_address_type_t::RANDOM,
+                (int8_t) -(40 + (int) simulator().uniform(0, 50)), payload, sizeof(payload)
+            );
+        }
+    }
+
+    const options_t &_options;
+    std::vector<Central *> _centrals;
+    std::vector<std::pair<ble::connection_handle_t, Central *> > _handles;
+};
+
+bool parse(int argc, char **argv, options_t &options)
+{
+    for (int i = 1; i < argc; ++i) {
+        const char *name = argv[i];
+        if (!strcmp(name, "--quiet")) {
+            options.quiet = true;
+            continue;
+        }
+        if (i + 1 == argc) {
+            return false;
+        }
+        uint64_t value = strtoull(argv[++i], NULL, 0);
+        if (!strcmp(name, "--duration-s")) {
+            options.duration_s = value;
+        } else if (!strcmp(name, "--seed")) {
+            options.seed = value;
+        } else if (!strcmp(name, "--centrals")) {
+            options.centrals = value;
+        } else if (!strcmp(name, "--idle-s")) {
+            options.idle_s = value;
+        } else if (!strcmp(name, "--session-s")) {
+            options.session_s = value;
+        } else if (!strcmp(name, "--action-ms")) {
+            options.action_ms = value;
+        } else if (!strcmp(name, "--advertisers")) {
+            options.advertisers = value;
+        } else if (!strcmp(name, "--button-s")) {
+            options.button_s = value;
+        } else if (!strcmp(name, "--ap-reboot-s")) {
+            options.ap_reboot_s = value;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+void print_report(FILE *out, const Population &population, double wall_s)
+{
+    BLE &ble = BLE::Instance();
+    const Gap::sim_stats_t &gap = ble.gap().sim_stats();
+    const GattServer::sim_stats_t &server = ble.gattServer().sim_stats();
+    const sim_wifi_stats_t *wifi = sim_wifi_stats();
+    uint64_t now_us = simulator().now_us();
+
+    fprintf(out, "\r\n=== simulation report ===\r\n");
+    fprintf(
+        out, "sim time: %llu ms virtual in %.3f s wall (x%.0f), %llu tasks, %llu stack events\r\n",
+        (unsigned long long)(now_us / 1000), wall_s,
+        wall_s > 0 ? now_us / 1e6 / wall_s : 0.0,
+        (unsigned long long) simulator().tasks_run(),
+        (unsigned long long) ble.sim_events_processed()
+    );
+    fprintf(
+        out, "sim gap: %llu connections, %llu disconnections, %llu parameter updates\r\n",
+        (unsigned long long) gap.connections,
+        (unsigned long long) gap.disconnections,
+        (unsigned long long) gap.parameter_updates
+    );
+    fprintf(
+        out, "sim advertising: %llu ms, ~%llu events, %llu starts, %llu payload updates\r\n",
+        (unsigned long long)(gap.advertising_us / 1000),
+        (unsigned long long) gap.advertising_events,
+        (unsigned long long) gap.advertising_restarts,
+        (unsigned long long) gap.payload_updates
+    );
+    fprintf(
+        out, "sim broadcast: %llu payloads decoded, %llu invalid\r\n",
+        (unsigned long long) gap.broadcasts_decoded,
+        (unsigned long long) gap.broadcasts_invalid
+    );
+    fprintf(
+        out, "sim gatt: %llu notifications (%llu bytes), %llu dropped, %llu writes (%llu rejected), %llu reads\r\n",
+        (unsigned long long) server.notifications,
+        (unsigned long long) server.notification_bytes,
+        (unsigned long long) server.notifications_dropped,
+        (unsigned long long) server.client_writes,
+        (unsigned long long) server.client_writes_rejected,
+        (unsigned long long) server.client_reads
+    );
+    fprintf(
+        out, "sim security: %lu bonds, %llu advertising reports\r\n",
+        (unsigned long) ble.securityManager().sim_bond_count(),
+        (unsigned long long) gap.advertising_reports
+    );
+    fprintf(
+        out, "sim uplink: %lu sends (%lu failed), %llu bytes, %llu ms busy\r\n",
+        (unsigned long) wifi->sends,
+        (unsigned long) wifi->send_failures,
+        (unsigned long long) wifi->bytes,
+        (unsigned long long)(wifi->busy_us / 1000)
+    );
+    fprintf(
+        out, "sim access point: %lu reboots, %lu joins (%lu refused)\r\n",
+        (unsigned long) wifi->ap_reboots,
+        (unsigned long) wifi->joins,
+        (unsigned long) wifi->join_failures
+    );
+    population.print_report(out);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    options_t options = { 600, 1, 4, 20, 30, 2000, 0, 0, 0, false };
+    if (!parse(argc, argv, options)) {
+        fprintf(stderr, "usage: %s [--duration-s N] [--seed N] [--centrals N] [--idle-s N]\n"
+                "\t[--session-s N] [--action-ms N] [--advertisers N] [--button-s N]\n"
+                "\t[--ap-reboot-s N] [--quiet]\n", argv[0]);
+        return 1;
+    }
+
+    simulator().seed(options.seed);
+    simulator().set_end(options.duration_s * 1000000);
+
+    // the logger thread does not run; its flush is a periodic task
+    simulator().post(LOG_FLUSH_PERIOD_US, []() { BinaryLog::instance().flush(); }, LOG_FLUSH_PERIOD_US);
+    if (options.ap_reboot_s) {
+        uint64_t period_us = options.ap_reboot_s * 1000000;
+        simulator().post(period_us, []() { sim_wifi_ap_reboot(AP_DOWN_US); }, period_us);
+    }
+
+    Population population(options);
+    population.start();
+
+    // with --quiet the output of the application is dropped and the report
+    // goes to the standard error
+    FILE *out = stdout;
+    if (options.quiet) {
+        out = stderr;
+        if (!freopen("/dev/null", "w", stdout)) {
+            return 1;
+        }
+    }
+
+    clock_t start = clock();
+    node_main();
+    double wall_s = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    BinaryLog::instance().flush();
+    fflush(stdout);
+    print_report(out, population, wall_s);
+    return 0;
+}
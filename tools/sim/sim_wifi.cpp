@@ -0,0 +1,191 @@
+/*
+ * Simulated es-wifi module.
+ *
+ * A send consumes virtual time on the calling lane: the AT command and its
+ * answer take WIFI_COMMAND_US and the payload crosses the SPI bus at
+ * WIFI_SPI_BYTES_PER_MS. Received data is never available. The access
+ * point can be rebooted by the driver: the module loses its address and
+ * its socket, and cannot join until the access point is back.
+ *
+ * As in the driver, WIFI_GetIP_Address returns the state cached at the
+ * last join or query, cleared by WIFI_Disconnect only; the loss of the
+ * address is seen by WIFI_CheckConnection, which queries the module.
+ */
+#include "wifi.h"
+#include "es_wifi_io.h"
+
+#include <string.h>
+
+#include "Simulator.h"
+
+namespace {
+
+const uint64_t WIFI_COMMAND_US = 3000;
+const uint64_t WIFI_SPI_BYTES_PER_MS = 1000;
+
+bool joined = false;
+bool joined_cached = false;
+bool socket_open = false;
+uint64_t ap_down_until_us = 0;
+sim_wifi_stats_t stats = { 0, 0, 0, 0, 0, 0, 0 };
+WIFI_CommandHook_t command_hook = NULL;
+
+uint64_t now_us()
+{
+    return sim::Simulator::instance().now_us();
+}
+
+void consume(uint64_t us)
+{
+    sim::Simulator::instance().advance(us);
+    stats.busy_us += us;
+}
+
+WIFI_Status_t report(WIFI_Command_t command, WIFI_Status_t status, uint32_t bytes, uint64_t start_us)
+{
+    if (command_hook) {
+        command_hook(command, status, bytes, (uint32_t)(now_us() - start_us));
+    }
+    return status;
+}
+
+} // namespace
+
+extern "C" {
+
+WIFI_Status_t WIFI_Init(void)
+{
+    return report(WIFI_COMMAND_INIT, WIFI_STATUS_OK, 0, now_us());
+}
+
+void WIFI_SetCommandHook(WIFI_CommandHook_t hook)
+{
+    command_hook = hook;
+}
+
+WIFI_Status_t WIFI_Connect(const char *SSID, const char *Password, WIFI_Ecn_t ecn)
+{
+    (void) SSID;
+    (void) Password;
+    (void) ecn;
+    uint64_t start_us = now_us();
+    consume(WIFI_COMMAND_US);
+    if (now_us() < ap_down_until_us) {
+        ++stats.join_failures;
+        return report(WIFI_COMMAND_JOIN, WIFI_STATUS_ERROR, 0, start_us);
+    }
+    joined = true;
+    joined_cached = true;
+    ++stats.joins;
+    return report(WIFI_COMMAND_JOIN, WIFI_STATUS_OK, 0, start_us);
+}
+
+WIFI_Status_t WIFI_GetIP_Address(uint8_t *ipaddr)
+{
+    static const uint8_t address[4] = { 192, 168, 43, 20 };
+    if (!joined_cached) {
+        return WIFI_STATUS_ERROR;
+    }
+    memcpy(ipaddr, address, sizeof(address));
+    return WIFI_STATUS_OK;
+}
+
+WIFI_Status_t WIFI_CheckConnection(uint8_t *ipaddr)
+{
+    uint64_t start_us = now_us();
+    consume(WIFI_COMMAND_US);
+    joined_cached = joined;
+    report(WIFI_COMMAND_STATUS, WIFI_STATUS_OK, 0, start_us);
+    return WIFI_GetIP_Address(ipaddr);
+}
+
+WIFI_Status_t WIFI_GetMAC_Address(uint8_t *mac)
+{
+    static const uint8_t address[6] = { 0xC4, 0x7F, 0x51, 0x02, 0x3A, 0x10 };
+    memcpy(mac, address, sizeof(address));
+    return WIFI_STATUS_OK;
+}
+
+WIFI_Status_t WIFI_Disconnect(void)
+{
+    joined = false;
+    joined_cached = false;
+    socket_open = false;
+    return report(WIFI_COMMAND_DISCONNECT, WIFI_STATUS_OK, 0, now_us());
+}
+
+WIFI_Status_t WIFI_OpenClientConnection(
+    uint32_t socket, WIFI_Protocol_t type, const char *name, uint8_t *ipaddr,
+    uint16_t port, uint16_t local_port
+) {
+    (void) socket;
+    (void) type;
+    (void) name;
+    (void) ipaddr;
+    (void) port;
+    (void) local_port;
+    if (!joined) {
+        return report(WIFI_COMMAND_OPEN, WIFI_STATUS_ERROR, 0, now_us());
+    }
+    socket_open = true;
+    return report(WIFI_COMMAND_OPEN, WIFI_STATUS_OK, 0, now_us());
+}
+
+WIFI_Status_t WIFI_CloseClientConnection(uint32_t socket)
+{
+    (void) socket;
+    socket_open = false;
+    return report(WIFI_COMMAND_CLOSE, WIFI_STATUS_OK, 0, now_us());
+}
+
+WIFI_Status_t WIFI_SendData(
+    uint8_t socket, uint8_t *pdata, uint16_t Reqlen, uint16_t *SentDatalen, uint32_t Timeout
+) {
+    (void) socket;
+    (void) pdata;
+    (void) Timeout;
+    uint64_t start_us = now_us();
+    *SentDatalen = 0;
+    ++stats.sends;
+    if (!socket_open) {
+        ++stats.send_failures;
+        return report(WIFI_COMMAND_SEND, WIFI_STATUS_ERROR, 0, start_us);
+    }
+    consume(WIFI_COMMAND_US + (uint64_t) Reqlen * 1000 / WIFI_SPI_BYTES_PER_MS);
+    *SentDatalen = Reqlen;
+    stats.bytes += Reqlen;
+    return report(WIFI_COMMAND_SEND, WIFI_STATUS_OK, Reqlen, start_us);
+}
+
+WIFI_Status_t WIFI_ReceiveData(
+    uint8_t socket, uint8_t *pdata, uint16_t Reqlen, uint16_t *RcvDatalen, uint32_t Timeout
+) {
+    (void) socket;
+    (void) pdata;
+    (void) Reqlen;
+    uint64_t start_us = now_us();
+    *RcvDatalen = 0;
+    consume(WIFI_COMMAND_US);
+    (void) Timeout;
+    return report(WIFI_COMMAND_RECEIVE, socket_open ? WIFI_STATUS_OK : WIFI_STATUS_ERROR, 0, start_us);
+}
+
+uint32_t SPI_WIFI_GetBusyTime(void)
+{
+    return (uint32_t) stats.busy_us;
+}
+
+const sim_wifi_stats_t *sim_wifi_stats(void)
+{
+    return &stats;
+}
+
+void sim_wifi_ap_reboot(uint64_t down_us)
+{
+    joined = false;
+    socket_open = false;
+    ap_down_until_us = sim::Simulator::instance().now_us() + down_us;
+    ++stats.ap_reboots;
+}
+
+} // extern "C"